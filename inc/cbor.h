@@ -0,0 +1,60 @@
+#ifndef cbor_cbor_h
+#define cbor_cbor_h
+
+#include "parson.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	// CBOR (RFC 8949): a compact binary alternative to JSON for telemetry batches and programs.
+
+#define CBOR_CONTENT_TYPE "application/cbor"
+#define CBOR_MAX_DEPTH 32
+
+	// Streaming encoder: writes items straight into a caller buffer without allocating. Containers
+	// take their item count up front, or use the indefinite forms closed by CborWriter_End.
+	typedef struct
+	{
+		uint8_t *buffer;
+		size_t size;
+		size_t length;
+		bool overflow; // sticky
+	} CborWriter;
+
+	void CborWriter_Init(CborWriter *writer, uint8_t *buffer, size_t size);
+
+	bool CborWriter_BeginArray(CborWriter *writer, size_t count);
+	bool CborWriter_BeginMap(CborWriter *writer, size_t pairs);
+	bool CborWriter_BeginIndefiniteArray(CborWriter *writer);
+	bool CborWriter_BeginIndefiniteMap(CborWriter *writer);
+	bool CborWriter_End(CborWriter *writer); // closes the innermost indefinite array or map
+	bool CborWriter_Int(CborWriter *writer, int64_t value);
+	bool CborWriter_Double(CborWriter *writer, double value); // as half, single or double, whichever is exact
+	bool CborWriter_Bool(CborWriter *writer, bool value);
+	bool CborWriter_Null(CborWriter *writer);
+	bool CborWriter_String(CborWriter *writer, const char *value);
+	bool CborWriter_Bytes(CborWriter *writer, const void *data, size_t length);
+
+	// Returns the encoded length, or 0 if the buffer overflowed.
+	size_t CborWriter_Finish(const CborWriter *writer);
+
+	// Encodes a parson value, returns the encoded length or 0 if it does not fit or nests deeper than
+	// CBOR_MAX_DEPTH. JSONInteger values become CBOR integers and JSONNumber values floats.
+	size_t Cbor_EncodeJson(const JSON_Value *value, uint8_t *buffer, size_t size);
+
+	// Decodes one CBOR item that spans all of data into a parson value allocated from context (NULL
+	// for the default). Byte strings become base64url strings, integer map keys become decimal
+	// strings, tags are dropped and undefined becomes null. Returns NULL on malformed input or an
+	// item JSON cannot hold.
+	JSON_Value *Cbor_DecodeJson(const uint8_t *data, size_t length, JSON_Context *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef connection_connection_h
+#define connection_connection_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "iot_transport.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	// Decides when to connect to the hub and how long to back off after a failure. Transient
+	// failures are retried within seconds, others back off from a minute up to ten. Delays use
+	// decorrelated jitter, so devices that lose the hub together do not come back in lockstep.
+	// The hub a device was assigned is reused so reconnecting can skip provisioning; it is
+	// dropped when connecting straight to it fails for a reason other than the network.
+
+#define CONNECTION_MAX_HOSTNAME 128
+
+#define CONNECTION_TRANSIENT_BASE_MS 1000
+#define CONNECTION_TRANSIENT_CAP_MS 30000
+#define CONNECTION_RETRY_BASE_MS 60000
+#define CONNECTION_RETRY_CAP_MS 600000
+#define CONNECTION_START_SPREAD_MS 1000 // the first attempt after boot waits up to this long
+#define CONNECTION_CONNECTING_TIMEOUT_MS 60000
+
+	typedef enum
+	{
+		Connection_Disconnected, // no client, waiting to try again
+		Connection_Connecting,   // client created or reconnecting by itself, not authenticated yet
+		Connection_Connected,
+	} Connection_State;
+
+	typedef struct
+	{
+		Connection_State state;
+		int64_t retryAtMs;         // when Disconnected
+		int64_t connectingSinceMs; // when Connecting
+		uint32_t delayMs;          // the last backoff delay, the next one grows from it
+		uint32_t random;
+		uint32_t failures; // since the last successful connection
+		bool direct;       // the attempt in progress went straight to the cached hub
+		char hubHostname[CONNECTION_MAX_HOSTNAME]; // empty when unknown
+	} Connection;
+
+	// seed should differ between devices, hubHostname may be NULL
+	void Connection_Init(Connection *connection, uint32_t seed, const char *hubHostname, int64_t nowMs);
+
+	bool Connection_ShouldConnect(const Connection *connection, int64_t nowMs);
+
+	// The hub to connect straight to, or NULL to provision. Call right before connecting.
+	const char *Connection_Target(Connection *connection);
+
+	// Call with the result of creating the client, and the hub it was assigned if known
+	void Connection_Attempted(Connection *connection, IotTransport_Status result, const char *assignedHub,
+							  int64_t nowMs);
+
+	// Call when the client reports its connection status. Returns true when the client has to be
+	// torn down (outside of its callbacks) before connecting again.
+	bool Connection_StatusChanged(Connection *connection, bool authenticated, IotTransport_Status status,
+								  int64_t nowMs);
+
+	// Returns true, after moving to Disconnected, when the client has been trying to connect for
+	// too long and should be torn down.
+	bool Connection_TimedOut(Connection *connection, int64_t nowMs);
+
+	// Milliseconds until the next attempt, 0 when due
+	int64_t Connection_WaitMs(const Connection *connection, int64_t nowMs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef direct_method_direct_method_h
+#define direct_method_direct_method_h
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	// Direct methods are registered by name into a table kept sorted, and dispatched with a binary
+	// search. Handlers answer with a status and a preformatted JSON body, usually a static string.
+
+#define DIRECT_METHOD_MAX_METHODS 16
+
+	typedef struct
+	{
+		int status;
+		const char *body;
+		size_t length;
+	} DirectMethod_Result;
+
+	// For a string literal body
+#define DIRECT_METHOD_RESULT(status, body) {(status), (body), sizeof(body) - 1}
+
+	typedef DirectMethod_Result (*DirectMethod_Handler)(const char *payload, size_t size);
+
+	// Returns 0, or -1 if the table is full or the name is already registered
+	int DirectMethod_Register(const char *name, DirectMethod_Handler handler);
+
+	// Runs the named method and copies its body into a malloc'd response for the IoT client to
+	// free. Unknown methods get 404.
+	int DirectMethod_Dispatch(const char *name, const unsigned char *payload, size_t size,
+							  unsigned char **response, size_t *responseSize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef downsample_downsample_h
+#define downsample_downsample_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	// Streaming aggregate of one signal over a window: count, min, max, mean and last exactly,
+	// and the median and 90th percentile estimated with the P-square algorithm (Jain and
+	// Chlamtac), which keeps five markers per percentile instead of the samples. Fixed size, no
+	// allocation, O(1) to add a value. The estimates are good for noisy signals; a signal that
+	// trends steadily through a window can pull them well off, but then min, max and last tell
+	// the story anyway.
+
+	typedef struct
+	{
+		double heights[5];   // marker values, the middle one estimates the percentile
+		double desired[5];   // where the markers should be
+		int32_t positions[5]; // where they are, 1 based ranks
+	} Downsample_Quantile;
+
+	typedef struct
+	{
+		uint32_t count;
+		int32_t min;
+		int32_t max;
+		int32_t last;
+		int64_t sum;
+		Downsample_Quantile p50;
+		Downsample_Quantile p90;
+	} Downsample_Window;
+
+	typedef struct
+	{
+		uint32_t count;
+		int32_t min;
+		int32_t max;
+		int32_t mean; // rounded to nearest
+		int32_t last;
+		int32_t p50; // exact until five values have been added
+		int32_t p90;
+	} Downsample_Summary;
+
+	void Downsample_Reset(Downsample_Window *window);
+
+	void Downsample_Add(Downsample_Window *window, int32_t value);
+
+	// The window must not be empty
+	void Downsample_Summarize(const Downsample_Window *window, Downsample_Summary *summary);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
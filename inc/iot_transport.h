@@ -0,0 +1,70 @@
+#ifndef iot_transport_iot_transport_h
+#define iot_transport_iot_transport_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	// The IoT Hub client calls the application makes, so it can run against the real hub or a local
+	// stand-in. Callbacks arrive from within DoWork, as they do with the SDK's LL client.
+
+	// How a connection attempt or a dropped connection failed, which decides how soon to retry
+	typedef enum
+	{
+		IotTransport_Ok,
+		IotTransport_Transient,   // network or device auth not ready, connection lost: retry soon
+		IotTransport_Retry,       // provisioning or service errors: back off
+		IotTransport_Credentials, // expired or rejected credentials: provision again
+	} IotTransport_Status;
+
+	typedef struct
+	{
+		// After a transient drop the client keeps trying by itself; otherwise it has to be recreated
+		void (*ConnectionStatus)(bool authenticated, IotTransport_Status status, const char *reason);
+		void (*TwinUpdate)(bool complete, const unsigned char *payload, size_t size);
+		// response must be allocated with malloc, the transport frees it
+		int (*Method)(const char *name, const unsigned char *payload, size_t size, unsigned char **response,
+					  size_t *responseSize);
+		void (*EventConfirmed)(bool delivered);
+		void (*ReportedStateConfirmed)(int status);
+	} IotTransport_Handlers;
+
+	typedef struct
+	{
+		const char *name;
+		bool (*IsNetworkReady)(void);
+		// Creates the client for target (the DPS scope ID for the hub), connecting straight to
+		// hubHostname when it is given instead of provisioning. Returns how that failed, or
+		// IotTransport_Ok, after which the connection status arrives through the handlers.
+		IotTransport_Status (*Connect)(const char *target, const char *hubHostname,
+									   const IotTransport_Handlers *handlers);
+		// The hub the last Connect was assigned, when known, so the next one can skip provisioning
+		const char *(*AssignedHub)(void);
+		void (*Disconnect)(void);
+		void (*DoWork)(void);
+		bool (*IsBusy)(void); // messages or acknowledgements outstanding
+		bool (*SendEvent)(const uint8_t *body, size_t length, const char *contentType);
+		bool (*SendReportedState)(const char *json, size_t length);
+	} IotTransport;
+
+	// Azure IoT Hub through DPS with the device's Azure Sphere certificate
+	extern const IotTransport IotTransport_Hub;
+
+	// The ID the hub knows the device by, which connecting straight to a hub needs. Without it
+	// direct attempts fail with IotTransport_Retry, so the connection provisions through DPS.
+	void IotTransport_HubSetDeviceId(const char *deviceId);
+
+	// Local stand-in driven by a script of timed commands read from a file or FIFO. It records
+	// what the application sends in "<script>.out". See iot_transport_loopback.c for the format.
+	extern const IotTransport IotTransport_Loopback;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef json_reader_json_reader_h
+#define json_reader_json_reader_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	// Pull parser: walks a JSON text token by token without building a tree or allocating.
+	// The text does not need to be null terminated.
+
+#define JSON_READER_MAX_DEPTH 32
+
+	typedef enum
+	{
+		JsonToken_Error = -1,
+		JsonToken_End = 0,
+		JsonToken_ObjectStart,
+		JsonToken_ObjectEnd,
+		JsonToken_ArrayStart,
+		JsonToken_ArrayEnd,
+		JsonToken_Key, // member name, the reader is then positioned on its value
+		JsonToken_String,
+		JsonToken_Number,
+		JsonToken_True,
+		JsonToken_False,
+		JsonToken_Null,
+	} JsonToken;
+
+	typedef struct
+	{
+		const char *json;
+		size_t length;
+		size_t offset;
+		int state;
+		int depth;
+		uint32_t objectBits; // bit n set when nesting level n is an object
+		JsonToken token;
+		const char *text; // current key, string (without quotes) or number
+		size_t textLength;
+		bool textEscaped;
+	} JsonReader;
+
+	void JsonReader_Init(JsonReader *reader, const char *json, size_t length);
+
+	// Returns the next token. Errors are sticky: once JsonToken_Error is returned it is returned
+	// again, and JsonReader_Offset tells where the input went wrong.
+	JsonToken JsonReader_Next(JsonReader *reader);
+
+	// Skips the value the reader is positioned on (call after JsonToken_Key), or the rest of the
+	// object or array whose start token was just returned.
+	bool JsonReader_Skip(JsonReader *reader);
+
+	size_t JsonReader_Offset(const JsonReader *reader);
+
+	// Compare or convert the current token
+	bool JsonReader_TextEquals(const JsonReader *reader, const char *text, size_t length);
+	bool JsonReader_GetInt64(const JsonReader *reader, int64_t *value);
+	bool JsonReader_GetDouble(const JsonReader *reader, double *value);
+	bool JsonReader_GetBool(const JsonReader *reader, bool *value);
+
+	// Unescapes the current key or string into buffer (null terminated), returns its length or -1
+	// if the buffer is too small or the string has a bad escape.
+	int JsonReader_GetString(const JsonReader *reader, char *buffer, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
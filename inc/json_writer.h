@@ -0,0 +1,62 @@
+#ifndef json_writer_json_writer_h
+#define json_writer_json_writer_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	// Streaming writer: emits escaped JSON straight into a caller buffer in one pass, without
+	// building a tree or allocating. Commas and nesting are tracked for the caller.
+
+#define JSON_WRITER_MAX_DEPTH 16
+
+	typedef enum
+	{
+		JsonWriterError_None = 0,
+		JsonWriterError_Overflow, // the buffer is too small
+		JsonWriterError_Nesting,  // deeper than JSON_WRITER_MAX_DEPTH
+		JsonWriterError_Usage,    // a call that would not produce valid JSON
+	} JsonWriterError;
+
+	typedef struct
+	{
+		char *buffer;
+		size_t size;
+		size_t length;
+		int depth;
+		uint32_t objectBits; // bit n set when nesting level n is an object
+		bool hasValue;       // the current level already holds a value, so the next needs a comma
+		bool afterKey;
+		JsonWriterError error;
+	} JsonWriter;
+
+	void JsonWriter_Init(JsonWriter *writer, char *buffer, size_t size);
+
+	// Each call returns false once the writer has failed. Errors are sticky, so a message can be
+	// built without checking every call and tested once with JsonWriter_Finish.
+	bool JsonWriter_BeginObject(JsonWriter *writer);
+	bool JsonWriter_BeginArray(JsonWriter *writer);
+	bool JsonWriter_End(JsonWriter *writer); // closes the innermost object or array
+	bool JsonWriter_Key(JsonWriter *writer, const char *name);
+	bool JsonWriter_String(JsonWriter *writer, const char *value);
+	bool JsonWriter_Int(JsonWriter *writer, int64_t value);
+	bool JsonWriter_Double(JsonWriter *writer, double value); // NaN and infinities are written as null
+	bool JsonWriter_Bool(JsonWriter *writer, bool value);
+	bool JsonWriter_Null(JsonWriter *writer);
+
+	// Null terminates the buffer and returns the length of the document, or 0 if the writer failed
+	// or the document is incomplete.
+	size_t JsonWriter_Finish(JsonWriter *writer);
+
+	JsonWriterError JsonWriter_GetError(const JsonWriter *writer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef latency_histogram_latency_histogram_h
+#define latency_histogram_latency_histogram_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cbor.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	// Log-bucketed latency histogram in the HDR style: values below 16 us are counted exactly,
+	// above that every power of two is split into 16 buckets, so a value is known to within
+	// 6.25%. Values past LATENCY_HISTOGRAM_MAX_US count in the last bucket. Fixed size, no
+	// allocation, O(1) to record.
+
+#define LATENCY_HISTOGRAM_SUB_BUCKET_BITS 4
+#define LATENCY_HISTOGRAM_SUB_BUCKETS (1 << LATENCY_HISTOGRAM_SUB_BUCKET_BITS)
+#define LATENCY_HISTOGRAM_MAX_MAGNITUDE 28 // 2^28 us, about 4.5 minutes
+#define LATENCY_HISTOGRAM_MAX_US ((1u << LATENCY_HISTOGRAM_MAX_MAGNITUDE) - 1)
+#define LATENCY_HISTOGRAM_BUCKETS \
+	(LATENCY_HISTOGRAM_SUB_BUCKETS * (LATENCY_HISTOGRAM_MAX_MAGNITUDE - LATENCY_HISTOGRAM_SUB_BUCKET_BITS + 1))
+
+	typedef struct
+	{
+		uint32_t counts[LATENCY_HISTOGRAM_BUCKETS];
+		uint32_t total;
+		uint32_t max;
+	} LatencyHistogram;
+
+	// CLOCK_MONOTONIC in microseconds, for timestamps to take differences of
+	int64_t Latency_NowUs(void);
+
+	void LatencyHistogram_Reset(LatencyHistogram *histogram);
+
+	// Negative values, from timestamps taken out of order, are ignored
+	void LatencyHistogram_Record(LatencyHistogram *histogram, int64_t us);
+
+	// Returns the highest value in the bucket holding the given percentile (0 to 100), capped at
+	// the maximum recorded, or 0 when empty.
+	uint32_t LatencyHistogram_Percentile(const LatencyHistogram *histogram, double percentile);
+
+	// Writes [count, p50, p90, p99, p99.9, max] in microseconds
+	void LatencyHistogram_Encode(const LatencyHistogram *histogram, CborWriter *writer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -10,4 +10,5 @@
 #include <iothub_client_options.h>
 #include <iothubtransportmqtt.h>
 #include <iothub.h>
+#include <iothub_security_factory.h>
 #include <azure_sphere_provisioning.h>
\ No newline at end of file
@@ -37,11 +37,14 @@ extern "C"
 #endif
 
 #include <stddef.h> /* size_t */
+#include <stdint.h> /* int64_t */
 
     /* Types and enums */
     typedef struct json_object_t JSON_Object;
     typedef struct json_array_t JSON_Array;
     typedef struct json_value_t JSON_Value;
+    typedef struct json_path_t JSON_Path;
+    typedef struct json_context_t JSON_Context;
 
     enum json_value_type
     {
@@ -51,7 +54,8 @@ extern "C"
         JSONNumber = 3,
         JSONObject = 4,
         JSONArray = 5,
-        JSONBoolean = 6
+        JSONBoolean = 6,
+        JSONInteger = 7 /* number literal without fraction or exponent that fits in int64_t */
     };
     typedef int JSON_Value_Type;
 
@@ -62,37 +66,150 @@ extern "C"
     };
     typedef int JSON_Status;
 
+    enum json_parse_error_code_t
+    {
+        JSONParseErrorNone = 0,
+        JSONParseErrorSyntax,
+        JSONParseErrorNesting,       /* deeper than the context's max nesting */
+        JSONParseErrorBytes,         /* JSON_Parse_Limits.max_bytes */
+        JSONParseErrorValues,        /* JSON_Parse_Limits.max_values */
+        JSONParseErrorStringLength,  /* JSON_Parse_Limits.max_string_length */
+        JSONParseErrorContainerSize, /* JSON_Parse_Limits.max_container_size */
+        JSONParseErrorAllocation     /* the allocator returned NULL */
+    };
+    typedef int JSON_Parse_Error_Code;
+
+    typedef struct json_parse_error_t
+    {
+        JSON_Parse_Error_Code code;
+        size_t offset; /* of the token the parser stopped at, from the start of the input */
+    } JSON_Parse_Error;
+
+    /* Budgets for a single parse, 0 means unlimited */
+    typedef struct json_parse_limits_t
+    {
+        size_t max_bytes;          /* requested from the allocator while parsing */
+        size_t max_values;         /* values created, containers included */
+        size_t max_string_length;  /* of strings and member names, as written between the quotes */
+        size_t max_container_size; /* members of an object or items of an array */
+    } JSON_Parse_Limits;
+
     typedef void *(*JSON_Malloc_Function)(size_t);
     typedef void (*JSON_Free_Function)(void *);
 
+    /* Receives serialized output in chunks, returns JSONFailure to abort serialization */
+    typedef JSON_Status (*JSON_Flush_Function)(void *context, const char *data, size_t size);
+
     /* Call only once, before calling any other function from parson API. If not called, malloc and free
-   from stdlib will be used for all allocations */
+   from stdlib will be used for all allocations made through the default context */
     void json_set_allocation_functions(JSON_Malloc_Function malloc_fun, JSON_Free_Function free_fun);
 
-    /*  Parses first JSON value in a string, returns NULL in case of error */
+    /* When enabled, objects created afterwards store their names in a shared, reference counted
+   table, so a name repeated across a document (or across documents) is allocated once. Objects
+   keep the mode they were created with, so it can be switched at any time. Disabled by default.
+   Applies to the default context, whose table is not thread safe. */
+    void json_set_key_interning(int enabled);
+
+    /* Contexts
+   A context carries an allocator, parser limits, an intern table and parser scratch space. Values
+   remember the context they were created in: everything later added to them (set, append,
+   dotset, merge patch) is allocated from it and json_value_free returns memory to it. Functions
+   without a _ctx suffix use the default context, configured by the two functions above.
+   A context may only be used by one thread at a time, so give each thread its own to parse and
+   build documents concurrently. json_context_init falls back to malloc and free when given NULL
+   and starts with the default limits (MAX_NESTING, no interning). json_context_free must only be
+   called after every value created in the context was freed. */
+    JSON_Context *json_context_init(JSON_Malloc_Function malloc_fun, JSON_Free_Function free_fun);
+    void json_context_free(JSON_Context *context);
+    JSON_Context *json_context_default(void);
+    void json_context_set_key_interning(JSON_Context *context, int enabled);
+    JSON_Status json_context_set_max_nesting(JSON_Context *context, size_t max_nesting);
+
+    /* Parse budgets: a parse through the context that would exceed one of limits stops before the
+   allocation that breaks it, frees what it built and returns NULL, so memory used by a bad or
+   oversized document is bounded. limits is copied, NULL removes all limits. None are set by
+   default. json_context_get_parse_error tells why the last parse through the context failed. */
+    void json_context_set_parse_limits(JSON_Context *context, const JSON_Parse_Limits *limits);
+    JSON_Parse_Error json_context_get_parse_error(const JSON_Context *context);
+
+    /* Node pools: with a non-zero limit, the context keeps freed values, objects, arrays, their
+   member arrays and strings of up to 2 KB on free lists and hands them out again, so documents
+   that are parsed or built and freed over and over stop reaching the allocator. Blocks are
+   rounded up to power of two size classes. The pools hold at most max_bytes, lowering the limit
+   releases the excess and 0 turns pooling off. Pooling can only be turned on before the context
+   allocates anything, JSONFailure is returned otherwise. */
+    JSON_Status json_context_set_pool_limit(JSON_Context *context, size_t max_bytes);
+    size_t json_context_get_pool_size(const JSON_Context *context); /* bytes held by the pools */
+
+    /* Raw blocks from the context's allocator and pools, for code that builds values in it (a
+   decoder's scratch space, for instance). Blocks go back with the size they were allocated with.
+   Returns NULL when the allocation fails. */
+    void *json_context_malloc(JSON_Context *context, size_t size);
+    void json_context_free_block(JSON_Context *context, void *block, size_t size);
+
+    /*  Parses first JSON value in a string, returns NULL in case of error.
+    Documents nested deeper than MAX_NESTING (2048 unless overridden at build time) are rejected.
+    Only json_validate recurses, so the C stack usage of everything else doesn't grow with
+    nesting. Copying, comparing and merge patches walk at most the context's max nesting levels
+    and fail (or compare unequal) on deeper documents built by hand. */
     JSON_Value *json_parse_string(const char *string);
 
     /*  Parses first JSON value in a string and ignores comments (/ * * / and //),
     returns NULL in case of error */
     JSON_Value *json_parse_string_with_comments(const char *string);
 
-    /* Serialization */
+    JSON_Value *json_parse_string_ctx(JSON_Context *context, const char *string);
+    JSON_Value *json_parse_string_with_comments_ctx(JSON_Context *context, const char *string);
+
+    /* Serialization
+   All serializers walk the value once. json_serialize_to_buffer fails if the output (including the
+   terminating '\0') doesn't fit, in which case the contents of buf are unspecified.
+   json_serialize_to_stream uses buf as scratch space and passes it to flush every time it fills
+   up and once more at the end; the streamed output isn't '\0' terminated. */
     size_t json_serialization_size(const JSON_Value *value); /* returns 0 on fail */
     JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes);
     char *json_serialize_to_string(const JSON_Value *value);
+    JSON_Status json_serialize_to_stream(const JSON_Value *value, char *buf, size_t buf_size_in_bytes,
+                                         JSON_Flush_Function flush, void *context);
 
     /* Pretty serialization */
     size_t json_serialization_size_pretty(const JSON_Value *value); /* returns 0 on fail */
     JSON_Status json_serialize_to_buffer_pretty(const JSON_Value *value, char *buf,
                                                 size_t buf_size_in_bytes);
     char *json_serialize_to_string_pretty(const JSON_Value *value);
+    JSON_Status json_serialize_to_stream_pretty(const JSON_Value *value, char *buf,
+                                                size_t buf_size_in_bytes, JSON_Flush_Function flush,
+                                                void *context);
 
     void json_free_serialized_string(char *string); /* frees string from json_serialize_to_string and
                                                    json_serialize_to_string_pretty */
 
+    /* Same as above, with the output string allocated from (and freed to) context */
+    char *json_serialize_to_string_ctx(JSON_Context *context, const JSON_Value *value);
+    char *json_serialize_to_string_pretty_ctx(JSON_Context *context, const JSON_Value *value);
+    void json_free_serialized_string_ctx(JSON_Context *context, char *string);
+
+    /* Formats number the way the serializers do: the shortest digits that read back as the same
+   double, whatever the locale. buf must hold JSON_NUMBER_BUFFER_SIZE bytes and is '\0'
+   terminated. Returns the length, or 0 for NaN and infinities, which JSON can't express. */
+#define JSON_NUMBER_BUFFER_SIZE 32
+    int json_format_number(char *buf, double number);
+
     /* Comparing */
     int json_value_equals(const JSON_Value *a, const JSON_Value *b);
 
+    /* JSON Merge Patch (RFC 7386)
+   json_merge_patch_apply applies patch to target and returns the patched document. target is
+   consumed: objects are patched in place and the same value is returned, anything else is freed
+   and replaced by a copy of (or an object built from) patch. Work is proportional to the size of
+   patch. Returns NULL on failure, target is freed in that case too. target may be NULL.
+   json_merge_patch_diff returns a new patch that turns old_value into new_value ({} when they are
+   equal, a copy of new_value when either isn't an object), or NULL on allocation failure or when
+   the documents are nested too deep. Nulls inside new_value objects can't be expressed by a merge
+   patch, they read as removals. */
+    JSON_Value *json_merge_patch_apply(JSON_Value *target, const JSON_Value *patch);
+    JSON_Value *json_merge_patch_diff(const JSON_Value *old_value, const JSON_Value *new_value);
+
     /* Validation
    This is *NOT* JSON Schema. It validates json by checking if object have identically
    named fields with matching types.
@@ -113,6 +230,7 @@ extern "C"
     JSON_Object *json_object_get_object(const JSON_Object *object, const char *name);
     JSON_Array *json_object_get_array(const JSON_Object *object, const char *name);
     double json_object_get_number(const JSON_Object *object, const char *name); /* returns 0 on fail */
+    int64_t json_object_get_int64(const JSON_Object *object, const char *name); /* returns 0 on fail */
     int json_object_get_boolean(const JSON_Object *object, const char *name);   /* returns -1 on fail */
 
     /* dotget functions enable addressing values with dot notation in nested objects,
@@ -125,6 +243,8 @@ extern "C"
     JSON_Array *json_object_dotget_array(const JSON_Object *object, const char *name);
     double json_object_dotget_number(const JSON_Object *object,
                                      const char *name); /* returns 0 on fail */
+    int64_t json_object_dotget_int64(const JSON_Object *object,
+                                     const char *name); /* returns 0 on fail */
     int json_object_dotget_boolean(const JSON_Object *object,
                                    const char *name); /* returns -1 on fail */
 
@@ -149,6 +269,7 @@ extern "C"
     JSON_Status json_object_set_value(JSON_Object *object, const char *name, JSON_Value *value);
     JSON_Status json_object_set_string(JSON_Object *object, const char *name, const char *string);
     JSON_Status json_object_set_number(JSON_Object *object, const char *name, double number);
+    JSON_Status json_object_set_int64(JSON_Object *object, const char *name, int64_t integer);
     JSON_Status json_object_set_boolean(JSON_Object *object, const char *name, int boolean);
     JSON_Status json_object_set_null(JSON_Object *object, const char *name);
 
@@ -157,6 +278,7 @@ extern "C"
     JSON_Status json_object_dotset_value(JSON_Object *object, const char *name, JSON_Value *value);
     JSON_Status json_object_dotset_string(JSON_Object *object, const char *name, const char *string);
     JSON_Status json_object_dotset_number(JSON_Object *object, const char *name, double number);
+    JSON_Status json_object_dotset_int64(JSON_Object *object, const char *name, int64_t integer);
     JSON_Status json_object_dotset_boolean(JSON_Object *object, const char *name, int boolean);
     JSON_Status json_object_dotset_null(JSON_Object *object, const char *name);
 
@@ -169,6 +291,29 @@ extern "C"
     /* Removes all name-value pairs in object */
     JSON_Status json_object_clear(JSON_Object *object);
 
+    /*
+ * Compiled paths
+ */
+    /* Splits a path once so that repeated lookups don't have to scan it again. json_path_compile
+ takes dot notation (same rules as dotget), json_path_compile_pointer takes an RFC 6901 JSON
+ Pointer ("" is the whole document, "/a~1b/0" is key "a/b" then index 0). Returns NULL on invalid
+ input or allocation failure. */
+    JSON_Path *json_path_compile(const char *path);
+    JSON_Path *json_path_compile_pointer(const char *pointer);
+    void json_path_free(JSON_Path *path); /* returns the path to the context it came from */
+
+    /* Same as above, with the path allocated from context */
+    JSON_Path *json_path_compile_ctx(JSON_Context *context, const char *path);
+    JSON_Path *json_path_compile_pointer_ctx(JSON_Context *context, const char *pointer);
+
+    JSON_Value *json_path_get_value(const JSON_Value *root, const JSON_Path *path);
+    const char *json_path_get_string(const JSON_Value *root, const JSON_Path *path);
+    JSON_Object *json_path_get_object(const JSON_Value *root, const JSON_Path *path);
+    JSON_Array *json_path_get_array(const JSON_Value *root, const JSON_Path *path);
+    double json_path_get_number(const JSON_Value *root, const JSON_Path *path); /* returns 0 on fail */
+    int64_t json_path_get_int64(const JSON_Value *root, const JSON_Path *path); /* returns 0 on fail */
+    int json_path_get_boolean(const JSON_Value *root, const JSON_Path *path);   /* returns -1 on fail */
+
     /*
  *JSON Array
  */
@@ -177,6 +322,7 @@ extern "C"
     JSON_Object *json_array_get_object(const JSON_Array *array, size_t index);
     JSON_Array *json_array_get_array(const JSON_Array *array, size_t index);
     double json_array_get_number(const JSON_Array *array, size_t index); /* returns 0 on fail */
+    int64_t json_array_get_int64(const JSON_Array *array, size_t index); /* returns 0 on fail */
     int json_array_get_boolean(const JSON_Array *array, size_t index);   /* returns -1 on fail */
     size_t json_array_get_count(const JSON_Array *array);
     JSON_Value *json_array_get_wrapping_value(const JSON_Array *array);
@@ -191,6 +337,7 @@ extern "C"
     JSON_Status json_array_replace_value(JSON_Array *array, size_t i, JSON_Value *value);
     JSON_Status json_array_replace_string(JSON_Array *array, size_t i, const char *string);
     JSON_Status json_array_replace_number(JSON_Array *array, size_t i, double number);
+    JSON_Status json_array_replace_int64(JSON_Array *array, size_t i, int64_t integer);
     JSON_Status json_array_replace_boolean(JSON_Array *array, size_t i, int boolean);
     JSON_Status json_array_replace_null(JSON_Array *array, size_t i);
 
@@ -202,6 +349,7 @@ extern "C"
     JSON_Status json_array_append_value(JSON_Array *array, JSON_Value *value);
     JSON_Status json_array_append_string(JSON_Array *array, const char *string);
     JSON_Status json_array_append_number(JSON_Array *array, double number);
+    JSON_Status json_array_append_int64(JSON_Array *array, int64_t integer);
     JSON_Status json_array_append_boolean(JSON_Array *array, int boolean);
     JSON_Status json_array_append_null(JSON_Array *array);
 
@@ -212,16 +360,27 @@ extern "C"
     JSON_Value *json_value_init_array(void);
     JSON_Value *json_value_init_string(const char *string); /* copies passed string */
     JSON_Value *json_value_init_number(double number);
+    JSON_Value *json_value_init_int64(int64_t integer);
     JSON_Value *json_value_init_boolean(int boolean);
     JSON_Value *json_value_init_null(void);
-    JSON_Value *json_value_deep_copy(const JSON_Value *value);
+    JSON_Value *json_value_deep_copy(const JSON_Value *value); /* copy shares value's context */
+
+    JSON_Value *json_value_init_object_ctx(JSON_Context *context);
+    JSON_Value *json_value_init_array_ctx(JSON_Context *context);
+    JSON_Value *json_value_init_string_ctx(JSON_Context *context, const char *string);
+    JSON_Value *json_value_init_number_ctx(JSON_Context *context, double number);
+    JSON_Value *json_value_init_int64_ctx(JSON_Context *context, int64_t integer);
+    JSON_Value *json_value_init_boolean_ctx(JSON_Context *context, int boolean);
+    JSON_Value *json_value_init_null_ctx(JSON_Context *context);
+    JSON_Value *json_value_deep_copy_ctx(JSON_Context *context, const JSON_Value *value);
     void json_value_free(JSON_Value *value);
 
     JSON_Value_Type json_value_get_type(const JSON_Value *value);
     JSON_Object *json_value_get_object(const JSON_Value *value);
     JSON_Array *json_value_get_array(const JSON_Value *value);
     const char *json_value_get_string(const JSON_Value *value);
-    double json_value_get_number(const JSON_Value *value);
+    double json_value_get_number(const JSON_Value *value);   /* JSONNumber or JSONInteger */
+    int64_t json_value_get_int64(const JSON_Value *value);   /* JSONInteger, or truncated JSONNumber */
     int json_value_get_boolean(const JSON_Value *value);
     JSON_Value *json_value_get_parent(const JSON_Value *value);
 
@@ -231,6 +390,7 @@ extern "C"
     JSON_Array *json_array(const JSON_Value *value);
     const char *json_string(const JSON_Value *value);
     double json_number(const JSON_Value *value);
+    int64_t json_int64(const JSON_Value *value);
     int json_boolean(const JSON_Value *value);
 
 #ifdef __cplusplus
@@ -0,0 +1,39 @@
+#ifndef poll_scheduler_poll_scheduler_h
+#define poll_scheduler_poll_scheduler_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	// Decides how long to wait before the next poll of a transport: the fast period while work is
+	// in flight, then doubling back towards the idle period once things go quiet.
+
+	typedef struct
+	{
+		int fastMs;
+		int idleMs;
+		int delayMs;
+		bool activity; // something was sent or received since the last poll
+		uint32_t polls;
+		uint32_t fastPolls;
+	} PollScheduler;
+
+	void PollScheduler_Init(PollScheduler *scheduler, int fastMs, int idleMs);
+
+	// Something was sent or received. Returns true when this shortens the wait that is already
+	// scheduled, in which case the caller should re-arm its timer with the fast period.
+	bool PollScheduler_Kick(PollScheduler *scheduler);
+
+	// Call after each poll with whether the transport still has work queued. Returns the delay
+	// before the next poll.
+	int PollScheduler_Next(PollScheduler *scheduler, bool busy);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
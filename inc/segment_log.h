@@ -0,0 +1,63 @@
+#ifndef segment_log_segment_log_h
+#define segment_log_segment_log_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	// Bounded append-only log over a file descriptor (the mutable storage file on the device, any
+	// regular file on Linux). The file is a ring of fixed-size segments holding CRC-framed records.
+	// Appends are buffered a block at a time and written block aligned. When the ring is full the
+	// oldest segment is dropped. A segment is invalidated once it has been read to the end, so
+	// after a crash or restart only the partly read segment is replayed.
+
+#define SEGMENT_LOG_SEGMENT_SIZE 4096
+#define SEGMENT_LOG_BLOCK_SIZE 512
+#define SEGMENT_LOG_HEADER_SIZE 12 // magic, sequence, header CRC
+#define SEGMENT_LOG_RECORD_HEADER_SIZE 8 // length, reserved, CRC
+#define SEGMENT_LOG_MAX_RECORD (SEGMENT_LOG_SEGMENT_SIZE - SEGMENT_LOG_HEADER_SIZE - SEGMENT_LOG_RECORD_HEADER_SIZE)
+
+	typedef struct
+	{
+		int fd;
+		uint32_t segmentCount;
+		uint32_t writeSegment;
+		uint32_t writeSequence;
+		uint32_t writeOffset; // within the write segment
+		uint32_t readSegment;
+		uint32_t readSequence;
+		uint32_t readOffset; // within the read segment
+		uint32_t blockOffset; // offset in the write segment of the buffered block
+		bool blockDirty;
+		uint32_t droppedSegments;
+		uint8_t block[SEGMENT_LOG_BLOCK_SIZE];
+	} SegmentLog;
+
+	// Recovers the log from the file, which must be at least two segments long. Returns 0, or -1
+	// if the file cannot be read.
+	int SegmentLog_Open(SegmentLog *log, int fd, size_t capacity);
+
+	// Returns 0, or -1 if the record is too long or the write fails.
+	int SegmentLog_Append(SegmentLog *log, const void *data, size_t length);
+
+	// Writes out the partly filled block, for example before the device may lose power.
+	int SegmentLog_Flush(SegmentLog *log);
+
+	bool SegmentLog_IsEmpty(SegmentLog *log);
+
+	// Copies the record at the read cursor into buffer and returns its length, 0 when the log is
+	// empty, or -1 if the buffer is too small or the read fails. The record stays in the log until
+	// SegmentLog_Advance.
+	int SegmentLog_Peek(SegmentLog *log, void *buffer, size_t size);
+	int SegmentLog_Advance(SegmentLog *log);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
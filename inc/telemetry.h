@@ -0,0 +1,83 @@
+#ifndef telemetry_telemetry_h
+#define telemetry_telemetry_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "downsample.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	// Drivers record fixed-size samples into a preallocated ring; the main loop drains it into
+	// CBOR batches once enough samples have gathered or the oldest has waited long enough.
+	//
+	// With a window set, samples are aggregated per signal (channel and source) instead, and
+	// each window closes into one summary per signal that had samples. Summaries wait in a
+	// second ring and are batched the same way.
+
+#define TELEMETRY_RING_CAPACITY 1024 // samples, a power of two
+#define TELEMETRY_FLUSH_COUNT 256    // flush once this many samples are pending
+#define TELEMETRY_FLUSH_AGE_MS 5000  // or once the oldest pending sample is this old
+
+#define TELEMETRY_MAX_SIGNALS 16           // aggregated at once, samples of others are dropped
+#define TELEMETRY_SUMMARY_CAPACITY 64      // summaries, a power of two
+#define TELEMETRY_FLUSH_SUMMARIES 32       // flush once this many summaries are pending
+#define TELEMETRY_DEFAULT_WINDOW_MS 10000
+#define TELEMETRY_MAX_WINDOW_MS 3600000
+
+	typedef enum
+	{
+		Telemetry_MotorDuty = 1,    // signed duty cycle percent, source is the motor handle
+		Telemetry_StepRate = 2,     // signed steps per second, source is the stepper handle
+		Telemetry_EncoderCount = 3, // accumulated detents, source is the encoder handle
+		Telemetry_LoopLatency = 4,  // microseconds spent in a main loop pass
+	} Telemetry_Channel;
+
+	typedef struct
+	{
+		uint32_t timeMs; // CLOCK_MONOTONIC, wraps every 49 days
+		uint16_t channel;
+		uint16_t source;
+		int32_t value;
+	} Telemetry_Sample;
+
+	typedef struct
+	{
+		uint32_t windowStartMs; // CLOCK_MONOTONIC
+		uint32_t windowMs;
+		uint16_t channel;
+		uint16_t source;
+		Downsample_Summary summary;
+	} Telemetry_Summary;
+
+	// O(1) and allocation free. When the ring is full the oldest sample is dropped.
+	void Telemetry_Record(Telemetry_Channel channel, int source, int32_t value);
+
+	// Aggregates samples over windows of this many milliseconds, or records every sample when
+	// 0. Closes the window in progress. Values past TELEMETRY_MAX_WINDOW_MS are capped.
+	void Telemetry_SetWindow(uint32_t windowMs);
+	uint32_t Telemetry_Window(void);
+
+	bool Telemetry_FlushDue(void);
+
+	// Encodes as many pending samples as fit into one batch:
+	//     {"t": wall clock ms of the first sample, "dropped": n, "samples": [[dt ms, channel, source, value], ...]}
+	// or, once no samples are pending, as many summaries of windows the same length:
+	//     {"t": wall clock ms of the first window start, "window": ms, "dropped": n,
+	//      "summaries": [[dt ms, channel, source, count, min, max, mean, last, p50, p90], ...]}
+	// Returns the encoded length (0 when nothing is pending) and how many samples it holds. The
+	// samples stay pending until Telemetry_Consume is called with that count.
+	size_t Telemetry_EncodeBatch(uint8_t *buffer, size_t size, size_t *count);
+	void Telemetry_Consume(size_t count);
+
+	size_t Telemetry_Pending(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
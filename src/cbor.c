@@ -0,0 +1,651 @@
+#include "cbor.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum cbor_major_t
+{
+	Major_Unsigned = 0,
+	Major_Negative = 1,
+	Major_Bytes = 2,
+	Major_Text = 3,
+	Major_Array = 4,
+	Major_Map = 5,
+	Major_Tag = 6,
+	Major_Simple = 7,
+};
+
+#define INFO_UINT8 24
+#define INFO_UINT16 25
+#define INFO_UINT32 26
+#define INFO_UINT64 27
+#define INFO_INDEFINITE 31
+
+#define SIMPLE_FALSE 20
+#define SIMPLE_TRUE 21
+#define SIMPLE_NULL 22
+#define SIMPLE_UNDEFINED 23
+
+#define BREAK 0xFF
+
+// Encoder
+
+static bool Put(CborWriter *writer, const void *data, size_t length)
+{
+	if (writer->overflow || length > writer->size - writer->length)
+	{
+		writer->overflow = true;
+		return false;
+	}
+	memcpy(writer->buffer + writer->length, data, length);
+	writer->length += length;
+	return true;
+}
+
+static bool PutByte(CborWriter *writer, uint8_t byte)
+{
+	return Put(writer, &byte, 1);
+}
+
+// Initial byte plus the argument in the fewest bytes, most significant first
+static bool PutHead(CborWriter *writer, uint8_t major, uint64_t argument)
+{
+	uint8_t head[9];
+	size_t length;
+	if (argument < INFO_UINT8)
+	{
+		head[0] = (uint8_t)((major << 5) | argument);
+		return Put(writer, head, 1);
+	}
+	if (argument <= UINT8_MAX)
+	{
+		head[0] = (uint8_t)((major << 5) | INFO_UINT8);
+		length = 1;
+	}
+	else if (argument <= UINT16_MAX)
+	{
+		head[0] = (uint8_t)((major << 5) | INFO_UINT16);
+		length = 2;
+	}
+	else if (argument <= UINT32_MAX)
+	{
+		head[0] = (uint8_t)((major << 5) | INFO_UINT32);
+		length = 4;
+	}
+	else
+	{
+		head[0] = (uint8_t)((major << 5) | INFO_UINT64);
+		length = 8;
+	}
+	for (size_t i = 0; i < length; i++)
+	{
+		head[length - i] = (uint8_t)(argument >> (8 * i));
+	}
+	return Put(writer, head, length + 1);
+}
+
+// Returns true and the half-precision bits when value converts to binary16 exactly
+static bool ToHalf(float value, uint16_t *half)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint16_t sign = (uint16_t)((bits >> 16) & 0x8000u);
+	int exponent = (int)((bits >> 23) & 0xFF) - 127;
+	uint32_t mantissa = bits & 0x7FFFFFu;
+	if ((bits & 0x7FFFFFFFu) == 0)
+	{
+		*half = sign;
+		return true;
+	}
+	if (exponent >= -14 && exponent <= 15)
+	{
+		if ((mantissa & 0x1FFFu) != 0)
+		{
+			return false;
+		}
+		*half = (uint16_t)(sign | ((exponent + 15) << 10) | (mantissa >> 13));
+		return true;
+	}
+	if (exponent >= -24 && exponent < -14)
+	{
+		// Subnormal: the significand with its implicit bit, scaled to units of 2^-24
+		uint32_t significand = mantissa | 0x800000u;
+		int shift = -exponent - 1;
+		if ((significand & ((1u << shift) - 1)) != 0)
+		{
+			return false;
+		}
+		*half = (uint16_t)(sign | (significand >> shift));
+		return true;
+	}
+	return false;
+}
+
+void CborWriter_Init(CborWriter *writer, uint8_t *buffer, size_t size)
+{
+	writer->buffer = buffer;
+	writer->size = size;
+	writer->length = 0;
+	writer->overflow = false;
+}
+
+bool CborWriter_BeginArray(CborWriter *writer, size_t count)
+{
+	return PutHead(writer, Major_Array, count);
+}
+
+bool CborWriter_BeginMap(CborWriter *writer, size_t pairs)
+{
+	return PutHead(writer, Major_Map, pairs);
+}
+
+bool CborWriter_BeginIndefiniteArray(CborWriter *writer)
+{
+	return PutByte(writer, (Major_Array << 5) | INFO_INDEFINITE);
+}
+
+bool CborWriter_BeginIndefiniteMap(CborWriter *writer)
+{
+	return PutByte(writer, (Major_Map << 5) | INFO_INDEFINITE);
+}
+
+bool CborWriter_End(CborWriter *writer)
+{
+	return PutByte(writer, BREAK);
+}
+
+bool CborWriter_Int(CborWriter *writer, int64_t value)
+{
+	if (value < 0)
+	{
+		// -1 - value without overflowing at INT64_MIN
+		return PutHead(writer, Major_Negative, ~(uint64_t)value);
+	}
+	return PutHead(writer, Major_Unsigned, (uint64_t)value);
+}
+
+static bool PutHalf(CborWriter *writer, uint16_t half)
+{
+	uint8_t item[3] = {(Major_Simple << 5) | INFO_UINT16, (uint8_t)(half >> 8), (uint8_t)half};
+	return Put(writer, item, sizeof(item));
+}
+
+bool CborWriter_Double(CborWriter *writer, double value)
+{
+	uint8_t item[9];
+	uint16_t half;
+	if (isnan(value))
+	{
+		// Canonical quiet NaN
+		return PutHalf(writer, 0x7E00);
+	}
+	if (isinf(value))
+	{
+		return PutHalf(writer, value < 0 ? 0xFC00 : 0x7C00);
+	}
+	if (fabs(value) <= FLT_MAX && (double)(float)value == value)
+	{
+		float single = (float)value;
+		if (ToHalf(single, &half))
+		{
+			return PutHalf(writer, half);
+		}
+		uint32_t bits;
+		memcpy(&bits, &single, sizeof(bits));
+		item[0] = (Major_Simple << 5) | INFO_UINT32;
+		for (size_t i = 0; i < 4; i++)
+		{
+			item[4 - i] = (uint8_t)(bits >> (8 * i));
+		}
+		return Put(writer, item, 5);
+	}
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	item[0] = (Major_Simple << 5) | INFO_UINT64;
+	for (size_t i = 0; i < 8; i++)
+	{
+		item[8 - i] = (uint8_t)(bits >> (8 * i));
+	}
+	return Put(writer, item, 9);
+}
+
+bool CborWriter_Bool(CborWriter *writer, bool value)
+{
+	return PutByte(writer, (Major_Simple << 5) | (value ? SIMPLE_TRUE : SIMPLE_FALSE));
+}
+
+bool CborWriter_Null(CborWriter *writer)
+{
+	return PutByte(writer, (Major_Simple << 5) | SIMPLE_NULL);
+}
+
+bool CborWriter_String(CborWriter *writer, const char *value)
+{
+	size_t length = strlen(value);
+	return PutHead(writer, Major_Text, length) && Put(writer, value, length);
+}
+
+bool CborWriter_Bytes(CborWriter *writer, const void *data, size_t length)
+{
+	return PutHead(writer, Major_Bytes, length) && Put(writer, data, length);
+}
+
+size_t CborWriter_Finish(const CborWriter *writer)
+{
+	return writer->overflow ? 0 : writer->length;
+}
+
+static bool EncodeValue(CborWriter *writer, const JSON_Value *value, int depth)
+{
+	if (depth > CBOR_MAX_DEPTH)
+	{
+		return false;
+	}
+	switch (json_value_get_type(value))
+	{
+	case JSONObject:
+	{
+		const JSON_Object *object = json_value_get_object(value);
+		size_t count = json_object_get_count(object);
+		if (!CborWriter_BeginMap(writer, count))
+		{
+			return false;
+		}
+		for (size_t i = 0; i < count; i++)
+		{
+			if (!CborWriter_String(writer, json_object_get_name(object, i)) ||
+				!EncodeValue(writer, json_object_get_value_at(object, i), depth + 1))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+	case JSONArray:
+	{
+		const JSON_Array *array = json_value_get_array(value);
+		size_t count = json_array_get_count(array);
+		if (!CborWriter_BeginArray(writer, count))
+		{
+			return false;
+		}
+		for (size_t i = 0; i < count; i++)
+		{
+			if (!EncodeValue(writer, json_array_get_value(array, i), depth + 1))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+	case JSONString:
+		return CborWriter_String(writer, json_value_get_string(value));
+	case JSONInteger:
+		return CborWriter_Int(writer, json_value_get_int64(value));
+	case JSONNumber:
+		return CborWriter_Double(writer, json_value_get_number(value));
+	case JSONBoolean:
+		return CborWriter_Bool(writer, json_value_get_boolean(value) != 0);
+	case JSONNull:
+		return CborWriter_Null(writer);
+	default:
+		return false;
+	}
+}
+
+size_t Cbor_EncodeJson(const JSON_Value *value, uint8_t *buffer, size_t size)
+{
+	CborWriter writer;
+	CborWriter_Init(&writer, buffer, size);
+	if (!EncodeValue(&writer, value, 0))
+	{
+		return 0;
+	}
+	return CborWriter_Finish(&writer);
+}
+
+// Decoder
+
+typedef struct
+{
+	const uint8_t *data;
+	size_t length;
+	size_t offset;
+	JSON_Context *context;
+	// Null terminated keys and strings are built here; map keys stay on it, addressed by offset,
+	// while their value is decoded above them.
+	char *scratch;
+	size_t scratchSize;
+	size_t scratchUsed;
+} Decoder;
+
+static bool Reserve(Decoder *decoder, size_t length)
+{
+	if (length <= decoder->scratchSize - decoder->scratchUsed)
+	{
+		return true;
+	}
+	if (length > SIZE_MAX / 2 - decoder->scratchUsed)
+	{
+		return false;
+	}
+	size_t size = decoder->scratchSize != 0 ? decoder->scratchSize : 64;
+	while (size - decoder->scratchUsed < length)
+	{
+		size *= 2;
+	}
+	char *scratch = json_context_malloc(decoder->context, size);
+	if (scratch == NULL)
+	{
+		return false;
+	}
+	if (decoder->scratchUsed != 0)
+	{
+		memcpy(scratch, decoder->scratch, decoder->scratchUsed);
+	}
+	json_context_free_block(decoder->context, decoder->scratch, decoder->scratchSize);
+	decoder->scratch = scratch;
+	decoder->scratchSize = size;
+	return true;
+}
+
+static bool ReadHead(Decoder *decoder, uint8_t *major, uint8_t *info, uint64_t *argument)
+{
+	if (decoder->offset >= decoder->length)
+	{
+		return false;
+	}
+	uint8_t initial = decoder->data[decoder->offset++];
+	*major = initial >> 5;
+	*info = initial & 0x1F;
+	*argument = *info;
+	if (*info < INFO_UINT8 || *info == INFO_INDEFINITE)
+	{
+		return true;
+	}
+	if (*info > INFO_UINT64)
+	{
+		return false;
+	}
+	size_t length = (size_t)1 << (*info - INFO_UINT8);
+	if (length > decoder->length - decoder->offset)
+	{
+		return false;
+	}
+	*argument = 0;
+	for (size_t i = 0; i < length; i++)
+	{
+		*argument = (*argument << 8) | decoder->data[decoder->offset++];
+	}
+	return true;
+}
+
+// Appends a (possibly chunked) byte or text string to the scratch, without a terminator
+static bool ReadString(Decoder *decoder, uint8_t major, uint8_t info, uint64_t argument, size_t *length)
+{
+	*length = 0;
+	bool chunked = info == INFO_INDEFINITE;
+	for (;;)
+	{
+		if (chunked)
+		{
+			if (decoder->offset < decoder->length && decoder->data[decoder->offset] == BREAK)
+			{
+				decoder->offset++;
+				return true;
+			}
+			uint8_t chunkMajor;
+			if (!ReadHead(decoder, &chunkMajor, &info, &argument) || chunkMajor != major ||
+				info == INFO_INDEFINITE)
+			{
+				return false;
+			}
+		}
+		if (argument > decoder->length - decoder->offset || !Reserve(decoder, (size_t)argument + 1))
+		{
+			return false;
+		}
+		memcpy(decoder->scratch + decoder->scratchUsed, decoder->data + decoder->offset, (size_t)argument);
+		decoder->offset += (size_t)argument;
+		decoder->scratchUsed += (size_t)argument;
+		*length += (size_t)argument;
+		if (!chunked)
+		{
+			return true;
+		}
+	}
+}
+
+// Reads a text string, an integer or (as base64url) a byte string into the scratch as a null
+// terminated string, returning its offset.
+static bool ReadText(Decoder *decoder, uint8_t major, uint8_t info, uint64_t argument, size_t *offset)
+{
+	static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+	size_t start = decoder->scratchUsed;
+	size_t length;
+	*offset = start;
+	if (major == Major_Unsigned || major == Major_Negative)
+	{
+		if (info == INFO_INDEFINITE || !Reserve(decoder, 24))
+		{
+			return false;
+		}
+		int written = major == Major_Unsigned
+						  ? snprintf(decoder->scratch + start, 24, "%llu", (unsigned long long)argument)
+						  : snprintf(decoder->scratch + start, 24, "-%llu", (unsigned long long)argument + 1);
+		if (argument == UINT64_MAX && major == Major_Negative)
+		{
+			written = snprintf(decoder->scratch + start, 24, "-18446744073709551616");
+		}
+		decoder->scratchUsed += (size_t)written + 1;
+		return true;
+	}
+	// An empty indefinite-length string has no chunks to make ReadString reserve anything, so
+	// room for the terminator is reserved here
+	if (!ReadString(decoder, major, info, argument, &length) || !Reserve(decoder, 1))
+	{
+		return false;
+	}
+	if (major == Major_Bytes)
+	{
+		size_t encoded = (length * 4 + 2) / 3;
+		if (!Reserve(decoder, encoded + 1))
+		{
+			return false;
+		}
+		const uint8_t *bytes = (const uint8_t *)decoder->scratch + start;
+		char *text = decoder->scratch + start + length;
+		size_t out = 0;
+		for (size_t i = 0; i < length; i += 3)
+		{
+			uint32_t group = (uint32_t)bytes[i] << 16;
+			group |= i + 1 < length ? (uint32_t)bytes[i + 1] << 8 : 0;
+			group |= i + 2 < length ? bytes[i + 2] : 0;
+			text[out++] = alphabet[(group >> 18) & 0x3F];
+			text[out++] = alphabet[(group >> 12) & 0x3F];
+			if (i + 1 < length)
+			{
+				text[out++] = alphabet[(group >> 6) & 0x3F];
+			}
+			if (i + 2 < length)
+			{
+				text[out++] = alphabet[group & 0x3F];
+			}
+		}
+		memmove(decoder->scratch + start, text, out);
+		length = out;
+	}
+	else if (memchr(decoder->scratch + start, '\0', length) != NULL)
+	{
+		return false;
+	}
+	decoder->scratch[start + length] = '\0';
+	decoder->scratchUsed = start + length + 1;
+	return true;
+}
+
+static double HalfToDouble(uint16_t half)
+{
+	int exponent = (half >> 10) & 0x1F;
+	int mantissa = half & 0x3FF;
+	double value;
+	if (exponent == 0)
+	{
+		value = ldexp(mantissa, -24);
+	}
+	else if (exponent != 31)
+	{
+		value = ldexp(mantissa + 1024, exponent - 25);
+	}
+	else
+	{
+		value = mantissa == 0 ? INFINITY : NAN;
+	}
+	return (half & 0x8000) != 0 ? -value : value;
+}
+
+static JSON_Value *DecodeValue(Decoder *decoder, int depth);
+
+// Decodes the members of a map, or the elements of an array, into container
+static bool DecodeItems(Decoder *decoder, JSON_Value *container, uint8_t info, uint64_t count, int depth)
+{
+	bool isMap = json_value_get_type(container) == JSONObject;
+	for (uint64_t i = 0; info == INFO_INDEFINITE || i < count; i++)
+	{
+		if (info == INFO_INDEFINITE && decoder->offset < decoder->length &&
+			decoder->data[decoder->offset] == BREAK)
+		{
+			decoder->offset++;
+			return true;
+		}
+		size_t key = 0;
+		if (isMap)
+		{
+			uint8_t keyMajor, keyInfo;
+			uint64_t keyArgument;
+			if (!ReadHead(decoder, &keyMajor, &keyInfo, &keyArgument) ||
+				(keyMajor != Major_Text && keyMajor != Major_Unsigned && keyMajor != Major_Negative) ||
+				!ReadText(decoder, keyMajor, keyInfo, keyArgument, &key))
+			{
+				return false;
+			}
+		}
+		JSON_Value *item = DecodeValue(decoder, depth + 1);
+		if (item == NULL)
+		{
+			return false;
+		}
+		JSON_Status status = isMap ? json_object_set_value(json_value_get_object(container),
+														   decoder->scratch + key, item)
+								   : json_array_append_value(json_value_get_array(container), item);
+		if (isMap)
+		{
+			decoder->scratchUsed = key;
+		}
+		if (status != JSONSuccess)
+		{
+			json_value_free(item);
+			return false;
+		}
+	}
+	return true;
+}
+
+static JSON_Value *DecodeValue(Decoder *decoder, int depth)
+{
+	uint8_t major, info;
+	uint64_t argument;
+	if (depth > CBOR_MAX_DEPTH || !ReadHead(decoder, &major, &info, &argument))
+	{
+		return NULL;
+	}
+	switch (major)
+	{
+	case Major_Unsigned:
+		if (argument > INT64_MAX)
+		{
+			return json_value_init_number_ctx(decoder->context, (double)argument);
+		}
+		return json_value_init_int64_ctx(decoder->context, (int64_t)argument);
+	case Major_Negative:
+		if (argument > INT64_MAX)
+		{
+			return json_value_init_number_ctx(decoder->context, -1.0 - (double)argument);
+		}
+		return json_value_init_int64_ctx(decoder->context, -1 - (int64_t)argument);
+	case Major_Bytes:
+	case Major_Text:
+	{
+		size_t offset;
+		if (!ReadText(decoder, major, info, argument, &offset))
+		{
+			return NULL;
+		}
+		JSON_Value *value = json_value_init_string_ctx(decoder->context, decoder->scratch + offset);
+		decoder->scratchUsed = offset;
+		return value;
+	}
+	case Major_Array:
+	case Major_Map:
+	{
+		// Every item takes at least a byte, so a count beyond the input is malformed
+		if (info != INFO_INDEFINITE && argument > decoder->length - decoder->offset)
+		{
+			return NULL;
+		}
+		JSON_Value *value = major == Major_Map ? json_value_init_object_ctx(decoder->context)
+											   : json_value_init_array_ctx(decoder->context);
+		if (value != NULL && !DecodeItems(decoder, value, info, argument, depth))
+		{
+			json_value_free(value);
+			return NULL;
+		}
+		return value;
+	}
+	case Major_Tag:
+		return info == INFO_INDEFINITE ? NULL : DecodeValue(decoder, depth + 1);
+	default:
+		break;
+	}
+	switch (info)
+	{
+	case SIMPLE_FALSE:
+	case SIMPLE_TRUE:
+		return json_value_init_boolean_ctx(decoder->context, info == SIMPLE_TRUE);
+	case SIMPLE_NULL:
+	case SIMPLE_UNDEFINED:
+		return json_value_init_null_ctx(decoder->context);
+	case INFO_UINT16:
+		return json_value_init_number_ctx(decoder->context, HalfToDouble((uint16_t)argument));
+	case INFO_UINT32:
+	{
+		uint32_t bits = (uint32_t)argument;
+		float single;
+		memcpy(&single, &bits, sizeof(single));
+		return json_value_init_number_ctx(decoder->context, single);
+	}
+	case INFO_UINT64:
+	{
+		double value;
+		memcpy(&value, &argument, sizeof(value));
+		return json_value_init_number_ctx(decoder->context, value);
+	}
+	default:
+		return NULL;
+	}
+}
+
+JSON_Value *Cbor_DecodeJson(const uint8_t *data, size_t length, JSON_Context *context)
+{
+	Decoder decoder = {data, length, 0, context != NULL ? context : json_context_default(), NULL, 0, 0};
+	JSON_Value *value = DecodeValue(&decoder, 0);
+	json_context_free_block(decoder.context, decoder.scratch, decoder.scratchSize);
+	if (value != NULL && decoder.offset != length)
+	{
+		json_value_free(value);
+		return NULL;
+	}
+	return value;
+}
@@ -0,0 +1,140 @@
+#include "connection.h"
+#include <string.h>
+
+static uint32_t NextRandom(Connection *connection)
+{
+	// xorshift32, the state must never be zero
+	uint32_t x = connection->random;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	connection->random = x;
+	return x;
+}
+
+// Uniform in [low, high]
+static uint32_t RandomBetween(Connection *connection, uint32_t low, uint32_t high)
+{
+	if (high <= low)
+	{
+		return low;
+	}
+	return low + NextRandom(connection) % (high - low + 1);
+}
+
+static void BackOff(Connection *connection, IotTransport_Status status, int64_t nowMs)
+{
+	uint32_t base = status == IotTransport_Retry ? CONNECTION_RETRY_BASE_MS : CONNECTION_TRANSIENT_BASE_MS;
+	uint32_t cap = status == IotTransport_Retry ? CONNECTION_RETRY_CAP_MS : CONNECTION_TRANSIENT_CAP_MS;
+
+	// Decorrelated jitter: the next delay is random between the base and three times the last one
+	uint32_t previous = connection->delayMs < base ? base : connection->delayMs;
+	uint32_t high = previous > cap / 3 ? cap : previous * 3;
+	connection->delayMs = RandomBetween(connection, base, high);
+
+	connection->failures++;
+	connection->state = Connection_Disconnected;
+	connection->retryAtMs = nowMs + connection->delayMs;
+}
+
+void Connection_Init(Connection *connection, uint32_t seed, const char *hubHostname, int64_t nowMs)
+{
+	memset(connection, 0, sizeof(*connection));
+	connection->random = seed != 0 ? seed : 0x9E3779B9u;
+	if (hubHostname != NULL && strlen(hubHostname) < sizeof(connection->hubHostname))
+	{
+		strcpy(connection->hubHostname, hubHostname);
+	}
+	connection->state = Connection_Disconnected;
+	connection->retryAtMs = nowMs + RandomBetween(connection, 0, CONNECTION_START_SPREAD_MS);
+}
+
+bool Connection_ShouldConnect(const Connection *connection, int64_t nowMs)
+{
+	return connection->state == Connection_Disconnected && nowMs >= connection->retryAtMs;
+}
+
+const char *Connection_Target(Connection *connection)
+{
+	connection->direct = connection->hubHostname[0] != '\0';
+	return connection->direct ? connection->hubHostname : NULL;
+}
+
+void Connection_Attempted(Connection *connection, IotTransport_Status result, const char *assignedHub,
+						  int64_t nowMs)
+{
+	if (result != IotTransport_Ok)
+	{
+		// The hub may have moved, provision next time unless the network was to blame
+		if (connection->direct && result != IotTransport_Transient)
+		{
+			connection->hubHostname[0] = '\0';
+		}
+		BackOff(connection, result, nowMs);
+		return;
+	}
+
+	// A direct connection reports the hostname it was given, which is this very buffer
+	if (assignedHub != NULL && assignedHub != connection->hubHostname &&
+		strlen(assignedHub) < sizeof(connection->hubHostname))
+	{
+		strcpy(connection->hubHostname, assignedHub);
+	}
+	connection->state = Connection_Connecting;
+	connection->connectingSinceMs = nowMs;
+}
+
+bool Connection_StatusChanged(Connection *connection, bool authenticated, IotTransport_Status status,
+							  int64_t nowMs)
+{
+	if (connection->state == Connection_Disconnected)
+	{
+		return false; // a late callback from a client that is being torn down
+	}
+
+	if (authenticated)
+	{
+		connection->state = Connection_Connected;
+		connection->delayMs = 0;
+		connection->failures = 0;
+		return false;
+	}
+
+	if (status == IotTransport_Transient)
+	{
+		// The client reconnects by itself, give it until the timeout
+		if (connection->state == Connection_Connected)
+		{
+			connection->state = Connection_Connecting;
+			connection->connectingSinceMs = nowMs;
+		}
+		return false;
+	}
+
+	if (status == IotTransport_Credentials || connection->direct)
+	{
+		connection->hubHostname[0] = '\0';
+	}
+	BackOff(connection, status == IotTransport_Credentials ? IotTransport_Transient : IotTransport_Retry, nowMs);
+	return true;
+}
+
+bool Connection_TimedOut(Connection *connection, int64_t nowMs)
+{
+	if (connection->state != Connection_Connecting ||
+		nowMs - connection->connectingSinceMs < CONNECTION_CONNECTING_TIMEOUT_MS)
+	{
+		return false;
+	}
+	BackOff(connection, IotTransport_Transient, nowMs);
+	return true;
+}
+
+int64_t Connection_WaitMs(const Connection *connection, int64_t nowMs)
+{
+	if (connection->state != Connection_Disconnected || nowMs >= connection->retryAtMs)
+	{
+		return 0;
+	}
+	return connection->retryAtMs - nowMs;
+}
@@ -0,0 +1,72 @@
+#include "direct_method.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+	const char *name;
+	DirectMethod_Handler handler;
+} Method;
+
+static Method methods[DIRECT_METHOD_MAX_METHODS];
+static size_t methodCount = 0;
+
+static const DirectMethod_Result NotFound = DIRECT_METHOD_RESULT(404, "{\"error\":\"unknown method\"}");
+
+// Returns the index of name, or where it would be inserted as ~index
+static long Find(const char *name)
+{
+	size_t low = 0;
+	size_t high = methodCount;
+	while (low < high)
+	{
+		size_t middle = (low + high) / 2;
+		int order = strcmp(name, methods[middle].name);
+		if (order == 0)
+		{
+			return (long)middle;
+		}
+		if (order < 0)
+		{
+			high = middle;
+		}
+		else
+		{
+			low = middle + 1;
+		}
+	}
+	return ~(long)low;
+}
+
+int DirectMethod_Register(const char *name, DirectMethod_Handler handler)
+{
+	long index = Find(name);
+	if (index >= 0 || methodCount == DIRECT_METHOD_MAX_METHODS)
+	{
+		return -1;
+	}
+
+	size_t position = (size_t)~index;
+	memmove(&methods[position + 1], &methods[position], (methodCount - position) * sizeof(Method));
+	methods[position].name = name;
+	methods[position].handler = handler;
+	methodCount++;
+	return 0;
+}
+
+int DirectMethod_Dispatch(const char *name, const unsigned char *payload, size_t size,
+						  unsigned char **response, size_t *responseSize)
+{
+	long index = Find(name);
+	DirectMethod_Result result = index >= 0 ? methods[index].handler((const char *)payload, size) : NotFound;
+
+	*response = malloc(result.length > 0 ? result.length : 1);
+	if (*response == NULL)
+	{
+		*responseSize = 0;
+		return 500;
+	}
+	memcpy(*response, result.body, result.length);
+	*responseSize = result.length;
+	return result.status;
+}
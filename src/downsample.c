@@ -0,0 +1,153 @@
+#include "downsample.h"
+#include <math.h>
+#include <string.h>
+
+void Downsample_Reset(Downsample_Window *window)
+{
+	memset(window, 0, sizeof(*window));
+}
+
+static void InsertSorted(double *values, uint32_t count, double value)
+{
+	uint32_t i = count;
+	while (i > 0 && values[i - 1] > value)
+	{
+		values[i] = values[i - 1];
+		i--;
+	}
+	values[i] = value;
+}
+
+// The marker heights hold the first five values sorted until the markers are placed
+static void AddQuantile(Downsample_Quantile *quantile, double p, uint32_t count, int32_t value)
+{
+	double x = value;
+	double *q = quantile->heights;
+	int32_t *n = quantile->positions;
+
+	if (count < 5)
+	{
+		InsertSorted(q, count, x);
+		if (count == 4)
+		{
+			for (int i = 0; i < 5; i++)
+			{
+				n[i] = i + 1;
+			}
+			quantile->desired[0] = 1;
+			quantile->desired[1] = 1 + 2 * p;
+			quantile->desired[2] = 1 + 4 * p;
+			quantile->desired[3] = 3 + 2 * p;
+			quantile->desired[4] = 5;
+		}
+		return;
+	}
+
+	// Find the cell the value falls in, widening the ends when it lies outside
+	int k;
+	if (x < q[0])
+	{
+		q[0] = x;
+		k = 0;
+	}
+	else if (x >= q[4])
+	{
+		q[4] = x;
+		k = 3;
+	}
+	else
+	{
+		k = 0;
+		while (x >= q[k + 1])
+		{
+			k++;
+		}
+	}
+
+	for (int i = k + 1; i < 5; i++)
+	{
+		n[i]++;
+	}
+	const double increments[5] = {0, p / 2, p, (1 + p) / 2, 1};
+	for (int i = 0; i < 5; i++)
+	{
+		quantile->desired[i] += increments[i];
+	}
+
+	// Move the middle markers a step towards where they should be, along a parabola through
+	// their neighbours, or linearly when that would take them past one
+	for (int i = 1; i < 4; i++)
+	{
+		double offset = quantile->desired[i] - n[i];
+		if ((offset >= 1 && n[i + 1] - n[i] > 1) || (offset <= -1 && n[i - 1] - n[i] < -1))
+		{
+			int d = offset > 0 ? 1 : -1;
+			double parabolic =
+				q[i] + (double)d / (n[i + 1] - n[i - 1]) *
+						   ((n[i] - n[i - 1] + d) * (q[i + 1] - q[i]) / (n[i + 1] - n[i]) +
+							(n[i + 1] - n[i] - d) * (q[i] - q[i - 1]) / (n[i] - n[i - 1]));
+			if (q[i - 1] < parabolic && parabolic < q[i + 1])
+			{
+				q[i] = parabolic;
+			}
+			else
+			{
+				q[i] += d * (q[i + d] - q[i]) / (n[i + d] - n[i]);
+			}
+			n[i] += d;
+		}
+	}
+}
+
+static int32_t EstimateQuantile(const Downsample_Quantile *quantile, double p, uint32_t count)
+{
+	const double *q = quantile->heights;
+	const int32_t *n = quantile->positions;
+
+	// Nearest rank, exact while the values seen so far are the heights
+	uint32_t rank = (uint32_t)ceil(p * count);
+	rank = rank > 0 ? rank : 1;
+	if (count <= 5)
+	{
+		return (int32_t)q[rank - 1];
+	}
+
+	// Early on the middle marker still lags where it should be, so read the rank off the
+	// markers around it; once they have settled this is the middle marker
+	int i = 0;
+	while (i < 3 && n[i + 1] <= (int32_t)rank)
+	{
+		i++;
+	}
+	double fraction = ((double)rank - n[i]) / (n[i + 1] - n[i]);
+	fraction = fraction < 0 ? 0 : fraction > 1 ? 1 : fraction;
+	return (int32_t)lround(q[i] + fraction * (q[i + 1] - q[i]));
+}
+
+void Downsample_Add(Downsample_Window *window, int32_t value)
+{
+	if (window->count == 0 || value < window->min)
+	{
+		window->min = value;
+	}
+	if (window->count == 0 || value > window->max)
+	{
+		window->max = value;
+	}
+	window->last = value;
+	window->sum += value;
+	AddQuantile(&window->p50, 0.5, window->count, value);
+	AddQuantile(&window->p90, 0.9, window->count, value);
+	window->count++;
+}
+
+void Downsample_Summarize(const Downsample_Window *window, Downsample_Summary *summary)
+{
+	summary->count = window->count;
+	summary->min = window->min;
+	summary->max = window->max;
+	summary->mean = (int32_t)llround((double)window->sum / window->count);
+	summary->last = window->last;
+	summary->p50 = EstimateQuantile(&window->p50, 0.5, window->count);
+	summary->p90 = EstimateQuantile(&window->p90, 0.9, window->count);
+}
@@ -0,0 +1,520 @@
+#include "iot_transport.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Stand-in for the IoT Hub that needs no network. The target passed to Connect names a script,
+// a regular file or a FIFO that another process writes, with one command per line:
+//
+//     [@<ms>] twin <json>            deliver a partial desired-properties patch
+//     [@<ms>] twin-complete <json>   deliver a full twin document
+//     [@<ms>] method <name> [<json>] invoke a direct method
+//     [@<ms>] disconnect [<reason>]  drop the connection with an IOTHUB_CLIENT_CONNECTION_* reason
+//     [@<ms>] refuse <n> [<class>]   fail the next n connection attempts, transient (the default),
+//                                    retry or credentials
+//     [@<ms>] reconnect-after <ms>   how long the client takes to come back by itself after a
+//                                    transient drop, -1 for never (default 1000)
+//     [@<ms>] hub-moved              connecting straight to the hub fails until provisioned again
+//     [@<ms>] network up|down        what IsNetworkReady reports; down drops the connection
+//     # comment
+//
+// @<ms> holds the line until that many milliseconds after the first Connect; lines without it
+// run as soon as they are read. The script advances whenever the application calls DoWork,
+// IsNetworkReady or Connect. Twin updates and methods wait while disconnected. Everything the
+// application sends, and each callback delivered to it, is written to "<script>.out" prefixed
+// with microseconds since the first Connect, for example:
+//
+//     1503 twin {"SpeedMotorA":40}
+//     1571 reported {"SpeedMotorA":40}
+//     5002 event application/cbor 1843
+//
+// Sends are acknowledged on the next DoWork, so IsBusy and the confirmations behave like the
+// LL client. IsBusy also reports a script line that is due and able to run, so the application
+// polls fast enough to run it; a timed line can run up to one idle poll period late.
+
+#define LOOPBACK_MAX_LINE 8192
+#define LOOPBACK_MAX_PATH 256
+#define LOOPBACK_HUB "loopback.azure-devices.net"
+
+static const IotTransport_Handlers *handlers = NULL;
+static int scriptFd = -1;
+static bool scriptEnded = false;
+static FILE *record = NULL;
+static char script[LOOPBACK_MAX_LINE];
+static size_t scriptLength = 0;
+static int64_t startUs = -1;
+
+static bool networkReady = true;
+static bool clientCreated = false;
+static bool connected = false;
+static bool statusPending = false;
+static IotTransport_Status statusClass = IotTransport_Ok;
+static const char *statusReason = "IOTHUB_CLIENT_CONNECTION_OK";
+static char disconnectReason[64];
+static int64_t reconnectAtUs = -1;
+static long reconnectAfterMs = 1000;
+static int refuseCount = 0;
+static IotTransport_Status refuseStatus = IotTransport_Transient;
+static bool hubMoved = false;
+static const char *assignedHub = NULL;
+static int pendingEvents = 0;
+static int pendingReports = 0;
+
+static int64_t ElapsedUs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t us = (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+	if (startUs < 0)
+	{
+		startUs = us;
+	}
+	return us - startUs;
+}
+
+static void Record(const char *kind, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void Record(const char *kind, const char *format, ...)
+{
+	if (record == NULL)
+	{
+		return;
+	}
+	fprintf(record, "%lld %s ", (long long)ElapsedUs(), kind);
+	va_list args;
+	va_start(args, format);
+	vfprintf(record, format, args);
+	va_end(args);
+	fputc('\n', record);
+	fflush(record);
+}
+
+static bool OpenScript(const char *path)
+{
+	char recordPath[LOOPBACK_MAX_PATH];
+	if (snprintf(recordPath, sizeof(recordPath), "%s.out", path) >= (int)sizeof(recordPath))
+	{
+		return false;
+	}
+
+	// Non-blocking, so a FIFO opens before its writer does and DoWork never waits on it
+	scriptFd = open(path, O_RDONLY | O_NONBLOCK);
+	if (scriptFd < 0)
+	{
+		return false;
+	}
+	record = fopen(recordPath, "w");
+	if (record == NULL)
+	{
+		close(scriptFd);
+		scriptFd = -1;
+		return false;
+	}
+	return true;
+}
+
+static void ReadScript(void)
+{
+	if (scriptEnded || scriptFd < 0)
+	{
+		return;
+	}
+	ssize_t count = read(scriptFd, script + scriptLength, sizeof(script) - scriptLength);
+	if (count > 0)
+	{
+		scriptLength += (size_t)count;
+	}
+	else if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+	{
+		scriptEnded = true;
+	}
+
+	if (scriptLength == sizeof(script) && memchr(script, '\n', scriptLength) == NULL)
+	{
+		Record("error", "script line longer than %d bytes dropped", LOOPBACK_MAX_LINE);
+		scriptLength = 0;
+	}
+}
+
+static const char *StatusName(IotTransport_Status status)
+{
+	switch (status)
+	{
+	case IotTransport_Ok:
+		return "ok";
+	case IotTransport_Transient:
+		return "transient";
+	case IotTransport_Retry:
+		return "retry";
+	default:
+		return "credentials";
+	}
+}
+
+// Classifies a disconnect reason the way the hub transport does
+static IotTransport_Status ReasonStatus(const char *reason)
+{
+	if (strcmp(reason, "IOTHUB_CLIENT_CONNECTION_NO_NETWORK") == 0 ||
+		strcmp(reason, "IOTHUB_CLIENT_CONNECTION_COMMUNICATION_ERROR") == 0 ||
+		strcmp(reason, "IOTHUB_CLIENT_CONNECTION_NO_PING_RESPONSE") == 0)
+	{
+		return IotTransport_Transient;
+	}
+	if (strcmp(reason, "IOTHUB_CLIENT_CONNECTION_EXPIRED_SAS_TOKEN") == 0 ||
+		strcmp(reason, "IOTHUB_CLIENT_CONNECTION_BAD_CREDENTIAL") == 0)
+	{
+		return IotTransport_Credentials;
+	}
+	return IotTransport_Retry;
+}
+
+static void Drop(const char *reason)
+{
+	snprintf(disconnectReason, sizeof(disconnectReason), "%s", reason);
+	connected = false;
+	statusPending = true;
+	statusReason = disconnectReason;
+	statusClass = ReasonStatus(disconnectReason);
+
+	// Like the LL client, come back by itself after a transient drop
+	reconnectAtUs = statusClass == IotTransport_Transient && reconnectAfterMs >= 0
+						? ElapsedUs() + (int64_t)reconnectAfterMs * 1000
+						: -1;
+}
+
+// Splits the first word off text, returning the rest with leading spaces skipped
+static char *NextWord(char *text)
+{
+	while (*text != '\0' && *text != ' ' && *text != '\t')
+	{
+		text++;
+	}
+	if (*text != '\0')
+	{
+		*text++ = '\0';
+	}
+	while (*text == ' ' || *text == '\t')
+	{
+		text++;
+	}
+	return text;
+}
+
+static void InvokeMethod(char *arguments)
+{
+	char *payload = NextWord(arguments);
+	if (*payload == '\0')
+	{
+		payload = "{}";
+	}
+
+	Record("method", "%s %s", arguments, payload);
+	unsigned char *response = NULL;
+	size_t responseSize = 0;
+	int status = handlers->Method(arguments, (const unsigned char *)payload, strlen(payload), &response,
+								  &responseSize);
+	Record("method-response", "%s %d %.*s", arguments, status, (int)responseSize, (const char *)response);
+	free(response);
+}
+
+// Runs one line, or returns false if it has to wait until the application is connected
+static bool RunLine(char *line)
+{
+	char *arguments = NextWord(line);
+	if (line[0] == '\0' || line[0] == '#')
+	{
+		return true;
+	}
+
+	if (strcmp(line, "twin") == 0 || strcmp(line, "twin-complete") == 0)
+	{
+		if (!connected)
+		{
+			return false;
+		}
+		bool complete = line[4] != '\0';
+		Record(line, "%s", arguments);
+		handlers->TwinUpdate(complete, (const unsigned char *)arguments, strlen(arguments));
+	}
+	else if (strcmp(line, "method") == 0)
+	{
+		if (!connected)
+		{
+			return false;
+		}
+		InvokeMethod(arguments);
+	}
+	else if (strcmp(line, "disconnect") == 0)
+	{
+		Drop(*arguments != '\0' ? arguments : "IOTHUB_CLIENT_CONNECTION_COMMUNICATION_ERROR");
+	}
+	else if (strcmp(line, "refuse") == 0)
+	{
+		char *status = NextWord(arguments);
+		refuseCount = atoi(arguments);
+		refuseStatus = strcmp(status, "retry") == 0		  ? IotTransport_Retry
+					   : strcmp(status, "credentials") == 0 ? IotTransport_Credentials
+															: IotTransport_Transient;
+	}
+	else if (strcmp(line, "reconnect-after") == 0)
+	{
+		reconnectAfterMs = atol(arguments);
+	}
+	else if (strcmp(line, "hub-moved") == 0)
+	{
+		hubMoved = true;
+	}
+	else if (strcmp(line, "network") == 0)
+	{
+		networkReady = strcmp(arguments, "down") != 0;
+		Record("network", "%s", networkReady ? "up" : "down");
+		if (!networkReady && connected)
+		{
+			Drop("IOTHUB_CLIENT_CONNECTION_NO_NETWORK");
+		}
+	}
+	else
+	{
+		Record("error", "unknown command '%s'", line);
+	}
+	return true;
+}
+
+// Runs the complete lines that are due, stopping at the first that has to wait
+static void RunScript(void)
+{
+	size_t start = 0;
+	for (;;)
+	{
+		char *end = memchr(script + start, '\n', scriptLength - start);
+		if (end == NULL)
+		{
+			break;
+		}
+		char *line = script + start;
+		*end = '\0';
+
+		if (line[0] == '@')
+		{
+			char *rest;
+			long long dueMs = strtoll(line + 1, &rest, 10);
+			if (ElapsedUs() < dueMs * 1000)
+			{
+				*end = '\n';
+				break;
+			}
+			while (*rest == ' ' || *rest == '\t')
+			{
+				rest++;
+			}
+			line = rest;
+		}
+
+		// RunLine splits the line in place, so keep a copy in case it has to wait
+		char held[LOOPBACK_MAX_LINE];
+		size_t heldLength = (size_t)(end - line);
+		memcpy(held, line, heldLength + 1);
+		if (!RunLine(line))
+		{
+			memcpy(line, held, heldLength + 1);
+			*end = '\n';
+			break;
+		}
+		start = (size_t)(end - script) + 1;
+	}
+
+	memmove(script, script + start, scriptLength - start);
+	scriptLength -= start;
+}
+
+// The script advances whenever the application calls in: DoWork, IsNetworkReady or Connect
+static void Pump(void)
+{
+	ReadScript();
+	RunScript();
+}
+
+static bool Loopback_IsNetworkReady(void)
+{
+	Pump();
+	return networkReady;
+}
+
+static IotTransport_Status Loopback_Connect(const char *target, const char *hubHostname,
+											const IotTransport_Handlers *transportHandlers)
+{
+	handlers = transportHandlers;
+	if (record == NULL && !OpenScript(target))
+	{
+		return IotTransport_Retry;
+	}
+
+	// A new client drops whatever the old one had outstanding
+	clientCreated = false;
+	connected = false;
+	statusPending = false;
+	reconnectAtUs = -1;
+	pendingEvents = 0;
+	pendingReports = 0;
+	assignedHub = NULL;
+
+	Pump();
+	const char *route = hubHostname != NULL ? "direct" : "dps";
+	IotTransport_Status result = IotTransport_Ok;
+	if (!networkReady)
+	{
+		result = IotTransport_Transient;
+	}
+	else if (refuseCount > 0)
+	{
+		refuseCount--;
+		result = refuseStatus;
+	}
+	else if (hubHostname != NULL && (hubMoved || strcmp(hubHostname, LOOPBACK_HUB) != 0))
+	{
+		result = IotTransport_Retry;
+	}
+	Record("connect", "%s %s", route, StatusName(result));
+	if (result != IotTransport_Ok)
+	{
+		return result;
+	}
+
+	if (hubHostname == NULL)
+	{
+		hubMoved = false;
+	}
+	assignedHub = LOOPBACK_HUB;
+	clientCreated = true;
+	connected = true;
+	statusPending = true;
+	statusClass = IotTransport_Ok;
+	statusReason = "IOTHUB_CLIENT_CONNECTION_OK";
+	return IotTransport_Ok;
+}
+
+static const char *Loopback_AssignedHub(void)
+{
+	return assignedHub;
+}
+
+static void Loopback_Disconnect(void)
+{
+	Record("disconnect", "by application");
+	clientCreated = false;
+	connected = false;
+	statusPending = false;
+	reconnectAtUs = -1;
+	pendingEvents = 0;
+	pendingReports = 0;
+}
+
+static void Loopback_DoWork(void)
+{
+	if (!clientCreated)
+	{
+		return;
+	}
+
+	if (!connected && reconnectAtUs >= 0 && ElapsedUs() >= reconnectAtUs && networkReady)
+	{
+		reconnectAtUs = -1;
+		connected = true;
+		statusPending = true;
+		statusClass = IotTransport_Ok;
+		statusReason = "IOTHUB_CLIENT_CONNECTION_OK";
+	}
+
+	if (statusPending)
+	{
+		statusPending = false;
+		Record("connection", "%s %s", connected ? "authenticated" : "unauthenticated", statusReason);
+		handlers->ConnectionStatus(connected, statusClass, statusReason);
+	}
+
+	// Take the counts first, the handlers may send more
+	int events = pendingEvents;
+	int reports = pendingReports;
+	pendingEvents = 0;
+	pendingReports = 0;
+	for (int i = 0; i < events; i++)
+	{
+		handlers->EventConfirmed(connected);
+	}
+	for (int i = 0; i < reports; i++)
+	{
+		handlers->ReportedStateConfirmed(connected ? 204 : 0);
+	}
+
+	Pump();
+}
+
+// Whether the first complete script line could run now. Lines that could ran on the last Pump,
+// so what is left is waiting for its time or for the connection.
+static bool ScriptLineDue(void)
+{
+	if (memchr(script, '\n', scriptLength) == NULL)
+	{
+		return false;
+	}
+	char *line = script;
+	if (line[0] == '@')
+	{
+		if (ElapsedUs() < strtoll(line + 1, &line, 10) * 1000)
+		{
+			return false;
+		}
+		while (*line == ' ' || *line == '\t')
+		{
+			line++;
+		}
+	}
+	// twin-complete shares the prefix
+	return connected || (strncmp(line, "twin", 4) != 0 && strncmp(line, "method", 6) != 0);
+}
+
+static bool Loopback_IsBusy(void)
+{
+	return pendingEvents > 0 || pendingReports > 0 || statusPending ||
+		   (reconnectAtUs >= 0 && ElapsedUs() >= reconnectAtUs) || ScriptLineDue();
+}
+
+static bool Loopback_SendEvent(const uint8_t *body, size_t length, const char *contentType)
+{
+	(void)body; // only the size is recorded
+	if (!connected || !networkReady)
+	{
+		return false;
+	}
+	Record("event", "%s %zu", contentType, length);
+	pendingEvents++;
+	return true;
+}
+
+static bool Loopback_SendReportedState(const char *json, size_t length)
+{
+	if (!connected)
+	{
+		return false;
+	}
+	Record("reported", "%.*s", (int)length, json);
+	pendingReports++;
+	return true;
+}
+
+const IotTransport IotTransport_Loopback = {
+	.name = "loopback",
+	.IsNetworkReady = Loopback_IsNetworkReady,
+	.Connect = Loopback_Connect,
+	.AssignedHub = Loopback_AssignedHub,
+	.Disconnect = Loopback_Disconnect,
+	.DoWork = Loopback_DoWork,
+	.IsBusy = Loopback_IsBusy,
+	.SendEvent = Loopback_SendEvent,
+	.SendReportedState = Loopback_SendReportedState,
+};
@@ -0,0 +1,534 @@
+#include "json_reader.h"
+#include <stdlib.h>
+#include <string.h>
+
+enum reader_state_t
+{
+	State_Value,
+	State_FirstMember,  // after '{'
+	State_FirstElement, // after '['
+	State_Key,
+	State_AfterValue,
+	State_Done,
+	State_Error,
+};
+
+#define NUMBER_BUFFER_SIZE 64
+#define KEY_BUFFER_SIZE 64
+
+static char Peek(const JsonReader *reader)
+{
+	return reader->offset < reader->length ? reader->json[reader->offset] : '\0';
+}
+
+static bool IsDigit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static bool InObject(const JsonReader *reader)
+{
+	return reader->depth > 0 && ((reader->objectBits >> (reader->depth - 1)) & 1u) != 0;
+}
+
+static JsonToken Fail(JsonReader *reader)
+{
+	reader->state = State_Error;
+	reader->token = JsonToken_Error;
+	return JsonToken_Error;
+}
+
+static JsonToken Emit(JsonReader *reader, JsonToken token, int state)
+{
+	reader->state = state;
+	reader->token = token;
+	return token;
+}
+
+static void SkipWhitespace(JsonReader *reader)
+{
+	while (reader->offset < reader->length)
+	{
+		char c = reader->json[reader->offset];
+		if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+		{
+			break;
+		}
+		reader->offset++;
+	}
+}
+
+static bool Push(JsonReader *reader, bool isObject)
+{
+	if (reader->depth >= JSON_READER_MAX_DEPTH)
+	{
+		return false;
+	}
+	if (isObject)
+	{
+		reader->objectBits |= (1u << reader->depth);
+	}
+	else
+	{
+		reader->objectBits &= ~(1u << reader->depth);
+	}
+	reader->depth++;
+	return true;
+}
+
+static bool ReadString(JsonReader *reader)
+{
+	size_t start = ++reader->offset; // opening quote
+	reader->textEscaped = false;
+	while (reader->offset < reader->length)
+	{
+		unsigned char c = (unsigned char)reader->json[reader->offset];
+		if (c == '"')
+		{
+			reader->text = reader->json + start;
+			reader->textLength = reader->offset - start;
+			reader->offset++;
+			return true;
+		}
+		if (c == '\\')
+		{
+			reader->textEscaped = true;
+			reader->offset++;
+		}
+		else if (c < 0x20)
+		{
+			return false;
+		}
+		reader->offset++;
+	}
+	return false;
+}
+
+static bool ReadLiteral(JsonReader *reader, const char *literal, size_t length)
+{
+	if (reader->length - reader->offset < length ||
+		memcmp(reader->json + reader->offset, literal, length) != 0)
+	{
+		return false;
+	}
+	reader->text = reader->json + reader->offset;
+	reader->textLength = length;
+	reader->offset += length;
+	return true;
+}
+
+// -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+static bool ReadNumber(JsonReader *reader)
+{
+	size_t start = reader->offset;
+	if (Peek(reader) == '-')
+	{
+		reader->offset++;
+	}
+	if (Peek(reader) == '0')
+	{
+		reader->offset++;
+	}
+	else if (IsDigit(Peek(reader)))
+	{
+		while (IsDigit(Peek(reader)))
+		{
+			reader->offset++;
+		}
+	}
+	else
+	{
+		return false;
+	}
+	if (Peek(reader) == '.')
+	{
+		reader->offset++;
+		if (!IsDigit(Peek(reader)))
+		{
+			return false;
+		}
+		while (IsDigit(Peek(reader)))
+		{
+			reader->offset++;
+		}
+	}
+	if (Peek(reader) == 'e' || Peek(reader) == 'E')
+	{
+		reader->offset++;
+		if (Peek(reader) == '+' || Peek(reader) == '-')
+		{
+			reader->offset++;
+		}
+		if (!IsDigit(Peek(reader)))
+		{
+			return false;
+		}
+		while (IsDigit(Peek(reader)))
+		{
+			reader->offset++;
+		}
+	}
+	reader->text = reader->json + start;
+	reader->textLength = reader->offset - start;
+	return true;
+}
+
+static JsonToken ReadKey(JsonReader *reader)
+{
+	if (Peek(reader) != '"' || !ReadString(reader))
+	{
+		return Fail(reader);
+	}
+	SkipWhitespace(reader);
+	if (Peek(reader) != ':')
+	{
+		return Fail(reader);
+	}
+	reader->offset++;
+	return Emit(reader, JsonToken_Key, State_Value);
+}
+
+static JsonToken ReadValue(JsonReader *reader)
+{
+	switch (Peek(reader))
+	{
+	case '{':
+		reader->offset++;
+		return Push(reader, true) ? Emit(reader, JsonToken_ObjectStart, State_FirstMember) : Fail(reader);
+	case '[':
+		reader->offset++;
+		return Push(reader, false) ? Emit(reader, JsonToken_ArrayStart, State_FirstElement) : Fail(reader);
+	case '"':
+		return ReadString(reader) ? Emit(reader, JsonToken_String, State_AfterValue) : Fail(reader);
+	case 't':
+		return ReadLiteral(reader, "true", 4) ? Emit(reader, JsonToken_True, State_AfterValue) : Fail(reader);
+	case 'f':
+		return ReadLiteral(reader, "false", 5) ? Emit(reader, JsonToken_False, State_AfterValue) : Fail(reader);
+	case 'n':
+		return ReadLiteral(reader, "null", 4) ? Emit(reader, JsonToken_Null, State_AfterValue) : Fail(reader);
+	default:
+		return ReadNumber(reader) ? Emit(reader, JsonToken_Number, State_AfterValue) : Fail(reader);
+	}
+}
+
+void JsonReader_Init(JsonReader *reader, const char *json, size_t length)
+{
+	memset(reader, 0, sizeof(*reader));
+	reader->json = json;
+	reader->length = length;
+	reader->state = State_Value;
+	reader->token = JsonToken_End;
+}
+
+JsonToken JsonReader_Next(JsonReader *reader)
+{
+	if (reader->state == State_Error)
+	{
+		return JsonToken_Error;
+	}
+	SkipWhitespace(reader);
+	switch (reader->state)
+	{
+	case State_Done:
+		return Emit(reader, JsonToken_End, State_Done);
+	case State_AfterValue:
+		if (reader->depth == 0)
+		{
+			// only whitespace may follow the top level value
+			return reader->offset == reader->length ? Emit(reader, JsonToken_End, State_Done) : Fail(reader);
+		}
+		if (Peek(reader) == ',')
+		{
+			reader->offset++;
+			SkipWhitespace(reader);
+			reader->state = InObject(reader) ? State_Key : State_Value;
+			break;
+		}
+		if (Peek(reader) == (InObject(reader) ? '}' : ']'))
+		{
+			JsonToken token = InObject(reader) ? JsonToken_ObjectEnd : JsonToken_ArrayEnd;
+			reader->offset++;
+			reader->depth--;
+			return Emit(reader, token, State_AfterValue);
+		}
+		return Fail(reader);
+	case State_FirstMember:
+		if (Peek(reader) == '}')
+		{
+			reader->offset++;
+			reader->depth--;
+			return Emit(reader, JsonToken_ObjectEnd, State_AfterValue);
+		}
+		reader->state = State_Key;
+		break;
+	case State_FirstElement:
+		if (Peek(reader) == ']')
+		{
+			reader->offset++;
+			reader->depth--;
+			return Emit(reader, JsonToken_ArrayEnd, State_AfterValue);
+		}
+		reader->state = State_Value;
+		break;
+	default:
+		break;
+	}
+
+	return reader->state == State_Key ? ReadKey(reader) : ReadValue(reader);
+}
+
+bool JsonReader_Skip(JsonReader *reader)
+{
+	int depth = reader->depth;
+	if (reader->token != JsonToken_ObjectStart && reader->token != JsonToken_ArrayStart)
+	{
+		JsonToken token = JsonReader_Next(reader);
+		if (token != JsonToken_ObjectStart && token != JsonToken_ArrayStart)
+		{
+			return token != JsonToken_Error;
+		}
+		depth = reader->depth;
+	}
+
+	while (reader->depth >= depth)
+	{
+		if (JsonReader_Next(reader) == JsonToken_Error)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+size_t JsonReader_Offset(const JsonReader *reader)
+{
+	return reader->offset;
+}
+
+bool JsonReader_TextEquals(const JsonReader *reader, const char *text, size_t length)
+{
+	if (reader->textEscaped)
+	{
+		char buffer[KEY_BUFFER_SIZE];
+		int unescapedLength = JsonReader_GetString(reader, buffer, sizeof(buffer));
+		return unescapedLength >= 0 && (size_t)unescapedLength == length && memcmp(buffer, text, length) == 0;
+	}
+	return reader->textLength == length && memcmp(reader->text, text, length) == 0;
+}
+
+bool JsonReader_GetDouble(const JsonReader *reader, double *value)
+{
+	char buffer[NUMBER_BUFFER_SIZE];
+	if (reader->token != JsonToken_Number || reader->textLength >= sizeof(buffer))
+	{
+		return false;
+	}
+	memcpy(buffer, reader->text, reader->textLength);
+	buffer[reader->textLength] = '\0';
+	*value = strtod(buffer, NULL);
+	return true;
+}
+
+bool JsonReader_GetInt64(const JsonReader *reader, int64_t *value)
+{
+	uint64_t magnitude = 0;
+	size_t i = 0;
+	bool negative = false;
+	if (reader->token != JsonToken_Number)
+	{
+		return false;
+	}
+	if (reader->text[0] == '-')
+	{
+		negative = true;
+		i++;
+	}
+	for (; i < reader->textLength; i++)
+	{
+		char c = reader->text[i];
+		if (!IsDigit(c))
+		{
+			// fraction or exponent: accept it if the value is still a whole number
+			double number = 0;
+			if (!JsonReader_GetDouble(reader, &number) || number < -9223372036854775808.0 ||
+				number >= 9223372036854775808.0 || number != (double)(int64_t)number)
+			{
+				return false;
+			}
+			*value = (int64_t)number;
+			return true;
+		}
+		if (magnitude > (UINT64_MAX - 9) / 10)
+		{
+			return false;
+		}
+		magnitude = magnitude * 10 + (uint64_t)(c - '0');
+	}
+	if (magnitude > (uint64_t)INT64_MAX + (negative ? 1 : 0))
+	{
+		return false;
+	}
+	*value = negative ? (int64_t)(0 - magnitude) : (int64_t)magnitude;
+	return true;
+}
+
+bool JsonReader_GetBool(const JsonReader *reader, bool *value)
+{
+	if (reader->token != JsonToken_True && reader->token != JsonToken_False)
+	{
+		return false;
+	}
+	*value = reader->token == JsonToken_True;
+	return true;
+}
+
+static int HexValue(char c)
+{
+	if (IsDigit(c))
+	{
+		return c - '0';
+	}
+	if (c >= 'a' && c <= 'f')
+	{
+		return c - 'a' + 10;
+	}
+	if (c >= 'A' && c <= 'F')
+	{
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+static bool ReadHex4(const char *text, size_t remaining, unsigned int *value)
+{
+	*value = 0;
+	if (remaining < 4)
+	{
+		return false;
+	}
+	for (int i = 0; i < 4; i++)
+	{
+		int digit = HexValue(text[i]);
+		if (digit < 0)
+		{
+			return false;
+		}
+		*value = (*value << 4) | (unsigned int)digit;
+	}
+	return true;
+}
+
+int JsonReader_GetString(const JsonReader *reader, char *buffer, size_t size)
+{
+	const char *in = reader->text;
+	const char *end = reader->text + reader->textLength;
+	size_t out = 0;
+	if (reader->token != JsonToken_Key && reader->token != JsonToken_String)
+	{
+		return -1;
+	}
+	while (in < end)
+	{
+		char utf8[4];
+		size_t utf8Length = 1;
+		if (*in != '\\')
+		{
+			utf8[0] = *in++;
+		}
+		else
+		{
+			in++; // the reader made sure an escaped character follows
+			switch (*in++)
+			{
+			case '"':
+				utf8[0] = '"';
+				break;
+			case '\\':
+				utf8[0] = '\\';
+				break;
+			case '/':
+				utf8[0] = '/';
+				break;
+			case 'b':
+				utf8[0] = '\b';
+				break;
+			case 'f':
+				utf8[0] = '\f';
+				break;
+			case 'n':
+				utf8[0] = '\n';
+				break;
+			case 'r':
+				utf8[0] = '\r';
+				break;
+			case 't':
+				utf8[0] = '\t';
+				break;
+			case 'u':
+			{
+				unsigned int cp = 0;
+				unsigned int low = 0;
+				if (!ReadHex4(in, (size_t)(end - in), &cp))
+				{
+					return -1;
+				}
+				in += 4;
+				if (cp >= 0xD800 && cp <= 0xDBFF)
+				{
+					if (end - in < 6 || in[0] != '\\' || in[1] != 'u' ||
+						!ReadHex4(in + 2, (size_t)(end - in - 2), &low) || low < 0xDC00 || low > 0xDFFF)
+					{
+						return -1;
+					}
+					in += 6;
+					cp = (((cp & 0x3FF) << 10) | (low & 0x3FF)) + 0x10000;
+				}
+				else if (cp >= 0xDC00 && cp <= 0xDFFF)
+				{
+					return -1;
+				}
+				if (cp < 0x80)
+				{
+					utf8[0] = (char)cp;
+				}
+				else if (cp < 0x800)
+				{
+					utf8[0] = (char)(0xC0 | (cp >> 6));
+					utf8[1] = (char)(0x80 | (cp & 0x3F));
+					utf8Length = 2;
+				}
+				else if (cp < 0x10000)
+				{
+					utf8[0] = (char)(0xE0 | (cp >> 12));
+					utf8[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+					utf8[2] = (char)(0x80 | (cp & 0x3F));
+					utf8Length = 3;
+				}
+				else
+				{
+					utf8[0] = (char)(0xF0 | (cp >> 18));
+					utf8[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+					utf8[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+					utf8[3] = (char)(0x80 | (cp & 0x3F));
+					utf8Length = 4;
+				}
+				break;
+			}
+			default:
+				return -1;
+			}
+		}
+		if (out + utf8Length >= size)
+		{
+			return -1;
+		}
+		memcpy(buffer + out, utf8, utf8Length);
+		out += utf8Length;
+	}
+	if (size == 0)
+	{
+		return -1;
+	}
+	buffer[out] = '\0';
+	return (int)out;
+}
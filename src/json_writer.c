@@ -0,0 +1,268 @@
+#include "json_writer.h"
+#include "parson.h"
+#include <math.h>
+#include <string.h>
+
+static bool Fail(JsonWriter *writer, JsonWriterError error)
+{
+	if (writer->error == JsonWriterError_None)
+	{
+		writer->error = error;
+	}
+	return false;
+}
+
+static bool InObject(const JsonWriter *writer)
+{
+	return writer->depth > 0 && ((writer->objectBits >> (writer->depth - 1)) & 1u) != 0;
+}
+
+// Always leaves room for the terminator written by JsonWriter_Finish
+static bool Put(JsonWriter *writer, const char *text, size_t length)
+{
+	if (length >= writer->size - writer->length)
+	{
+		return Fail(writer, JsonWriterError_Overflow);
+	}
+	memcpy(writer->buffer + writer->length, text, length);
+	writer->length += length;
+	return true;
+}
+
+static bool PutString(JsonWriter *writer, const char *value)
+{
+	static const char hex[] = "0123456789abcdef";
+	if (!Put(writer, "\"", 1))
+	{
+		return false;
+	}
+	const char *run = value;
+	for (;; value++)
+	{
+		unsigned char c = (unsigned char)*value;
+		if (c >= 0x20 && c != '"' && c != '\\')
+		{
+			continue;
+		}
+		// Copy the run of characters that need no escaping in one go
+		if (value > run && !Put(writer, run, (size_t)(value - run)))
+		{
+			return false;
+		}
+		if (c == '\0')
+		{
+			break;
+		}
+		char escaped[6] = {'\\', (char)c, 0, 0, 0, 0};
+		size_t length = 2;
+		switch (c)
+		{
+		case '"':
+		case '\\':
+			break;
+		case '\b':
+			escaped[1] = 'b';
+			break;
+		case '\f':
+			escaped[1] = 'f';
+			break;
+		case '\n':
+			escaped[1] = 'n';
+			break;
+		case '\r':
+			escaped[1] = 'r';
+			break;
+		case '\t':
+			escaped[1] = 't';
+			break;
+		default:
+			escaped[1] = 'u';
+			escaped[2] = '0';
+			escaped[3] = '0';
+			escaped[4] = hex[c >> 4];
+			escaped[5] = hex[c & 0xF];
+			length = 6;
+			break;
+		}
+		if (!Put(writer, escaped, length))
+		{
+			return false;
+		}
+		run = value + 1;
+	}
+	return Put(writer, "\"", 1);
+}
+
+// Checks that a value may go here and writes the separator in front of it
+static bool BeginValue(JsonWriter *writer)
+{
+	if (writer->error != JsonWriterError_None)
+	{
+		return false;
+	}
+	if (writer->depth == 0)
+	{
+		// Only one root value
+		return writer->hasValue ? Fail(writer, JsonWriterError_Usage) : true;
+	}
+	if (InObject(writer))
+	{
+		return writer->afterKey ? true : Fail(writer, JsonWriterError_Usage);
+	}
+	return writer->hasValue ? Put(writer, ",", 1) : true;
+}
+
+static bool EndValue(JsonWriter *writer)
+{
+	writer->hasValue = true;
+	writer->afterKey = false;
+	return true;
+}
+
+static bool Begin(JsonWriter *writer, bool object)
+{
+	if (!BeginValue(writer))
+	{
+		return false;
+	}
+	if (writer->depth == JSON_WRITER_MAX_DEPTH)
+	{
+		return Fail(writer, JsonWriterError_Nesting);
+	}
+	if (!Put(writer, object ? "{" : "[", 1))
+	{
+		return false;
+	}
+	if (object)
+	{
+		writer->objectBits |= 1u << writer->depth;
+	}
+	else
+	{
+		writer->objectBits &= ~(1u << writer->depth);
+	}
+	writer->depth++;
+	writer->hasValue = false;
+	writer->afterKey = false;
+	return true;
+}
+
+void JsonWriter_Init(JsonWriter *writer, char *buffer, size_t size)
+{
+	memset(writer, 0, sizeof(*writer));
+	writer->buffer = buffer;
+	writer->size = size;
+	if (size == 0)
+	{
+		writer->error = JsonWriterError_Overflow;
+	}
+}
+
+bool JsonWriter_BeginObject(JsonWriter *writer)
+{
+	return Begin(writer, true);
+}
+
+bool JsonWriter_BeginArray(JsonWriter *writer)
+{
+	return Begin(writer, false);
+}
+
+bool JsonWriter_End(JsonWriter *writer)
+{
+	if (writer->error != JsonWriterError_None)
+	{
+		return false;
+	}
+	if (writer->depth == 0 || writer->afterKey)
+	{
+		return Fail(writer, JsonWriterError_Usage);
+	}
+	if (!Put(writer, InObject(writer) ? "}" : "]", 1))
+	{
+		return false;
+	}
+	writer->depth--;
+	return EndValue(writer);
+}
+
+bool JsonWriter_Key(JsonWriter *writer, const char *name)
+{
+	if (writer->error != JsonWriterError_None)
+	{
+		return false;
+	}
+	if (!InObject(writer) || writer->afterKey)
+	{
+		return Fail(writer, JsonWriterError_Usage);
+	}
+	if ((writer->hasValue && !Put(writer, ",", 1)) || !PutString(writer, name) || !Put(writer, ":", 1))
+	{
+		return false;
+	}
+	writer->afterKey = true;
+	return true;
+}
+
+bool JsonWriter_String(JsonWriter *writer, const char *value)
+{
+	return BeginValue(writer) && PutString(writer, value) && EndValue(writer);
+}
+
+bool JsonWriter_Int(JsonWriter *writer, int64_t value)
+{
+	char digits[21];
+	size_t count = 0;
+	uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+	do
+	{
+		digits[sizeof(digits) - 1 - count++] = (char)('0' + magnitude % 10);
+		magnitude /= 10;
+	} while (magnitude != 0);
+	if (value < 0)
+	{
+		digits[sizeof(digits) - 1 - count++] = '-';
+	}
+	return BeginValue(writer) && Put(writer, digits + sizeof(digits) - count, count) && EndValue(writer);
+}
+
+bool JsonWriter_Double(JsonWriter *writer, double value)
+{
+	if (!isfinite(value))
+	{
+		return JsonWriter_Null(writer);
+	}
+	// Same shortest round-trip digits as parson's serializer
+	char text[JSON_NUMBER_BUFFER_SIZE];
+	int length = json_format_number(text, value);
+	return BeginValue(writer) && Put(writer, text, (size_t)length) && EndValue(writer);
+}
+
+bool JsonWriter_Bool(JsonWriter *writer, bool value)
+{
+	return BeginValue(writer) && Put(writer, value ? "true" : "false", value ? 4 : 5) && EndValue(writer);
+}
+
+bool JsonWriter_Null(JsonWriter *writer)
+{
+	return BeginValue(writer) && Put(writer, "null", 4) && EndValue(writer);
+}
+
+size_t JsonWriter_Finish(JsonWriter *writer)
+{
+	if (writer->error == JsonWriterError_None && (writer->depth != 0 || !writer->hasValue))
+	{
+		Fail(writer, JsonWriterError_Usage);
+	}
+	if (writer->size > 0)
+	{
+		// Put never fills the last byte, so this is in bounds even after an overflow
+		writer->buffer[writer->length] = '\0';
+	}
+	return writer->error == JsonWriterError_None ? writer->length : 0;
+}
+
+JsonWriterError JsonWriter_GetError(const JsonWriter *writer)
+{
+	return writer->error;
+}
@@ -0,0 +1,97 @@
+#include "latency_histogram.h"
+#include <string.h>
+#include <time.h>
+
+int64_t Latency_NowUs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void LatencyHistogram_Reset(LatencyHistogram *histogram)
+{
+	memset(histogram, 0, sizeof(*histogram));
+}
+
+static int BucketIndex(uint32_t value)
+{
+	if (value < LATENCY_HISTOGRAM_SUB_BUCKETS)
+	{
+		return (int)value;
+	}
+	// value has magnitude bits, keep the top SUB_BUCKET_BITS + 1 of them
+	int magnitude = 31 - __builtin_clz(value);
+	int shift = magnitude - LATENCY_HISTOGRAM_SUB_BUCKET_BITS;
+	int subBucket = (int)(value >> shift) - LATENCY_HISTOGRAM_SUB_BUCKETS;
+	return LATENCY_HISTOGRAM_SUB_BUCKETS * (shift + 1) + subBucket;
+}
+
+static uint32_t BucketHighestValue(int index)
+{
+	if (index < LATENCY_HISTOGRAM_SUB_BUCKETS)
+	{
+		return (uint32_t)index;
+	}
+	int shift = index / LATENCY_HISTOGRAM_SUB_BUCKETS - 1;
+	uint32_t lowest = (uint32_t)(LATENCY_HISTOGRAM_SUB_BUCKETS + index % LATENCY_HISTOGRAM_SUB_BUCKETS) << shift;
+	return lowest + (1u << shift) - 1;
+}
+
+void LatencyHistogram_Record(LatencyHistogram *histogram, int64_t us)
+{
+	if (us < 0)
+	{
+		return;
+	}
+	uint32_t value = us > LATENCY_HISTOGRAM_MAX_US ? LATENCY_HISTOGRAM_MAX_US : (uint32_t)us;
+	histogram->counts[BucketIndex(value)]++;
+	histogram->total++;
+	if (value > histogram->max)
+	{
+		histogram->max = value;
+	}
+}
+
+uint32_t LatencyHistogram_Percentile(const LatencyHistogram *histogram, double percentile)
+{
+	if (histogram->total == 0)
+	{
+		return 0;
+	}
+
+	// The smallest rank with at least percentile of the values at or below it
+	double exact = percentile / 100.0 * histogram->total;
+	uint32_t rank = (uint32_t)exact;
+	if (rank < exact || rank == 0)
+	{
+		rank++;
+	}
+	if (rank > histogram->total)
+	{
+		rank = histogram->total;
+	}
+
+	uint32_t seen = 0;
+	for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++)
+	{
+		seen += histogram->counts[i];
+		if (seen >= rank)
+		{
+			uint32_t value = BucketHighestValue(i);
+			return value < histogram->max ? value : histogram->max;
+		}
+	}
+	return histogram->max;
+}
+
+void LatencyHistogram_Encode(const LatencyHistogram *histogram, CborWriter *writer)
+{
+	CborWriter_BeginArray(writer, 6);
+	CborWriter_Int(writer, histogram->total);
+	CborWriter_Int(writer, LatencyHistogram_Percentile(histogram, 50.0));
+	CborWriter_Int(writer, LatencyHistogram_Percentile(histogram, 90.0));
+	CborWriter_Int(writer, LatencyHistogram_Percentile(histogram, 99.0));
+	CborWriter_Int(writer, LatencyHistogram_Percentile(histogram, 99.9));
+	CborWriter_Int(writer, histogram->max);
+}
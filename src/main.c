@@ -10,11 +10,11 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <unistd.h>
 
 // applibs_versions.h defines the API struct versions to use for applibs APIs.
 #include "applibs_versions.h"
 #include <applibs/log.h>
-#include <applibs/networking.h>
 #include <applibs/gpio.h>
 #include <applibs/pwm.h>
 #include <applibs/storage.h>
@@ -24,8 +24,16 @@
 
 #include "eventloop_timer_utilities.h"
 
+#include "cbor.h"
+#include "connection.h"
+#include "direct_method.h"
+#include "iot_transport.h"
+#include "json_reader.h"
+#include "latency_histogram.h"
 #include "motor.h"
-#include "networking.h"
+#include "poll_scheduler.h"
+#include "segment_log.h"
+#include "telemetry.h"
 
 /// <summary>
 /// Exit codes for this application. These are used for the
@@ -43,34 +51,76 @@ typedef enum
     ExitCode_Init_GPIO = 12,
     ExitCode_Init_PWM = 13,
     ExitCode_Init_Motor = 14,
+    ExitCode_Init_TelemetryTimer = 15,
+    ExitCode_TelemetryTimer_Consume = 16,
+    ExitCode_Init_ReportTimer = 17,
+    ExitCode_ReportTimer_Consume = 18,
+    ExitCode_Init_MotionTimer = 19,
+    ExitCode_MotionTimer_Consume = 20,
 } ExitCode;
 
 static volatile sig_atomic_t exitCode = ExitCode_Success;
 
-#include "parson.h" // used to parse Device Twin messages.
+#include "twin_model.h" // Device Twin codec generated from interface.json
 
 // Azure IoT defines.
-static char *scopeId; // ScopeId for DPS
-static IOTHUB_DEVICE_CLIENT_LL_HANDLE iothubClientHandle = NULL;
-static const int keepalivePeriodSeconds = 20;
-static bool iothubAuthenticated = false;
+static char *scopeId; // ScopeId for DPS, or the script for the loopback transport
+static const IotTransport *transport = &IotTransport_Hub;
+static const char LoopbackPrefix[] = "loopback:";
+static const char *hubHostname = NULL; // optional, lets the first connection skip DPS
+static Connection connection;
+static bool iothubAuthenticated = false; // connection.state == Connection_Connected
+
+// Device Twin state: the desired properties received so far, and what we last reported. Reports
+// are held for a short window so a burst of updates goes up as one patch of what changed.
+// A full twin resets properties it doesn't mention to what the device starts with
+#define DEFAULT_DESIRED_STATE \
+    {.SpeedMotorA = 0, .SpeedMotorB = 0, .TelemetryWindowSeconds = TELEMETRY_DEFAULT_WINDOW_MS / 1000}
+static const TwinModel_Properties defaultDesiredState = DEFAULT_DESIRED_STATE;
+static TwinModel_Properties desiredState = DEFAULT_DESIRED_STATE;
+static int64_t desiredVersion = -1; // $version of the desired properties applied last
+static TwinModel_Properties reportedState = {0};
+static bool reportedStateValid = false;
+static bool reportScheduled = false;
+static int reportRequests = 0; // since the last report went up
+static const int ReportCoalesceMilliseconds = 100;
 
 // Function declarations
-// static void SendEventCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *context);
-static void DeviceTwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payload,
-                               size_t payloadSize, void *userContextCallback);
-static void TwinReportState(const char *jsonState);
-static void ReportedStateCallback(int result, void *context);
+static void ConnectionStatusCallback(bool authenticated, IotTransport_Status status,
+                                     const char *reason);
+static void SendEventCallback(bool delivered);
+static void DeviceTwinCallback(bool complete, const unsigned char *payload, size_t payloadSize);
+static bool TwinReportState(const char *jsonState);
+static void ReportMotorState(void);
+static void ScheduleReport(void);
+static void ReportTimerEventHandler(EventLoopTimer *timer);
+static void RegisterDirectMethods(void);
+static void SetMotorSpeed(int motor, int speed);
+static void CancelMotion(void);
+static void MotionTimerEventHandler(EventLoopTimer *timer);
+static void ReportedStateCallback(int result);
 static int DeviceMethodCallback(const char *methodName, const unsigned char *payload,
-                                size_t payloadSize, unsigned char **response, size_t *responseSize,
-                                void *userContextCallback);
-static const char *GetReasonString(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason);
-static const char *GetAzureSphereProvisioningResultString(
-    AZURE_SPHERE_PROV_RETURN_VALUE provisioningResult);
-// static void SendTelemetry(const char *jsonMessage);
-static void SetupAzureClient(void);
-static void SendSimulatedTelemetry(void);
+                                size_t payloadSize, unsigned char **response, size_t *responseSize);
+static bool SendTelemetry(const uint8_t *body, size_t length, const char *contentType);
+static void SetupAzureClient(int64_t now);
+static long NowMilliseconds(void);
+static void FlushTelemetry(void);
+static void SetTelemetryWindow(int seconds);
+static void DrainTelemetryLog(void);
 static void AzureTimerEventHandler(EventLoopTimer *timer);
+static void ArmAzureTimer(long milliseconds);
+static void PollSoon(void);
+static void TelemetryTimerEventHandler(EventLoopTimer *timer);
+static void PublishLatency(void);
+static void MotorsApplied(int64_t appliedUs);
+
+static const IotTransport_Handlers transportHandlers = {
+    .ConnectionStatus = ConnectionStatusCallback,
+    .TwinUpdate = DeviceTwinCallback,
+    .Method = DeviceMethodCallback,
+    .EventConfirmed = SendEventCallback,
+    .ReportedStateConfirmed = ReportedStateCallback,
+};
 
 // Initialization/Cleanup
 static ExitCode InitPeripheralsAndHandlers(void);
@@ -88,15 +138,75 @@ static int speedMotorB = 0;
 // Timer / polling
 static EventLoop *eventLoop = NULL;
 static EventLoopTimer *azureTimer = NULL;
+static EventLoopTimer *telemetryTimer = NULL;
+static EventLoopTimer *reportTimer = NULL;
+static EventLoopTimer *motionTimer = NULL;
 
-// Azure IoT poll periods
-static const int AzureIoTDefaultPollPeriodSeconds = 1;        // poll azure iot every second
-static const int AzureIoTPollPeriodsPerTelemetry = 5;         // only send telemetry 1/5 of polls
-static const int AzureIoTMinReconnectPeriodSeconds = 60;      // back off when reconnecting
-static const int AzureIoTMaxReconnectPeriodSeconds = 10 * 60; // back off limit
-
-static int azureIoTPollPeriodSeconds = -1;
-static int telemetryCount = 0;
+// Ramps and programs started by direct methods, stepped by the motion timer while one is running
+typedef struct
+{
+    bool active;
+    int from;
+    int to;
+    long startMs;
+    long durationMs;
+} SpeedRamp;
+
+typedef struct
+{
+    int speedA;
+    int speedB;
+    long durationMs;
+} ProgramStep;
+
+static const int MotionTickMilliseconds = 20;
+static const long MaxMotionMilliseconds = 10 * 60 * 1000;
+#define MAX_PROGRAM_STEPS 16
+static SpeedRamp ramps[2];
+static ProgramStep program[MAX_PROGRAM_STEPS];
+static int programLength = 0;
+static int programStep = -1; // -1 when no program is running
+static long programStepStartMs = 0;
+static bool motionRunning = false;
+
+// Azure IoT poll periods, connection backoff is up to the Connection state machine
+static const int AzureIoTFastPollMilliseconds = 20;   // DoWork while messages are in flight
+static const int AzureIoTIdlePollMilliseconds = 1000; // DoWork once things go quiet, and how
+                                                      // often to check for the network
+
+static PollScheduler pollScheduler;
+
+// Telemetry batches are encoded here rather than on the stack. A batch must fit one record of
+// the store-and-forward log that holds it while the hub is unreachable.
+static uint8_t telemetryBatch[SEGMENT_LOG_MAX_RECORD];
+static SegmentLog telemetryLog;
+static bool telemetryLogOpen = false;
+static const size_t TelemetryLogCapacity = 64 * 1024; // the MutableStorage size in app_manifest.json
+static const int TelemetryLogBatchesPerPoll = 2;        // drain slowly after reconnecting
+
+// Control path latency: how long a cloud command takes from DoWork picking it up to the motors
+// moving and the new state being acknowledged. Percentiles are published as telemetry.
+typedef enum
+{
+    LatencyStage_Dispatch,  // DoWork entry to twin or method callback entry
+    LatencyStage_Parse,     // twin callback entry to desired properties parsed
+    LatencyStage_Apply,     // parsed to Motor_Move applied
+    LatencyStage_Control,   // DoWork entry to Motor_Move applied, twin or method
+    LatencyStage_Method,    // method callback entry to response ready
+    LatencyStage_ReportAck, // Motor_Move applied to the reported state acknowledged
+    LatencyStage_Count
+} LatencyStage;
+
+static const char *const LatencyStageNames[LatencyStage_Count] = {
+    "dispatch", "parse", "apply", "control", "method", "reportAck"};
+static LatencyHistogram latency[LatencyStage_Count];
+static int64_t doWorkStartUs = -1;         // DoWork entry of the pass in progress
+static int64_t awaitingAckSinceUs = -1;    // motors moved, report not acknowledged yet
+static bool awaitingAckReportSent = false; // a report covering that move has gone out
+static const int LatencyPublishSeconds = 60;
+static int latencyPublishCountdown = 60;
+
+static void RecordLatency(LatencyStage stage, int64_t fromUs, int64_t toUs);
 
 /// <summary>
 ///     Signal handler for termination requests. This handler must be async-signal-safe.
@@ -114,16 +224,31 @@ int main(int argc, char *argv[])
 {
     Log_Debug("Azure IoT Application starting.\n");
 
-    bool isNetworkingReady = false;
-    if ((Networking_IsNetworkingReady(&isNetworkingReady) == -1) || !isNetworkingReady)
-    {
-        Log_Debug("WARNING: Network is not ready. Device cannot connect until network is ready.\n");
-    }
-
     if (argc > 1)
     {
+        // "loopback:<script>" runs against the local stand-in instead of the hub
         scopeId = argv[1];
-        Log_Debug("Using Azure IoT DPS Scope ID %s\n", scopeId);
+        if (strncmp(scopeId, LoopbackPrefix, sizeof(LoopbackPrefix) - 1) == 0)
+        {
+            transport = &IotTransport_Loopback;
+            scopeId += sizeof(LoopbackPrefix) - 1;
+            Log_Debug("Using the loopback IoT transport with script %s\n", scopeId);
+        }
+        else
+        {
+            Log_Debug("Using Azure IoT DPS Scope ID %s\n", scopeId);
+        }
+        if (argc > 2)
+        {
+            hubHostname = argv[2];
+            Log_Debug("Connecting straight to Azure IoT Hub %s when possible\n", hubHostname);
+        }
+        if (argc > 3)
+        {
+            // The hub needs to be told which device it is when DPS is skipped
+            IotTransport_HubSetDeviceId(argv[3]);
+            Log_Debug("Using device ID %s for direct connections\n", argv[3]);
+        }
     }
     else
     {
@@ -131,6 +256,11 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    if (!transport->IsNetworkReady())
+    {
+        Log_Debug("WARNING: Network is not ready. Device cannot connect until network is ready.\n");
+    }
+
     exitCode = InitPeripheralsAndHandlers();
 
     // Main loop
@@ -152,7 +282,9 @@ int main(int argc, char *argv[])
 }
 
 /// <summary>
-/// Azure timer event:  Check connection status and send telemetry
+/// Azure timer event: connect when the connection state machine says so and the network is up,
+/// otherwise pump the IoT Hub client. The timer is one-shot and re-armed each time: with the
+/// backoff delay while disconnected, and with the poll scheduler's delay while there is a client.
 /// </summary>
 static void AzureTimerEventHandler(EventLoopTimer *timer)
 {
@@ -162,28 +294,108 @@ static void AzureTimerEventHandler(EventLoopTimer *timer)
         return;
     }
 
-    bool isNetworkReady = false;
-    if (Networking_IsNetworkingReady(&isNetworkReady) != -1)
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    int64_t now = NowMilliseconds();
+    bool networkReady = true;
+    if (Connection_ShouldConnect(&connection, now))
     {
-        if (isNetworkReady && !iothubAuthenticated)
+        networkReady = transport->IsNetworkReady();
+        if (networkReady)
         {
-            SetupAzureClient();
+            SetupAzureClient(now);
         }
     }
-    else
+
+    if (Connection_TimedOut(&connection, now))
     {
-        Log_Debug("Failed to get Network state\n");
+        Log_Debug("WARNING: Azure IoT Hub client did not connect in time, recreating it.\n");
+        iothubAuthenticated = false;
+        transport->Disconnect();
     }
 
-    if (iothubAuthenticated)
+    if (connection.state != Connection_Disconnected)
     {
-        telemetryCount++;
-        if (telemetryCount == AzureIoTPollPeriodsPerTelemetry)
+        doWorkStartUs = Latency_NowUs();
+        transport->DoWork();
+        doWorkStartUs = -1;
+
+        if (connection.state == Connection_Disconnected)
         {
-            telemetryCount = 0;
-            SendSimulatedTelemetry();
+            // The client gave up during DoWork, tear it down outside of its callbacks
+            iothubAuthenticated = false;
+            transport->Disconnect();
         }
-        IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
+    }
+
+    if (connection.state != Connection_Disconnected)
+    {
+        // Keep polling fast while the client still has messages or acknowledgements outstanding
+        ArmAzureTimer(PollScheduler_Next(&pollScheduler, transport->IsBusy()));
+    }
+    else
+    {
+        // Wait for the backoff, checking for the network while that is the holdup
+        int64_t wait = Connection_WaitMs(&connection, NowMilliseconds());
+        ArmAzureTimer(networkReady || wait > AzureIoTIdlePollMilliseconds
+                          ? (long)(wait > 0 ? wait : 1)
+                          : AzureIoTIdlePollMilliseconds);
+    }
+
+    struct timespec finished;
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    Telemetry_Record(Telemetry_LoopLatency, 0,
+                     (int32_t)((finished.tv_sec - started.tv_sec) * 1000000 +
+                               (finished.tv_nsec - started.tv_nsec) / 1000));
+}
+
+/// <summary>
+///     Arms the one-shot Azure timer.
+/// </summary>
+static void ArmAzureTimer(long milliseconds)
+{
+    struct timespec delay = {.tv_sec = milliseconds / 1000,
+                             .tv_nsec = (milliseconds % 1000) * 1000000};
+    if (SetEventLoopTimerOneShot(azureTimer, &delay) != 0)
+    {
+        Log_Debug("ERROR: Could not arm the Azure timer: %s (%d).\n", strerror(errno), errno);
+    }
+}
+
+/// <summary>
+///     Called when something is sent or received: poll again soon rather than after the idle
+///     period, so acknowledgements and follow-up messages are picked up quickly.
+/// </summary>
+static void PollSoon(void)
+{
+    if (PollScheduler_Kick(&pollScheduler) && connection.state != Connection_Disconnected)
+    {
+        ArmAzureTimer(AzureIoTFastPollMilliseconds);
+    }
+}
+
+/// <summary>
+/// Telemetry timer event: batch up pending samples and forward any that were stored while
+/// offline. This runs on its own period so it keeps up while the Azure timer is backing off.
+/// </summary>
+static void TelemetryTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0)
+    {
+        exitCode = ExitCode_TelemetryTimer_Consume;
+        return;
+    }
+
+    FlushTelemetry();
+    if (--latencyPublishCountdown <= 0)
+    {
+        latencyPublishCountdown = LatencyPublishSeconds;
+        PublishLatency();
+    }
+    if (iothubAuthenticated)
+    {
+        DrainTelemetryLog();
     }
 }
 
@@ -233,14 +445,60 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return ExitCode_Init_Motor;
     }
 
-    azureIoTPollPeriodSeconds = AzureIoTDefaultPollPeriodSeconds;
-    struct timespec azureTelemetryPeriod = {.tv_sec = azureIoTPollPeriodSeconds, .tv_nsec = 0};
-    azureTimer =
-        CreateEventLoopPeriodicTimer(eventLoop, &AzureTimerEventHandler, &azureTelemetryPeriod);
+    // Seed the backoff jitter from the clocks so devices that boot together still spread out
+    struct timespec realtime, monotonic;
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    long now = NowMilliseconds();
+    Connection_Init(&connection,
+                    (uint32_t)(realtime.tv_nsec ^ monotonic.tv_nsec ^ (realtime.tv_sec << 10)),
+                    hubHostname, now);
+    PollScheduler_Init(&pollScheduler, AzureIoTFastPollMilliseconds, AzureIoTIdlePollMilliseconds);
+    azureTimer = CreateEventLoopDisarmedTimer(eventLoop, &AzureTimerEventHandler);
     if (azureTimer == NULL)
     {
         return ExitCode_Init_AzureTimer;
     }
+    ArmAzureTimer((long)Connection_WaitMs(&connection, now) + 1);
+
+    // Telemetry is kept in mutable storage while the hub is unreachable; without it, samples
+    // wait in the ring and the oldest are dropped.
+    int logFd = Storage_OpenMutableFile();
+    if (logFd < 0)
+    {
+        Log_Debug("WARNING: Could not open mutable storage: %s (%d).\n", strerror(errno), errno);
+    }
+    else if (SegmentLog_Open(&telemetryLog, logFd, TelemetryLogCapacity) != 0)
+    {
+        Log_Debug("WARNING: Could not open the telemetry log.\n");
+        close(logFd);
+    }
+    else
+    {
+        telemetryLogOpen = true;
+    }
+
+    struct timespec telemetryPeriod = {.tv_sec = 1, .tv_nsec = 0};
+    telemetryTimer =
+        CreateEventLoopPeriodicTimer(eventLoop, &TelemetryTimerEventHandler, &telemetryPeriod);
+    if (telemetryTimer == NULL)
+    {
+        return ExitCode_Init_TelemetryTimer;
+    }
+
+    reportTimer = CreateEventLoopDisarmedTimer(eventLoop, &ReportTimerEventHandler);
+    if (reportTimer == NULL)
+    {
+        return ExitCode_Init_ReportTimer;
+    }
+
+    motionTimer = CreateEventLoopDisarmedTimer(eventLoop, &MotionTimerEventHandler);
+    if (motionTimer == NULL)
+    {
+        return ExitCode_Init_MotionTimer;
+    }
+
+    RegisterDirectMethods();
 
     return ExitCode_Success;
 }
@@ -269,9 +527,19 @@ static void CloseFdAndPrintError(int fd, const char *fdName)
 /// </summary>
 static void ClosePeripheralsAndHandlers(void)
 {
+    transport->Disconnect();
     DisposeEventLoopTimer(azureTimer);
+    DisposeEventLoopTimer(telemetryTimer);
+    DisposeEventLoopTimer(reportTimer);
+    DisposeEventLoopTimer(motionTimer);
     EventLoop_Close(eventLoop);
 
+    if (telemetryLogOpen)
+    {
+        SegmentLog_Flush(&telemetryLog);
+        close(telemetryLog.fd);
+    }
+
     Log_Debug("Closing file descriptors\n");
 
     Motor_Close(motorA);
@@ -283,333 +551,830 @@ static void ClosePeripheralsAndHandlers(void)
 ///     This can indicate that a new connection attempt has succeeded or failed.
 ///     It can also indicate than an existing connection has expired due to SAS token expiry.
 /// </summary>
-static void ConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
-                                     IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason,
-                                     void *userContextCallback)
+static void ConnectionStatusCallback(bool authenticated, IotTransport_Status status,
+                                     const char *reason)
 {
-    iothubAuthenticated = (result == IOTHUB_CLIENT_CONNECTION_AUTHENTICATED);
-    Log_Debug("Azure IoT connection status: %s\n", GetReasonString(reason));
+    Log_Debug("Azure IoT connection status: %s\n", reason);
+    if (Connection_StatusChanged(&connection, authenticated, status, NowMilliseconds()))
+    {
+        // The timer handler tears the client down once DoWork returns
+        Log_Debug("Azure IoT Hub client will be recreated in %lld ms.\n",
+                  (long long)Connection_WaitMs(&connection, NowMilliseconds()));
+    }
+    iothubAuthenticated = connection.state == Connection_Connected;
+    PollSoon();
     if (iothubAuthenticated)
     {
-        // Send static device twin properties when connection is established
-        TwinReportState(
-            "{\"SpeedMotorA\":\"0\",\"SpeedMotorB\":\"0\"}");
+        // Report the full state when connection is established
+        reportedStateValid = false;
+        ScheduleReport();
     }
 }
 
 /// <summary>
-///     Sets up the Azure IoT Hub connection (creates the iothubClientHandle)
-///     When the SAS Token for a device expires the connection needs to be recreated
-///     which is why this is not simply a one time call.
+///     Creates the Azure IoT Hub client through the transport, straight to the hub it was last
+///     assigned when there is one. When the SAS Token for a device expires the connection needs
+///     to be recreated which is why this is not simply a one time call.
 /// </summary>
-static void SetupAzureClient(void)
+static void SetupAzureClient(int64_t now)
 {
-    if (iothubClientHandle != NULL)
+    const char *target = Connection_Target(&connection);
+    IotTransport_Status result = transport->Connect(scopeId, target, &transportHandlers);
+    Connection_Attempted(&connection, result,
+                         result == IotTransport_Ok ? transport->AssignedHub() : NULL, now);
+    if (result != IotTransport_Ok)
     {
-        IoTHubDeviceClient_LL_Destroy(iothubClientHandle);
+        Log_Debug("ERROR: Failed to create IoTHub Handle (%s) - will retry in %lld ms.\n",
+                  target != NULL ? target : "DPS",
+                  (long long)Connection_WaitMs(&connection, NowMilliseconds()));
+        return;
     }
 
-    AZURE_SPHERE_PROV_RETURN_VALUE provResult =
-        IoTHubDeviceClient_LL_CreateWithAzureSphereDeviceAuthProvisioning(scopeId, 10000,
-                                                                          &iothubClientHandle);
-    Log_Debug("IoTHubDeviceClient_LL_CreateWithAzureSphereDeviceAuthProvisioning returned '%s'.\n",
-              GetAzureSphereProvisioningResultString(provResult));
+    PollScheduler_Kick(&pollScheduler);
+}
 
-    if (provResult.result != AZURE_SPHERE_PROV_RESULT_OK)
+/// <summary>
+///     Callback invoked when a Direct Method is received from Azure IoT Hub.
+/// </summary>
+static int DeviceMethodCallback(const char *methodName, const unsigned char *payload,
+                                size_t payloadSize, unsigned char **response, size_t *responseSize)
+{
+    int64_t callbackUs = Latency_NowUs();
+    RecordLatency(LatencyStage_Dispatch, doWorkStartUs, callbackUs);
+    Log_Debug("Received Device Method callback: Method name %s.\n", methodName);
+    PollSoon(); // the response goes out on the next DoWork
+
+    int speedA = speedMotorA;
+    int speedB = speedMotorB;
+    int status = DirectMethod_Dispatch(methodName, payload, payloadSize, response, responseSize);
+    int64_t handledUs = Latency_NowUs();
+    RecordLatency(LatencyStage_Method, callbackUs, handledUs);
+    if (speedA != speedMotorA || speedB != speedMotorB)
     {
+        MotorsApplied(handledUs);
+    }
+    return status;
+}
 
-        // If we fail to connect, reduce the polling frequency, starting at
-        // AzureIoTMinReconnectPeriodSeconds and with a backoff up to
-        // AzureIoTMaxReconnectPeriodSeconds
-        if (azureIoTPollPeriodSeconds == AzureIoTDefaultPollPeriodSeconds)
-        {
-            azureIoTPollPeriodSeconds = AzureIoTMinReconnectPeriodSeconds;
-        }
-        else
-        {
-            azureIoTPollPeriodSeconds *= 2;
-            if (azureIoTPollPeriodSeconds > AzureIoTMaxReconnectPeriodSeconds)
-            {
-                azureIoTPollPeriodSeconds = AzureIoTMaxReconnectPeriodSeconds;
-            }
-        }
-
-        struct timespec azureTelemetryPeriod = {azureIoTPollPeriodSeconds, 0};
-        SetEventLoopTimerPeriod(azureTimer, &azureTelemetryPeriod);
+/// <summary>
+///     Callback invoked when a Device Twin update is received from Azure IoT Hub.
+/// </summary>
+static void DeviceTwinCallback(bool complete, const unsigned char *payload, size_t payloadSize)
+{
+    // A full twin document nests the desired properties, a partial update carries only the
+    // changed ones. The generated parser takes both and flags the properties it found. A full
+    // document is the whole desired state, so it applies on top of the defaults and every
+    // property counts as set.
+    int64_t callbackUs = Latency_NowUs();
+    RecordLatency(LatencyStage_Dispatch, doWorkStartUs, callbackUs);
+    PollSoon(); // more of a burst of changes may follow
+    TwinModel_Properties update = complete ? defaultDesiredState : desiredState;
+    uint32_t fields = 0;
+    int64_t version = -1;
+    if (!TwinModel_ParseDesired((const char *)payload, payloadSize, &update, &fields, &version))
+    {
+        Log_Debug("WARNING: Cannot parse the Device Twin update.\n");
+        return;
+    }
+    if (complete)
+    {
+        fields = TWIN_MODEL_WRITABLE_FIELDS;
+    }
+    int64_t parsedUs = Latency_NowUs();
+    RecordLatency(LatencyStage_Parse, callbackUs, parsedUs);
 
-        Log_Debug("ERROR: Failed to create IoTHub Handle - will retry in %i seconds.\n",
-                  azureIoTPollPeriodSeconds);
+    // The hub redelivers the full twin after reconnecting and updates can arrive out of order, so
+    // anything not newer than what was applied last is stale.
+    if (version >= 0 && version <= desiredVersion)
+    {
+        Log_Debug("INFO: Ignoring Device Twin update version %lld, already at %lld.\n",
+                  (long long)version, (long long)desiredVersion);
         return;
     }
+    desiredState = update;
+    if (version >= 0)
+    {
+        desiredVersion = version;
+    }
+    if (complete)
+    {
+        reportedStateValid = false; // report every property, not only what changed
+    }
 
-    // Successfully connected, so make sure the polling frequency is back to the default
-    azureIoTPollPeriodSeconds = AzureIoTDefaultPollPeriodSeconds;
-    struct timespec azureTelemetryPeriod = {.tv_sec = azureIoTPollPeriodSeconds, .tv_nsec = 0};
-    SetEventLoopTimerPeriod(azureTimer, &azureTelemetryPeriod);
+    // A desired speed takes over from any ramp or program a direct method started
+    if ((fields & (TwinModel_Field_SpeedMotorA | TwinModel_Field_SpeedMotorB)) != 0)
+    {
+        CancelMotion();
+    }
 
-    iothubAuthenticated = true;
+    int speedA = speedMotorA;
+    int speedB = speedMotorB;
 
-    if (IoTHubDeviceClient_LL_SetOption(iothubClientHandle, OPTION_KEEP_ALIVE,
-                                        &keepalivePeriodSeconds) != IOTHUB_CLIENT_OK)
+    if ((fields & TwinModel_Field_SpeedMotorA) != 0 && desiredState.SpeedMotorA != speedMotorA)
     {
-        Log_Debug("ERROR: Failure setting Azure IoT Hub client option \"%s\".\n",
-                  OPTION_KEEP_ALIVE);
-        return;
+        Log_Debug("Changing speed of Motor A to %d.\n", desiredState.SpeedMotorA);
+        SetMotorSpeed(0, desiredState.SpeedMotorA);
+    }
+
+    if ((fields & TwinModel_Field_SpeedMotorB) != 0 && desiredState.SpeedMotorB != speedMotorB)
+    {
+        Log_Debug("Changing speed of Motor B to %d.\n", desiredState.SpeedMotorB);
+        SetMotorSpeed(1, desiredState.SpeedMotorB);
     }
 
-    IoTHubDeviceClient_LL_SetDeviceTwinCallback(iothubClientHandle, DeviceTwinCallback, NULL);
-    IoTHubDeviceClient_LL_SetDeviceMethodCallback(iothubClientHandle, DeviceMethodCallback, NULL);
-    IoTHubDeviceClient_LL_SetConnectionStatusCallback(iothubClientHandle, ConnectionStatusCallback,
-                                                      NULL);
+    if ((fields & TwinModel_Field_TelemetryWindowSeconds) != 0)
+    {
+        SetTelemetryWindow(desiredState.TelemetryWindowSeconds);
+    }
+
+    if (speedA != speedMotorA || speedB != speedMotorB)
+    {
+        int64_t appliedUs = Latency_NowUs();
+        RecordLatency(LatencyStage_Apply, parsedUs, appliedUs);
+        MotorsApplied(appliedUs);
+    }
+    ScheduleReport();
 }
 
 /// <summary>
-///     Callback invoked when a Direct Method is received from Azure IoT Hub.
+///     Sends a telemetry message to Azure IoT Hub. Returns true once the client has accepted it.
 /// </summary>
-static int DeviceMethodCallback(const char *methodName, const unsigned char *payload,
-                                size_t payloadSize, unsigned char **response, size_t *responseSize,
-                                void *userContextCallback)
+static bool SendTelemetry(const uint8_t *body, size_t length, const char *contentType)
 {
-    int result;
-    char *responseString;
+    Log_Debug("Sending Azure IoT Hub telemetry: %zu bytes of %s.\n", length, contentType);
 
-    Log_Debug("Received Device Method callback: Method name %s.\n", methodName);
+    if (!transport->SendEvent(body, length, contentType))
+    {
+        Log_Debug("ERROR: failure requesting IoTHubClient to send telemetry event.\n");
+        return false;
+    }
 
-    if (strcmp("TriggerAlarm", methodName) == 0)
+    Log_Debug("INFO: IoTHubClient accepted the telemetry event for delivery.\n");
+    PollSoon();
+    return true;
+}
+
+/// <summary>
+///     Callback invoked when the Azure IoT Hub send event request is processed.
+/// </summary>
+static void SendEventCallback(bool delivered)
+{
+    Log_Debug("INFO: Azure IoT Hub send telemetry event callback: %s.\n",
+              delivered ? "delivered" : "not delivered");
+}
+
+/// <summary>
+///     Enqueues a report containing Device Twin reported properties. The report is not sent
+///     immediately, but it is sent on the next invocation of the transport's DoWork.
+/// </summary>
+static bool TwinReportState(const char *jsonState)
+{
+    if (!transport->SendReportedState(jsonState, strlen(jsonState)))
     {
-        // Output alarm using Log_Debug
-        Log_Debug("  ----- ALARM TRIGGERED! -----\n");
-        responseString = "\"Alarm Triggered\""; // must be a JSON string (in quotes)
-        result = 200;
+        Log_Debug("ERROR: Azure IoT Hub client error when reporting state '%s'.\n", jsonState);
+        return false;
     }
-    else
+
+    Log_Debug("INFO: Azure IoT Hub client accepted request to report state '%s'.\n", jsonState);
+    PollSoon();
+    return true;
+}
+
+/// <summary>
+///     Reports the motor speeds, sending only the properties that changed since the last
+///     accepted report.
+/// </summary>
+static void ReportMotorState(void)
+{
+    TwinModel_Properties state = {.SpeedMotorA = speedMotorA,
+                                  .SpeedMotorB = speedMotorB,
+                                  .TelemetryWindowSeconds = (int)(Telemetry_Window() / 1000)};
+    uint32_t changed =
+        reportedStateValid ? TwinModel_Diff(&reportedState, &state) : TWIN_MODEL_ALL_FIELDS;
+    if (changed == 0)
     {
-        // All other method names are ignored
-        responseString = "{}";
-        result = -1;
+        reportRequests = 0;
+        return; // nothing changed
     }
 
-    // if 'response' is non-NULL, the Azure IoT library frees it after use, so copy it to heap
-    *responseSize = strlen(responseString);
-    *response = malloc(*responseSize);
-    memcpy(*response, responseString, *responseSize);
-    return result;
+    char patch[TWIN_MODEL_MAX_REPORTED_SIZE];
+    if (TwinModel_SerializeReported(&state, changed, patch, sizeof(patch)) == 0)
+    {
+        Log_Debug("ERROR: Could not serialize the reported state.\n");
+        return;
+    }
+    if (TwinReportState(patch))
+    {
+        Log_Debug("INFO: Reported state covers %d update(s).\n", reportRequests);
+        awaitingAckReportSent = awaitingAckSinceUs >= 0;
+        reportedState = state;
+        reportedStateValid = true;
+        reportRequests = 0;
+    }
 }
 
 /// <summary>
-///     Callback invoked when a Device Twin update is received from Azure IoT Hub.
+///     Asks for the motor state to be reported once the coalescing window closes. Further
+///     requests inside the window are folded into the same report.
 /// </summary>
-static void DeviceTwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payload,
-                               size_t payloadSize, void *userContextCallback)
+static void ScheduleReport(void)
 {
-    size_t nullTerminatedJsonSize = payloadSize + 1;
-    char *nullTerminatedJsonString = (char *)malloc(nullTerminatedJsonSize);
-    if (nullTerminatedJsonString == NULL)
+    reportRequests++;
+    if (reportScheduled)
     {
-        Log_Debug("ERROR: Could not allocate buffer for twin update payload.\n");
-        abort();
+        return;
     }
 
-    // Copy the provided buffer to a null terminated buffer.
-    memcpy(nullTerminatedJsonString, payload, payloadSize);
-    // Add the null terminator at the end.
-    nullTerminatedJsonString[nullTerminatedJsonSize - 1] = 0;
+    struct timespec delay = {.tv_sec = 0, .tv_nsec = ReportCoalesceMilliseconds * 1000000L};
+    if (SetEventLoopTimerOneShot(reportTimer, &delay) != 0)
+    {
+        Log_Debug("ERROR: Could not arm the report timer: %s (%d).\n", strerror(errno), errno);
+        ReportMotorState();
+        return;
+    }
+    reportScheduled = true;
+}
 
-    JSON_Value *rootProperties = NULL;
-    rootProperties = json_parse_string(nullTerminatedJsonString);
-    if (rootProperties == NULL)
+/// <summary>
+/// Report timer event: the coalescing window has closed, so report what changed in it. While
+/// disconnected the report waits for the full republish that follows reconnecting.
+/// </summary>
+static void ReportTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0)
     {
-        Log_Debug("WARNING: Cannot parse the string as JSON content.\n");
-        goto cleanup;
+        exitCode = ExitCode_ReportTimer_Consume;
+        return;
     }
 
-    JSON_Object *rootObject = json_value_get_object(rootProperties);
-    JSON_Object *desiredProperties = json_object_dotget_object(rootObject, "desired");
-    if (desiredProperties == NULL)
+    reportScheduled = false;
+    if (iothubAuthenticated)
     {
-        desiredProperties = rootObject;
+        ReportMotorState();
     }
+}
 
-    // The desired properties should have a "SpeedMotorA" object
-    JSON_Object *sMotorA = json_object_dotget_object(desiredProperties, "SpeedMotorA");
-    if (sMotorA != NULL)
+/// <summary>
+///     Callback invoked when the Device Twin report state request is processed by Azure IoT Hub
+///     client.
+/// </summary>
+static void ReportedStateCallback(int result)
+{
+    Log_Debug("INFO: Azure IoT Hub Device Twin reported state callback: status code %d.\n", result);
+    if (result >= 200 && result < 300 && awaitingAckReportSent)
+    {
+        RecordLatency(LatencyStage_ReportAck, awaitingAckSinceUs, Latency_NowUs());
+        awaitingAckSinceUs = -1;
+        awaitingAckReportSent = false;
+    }
+    else if (result < 200 || result >= 300)
     {
-        // ... with a "value" field which is of type double
-        double speedValueA = json_object_get_number(sMotorA, "value");
-        speedMotorA = (int)speedValueA;
-        Log_Debug("Changing speed of Motor A to %d.\n", speedMotorA);
-        Motor_Move(motorA, speedMotorA);
+        // The hub may not have the patch, so republish everything rather than just what changes
+        reportedStateValid = false;
+        if (iothubAuthenticated)
+        {
+            ScheduleReport();
+        }
     }
+}
 
-    // The desired properties should have a "SpeedMotorB" object
-    JSON_Object *sMotorB = json_object_dotget_object(desiredProperties, "SpeedMotorB");
-    if (sMotorB != NULL)
+/// <summary>
+///     Sets how many seconds of samples are aggregated into one summary per signal before
+///     upload, or 0 to upload every sample.
+/// </summary>
+static void SetTelemetryWindow(int seconds)
+{
+    int maxSeconds = TELEMETRY_MAX_WINDOW_MS / 1000;
+    if (seconds < 0 || seconds > maxSeconds)
+    {
+        Log_Debug("WARNING: Telemetry window of %d seconds is out of range, using %d.\n", seconds,
+                  seconds < 0 ? 0 : maxSeconds);
+        seconds = seconds < 0 ? 0 : maxSeconds;
+    }
+    if ((uint32_t)seconds * 1000 != Telemetry_Window())
     {
-        // ... with a "value" field which is of type double
-        double speedValueB = json_object_get_number(sMotorB, "value");
-        speedMotorB = (int)speedValueB;
-        Log_Debug("Changing speed of Motor B to %d.\n", speedMotorB);
-        Motor_Move(motorB, speedMotorB);
+        Log_Debug("Changing the telemetry window to %d seconds.\n", seconds);
+        Telemetry_SetWindow((uint32_t)seconds * 1000);
     }
+}
 
-    // update device twin
+/// <summary>
+///     Encodes the pending telemetry samples as one CBOR batch once the ring has gathered enough of
+///     them or the oldest has waited long enough. The batch goes straight to the hub when it is
+///     connected and nothing older is waiting, and to the store-and-forward log otherwise. Samples
+///     stay in the ring if neither takes them.
+/// </summary>
+static void FlushTelemetry(void)
+{
+    if (!Telemetry_FlushDue())
+    {
+        return;
+    }
 
-    char twinBuffer[255];
-    int len = snprintf(twinBuffer, 255, "{\"SpeedMotorA\": %d,\"SpeedMotorB\": %d}", speedMotorA, speedMotorB);
-    TwinReportState(twinBuffer);
+    size_t count = 0;
+    size_t length = Telemetry_EncodeBatch(telemetryBatch, sizeof(telemetryBatch), &count);
+    if (length == 0)
+    {
+        Log_Debug("ERROR: Could not encode the telemetry batch.\n");
+        return;
+    }
 
-cleanup:
-    // Release the allocated memory.
-    json_value_free(rootProperties);
-    free(nullTerminatedJsonString);
+    bool logEmpty = !telemetryLogOpen || SegmentLog_IsEmpty(&telemetryLog);
+    if (iothubAuthenticated && logEmpty && SendTelemetry(telemetryBatch, length, CBOR_CONTENT_TYPE))
+    {
+        Telemetry_Consume(count);
+    }
+    else if (telemetryLogOpen && SegmentLog_Append(&telemetryLog, telemetryBatch, length) == 0 &&
+             SegmentLog_Flush(&telemetryLog) == 0)
+    {
+        Telemetry_Consume(count);
+    }
 }
 
 /// <summary>
-///     Converts the Azure IoT Hub connection status reason to a string.
+///     Forwards a few of the batches stored while offline, oldest first, so reconnecting does not
+///     flood the hub.
 /// </summary>
-static const char *GetReasonString(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason)
+static void DrainTelemetryLog(void)
 {
-    static char *reasonString = "unknown reason";
-    switch (reason)
+    if (!telemetryLogOpen)
     {
-    case IOTHUB_CLIENT_CONNECTION_EXPIRED_SAS_TOKEN:
-        reasonString = "IOTHUB_CLIENT_CONNECTION_EXPIRED_SAS_TOKEN";
-        break;
-    case IOTHUB_CLIENT_CONNECTION_DEVICE_DISABLED:
-        reasonString = "IOTHUB_CLIENT_CONNECTION_DEVICE_DISABLED";
-        break;
-    case IOTHUB_CLIENT_CONNECTION_BAD_CREDENTIAL:
-        reasonString = "IOTHUB_CLIENT_CONNECTION_BAD_CREDENTIAL";
-        break;
-    case IOTHUB_CLIENT_CONNECTION_RETRY_EXPIRED:
-        reasonString = "IOTHUB_CLIENT_CONNECTION_RETRY_EXPIRED";
-        break;
-    case IOTHUB_CLIENT_CONNECTION_NO_NETWORK:
-        reasonString = "IOTHUB_CLIENT_CONNECTION_NO_NETWORK";
-        break;
-    case IOTHUB_CLIENT_CONNECTION_COMMUNICATION_ERROR:
-        reasonString = "IOTHUB_CLIENT_CONNECTION_COMMUNICATION_ERROR";
-        break;
-    case IOTHUB_CLIENT_CONNECTION_OK:
-        reasonString = "IOTHUB_CLIENT_CONNECTION_OK";
-        break;
+        return;
+    }
+
+    for (int i = 0; i < TelemetryLogBatchesPerPoll; i++)
+    {
+        int length = SegmentLog_Peek(&telemetryLog, telemetryBatch, sizeof(telemetryBatch));
+        if (length <= 0)
+        {
+            if (length < 0)
+            {
+                Log_Debug("ERROR: Could not read the telemetry log.\n");
+            }
+            return;
+        }
+        if (!SendTelemetry(telemetryBatch, (size_t)length, CBOR_CONTENT_TYPE))
+        {
+            return;
+        }
+        SegmentLog_Advance(&telemetryLog);
     }
-    return reasonString;
 }
 
 /// <summary>
-///     Converts AZURE_SPHERE_PROV_RETURN_VALUE to a string.
+///     Sets a motor's speed (motor 0 is A, 1 is B), skipping the hardware write when it is
+///     unchanged. The caller decides when to report.
 /// </summary>
-static const char *GetAzureSphereProvisioningResultString(
-    AZURE_SPHERE_PROV_RETURN_VALUE provisioningResult)
+static void SetMotorSpeed(int motor, int speed)
 {
-    switch (provisioningResult.result)
+    int *current = motor == 0 ? &speedMotorA : &speedMotorB;
+    if (*current != speed)
     {
-    case AZURE_SPHERE_PROV_RESULT_OK:
-        return "AZURE_SPHERE_PROV_RESULT_OK";
-    case AZURE_SPHERE_PROV_RESULT_INVALID_PARAM:
-        return "AZURE_SPHERE_PROV_RESULT_INVALID_PARAM";
-    case AZURE_SPHERE_PROV_RESULT_NETWORK_NOT_READY:
-        return "AZURE_SPHERE_PROV_RESULT_NETWORK_NOT_READY";
-    case AZURE_SPHERE_PROV_RESULT_DEVICEAUTH_NOT_READY:
-        return "AZURE_SPHERE_PROV_RESULT_DEVICEAUTH_NOT_READY";
-    case AZURE_SPHERE_PROV_RESULT_PROV_DEVICE_ERROR:
-        return "AZURE_SPHERE_PROV_RESULT_PROV_DEVICE_ERROR";
-    case AZURE_SPHERE_PROV_RESULT_GENERIC_ERROR:
-        return "AZURE_SPHERE_PROV_RESULT_GENERIC_ERROR";
-    default:
-        return "UNKNOWN_RETURN_VALUE";
+        *current = speed;
+        Motor_Move(motor == 0 ? motorA : motorB, speed);
     }
 }
 
-#if 0
+static long NowMilliseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
 /// <summary>
-///     Sends telemetry to Azure IoT Hub
+///     Starts the motion timer if a ramp or program needs it.
 /// </summary>
-static void SendTelemetry(const char *jsonMessage)
+static void StartMotion(void)
 {
-    Log_Debug("Sending Azure IoT Hub telemetry: %s.\n", jsonMessage);
-
-    bool isNetworkingReady = false;
-    if ((Networking_IsNetworkingReady(&isNetworkingReady) == -1) || !isNetworkingReady)
+    if (motionRunning)
     {
-        Log_Debug("WARNING: Cannot send Azure IoT Hub telemetry because the network is not up.\n");
         return;
     }
+    struct timespec tick = {.tv_sec = 0, .tv_nsec = MotionTickMilliseconds * 1000000L};
+    if (SetEventLoopTimerPeriod(motionTimer, &tick) != 0)
+    {
+        Log_Debug("ERROR: Could not start the motion timer: %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+    motionRunning = true;
+}
+
+/// <summary>
+///     Disarms the motion timer once no ramp or program is left for it.
+/// </summary>
+static void StopMotionIfIdle(void)
+{
+    if (motionRunning && !ramps[0].active && !ramps[1].active && programStep < 0)
+    {
+        DisarmEventLoopTimer(motionTimer);
+        motionRunning = false;
+    }
+}
+
+/// <summary>
+///     Stops any ramp or program, leaving the motors at their current speeds.
+/// </summary>
+static void CancelMotion(void)
+{
+    ramps[0].active = false;
+    ramps[1].active = false;
+    programStep = -1;
+    StopMotionIfIdle();
+}
+
+/// <summary>
+///     Stops the ramp of one motor and any program, which drives both. The other motor's ramp
+///     carries on.
+/// </summary>
+static void CancelMotorMotion(int motor)
+{
+    ramps[motor].active = false;
+    programStep = -1;
+    StopMotionIfIdle();
+}
 
-    IOTHUB_MESSAGE_HANDLE messageHandle = IoTHubMessage_CreateFromString(jsonMessage);
+static void StartProgramStep(int step, long now)
+{
+    programStep = step;
+    programStepStartMs = now;
+    SetMotorSpeed(0, program[step].speedA);
+    SetMotorSpeed(1, program[step].speedB);
+    ScheduleReport();
+}
 
-    if (messageHandle == 0)
+/// <summary>
+/// Motion timer event: moves ramping motors along and steps the running program. The timer is
+/// disarmed once nothing is left to do.
+/// </summary>
+static void MotionTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0)
     {
-        Log_Debug("ERROR: unable to create a new IoTHubMessage.\n");
+        exitCode = ExitCode_MotionTimer_Consume;
         return;
     }
 
-    if (IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle, SendEventCallback,
-                                             /*&callback_param*/ NULL) != IOTHUB_CLIENT_OK)
+    long now = NowMilliseconds();
+    for (int motor = 0; motor < 2; motor++)
     {
-        Log_Debug("ERROR: failure requesting IoTHubClient to send telemetry event.\n");
+        SpeedRamp *ramp = &ramps[motor];
+        if (!ramp->active)
+        {
+            continue;
+        }
+        long elapsed = now - ramp->startMs;
+        if (elapsed >= ramp->durationMs)
+        {
+            ramp->active = false;
+            SetMotorSpeed(motor, ramp->to);
+            ScheduleReport();
+        }
+        else
+        {
+            SetMotorSpeed(motor, ramp->from + (int)((ramp->to - ramp->from) * elapsed /
+                                                    ramp->durationMs));
+        }
     }
-    else
+
+    if (programStep >= 0 && now - programStepStartMs >= program[programStep].durationMs)
     {
-        Log_Debug("INFO: IoTHubClient accepted the telemetry event for delivery.\n");
+        if (programStep + 1 < programLength)
+        {
+            StartProgramStep(programStep + 1, now);
+        }
+        else
+        {
+            // The motors stop when the program ends
+            programStep = -1;
+            SetMotorSpeed(0, 0);
+            SetMotorSpeed(1, 0);
+            ScheduleReport();
+        }
     }
 
-    IoTHubMessage_Destroy(messageHandle);
+    StopMotionIfIdle();
 }
 
+// Direct method responses
+static const DirectMethod_Result MethodOk = DIRECT_METHOD_RESULT(200, "{\"result\":\"ok\"}");
+static const DirectMethod_Result MethodBadPayload =
+    DIRECT_METHOD_RESULT(400, "{\"error\":\"bad payload\"}");
+static const DirectMethod_Result AlarmTriggered =
+    DIRECT_METHOD_RESULT(200, "\"Alarm Triggered\""); // must be a JSON string (in quotes)
+
+typedef struct
+{
+    int motor; // -1 when not given
+    int speed;
+    long durationMs;
+    bool hasSpeed;
+} MotorCommand;
 
 /// <summary>
-///     Callback invoked when the Azure IoT Hub send event request is processed.
+///     Reads {"motor": "A" | "B", "speed": -100..100, "ms": duration} without building a tree.
+///     Members may be missing; unknown members are skipped.
 /// </summary>
-static void SendEventCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *context)
+static bool ParseMotorCommand(const char *payload, size_t size, MotorCommand *command)
 {
-    Log_Debug("INFO: Azure IoT Hub send telemetry event callback: status code %d.\n", result);
+    *command = (MotorCommand){.motor = -1, .speed = 0, .durationMs = 0, .hasSpeed = false};
+
+    JsonReader reader;
+    JsonReader_Init(&reader, payload, size);
+    if (JsonReader_Next(&reader) != JsonToken_ObjectStart)
+    {
+        return false;
+    }
+
+    JsonToken token;
+    while ((token = JsonReader_Next(&reader)) == JsonToken_Key)
+    {
+        int64_t number = 0;
+        if (JsonReader_TextEquals(&reader, "motor", 5))
+        {
+            if (JsonReader_Next(&reader) != JsonToken_String)
+            {
+                return false;
+            }
+            if (JsonReader_TextEquals(&reader, "A", 1))
+            {
+                command->motor = 0;
+            }
+            else if (JsonReader_TextEquals(&reader, "B", 1))
+            {
+                command->motor = 1;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        else if (JsonReader_TextEquals(&reader, "speed", 5))
+        {
+            if (JsonReader_Next(&reader) != JsonToken_Number ||
+                !JsonReader_GetInt64(&reader, &number) || number < -100 || number > 100)
+            {
+                return false;
+            }
+            command->speed = (int)number;
+            command->hasSpeed = true;
+        }
+        else if (JsonReader_TextEquals(&reader, "ms", 2))
+        {
+            if (JsonReader_Next(&reader) != JsonToken_Number ||
+                !JsonReader_GetInt64(&reader, &number) || number < 0 ||
+                number > MaxMotionMilliseconds)
+            {
+                return false;
+            }
+            command->durationMs = (long)number;
+        }
+        else if (!JsonReader_Skip(&reader))
+        {
+            return false;
+        }
+    }
+    return token == JsonToken_ObjectEnd;
 }
 
-#endif
+/// <summary>
+///     SetSpeed {"motor": "A", "speed": 50}: sets the speed at once.
+/// </summary>
+static DirectMethod_Result SetSpeedMethod(const char *payload, size_t size)
+{
+    MotorCommand command;
+    if (!ParseMotorCommand(payload, size, &command) || command.motor < 0 || !command.hasSpeed)
+    {
+        return MethodBadPayload;
+    }
+
+    CancelMotorMotion(command.motor);
+    SetMotorSpeed(command.motor, command.speed);
+    ScheduleReport();
+    return MethodOk;
+}
 
 /// <summary>
-///     Enqueues a report containing Device Twin reported properties. The report is not sent
-///     immediately, but it is sent on the next invocation of IoTHubDeviceClient_LL_DoWork().
+///     RampTo {"motor": "A", "speed": 50, "ms": 2000}: changes the speed linearly over ms.
 /// </summary>
-static void TwinReportState(const char *jsonState)
+static DirectMethod_Result RampToMethod(const char *payload, size_t size)
 {
-    if (iothubClientHandle == NULL)
+    MotorCommand command;
+    if (!ParseMotorCommand(payload, size, &command) || command.motor < 0 || !command.hasSpeed)
+    {
+        return MethodBadPayload;
+    }
+
+    // A ramp replaces a running program but leaves the other motor's ramp alone
+    if (command.durationMs == 0)
     {
-        Log_Debug("ERROR: Azure IoT Hub client not initialized.\n");
+        CancelMotorMotion(command.motor);
+        SetMotorSpeed(command.motor, command.speed);
+        ScheduleReport();
+        return MethodOk;
+    }
+
+    programStep = -1;
+    SpeedRamp *ramp = &ramps[command.motor];
+    ramp->active = true;
+    ramp->from = command.motor == 0 ? speedMotorA : speedMotorB;
+    ramp->to = command.speed;
+    ramp->startMs = NowMilliseconds();
+    ramp->durationMs = command.durationMs;
+    StartMotion();
+    return MethodOk;
+}
+
+/// <summary>
+///     Stop with no payload, null or {}: cancels ramps and programs and stops both motors.
+///     Stop {"motor": "A"}: cancels that motor's ramp and any program and stops that motor; the
+///     other motor keeps its speed and its ramp.
+/// </summary>
+static DirectMethod_Result StopMethod(const char *payload, size_t size)
+{
+    MotorCommand command = {.motor = -1};
+    JsonReader reader;
+    JsonReader_Init(&reader, payload, size);
+    bool noPayload = size == 0 || (JsonReader_Next(&reader) == JsonToken_Null &&
+                                   JsonReader_Next(&reader) == JsonToken_End);
+    if (!noPayload && !ParseMotorCommand(payload, size, &command))
+    {
+        return MethodBadPayload;
+    }
+
+    if (command.motor < 0)
+    {
+        CancelMotion();
+        SetMotorSpeed(0, 0);
+        SetMotorSpeed(1, 0);
     }
     else
     {
-        if (IoTHubDeviceClient_LL_SendReportedState(
-                iothubClientHandle, (const unsigned char *)jsonState, strlen(jsonState),
-                ReportedStateCallback, NULL) != IOTHUB_CLIENT_OK)
+        CancelMotorMotion(command.motor);
+        SetMotorSpeed(command.motor, 0);
+    }
+    ScheduleReport();
+    return MethodOk;
+}
+
+/// <summary>
+///     RunProgram {"steps": [[speedA, speedB, ms], ...]}: holds each pair of speeds for its
+///     duration in turn, then stops the motors.
+/// </summary>
+static DirectMethod_Result RunProgramMethod(const char *payload, size_t size)
+{
+    ProgramStep steps[MAX_PROGRAM_STEPS];
+    int count = 0;
+
+    JsonReader reader;
+    JsonReader_Init(&reader, payload, size);
+    if (JsonReader_Next(&reader) != JsonToken_ObjectStart)
+    {
+        return MethodBadPayload;
+    }
+
+    JsonToken token;
+    while ((token = JsonReader_Next(&reader)) == JsonToken_Key)
+    {
+        if (!JsonReader_TextEquals(&reader, "steps", 5))
         {
-            Log_Debug("ERROR: Azure IoT Hub client error when reporting state '%s'.\n", jsonState);
+            if (!JsonReader_Skip(&reader))
+            {
+                return MethodBadPayload;
+            }
+            continue;
         }
-        else
+
+        if (JsonReader_Next(&reader) != JsonToken_ArrayStart)
         {
-            Log_Debug("INFO: Azure IoT Hub client accepted request to report state '%s'.\n",
-                      jsonState);
+            return MethodBadPayload;
+        }
+        while ((token = JsonReader_Next(&reader)) == JsonToken_ArrayStart)
+        {
+            int64_t values[3];
+            for (int i = 0; i < 3; i++)
+            {
+                if (JsonReader_Next(&reader) != JsonToken_Number ||
+                    !JsonReader_GetInt64(&reader, &values[i]))
+                {
+                    return MethodBadPayload;
+                }
+            }
+            if (count == MAX_PROGRAM_STEPS || JsonReader_Next(&reader) != JsonToken_ArrayEnd ||
+                values[0] < -100 || values[0] > 100 || values[1] < -100 || values[1] > 100 ||
+                values[2] <= 0 || values[2] > MaxMotionMilliseconds)
+            {
+                return MethodBadPayload;
+            }
+            steps[count].speedA = (int)values[0];
+            steps[count].speedB = (int)values[1];
+            steps[count].durationMs = (long)values[2];
+            count++;
+        }
+        if (token != JsonToken_ArrayEnd)
+        {
+            return MethodBadPayload;
         }
     }
+    if (token != JsonToken_ObjectEnd || count == 0)
+    {
+        return MethodBadPayload;
+    }
+
+    CancelMotion();
+    memcpy(program, steps, (size_t)count * sizeof(ProgramStep));
+    programLength = count;
+    StartProgramStep(0, NowMilliseconds());
+    StartMotion();
+    return MethodOk;
+}
+
+static DirectMethod_Result TriggerAlarmMethod(const char *payload, size_t size)
+{
+    // Output alarm using Log_Debug
+    Log_Debug("  ----- ALARM TRIGGERED! -----\n");
+    return AlarmTriggered;
+}
+
+static void RegisterDirectMethods(void)
+{
+    if (DirectMethod_Register("SetSpeed", SetSpeedMethod) != 0 ||
+        DirectMethod_Register("RampTo", RampToMethod) != 0 ||
+        DirectMethod_Register("Stop", StopMethod) != 0 ||
+        DirectMethod_Register("RunProgram", RunProgramMethod) != 0 ||
+        DirectMethod_Register("TriggerAlarm", TriggerAlarmMethod) != 0)
+    {
+        Log_Debug("ERROR: Could not register the direct methods.\n");
+    }
 }
 
 /// <summary>
-///     Callback invoked when the Device Twin report state request is processed by Azure IoT Hub
-///     client.
+///     Records the time between two timestamps, unless the first was not taken (negative).
 /// </summary>
-static void ReportedStateCallback(int result, void *context)
+static void RecordLatency(LatencyStage stage, int64_t fromUs, int64_t toUs)
 {
-    Log_Debug("INFO: Azure IoT Hub Device Twin reported state callback: status code %d.\n", result);
+    if (fromUs >= 0)
+    {
+        LatencyHistogram_Record(&latency[stage], toUs - fromUs);
+    }
 }
 
-#define TELEMETRY_BUFFER_SIZE 100
+/// <summary>
+///     Notes that a cloud command has moved the motors: the end of the control path, and the
+///     start of the wait for the reported state to be acknowledged.
+/// </summary>
+static void MotorsApplied(int64_t appliedUs)
+{
+    RecordLatency(LatencyStage_Control, doWorkStartUs, appliedUs);
+    if (awaitingAckSinceUs < 0)
+    {
+        awaitingAckSinceUs = appliedUs;
+        awaitingAckReportSent = false;
+    }
+}
 
 /// <summary>
-///     Generate simulated telemetry and send to Azure IoT Hub.
+///     Sends the latency percentiles gathered since the last publish as one CBOR message:
+///     {"latency": {stage: [count, p50, p90, p99, p99.9, max], ...}} in microseconds. The
+///     histograms keep accumulating until a publish is accepted.
 /// </summary>
-void SendSimulatedTelemetry(void)
+static void PublishLatency(void)
 {
-    // no-op!
+    int stages = 0;
+    for (int i = 0; i < LatencyStage_Count; i++)
+    {
+        stages += latency[i].total > 0;
+    }
+    if (stages == 0 || !iothubAuthenticated)
+    {
+        return;
+    }
+
+    CborWriter writer;
+    CborWriter_Init(&writer, telemetryBatch, sizeof(telemetryBatch));
+    CborWriter_BeginMap(&writer, 1);
+    CborWriter_String(&writer, "latency");
+    CborWriter_BeginMap(&writer, (size_t)stages);
+    for (int i = 0; i < LatencyStage_Count; i++)
+    {
+        if (latency[i].total > 0)
+        {
+            CborWriter_String(&writer, LatencyStageNames[i]);
+            LatencyHistogram_Encode(&latency[i], &writer);
+        }
+    }
+
+    size_t length = CborWriter_Finish(&writer);
+    if (length == 0)
+    {
+        Log_Debug("ERROR: Could not encode the latency histograms.\n");
+        return;
+    }
+    if (SendTelemetry(telemetryBatch, length, CBOR_CONTENT_TYPE))
+    {
+        for (int i = 0; i < LatencyStage_Count; i++)
+        {
+            LatencyHistogram_Reset(&latency[i]);
+        }
+    }
 }
@@ -1,5 +1,6 @@
 #include "motor.h"
 #include "pwmcontroller.h"
+#include "telemetry.h"
 #include "unistd.h"
 #include <applibs/gpio.h>
 
@@ -120,6 +121,7 @@ int Motor_Move(int hMotor, int speed)
 		return -1;
 	}
 
+	int requestedSpeed = speed;
 	if (speed > 0)
 	{ // Clockwise
 		if (GPIO_SetValue(motor->fdPin1, GPIO_Value_High) == -1)
@@ -166,6 +168,7 @@ int Motor_Move(int hMotor, int speed)
 		return -1;
 	}
 
+	Telemetry_Record(Telemetry_MotorDuty, hMotor, requestedSpeed);
 	return 0;
 }
 
@@ -2,4 +2,344 @@
    Portions are based on the Azure Sphere IoT Sample which is (c) Microsoft Corp
    Licensed under the MIT License. */
 
+#include <stdlib.h>
+
+#include "applibs_versions.h"
+#include <applibs/log.h>
+#include <applibs/networking.h>
+
+#include "iot_transport.h"
 #include "networking.h"
+
+// IotTransport_Hub: the Azure IoT Hub LL client, provisioned through DPS with the device's
+// Azure Sphere certificate.
+
+static IOTHUB_DEVICE_CLIENT_LL_HANDLE iothubClientHandle = NULL;
+static const int keepalivePeriodSeconds = 20;
+static const IotTransport_Handlers *handlers = NULL;
+static const char *assignedHub = NULL;
+static const char *deviceId = NULL; // needed to connect without DPS
+
+/// <summary>
+///     Converts the Azure IoT Hub connection status reason to a string.
+/// </summary>
+static const char *GetReasonString(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason)
+{
+    static char *reasonString = "unknown reason";
+    switch (reason)
+    {
+    case IOTHUB_CLIENT_CONNECTION_EXPIRED_SAS_TOKEN:
+        reasonString = "IOTHUB_CLIENT_CONNECTION_EXPIRED_SAS_TOKEN";
+        break;
+    case IOTHUB_CLIENT_CONNECTION_DEVICE_DISABLED:
+        reasonString = "IOTHUB_CLIENT_CONNECTION_DEVICE_DISABLED";
+        break;
+    case IOTHUB_CLIENT_CONNECTION_BAD_CREDENTIAL:
+        reasonString = "IOTHUB_CLIENT_CONNECTION_BAD_CREDENTIAL";
+        break;
+    case IOTHUB_CLIENT_CONNECTION_RETRY_EXPIRED:
+        reasonString = "IOTHUB_CLIENT_CONNECTION_RETRY_EXPIRED";
+        break;
+    case IOTHUB_CLIENT_CONNECTION_NO_NETWORK:
+        reasonString = "IOTHUB_CLIENT_CONNECTION_NO_NETWORK";
+        break;
+    case IOTHUB_CLIENT_CONNECTION_COMMUNICATION_ERROR:
+        reasonString = "IOTHUB_CLIENT_CONNECTION_COMMUNICATION_ERROR";
+        break;
+    case IOTHUB_CLIENT_CONNECTION_OK:
+        reasonString = "IOTHUB_CLIENT_CONNECTION_OK";
+        break;
+    case IOTHUB_CLIENT_CONNECTION_NO_PING_RESPONSE:
+        reasonString = "IOTHUB_CLIENT_CONNECTION_NO_PING_RESPONSE";
+        break;
+    }
+    return reasonString;
+}
+
+/// <summary>
+///     Classifies why the connection dropped. The client retries network errors by itself.
+/// </summary>
+static IotTransport_Status GetReasonStatus(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason)
+{
+    switch (reason)
+    {
+    case IOTHUB_CLIENT_CONNECTION_OK:
+        return IotTransport_Ok;
+    case IOTHUB_CLIENT_CONNECTION_NO_NETWORK:
+    case IOTHUB_CLIENT_CONNECTION_COMMUNICATION_ERROR:
+    case IOTHUB_CLIENT_CONNECTION_NO_PING_RESPONSE:
+        return IotTransport_Transient;
+    case IOTHUB_CLIENT_CONNECTION_EXPIRED_SAS_TOKEN:
+    case IOTHUB_CLIENT_CONNECTION_BAD_CREDENTIAL:
+        return IotTransport_Credentials;
+    default:
+        return IotTransport_Retry;
+    }
+}
+
+/// <summary>
+///     Converts AZURE_SPHERE_PROV_RETURN_VALUE to a string.
+/// </summary>
+static const char *GetAzureSphereProvisioningResultString(
+    AZURE_SPHERE_PROV_RETURN_VALUE provisioningResult)
+{
+    switch (provisioningResult.result)
+    {
+    case AZURE_SPHERE_PROV_RESULT_OK:
+        return "AZURE_SPHERE_PROV_RESULT_OK";
+    case AZURE_SPHERE_PROV_RESULT_INVALID_PARAM:
+        return "AZURE_SPHERE_PROV_RESULT_INVALID_PARAM";
+    case AZURE_SPHERE_PROV_RESULT_NETWORK_NOT_READY:
+        return "AZURE_SPHERE_PROV_RESULT_NETWORK_NOT_READY";
+    case AZURE_SPHERE_PROV_RESULT_DEVICEAUTH_NOT_READY:
+        return "AZURE_SPHERE_PROV_RESULT_DEVICEAUTH_NOT_READY";
+    case AZURE_SPHERE_PROV_RESULT_PROV_DEVICE_ERROR:
+        return "AZURE_SPHERE_PROV_RESULT_PROV_DEVICE_ERROR";
+    case AZURE_SPHERE_PROV_RESULT_GENERIC_ERROR:
+        return "AZURE_SPHERE_PROV_RESULT_GENERIC_ERROR";
+    default:
+        return "UNKNOWN_RETURN_VALUE";
+    }
+}
+
+/// <summary>
+///     Classifies a provisioning failure: the network and device authentication come up shortly
+///     after boot, anything else is worth backing off from.
+/// </summary>
+static IotTransport_Status GetProvisioningStatus(AZURE_SPHERE_PROV_RETURN_VALUE provisioningResult)
+{
+    switch (provisioningResult.result)
+    {
+    case AZURE_SPHERE_PROV_RESULT_OK:
+        return IotTransport_Ok;
+    case AZURE_SPHERE_PROV_RESULT_NETWORK_NOT_READY:
+    case AZURE_SPHERE_PROV_RESULT_DEVICEAUTH_NOT_READY:
+        return IotTransport_Transient;
+    default:
+        return IotTransport_Retry;
+    }
+}
+
+static void ConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
+                                     IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason,
+                                     void *userContextCallback)
+{
+    handlers->ConnectionStatus(result == IOTHUB_CLIENT_CONNECTION_AUTHENTICATED,
+                               GetReasonStatus(reason), GetReasonString(reason));
+}
+
+static void DeviceTwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payload,
+                               size_t payloadSize, void *userContextCallback)
+{
+    handlers->TwinUpdate(updateState == DEVICE_TWIN_UPDATE_COMPLETE, payload, payloadSize);
+}
+
+static int DeviceMethodCallback(const char *methodName, const unsigned char *payload,
+                                size_t payloadSize, unsigned char **response, size_t *responseSize,
+                                void *userContextCallback)
+{
+    // The Azure IoT library frees the response after use
+    return handlers->Method(methodName, payload, payloadSize, response, responseSize);
+}
+
+static void SendEventCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *context)
+{
+    handlers->EventConfirmed(result == IOTHUB_CLIENT_CONFIRMATION_OK);
+}
+
+static void ReportedStateCallback(int result, void *context)
+{
+    handlers->ReportedStateConfirmed(result);
+}
+
+static bool Hub_IsNetworkReady(void)
+{
+    bool isNetworkReady = false;
+    if (Networking_IsNetworkingReady(&isNetworkReady) == -1)
+    {
+        Log_Debug("Failed to get Network state\n");
+        return false;
+    }
+    return isNetworkReady;
+}
+
+/// <summary>
+///     Creates the iothubClientHandle, straight to the given hub or through DPS. When the SAS
+///     Token for a device expires the connection needs to be recreated which is why this is not
+///     simply a one time call.
+/// </summary>
+static IotTransport_Status Hub_Connect(const char *scopeId, const char *hubHostname,
+                                       const IotTransport_Handlers *transportHandlers)
+{
+    if (iothubClientHandle != NULL)
+    {
+        IoTHubDeviceClient_LL_Destroy(iothubClientHandle);
+        iothubClientHandle = NULL;
+    }
+
+    handlers = transportHandlers;
+    assignedHub = NULL;
+    if (hubHostname != NULL)
+    {
+        if (deviceId == NULL)
+        {
+            Log_Debug("ERROR: Connecting straight to a hub needs the device ID.\n");
+            return IotTransport_Retry;
+        }
+        if (iothub_security_init(IOTHUB_SECURITY_TYPE_X509) != 0)
+        {
+            Log_Debug("ERROR: iothub_security_init failed for the X.509 device certificate.\n");
+            return IotTransport_Transient; // device authentication may not be ready yet
+        }
+        iothubClientHandle =
+            IoTHubDeviceClient_LL_CreateFromDeviceAuth(hubHostname, deviceId, MQTT_Protocol);
+        Log_Debug("IoTHubDeviceClient_LL_CreateFromDeviceAuth(%s) %s.\n", hubHostname,
+                  iothubClientHandle != NULL ? "succeeded" : "failed");
+        if (iothubClientHandle == NULL)
+        {
+            return IotTransport_Retry;
+        }
+
+        // Directs the SDK to authenticate with the device's DAA certificate
+        static const int deviceIdForDaaCertUsage = 1;
+        if (IoTHubDeviceClient_LL_SetOption(iothubClientHandle, "SetDeviceId",
+                                            &deviceIdForDaaCertUsage) != IOTHUB_CLIENT_OK)
+        {
+            Log_Debug("ERROR: Failure setting Azure IoT Hub client option \"SetDeviceId\".\n");
+            IoTHubDeviceClient_LL_Destroy(iothubClientHandle);
+            iothubClientHandle = NULL;
+            return IotTransport_Retry;
+        }
+        assignedHub = hubHostname;
+    }
+    else
+    {
+        // This SDK does not say which hub DPS assigned, so a provisioned client cannot be
+        // recreated without provisioning again.
+        AZURE_SPHERE_PROV_RETURN_VALUE provResult =
+            IoTHubDeviceClient_LL_CreateWithAzureSphereDeviceAuthProvisioning(scopeId, 10000,
+                                                                              &iothubClientHandle);
+        Log_Debug(
+            "IoTHubDeviceClient_LL_CreateWithAzureSphereDeviceAuthProvisioning returned '%s'.\n",
+            GetAzureSphereProvisioningResultString(provResult));
+
+        if (provResult.result != AZURE_SPHERE_PROV_RESULT_OK)
+        {
+            iothubClientHandle = NULL;
+            return GetProvisioningStatus(provResult);
+        }
+    }
+
+    if (IoTHubDeviceClient_LL_SetOption(iothubClientHandle, OPTION_KEEP_ALIVE,
+                                        &keepalivePeriodSeconds) != IOTHUB_CLIENT_OK)
+    {
+        Log_Debug("ERROR: Failure setting Azure IoT Hub client option \"%s\".\n",
+                  OPTION_KEEP_ALIVE);
+    }
+
+    IoTHubDeviceClient_LL_SetDeviceTwinCallback(iothubClientHandle, DeviceTwinCallback, NULL);
+    IoTHubDeviceClient_LL_SetDeviceMethodCallback(iothubClientHandle, DeviceMethodCallback, NULL);
+    IoTHubDeviceClient_LL_SetConnectionStatusCallback(iothubClientHandle, ConnectionStatusCallback,
+                                                      NULL);
+    return IotTransport_Ok;
+}
+
+static const char *Hub_AssignedHub(void)
+{
+    return assignedHub;
+}
+
+static void Hub_Disconnect(void)
+{
+    if (iothubClientHandle != NULL)
+    {
+        IoTHubDeviceClient_LL_Destroy(iothubClientHandle);
+        iothubClientHandle = NULL;
+    }
+}
+
+static void Hub_DoWork(void)
+{
+    if (iothubClientHandle != NULL)
+    {
+        IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
+    }
+}
+
+static bool Hub_IsBusy(void)
+{
+    IOTHUB_CLIENT_STATUS sendStatus = IOTHUB_CLIENT_SEND_STATUS_IDLE;
+    if (iothubClientHandle != NULL)
+    {
+        IoTHubDeviceClient_LL_GetSendStatus(iothubClientHandle, &sendStatus);
+    }
+    return sendStatus == IOTHUB_CLIENT_SEND_STATUS_BUSY;
+}
+
+static bool Hub_SendEvent(const uint8_t *body, size_t length, const char *contentType)
+{
+    if (iothubClientHandle == NULL)
+    {
+        Log_Debug("ERROR: Azure IoT Hub client not initialized.\n");
+        return false;
+    }
+
+    if (!Hub_IsNetworkReady())
+    {
+        Log_Debug("WARNING: Cannot send Azure IoT Hub telemetry because the network is not up.\n");
+        return false;
+    }
+
+    IOTHUB_MESSAGE_HANDLE messageHandle = IoTHubMessage_CreateFromByteArray(body, length);
+
+    if (messageHandle == 0)
+    {
+        Log_Debug("ERROR: unable to create a new IoTHubMessage.\n");
+        return false;
+    }
+
+    bool accepted = false;
+    if (IoTHubMessage_SetContentTypeSystemProperty(messageHandle, contentType) != IOTHUB_MESSAGE_OK)
+    {
+        Log_Debug("ERROR: unable to set the telemetry content type.\n");
+    }
+    else if (IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle,
+                                                  SendEventCallback,
+                                                  /*&callback_param*/ NULL) == IOTHUB_CLIENT_OK)
+    {
+        accepted = true;
+    }
+
+    IoTHubMessage_Destroy(messageHandle);
+    return accepted;
+}
+
+static bool Hub_SendReportedState(const char *json, size_t length)
+{
+    if (iothubClientHandle == NULL)
+    {
+        Log_Debug("ERROR: Azure IoT Hub client not initialized.\n");
+        return false;
+    }
+
+    return IoTHubDeviceClient_LL_SendReportedState(iothubClientHandle, (const unsigned char *)json,
+                                                   length, ReportedStateCallback,
+                                                   NULL) == IOTHUB_CLIENT_OK;
+}
+
+void IotTransport_HubSetDeviceId(const char *id)
+{
+    deviceId = id;
+}
+
+const IotTransport IotTransport_Hub = {
+    .name = "Azure IoT Hub",
+    .IsNetworkReady = Hub_IsNetworkReady,
+    .Connect = Hub_Connect,
+    .AssignedHub = Hub_AssignedHub,
+    .Disconnect = Hub_Disconnect,
+    .DoWork = Hub_DoWork,
+    .IsBusy = Hub_IsBusy,
+    .SendEvent = Hub_SendEvent,
+    .SendReportedState = Hub_SendReportedState,
+};
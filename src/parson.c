@@ -3,6 +3,8 @@
     https://github.com/kgabis/parson at commit id 4f3eaa6
     Patched to avoid any usage of fopen(), and removed implicit
     cast warnings by making them explicit.
+    Numbers are formatted with Grisu2 instead of sprintf("%1.17g") and
+    parsed without strtod when the value is exactly representable.
 */
 
 /*
@@ -41,17 +43,54 @@
 #include <ctype.h>
 #include <math.h>
 #include <errno.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SCAN_BLOCK_SIZE 16
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SCAN_BLOCK_SIZE 16
+#else
+#define SCAN_BLOCK_SIZE sizeof(size_t)
+#endif
 
 /* Apparently sscanf is not implemented in some "standard" libraries, so don't use it, if you
  * don't have to. */
 #define sscanf THINK_TWICE_ABOUT_USING_SSCANF
 
 #define STARTING_CAPACITY 16
-#define MAX_NESTING 2048
-
-#define FLOAT_FORMAT "%1.17g" /* do not increase precision without incresing NUM_BUF_SIZE */
-/* double printed with "%1.17g" shouldn't be longer than 25 bytes so let's use 64 */
+#define PATH_NO_INDEX ((size_t)-1) /* path segment that can't index an array */
+#define INTERN_STARTING_BUCKETS 64
+
+/* Strings shorter than INLINE_STRING_SIZE are kept in the value itself. Internally such values
+   have type JSON_INLINE_STRING, json_value_get_type reports them as JSONString. */
+#define INLINE_STRING_SIZE 8 /* including '\0', same size as the union's double */
+#define JSON_INLINE_STRING 0x100
+#ifndef MAX_NESTING
+#define MAX_NESTING 2048 /* deepest container nesting accepted by the parser */
+#endif
+/* Parser container stack lives on the C stack up to this depth and spills to the context's
+ * scratch frames beyond it, so heap usage is bounded by max_nesting * sizeof(JSON_Parse_Frame). */
+#define PARSE_STACK_INLINE 16
+#define PARSE_SCRATCH_RETAIN 256 /* scratch frames kept by a context between parses */
+
+/* Node pools recycle blocks in power of two size classes from POOL_MIN_BLOCK to POOL_MAX_BLOCK */
+#define POOL_CLASS_COUNT 8
+#define POOL_MIN_BLOCK 16 /* big enough for the free list link */
+#define POOL_MAX_BLOCK (POOL_MIN_BLOCK << (POOL_CLASS_COUNT - 1))
+
+/* formatted double shouldn't be longer than 25 bytes (sign, 17 digits, point, exponent),
+ * so let's use 64 */
 #define NUM_BUF_SIZE 64
+#define MAX_EXACT_INTEGER 9007199254740992.0 /* 2^53, all integers up to it are exact doubles */
+#define MAX_EXACT_MANTISSA (1ULL << 53)       /* the same limit, compared before any rounding */
+#define MAX_FAST_MANTISSA_DIGITS 19           /* fits in uint64_t */
+#define MAX_FAST_POWER_OF_TEN 22              /* 10^22 is the largest exact power of ten */
+#define DOUBLE_EXPONENT_MASK 0x7FF0000000000000ULL
+#define DOUBLE_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFULL
+#define DOUBLE_HIDDEN_BIT 0x0010000000000000ULL
+#define DOUBLE_EXPONENT_BIAS (0x3FF + 52)
 
 #define SIZEOF_TOKEN(a) (sizeof(a) - 1)
 #define SKIP_CHAR(str) ((*str)++)
@@ -65,15 +104,22 @@
 #undef malloc
 #undef free
 
-static JSON_Malloc_Function parson_malloc = malloc;
-static JSON_Free_Function parson_free = free;
-
 #define IS_CONT(b) (((unsigned char)(b)&0xC0) == 0x80) /* is utf-8 continuation byte */
 
+/* Word-at-a-time (SWAR) byte tests. HAS_LESS is exact about whether some byte matches, only
+ * the position of further matches can be wrong. */
+#define SWAR_ONES ((size_t)-1 / 0xFF) /* 0x01 in every byte */
+#define SWAR_HIGHS (SWAR_ONES * 0x80) /* 0x80 in every byte */
+#define SWAR_HAS_ZERO(x) (((x)-SWAR_ONES) & ~(x)&SWAR_HIGHS)
+#define SWAR_HAS_BYTE(x, b) SWAR_HAS_ZERO((x) ^ (SWAR_ONES * (unsigned char)(b)))
+#define SWAR_HAS_LESS(x, n) (((x)-SWAR_ONES * (n)) & ~(x)&SWAR_HIGHS) /* n <= 128 */
+
 /* Type definitions */
 typedef union json_value_value {
     char *string;
+    char inline_string[INLINE_STRING_SIZE];
     double number;
+    int64_t integer;
     JSON_Object *object;
     JSON_Array *array;
     int boolean;
@@ -83,6 +129,7 @@ typedef union json_value_value {
 struct json_value_t
 {
     JSON_Value *parent;
+    JSON_Context *context; /* allocator of this value and of everything added to it */
     JSON_Value_Type type;
     JSON_Value_Value value;
 };
@@ -91,11 +138,29 @@ struct json_object_t
 {
     JSON_Value *wrapping_value;
     char **names;
+    uint32_t *hashes; /* hash_name() of each name, checked before comparing names */
     JSON_Value **values;
     size_t count;
     size_t capacity;
+    int interned_names; /* names belong to the intern table instead of this object */
 };
 
+/* Shared, reference counted object name. Names handed out by the intern table point at name. */
+typedef struct json_intern_entry_t
+{
+    struct json_intern_entry_t *next;
+    uint32_t hash;
+    size_t refcount;
+    char name[1]; /* '\0' terminated, allocated to fit */
+} JSON_Intern_Entry;
+
+typedef struct json_intern_table_t
+{
+    JSON_Intern_Entry **buckets;
+    size_t bucket_count; /* power of two */
+    size_t count;
+} JSON_Intern_Table;
+
 struct json_array_t
 {
     JSON_Value *wrapping_value;
@@ -104,16 +169,627 @@ struct json_array_t
     size_t capacity;
 };
 
+typedef struct json_path_segment_t
+{
+    const char *name; /* unescaped and '\0' terminated */
+    size_t name_len;
+    uint32_t hash;
+    size_t index; /* array index for JSON Pointer segments, PATH_NO_INDEX otherwise */
+} JSON_Path_Segment;
+
+/* Segments and their names live in the same allocation as the path itself. */
+struct json_path_t
+{
+    JSON_Path_Segment *segments;
+    size_t count;
+    JSON_Context *context; /* allocated from */
+    size_t size;           /* of the whole allocation */
+};
+
+/* Object or array that is still being parsed. It is attached to its parent once it is closed. */
+typedef struct json_parse_frame
+{
+    JSON_Value *value;
+    char *key; /* name the next member will be stored under, objects only */
+} JSON_Parse_Frame;
+
+typedef struct json_pool_block_t
+{
+    struct json_pool_block_t *next;
+} JSON_Pool_Block;
+
+typedef struct json_parse_stack
+{
+    JSON_Context *context;
+    JSON_Parse_Frame *frames; /* inline_frames or the context's scratch frames */
+    size_t count;
+    size_t capacity;
+    JSON_Parse_Frame inline_frames[PARSE_STACK_INLINE];
+} JSON_Parse_Stack;
+
+/* Container being walked by an iterative traversal, and how many of its children were visited.
+ * Traversals of two documents at once keep the matching container of the second in other, and
+ * ones that build a document keep the container being filled in result. */
+typedef struct json_walk_frame
+{
+    const JSON_Value *value;
+    const JSON_Value *other;
+    JSON_Value *result;
+    size_t index;
+} JSON_Walk_Frame;
+
+/* Like the parser's stack: inline up to PARSE_STACK_INLINE frames, then on the heap, and never
+ * deeper than the context's max nesting */
+typedef struct json_walk_stack
+{
+    JSON_Context *context;
+    JSON_Walk_Frame *frames; /* inline_frames or allocated from context */
+    size_t count;
+    size_t capacity;
+    JSON_Walk_Frame inline_frames[PARSE_STACK_INLINE];
+} JSON_Walk_Stack;
+
+struct json_context_t
+{
+    JSON_Malloc_Function malloc_fun;
+    JSON_Free_Function free_fun;
+    size_t max_nesting;
+    int intern_keys;
+    JSON_Intern_Table intern_table;
+    JSON_Parse_Frame *scratch_frames; /* parser stack spill space, reused between parses */
+    size_t scratch_capacity;
+    JSON_Parse_Limits limits; /* 0 for no limit */
+    JSON_Parse_Error parse_error;
+    int parsing; /* limits are only enforced while set */
+    size_t parse_bytes;
+    size_t parse_values;
+    JSON_Pool_Block *pools[POOL_CLASS_COUNT]; /* freed nodes and node arrays by size class */
+    size_t pool_limit;                        /* bytes the pools may hold, 0 disables pooling */
+    size_t pool_bytes;
+    int allocated; /* pooling can't be turned on after the first allocation */
+};
+
+/* Used by every function that doesn't take a context */
+static JSON_Context default_context = {malloc, free, MAX_NESTING, 0, {NULL, 0, 0}, NULL, 0,
+                                       {0, 0, 0, 0}, {JSONParseErrorNone, 0}, 0, 0, 0,
+                                       {NULL}, 0, 0, 0};
+
+/* Floating point number with a 64 bit significand: f * 2^e. Used by the double formatter. */
+typedef struct diy_fp
+{
+    uint64_t f;
+    int e;
+} Diy_Fp;
+
+/* Destination of a single serialization pass. With buf == NULL output is only counted, otherwise
+   a full buf is handed to flush, grown (grow != 0) or reported as an overflow. */
+typedef struct json_writer
+{
+    char *buf;
+    size_t buf_size;
+    size_t buf_len;
+    size_t total_len; /* bytes produced so far, including flushed ones */
+    JSON_Flush_Function flush;
+    void *context;
+    JSON_Context *allocator; /* grows buf, when grow != 0 */
+    int grow;
+    int failed;
+    char num_buf[NUM_BUF_SIZE];
+} JSON_Writer;
+
 /* Various */
+static void *context_malloc(JSON_Context *context, size_t size);
+static void context_free_sized(JSON_Context *context, void *block, size_t size);
+static int pool_class(size_t size);
+static void pool_drain(JSON_Context *context, size_t keep_bytes);
+static void parse_fail(JSON_Context *context, JSON_Parse_Error_Code code);
+static JSON_Status parse_check_string_length(JSON_Context *context, size_t string_len);
 static void remove_comments(char *string, const char *start_token, const char *end_token);
-static char *parson_strndup(const char *string, size_t n);
-static char *parson_strdup(const char *string);
+static char *parson_strndup(JSON_Context *context, const char *string, size_t n);
+static char *parson_strdup(JSON_Context *context, const char *string);
+static uint32_t hash_name(const char *name, size_t name_len);
+
+/* Key interning */
+static void intern_table_grow(JSON_Context *context);
+static char *intern_name(JSON_Context *context, const char *name, size_t name_len, uint32_t hash);
+static void intern_release(JSON_Context *context, char *name);
+static char *json_object_store_name(const JSON_Object *object, const char *name, size_t name_len,
+                                    uint32_t hash);
+static void json_object_release_name(const JSON_Object *object, char *name);
 static int hex_char_to_int(char c);
 static int parse_utf16_hex(const char *string, unsigned int *result);
 static int num_bytes_in_utf8_sequence(unsigned char c);
 static int verify_utf8_sequence(const unsigned char *string, int *len);
 static int is_valid_utf8(const char *string, size_t string_len);
 static int is_decimal(const char *string, size_t length);
+static int has_control_characters(const char *string, size_t string_len);
+static int block_has_string_special(const char *block);
+static const char *scan_string_body(const char *string);
+
+/* Number codec */
+static int parse_integer_fast(const char *string, int64_t *integer, const char **end);
+static int parse_number_fast(const char *string, double *number, const char **end);
+static int format_integer(char *buf, uint64_t magnitude, int is_negative);
+static Diy_Fp diy_fp_multiply(Diy_Fp x, Diy_Fp y);
+static Diy_Fp diy_fp_cached_power(int e, int *k);
+static void grisu_round(char *digits, int length, uint64_t delta, uint64_t rest,
+                        uint64_t ten_kappa, uint64_t wp_w);
+static void grisu_digit_gen(Diy_Fp w, Diy_Fp mp, uint64_t delta, char *digits, int *length,
+                            int *k);
+static void grisu2(double number, char *digits, int *length, int *k);
+static int format_double(char *buf, double number);
+static int format_number(char *buf, double number);
+static int format_int64(char *buf, int64_t integer);
+
+/* Number codec */
+
+/* Integer literals (no fraction or exponent) that fit in int64_t. "-0" is left to the double
+   parser so its sign survives. */
+static int parse_integer_fast(const char *string, int64_t *integer, const char **end)
+{
+    const char *ptr = string;
+    uint64_t magnitude = 0, limit = (uint64_t)INT64_MAX;
+    unsigned digit = 0;
+    if (*ptr == '-')
+    {
+        limit += 1; /* magnitude of INT64_MIN */
+        ptr++;
+    }
+    if (*ptr == '0' && ptr == string)
+    {
+        ptr++;
+    }
+    else if (*ptr >= '1' && *ptr <= '9')
+    {
+        while (isdigit((unsigned char)*ptr))
+        {
+            digit = (unsigned)(*ptr - '0');
+            if (magnitude > (limit - digit) / 10)
+            {
+                return 0;
+            }
+            magnitude = magnitude * 10 + digit;
+            ptr++;
+        }
+    }
+    else
+    {
+        return 0;
+    }
+    if (isdigit((unsigned char)*ptr) || *ptr == '.' || *ptr == 'e' || *ptr == 'E' || *ptr == 'x' ||
+        *ptr == 'X')
+    {
+        return 0;
+    }
+    *integer = *string == '-' ? (int64_t)(0 - magnitude) : (int64_t)magnitude;
+    *end = ptr;
+    return 1;
+}
+
+/* Clinger's fast path: when the decimal significand and the power of ten are both exact doubles,
+   a single multiplication or division is correctly rounded, i.e. gives exactly what strtod would.
+   Returns 0 when the literal has to go through strtod instead (long significands, large exponents
+   and anything the strict JSON grammar or is_decimal would reject). */
+static int parse_number_fast(const char *string, double *number, const char **end)
+{
+    static const double powers_of_ten[MAX_FAST_POWER_OF_TEN + 1] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    const char *ptr = string;
+    uint64_t mantissa = 0;
+    int digits = 0, fraction_digits = 0, exponent = 0, exponent_sign = 1, is_negative = 0;
+    double result = 0.0;
+    if (*ptr == '-')
+    {
+        is_negative = 1;
+        ptr++;
+    }
+    if (*ptr == '0')
+    {
+        ptr++;
+        if (isdigit((unsigned char)*ptr) || *ptr == 'x' || *ptr == 'X' || *ptr == 'e' ||
+            *ptr == 'E')
+        {
+            return 0;
+        }
+    }
+    else if (*ptr >= '1' && *ptr <= '9')
+    {
+        while (isdigit((unsigned char)*ptr))
+        {
+            if (++digits > MAX_FAST_MANTISSA_DIGITS)
+            {
+                return 0;
+            }
+            mantissa = mantissa * 10 + (uint64_t)(*ptr - '0');
+            ptr++;
+        }
+    }
+    else
+    {
+        return 0;
+    }
+    if (*ptr == '.')
+    {
+        ptr++;
+        while (isdigit((unsigned char)*ptr))
+        {
+            if (mantissa != 0 || *ptr != '0')
+            { /* leading zeros of the fraction aren't significant */
+                if (++digits > MAX_FAST_MANTISSA_DIGITS)
+                {
+                    return 0;
+                }
+                mantissa = mantissa * 10 + (uint64_t)(*ptr - '0');
+            }
+            fraction_digits++;
+            ptr++;
+        }
+    }
+    if (*ptr == 'e' || *ptr == 'E')
+    {
+        string = ptr + 1;
+        if (*string == '+' || *string == '-')
+        {
+            exponent_sign = *string == '-' ? -1 : 1;
+            string++;
+        }
+        if (isdigit((unsigned char)*string))
+        { /* like strtod, an 'e' without digits isn't part of the number */
+            while (isdigit((unsigned char)*string))
+            {
+                if (exponent < 10000)
+                {
+                    exponent = exponent * 10 + (*string - '0');
+                }
+                string++;
+            }
+            ptr = string;
+        }
+    }
+    exponent = exponent * exponent_sign - fraction_digits;
+    if (mantissa != 0)
+    {
+        if (mantissa > MAX_EXACT_MANTISSA || exponent < -MAX_FAST_POWER_OF_TEN ||
+            exponent > MAX_FAST_POWER_OF_TEN)
+        {
+            return 0;
+        }
+        result = (double)mantissa;
+        result = exponent < 0 ? result / powers_of_ten[-exponent] : result * powers_of_ten[exponent];
+    }
+    *number = is_negative ? -result : result;
+    *end = ptr;
+    return 1;
+}
+
+static int format_integer(char *buf, uint64_t magnitude, int is_negative)
+{
+    char digits[20];
+    int count = 0, written = 0;
+    uint32_t small_magnitude = 0;
+    while (magnitude > UINT32_MAX)
+    { /* 64 bit division is a library call on 32 bit targets, so only use it for the top digits */
+        digits[count++] = (char)('0' + (int)(magnitude % 10));
+        magnitude /= 10;
+    }
+    small_magnitude = (uint32_t)magnitude;
+    do
+    {
+        digits[count++] = (char)('0' + (int)(small_magnitude % 10));
+        small_magnitude /= 10;
+    } while (small_magnitude != 0);
+    if (is_negative)
+    {
+        buf[written++] = '-';
+    }
+    while (count > 0)
+    {
+        buf[written++] = digits[--count];
+    }
+    buf[written] = '\0';
+    return written;
+}
+
+/* Grisu2 (Florian Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with
+   Integers"), following Milo Yip's implementation. Output always reads back as the same double
+   and is the shortest such representation for the vast majority of inputs. */
+static Diy_Fp diy_fp_multiply(Diy_Fp x, Diy_Fp y)
+{
+    const uint64_t mask_32 = 0xFFFFFFFFULL;
+    uint64_t a = x.f >> 32, b = x.f & mask_32, c = y.f >> 32, d = y.f & mask_32;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t tmp = (bd >> 32) + (ad & mask_32) + (bc & mask_32);
+    Diy_Fp result;
+    tmp += 1ULL << 31; /* round */
+    result.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+    result.e = x.e + y.e + 64;
+    return result;
+}
+
+/* Normalized 10^-k with k chosen so that the product with a 2^e number has a binary exponent
+   in the range digit generation expects */
+static Diy_Fp diy_fp_cached_power(int e, int *k)
+{
+    static const uint64_t significands[] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL,
+    };
+    static const short exponents[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+    -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+    -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+    -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+    56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+    694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+    1013, 1039, 1066,
+    };
+    double dk = (-61 - e) * 0.30102999566398114 + 347; /* dk must be positive */
+    int ik = (int)dk;
+    unsigned index = 0;
+    Diy_Fp result;
+    if (dk - ik > 0.0)
+    {
+        ik++;
+    }
+    index = (unsigned)((ik >> 3) + 1);
+    *k = -(-348 + (int)(index << 3)); /* decimal exponent no need lookup table */
+    result.f = significands[index];
+    result.e = exponents[index];
+    return result;
+}
+
+static void grisu_round(char *digits, int length, uint64_t delta, uint64_t rest,
+                        uint64_t ten_kappa, uint64_t wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w))
+    {
+        digits[length - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static void grisu_digit_gen(Diy_Fp w, Diy_Fp mp, uint64_t delta, char *digits, int *length,
+                            int *k)
+{
+    static const uint64_t powers_of_ten[] = {1ULL,
+                                             10ULL,
+                                             100ULL,
+                                             1000ULL,
+                                             10000ULL,
+                                             100000ULL,
+                                             1000000ULL,
+                                             10000000ULL,
+                                             100000000ULL,
+                                             1000000000ULL,
+                                             10000000000ULL,
+                                             100000000000ULL,
+                                             1000000000000ULL,
+                                             10000000000000ULL,
+                                             100000000000000ULL,
+                                             1000000000000000ULL,
+                                             10000000000000000ULL,
+                                             100000000000000000ULL,
+                                             1000000000000000000ULL,
+                                             10000000000000000000ULL};
+    const int one_e = mp.e;
+    const uint64_t one_f = 1ULL << -one_e;
+    const uint64_t wp_w = mp.f - w.f;
+    uint32_t p1 = (uint32_t)(mp.f >> -one_e);
+    uint64_t p2 = mp.f & (one_f - 1);
+    uint64_t tmp = 0;
+    int kappa = 10;
+    int digit = 0;
+    while (kappa > 1 && p1 < powers_of_ten[kappa - 1])
+    {
+        kappa--;
+    }
+    *length = 0;
+    while (kappa > 0)
+    {
+        digit = (int)(p1 / (uint32_t)powers_of_ten[kappa - 1]);
+        p1 %= (uint32_t)powers_of_ten[kappa - 1];
+        if (digit || *length)
+        {
+            digits[(*length)++] = (char)('0' + digit);
+        }
+        kappa--;
+        tmp = ((uint64_t)p1 << -one_e) + p2;
+        if (tmp <= delta)
+        {
+            *k += kappa;
+            grisu_round(digits, *length, delta, tmp, powers_of_ten[kappa] << -one_e, wp_w);
+            return;
+        }
+    }
+    for (;;)
+    { /* kappa == 0 */
+        p2 *= 10;
+        delta *= 10;
+        digit = (int)(p2 >> -one_e);
+        if (digit || *length)
+        {
+            digits[(*length)++] = (char)('0' + digit);
+        }
+        p2 &= one_f - 1;
+        kappa--;
+        if (p2 < delta)
+        {
+            *k += kappa;
+            grisu_round(digits, *length, delta, p2, one_f,
+                        -kappa < 20 ? wp_w * powers_of_ten[-kappa] : 0);
+            return;
+        }
+    }
+}
+
+/* Produces the digits of a positive, finite number: number == digits * 10^k */
+static void grisu2(double number, char *digits, int *length, int *k)
+{
+    uint64_t bits = 0;
+    int biased_e = 0;
+    Diy_Fp v, w, w_plus, w_minus, c_mk;
+    memcpy(&bits, &number, sizeof(bits));
+    biased_e = (int)((bits & DOUBLE_EXPONENT_MASK) >> 52);
+    v.f = bits & DOUBLE_SIGNIFICAND_MASK;
+    if (biased_e != 0)
+    {
+        v.f += DOUBLE_HIDDEN_BIT;
+        v.e = biased_e - DOUBLE_EXPONENT_BIAS;
+    }
+    else
+    { /* subnormal */
+        v.e = 1 - DOUBLE_EXPONENT_BIAS;
+    }
+
+    /* boundaries m+ and m-, normalized to the same exponent */
+    w_plus.f = (v.f << 1) + 1;
+    w_plus.e = v.e - 1;
+    while (!(w_plus.f & (DOUBLE_HIDDEN_BIT << 1)))
+    {
+        w_plus.f <<= 1;
+        w_plus.e--;
+    }
+    w_plus.f <<= 64 - 52 - 2;
+    w_plus.e -= 64 - 52 - 2;
+    if (v.f == DOUBLE_HIDDEN_BIT)
+    { /* lower boundary is closer for powers of two */
+        w_minus.f = (v.f << 2) - 1;
+        w_minus.e = v.e - 2;
+    }
+    else
+    {
+        w_minus.f = (v.f << 1) - 1;
+        w_minus.e = v.e - 1;
+    }
+    w_minus.f <<= w_minus.e - w_plus.e;
+    w_minus.e = w_plus.e;
+
+    w = v;
+    while (!(w.f & (1ULL << 63)))
+    {
+        w.f <<= 1;
+        w.e--;
+    }
+
+    c_mk = diy_fp_cached_power(w_plus.e, k);
+    w = diy_fp_multiply(w, c_mk);
+    w_plus = diy_fp_multiply(w_plus, c_mk);
+    w_minus = diy_fp_multiply(w_minus, c_mk);
+    w_minus.f++;
+    w_plus.f--;
+    grisu_digit_gen(w, w_plus, w_plus.f - w_minus.f, digits, length, k);
+}
+
+/* Shortest representation that reads back as the same double, without printf and locales */
+static int format_double(char *buf, double number)
+{
+    char digits[20];
+    int length = 0, k = 0, point = 0, written = 0, i = 0;
+    if (number < 0)
+    {
+        buf[written++] = '-';
+        number = -number;
+    }
+    grisu2(number, digits, &length, &k);
+    point = length + k; /* 10^(point - 1) <= number < 10^point */
+    if (length <= point && point <= 21)
+    { /* 1234e7 -> 12340000000 */
+        memcpy(buf + written, digits, (size_t)length);
+        written += length;
+        for (i = length; i < point; i++)
+        {
+            buf[written++] = '0';
+        }
+    }
+    else if (0 < point && point <= 21)
+    { /* 1234e-2 -> 12.34 */
+        memcpy(buf + written, digits, (size_t)point);
+        written += point;
+        buf[written++] = '.';
+        memcpy(buf + written, digits + point, (size_t)(length - point));
+        written += length - point;
+    }
+    else if (-6 < point && point <= 0)
+    { /* 1234e-6 -> 0.001234 */
+        buf[written++] = '0';
+        buf[written++] = '.';
+        for (i = point; i < 0; i++)
+        {
+            buf[written++] = '0';
+        }
+        memcpy(buf + written, digits, (size_t)length);
+        written += length;
+    }
+    else
+    { /* 1234e30 -> 1.234e33 */
+        buf[written++] = digits[0];
+        if (length > 1)
+        {
+            buf[written++] = '.';
+            memcpy(buf + written, digits + 1, (size_t)(length - 1));
+            written += length - 1;
+        }
+        buf[written++] = 'e';
+        return written + format_integer(buf + written, (uint64_t)abs(point - 1), point - 1 < 0);
+    }
+    buf[written] = '\0';
+    return written;
+}
+
+static int format_int64(char *buf, int64_t integer)
+{
+    return integer < 0 ? format_integer(buf, 0 - (uint64_t)integer, 1)
+                       : format_integer(buf, (uint64_t)integer, 0);
+}
+
+static int format_number(char *buf, double number)
+{
+    if (fabs(number) < MAX_EXACT_INTEGER && (double)(int64_t)number == number)
+    { /* integer fast path, also keeps the sign of -0 */
+        return format_integer(buf, (uint64_t)(number < 0 ? -(int64_t)number : (int64_t)number),
+                              signbit(number) != 0);
+    }
+    return format_double(buf, number);
+}
+
+int json_format_number(char *buf, double number)
+{
+    if (buf == NULL || !isfinite(number))
+    {
+        return 0;
+    }
+    return format_number(buf, number);
+}
 
 /* JSON Object */
 static JSON_Object *json_object_init(JSON_Value *wrapping_value);
@@ -123,45 +799,190 @@ static JSON_Status json_object_addn(JSON_Object *object, const char *name, size_
 static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity);
 static JSON_Value *json_object_getn_value(const JSON_Object *object, const char *name,
                                           size_t name_len);
+static JSON_Value *json_object_getn_value_hashed(const JSON_Object *object, const char *name,
+                                                 size_t name_len, uint32_t hash);
 static JSON_Status json_object_remove_internal(JSON_Object *object, const char *name,
                                                int free_value);
 static JSON_Status json_object_dotremove_internal(JSON_Object *object, const char *name,
                                                   int free_value);
-static void json_object_free(JSON_Object *object);
+static JSON_Status merge_patch_object(JSON_Object *target, const JSON_Object *patch);
+static JSON_Status merge_patch_diff_object(JSON_Object *diff, const JSON_Object *old_object,
+                                           const JSON_Object *new_object);
+static JSON_Status merge_patch_diff_push(JSON_Walk_Stack *stack, JSON_Value *diff,
+                                         const JSON_Value *old_value, const JSON_Value *new_value);
+static void json_object_free(JSON_Object *object); /* once its members are freed */
 
 /* JSON Array */
 static JSON_Array *json_array_init(JSON_Value *wrapping_value);
 static JSON_Status json_array_add(JSON_Array *array, JSON_Value *value);
 static JSON_Status json_array_resize(JSON_Array *array, size_t new_capacity);
-static void json_array_free(JSON_Array *array);
+static void json_array_free(JSON_Array *array); /* once its items are freed */
 
 /* JSON Value */
-static JSON_Value *json_value_init_string_no_copy(char *string);
+static JSON_Value *json_value_alloc(JSON_Context *context, JSON_Value_Type type);
+static void json_value_free_node(JSON_Value *value);
+static JSON_Value *json_value_init_string_no_copy(JSON_Context *context, char *string);
+static JSON_Value *json_value_init_string_n(JSON_Context *context, const char *string,
+                                            size_t string_len);
+static JSON_Context *object_context(const JSON_Object *object);
+static JSON_Context *array_context(const JSON_Array *array);
 
 /* Parser */
 static JSON_Status skip_quotes(const char **string);
 static int parse_utf16(const char **unprocessed, char **processed);
-static char *process_string(const char *input, size_t len);
-static char *get_quoted_string(const char **string);
-static JSON_Value *parse_object_value(const char **string, size_t nesting);
-static JSON_Value *parse_array_value(const char **string, size_t nesting);
-static JSON_Value *parse_string_value(const char **string);
-static JSON_Value *parse_boolean_value(const char **string);
-static JSON_Value *parse_number_value(const char **string);
-static JSON_Value *parse_null_value(const char **string);
-static JSON_Value *parse_value(const char **string, size_t nesting);
+static JSON_Status unescape_string(const char *input, size_t len, char *output,
+                                   size_t *output_len);
+static char *process_string(JSON_Context *context, const char *input, size_t len);
+static char *get_quoted_string(JSON_Context *context, const char **string);
+static void parse_stack_init(JSON_Parse_Stack *stack, JSON_Context *context);
+static JSON_Status parse_stack_push(JSON_Parse_Stack *stack, JSON_Value *value);
+static void parse_stack_free(JSON_Parse_Stack *stack);
+static void walk_stack_init(JSON_Walk_Stack *stack, JSON_Context *context);
+static JSON_Status walk_stack_push(JSON_Walk_Stack *stack, const JSON_Value *value);
+static void walk_stack_free(JSON_Walk_Stack *stack);
+static JSON_Status parse_object_key(const char **string, JSON_Parse_Frame *frame);
+static JSON_Status parse_frame_add(JSON_Parse_Frame *frame, JSON_Value *value);
+static JSON_Status parse_check_container_size(JSON_Parse_Frame *frame);
+static JSON_Value *parse_scalar_value(JSON_Context *context, const char **string);
+static JSON_Value *parse_string_value(JSON_Context *context, const char **string);
+static JSON_Value *parse_boolean_value(JSON_Context *context, const char **string);
+static JSON_Value *parse_number_value(JSON_Context *context, const char **string);
+static JSON_Value *parse_null_value(JSON_Context *context, const char **string);
+static JSON_Value *parse_value(JSON_Context *context, const char **string);
 
 /* Serialization */
-static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int level, int is_pretty,
-                                      char *num_buf);
-static int json_serialize_string(const char *string, char *buf);
-static int append_indent(char *buf, int level);
-static int append_string(char *buf, const char *string);
+static void writer_init(JSON_Writer *writer, char *buf, size_t buf_size, JSON_Flush_Function flush,
+                        void *context);
+static JSON_Status writer_make_room(JSON_Writer *writer);
+static void writer_write(JSON_Writer *writer, const char *data, size_t len);
+static JSON_Status writer_finish(JSON_Writer *writer);
+static void json_serialize_to_writer(const JSON_Value *value, JSON_Writer *writer, int is_pretty);
+static int json_serialize_value_start(const JSON_Value *value, JSON_Writer *writer, int is_pretty);
+static void json_serialize_string(const char *string, JSON_Writer *writer);
+static void append_indent(JSON_Writer *writer, int level);
+static void append_string(JSON_Writer *writer, const char *string);
+static char *json_serialize_to_string_internal(JSON_Context *context, const JSON_Value *value,
+                                               int is_pretty);
+static JSON_Value *json_value_deep_copy_internal(JSON_Context *context, const JSON_Value *value);
+static JSON_Value *json_value_copy_node(JSON_Context *context, const JSON_Value *value);
+static size_t json_value_get_child_count(const JSON_Value *value);
+static int json_value_equals_node(const JSON_Value *a, const JSON_Value *b);
 
 /* Various */
-static char *parson_strndup(const char *string, size_t n)
+static void *context_malloc(JSON_Context *context, size_t size)
+{
+    void *block = NULL;
+    int size_class = context->pool_limit != 0 ? pool_class(size) : -1;
+    if (size_class >= 0)
+    { /* a pooled block must fit any request of its class */
+        size = (size_t)POOL_MIN_BLOCK << size_class;
+    }
+    if (context->parsing && context->limits.max_bytes != 0)
+    {
+        if (size > context->limits.max_bytes - context->parse_bytes)
+        {
+            parse_fail(context, JSONParseErrorBytes);
+            return NULL;
+        }
+        context->parse_bytes += size;
+    }
+    if (size_class >= 0 && context->pools[size_class] != NULL)
+    {
+        block = context->pools[size_class];
+        context->pools[size_class] = context->pools[size_class]->next;
+        context->pool_bytes -= size;
+        return block;
+    }
+    block = context->malloc_fun(size);
+    if (block == NULL && context->parsing)
+    {
+        parse_fail(context, JSONParseErrorAllocation);
+    }
+    context->allocated = 1;
+    return block;
+}
+
+/* Frees a block, keeping it for reuse if pooling is on and the pools are below their limit.
+   size may understate the request (strlen of a string with an embedded '\0'), never overstate it:
+   the block then goes to a smaller size class, which it still fits. */
+static void context_free_sized(JSON_Context *context, void *block, size_t size)
+{
+    int size_class = context->pool_limit != 0 ? pool_class(size) : -1;
+    if (block == NULL)
+    {
+        return;
+    }
+    if (size_class >= 0)
+    {
+        size = (size_t)POOL_MIN_BLOCK << size_class;
+        if (context->pool_bytes + size <= context->pool_limit)
+        {
+            ((JSON_Pool_Block *)block)->next = context->pools[size_class];
+            context->pools[size_class] = (JSON_Pool_Block *)block;
+            context->pool_bytes += size;
+            return;
+        }
+    }
+    context->free_fun(block);
+}
+
+static int pool_class(size_t size)
+{
+    int size_class = 0;
+    size_t block_size = POOL_MIN_BLOCK;
+    if (size > POOL_MAX_BLOCK)
+    {
+        return -1;
+    }
+    while (block_size < size)
+    {
+        block_size <<= 1;
+        size_class++;
+    }
+    return size_class;
+}
+
+/* Gives pooled blocks back to free_fun, largest first, until at most keep_bytes are held */
+static void pool_drain(JSON_Context *context, size_t keep_bytes)
+{
+    int size_class = POOL_CLASS_COUNT - 1;
+    JSON_Pool_Block *block = NULL;
+    while (context->pool_bytes > keep_bytes && size_class >= 0)
+    {
+        block = context->pools[size_class];
+        if (block == NULL)
+        {
+            size_class--;
+            continue;
+        }
+        context->pools[size_class] = block->next;
+        context->pool_bytes -= (size_t)POOL_MIN_BLOCK << size_class;
+        context->free_fun(block);
+    }
+}
+
+/* Records why the parse is failing, the first reason wins */
+static void parse_fail(JSON_Context *context, JSON_Parse_Error_Code code)
+{
+    if (context->parse_error.code == JSONParseErrorNone)
+    {
+        context->parse_error.code = code;
+    }
+}
+
+static JSON_Status parse_check_string_length(JSON_Context *context, size_t string_len)
+{
+    if (context->limits.max_string_length != 0 && string_len > context->limits.max_string_length)
+    {
+        parse_fail(context, JSONParseErrorStringLength);
+        return JSONFailure;
+    }
+    return JSONSuccess;
+}
+
+static char *parson_strndup(JSON_Context *context, const char *string, size_t n)
 {
-    char *output_string = (char *)parson_malloc(n + 1);
+    char *output_string = (char *)context_malloc(context, n + 1);
     if (!output_string)
     {
         return NULL;
@@ -171,9 +992,21 @@ static char *parson_strndup(const char *string, size_t n)
     return output_string;
 }
 
-static char *parson_strdup(const char *string)
+static char *parson_strdup(JSON_Context *context, const char *string)
+{
+    return parson_strndup(context, string, strlen(string));
+}
+
+/* FNV-1a */
+static uint32_t hash_name(const char *name, size_t name_len)
 {
-    return parson_strndup(string, strlen(string));
+    uint32_t hash = 2166136261u;
+    while (name_len--)
+    {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
 }
 
 static int hex_char_to_int(char c)
@@ -293,9 +1126,19 @@ static int verify_utf8_sequence(const unsigned char *string, int *len)
 static int is_valid_utf8(const char *string, size_t string_len)
 {
     int len = 0;
+    size_t word = 0;
     const char *string_end = string + string_len;
     while (string < string_end)
     {
+        if ((size_t)(string_end - string) >= sizeof(word))
+        { /* skip whole words of ASCII */
+            memcpy(&word, string, sizeof(word));
+            if ((word & SWAR_HIGHS) == 0)
+            {
+                string += sizeof(word);
+                continue;
+            }
+        }
         if (!verify_utf8_sequence((const unsigned char *)string, &len))
         {
             return 0;
@@ -305,34 +1148,107 @@ static int is_valid_utf8(const char *string, size_t string_len)
     return 1;
 }
 
-static int is_decimal(const char *string, size_t length)
+/* 0x00-0x1F are invalid characters for json string (http://www.ietf.org/rfc/rfc4627.txt) */
+static int has_control_characters(const char *string, size_t string_len)
 {
-    if (length > 1 && string[0] == '0' && string[1] != '.')
-    {
-        return 0;
-    }
-    if (length > 2 && !strncmp(string, "-0", 2) && string[2] != '.')
+    size_t word = 0;
+    while (string_len >= sizeof(word))
     {
-        return 0;
+        memcpy(&word, string, sizeof(word));
+        if (SWAR_HAS_LESS(word, 0x20))
+        {
+            return 1;
+        }
+        string += sizeof(word);
+        string_len -= sizeof(word);
     }
-    while (length--)
+    while (string_len > 0)
     {
-        if (strchr("xX", string[length]))
+        if ((unsigned char)*string < 0x20)
         {
-            return 0;
+            return 1;
         }
+        string++;
+        string_len--;
     }
-    return 1;
+    return 0;
 }
 
-static void remove_comments(char *string, const char *start_token, const char *end_token)
+/* Does an aligned block contain a quote, a backslash or the terminating '\0'? */
+static int block_has_string_special(const char *block)
 {
-    int in_string = 0, escaped = 0;
-    size_t i;
-    char *ptr = NULL, current_char;
-    size_t start_token_len = strlen(start_token);
-    size_t end_token_len = strlen(end_token);
-    if (start_token_len == 0 || end_token_len == 0)
+#if defined(__SSE2__)
+    __m128i chunk = _mm_load_si128((const __m128i *)(const void *)block);
+    __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\"')),
+                                             _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\'))),
+                                _mm_cmpeq_epi8(chunk, _mm_setzero_si128()));
+    return _mm_movemask_epi8(hits) != 0;
+#elif defined(__ARM_NEON)
+    uint8x16_t chunk = vld1q_u8((const uint8_t *)block);
+    uint64x2_t hits = vreinterpretq_u64_u8(
+        vorrq_u8(vorrq_u8(vceqq_u8(chunk, vdupq_n_u8('\"')), vceqq_u8(chunk, vdupq_n_u8('\\'))),
+                 vceqq_u8(chunk, vdupq_n_u8(0))));
+    return (vgetq_lane_u64(hits, 0) | vgetq_lane_u64(hits, 1)) != 0;
+#else
+    size_t word = 0;
+    memcpy(&word, block, sizeof(word));
+    return (SWAR_HAS_ZERO(word) | SWAR_HAS_BYTE(word, '\"') | SWAR_HAS_BYTE(word, '\\')) != 0;
+#endif
+}
+
+/* Returns the first quote, backslash or '\0' in a string body. Blocks are read aligned, so the
+   scan may look at bytes past the terminator, but never past the page holding it. */
+static const char *scan_string_body(const char *string)
+{
+#if !defined(__SANITIZE_ADDRESS__)
+    while (((uintptr_t)string & (SCAN_BLOCK_SIZE - 1)) != 0)
+    {
+        if (*string == '\"' || *string == '\\' || *string == '\0')
+        {
+            return string;
+        }
+        string++;
+    }
+    while (!block_has_string_special(string))
+    {
+        string += SCAN_BLOCK_SIZE;
+    }
+#endif
+    while (*string != '\"' && *string != '\\' && *string != '\0')
+    {
+        string++;
+    }
+    return string;
+}
+
+static int is_decimal(const char *string, size_t length)
+{
+    if (length > 1 && string[0] == '0' && string[1] != '.')
+    {
+        return 0;
+    }
+    if (length > 2 && !strncmp(string, "-0", 2) && string[2] != '.')
+    {
+        return 0;
+    }
+    while (length--)
+    {
+        if (strchr("xX", string[length]))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void remove_comments(char *string, const char *start_token, const char *end_token)
+{
+    int in_string = 0, escaped = 0;
+    size_t i;
+    char *ptr = NULL, current_char;
+    size_t start_token_len = strlen(start_token);
+    size_t end_token_len = strlen(end_token);
+    if (start_token_len == 0 || end_token_len == 0)
     {
         return;
     }
@@ -371,19 +1287,140 @@ static void remove_comments(char *string, const char *start_token, const char *e
     }
 }
 
+/* Key interning */
+static void intern_table_grow(JSON_Context *context)
+{
+    JSON_Intern_Table *table = &context->intern_table;
+    size_t new_bucket_count = MAX(table->bucket_count * 2, INTERN_STARTING_BUCKETS);
+    size_t i = 0;
+    JSON_Intern_Entry **new_buckets = NULL, *entry = NULL, *next = NULL;
+    new_buckets = (JSON_Intern_Entry **)context_malloc(context, new_bucket_count *
+                                                                    sizeof(JSON_Intern_Entry *));
+    if (new_buckets == NULL)
+    {
+        return; /* keep using longer chains */
+    }
+    memset(new_buckets, 0, new_bucket_count * sizeof(JSON_Intern_Entry *));
+    for (i = 0; i < table->bucket_count; i++)
+    {
+        for (entry = table->buckets[i]; entry != NULL; entry = next)
+        {
+            next = entry->next;
+            entry->next = new_buckets[entry->hash & (new_bucket_count - 1)];
+            new_buckets[entry->hash & (new_bucket_count - 1)] = entry;
+        }
+    }
+    context_free_sized(context, table->buckets, table->bucket_count * sizeof(JSON_Intern_Entry *));
+    table->buckets = new_buckets;
+    table->bucket_count = new_bucket_count;
+}
+
+static char *intern_name(JSON_Context *context, const char *name, size_t name_len, uint32_t hash)
+{
+    JSON_Intern_Table *table = &context->intern_table;
+    JSON_Intern_Entry *entry = NULL, **bucket = NULL;
+    if (table->bucket_count > 0)
+    {
+        for (entry = table->buckets[hash & (table->bucket_count - 1)]; entry != NULL;
+             entry = entry->next)
+        {
+            if (entry->hash == hash && strncmp(entry->name, name, name_len) == 0 &&
+                entry->name[name_len] == '\0')
+            {
+                entry->refcount++;
+                return entry->name;
+            }
+        }
+    }
+    if (table->count >= table->bucket_count / 4 * 3)
+    {
+        intern_table_grow(context);
+        if (table->bucket_count == 0)
+        {
+            return NULL;
+        }
+    }
+    entry = (JSON_Intern_Entry *)context_malloc(context, offsetof(JSON_Intern_Entry, name) +
+                                                             name_len + 1);
+    if (entry == NULL)
+    {
+        return NULL;
+    }
+    memcpy(entry->name, name, name_len);
+    entry->name[name_len] = '\0';
+    entry->hash = hash;
+    entry->refcount = 1;
+    bucket = &table->buckets[hash & (table->bucket_count - 1)];
+    entry->next = *bucket;
+    *bucket = entry;
+    table->count++;
+    return entry->name;
+}
+
+static void intern_release(JSON_Context *context, char *name)
+{
+    JSON_Intern_Table *table = &context->intern_table;
+    JSON_Intern_Entry *entry = (JSON_Intern_Entry *)(void *)(name - offsetof(JSON_Intern_Entry, name));
+    JSON_Intern_Entry **link = NULL;
+    if (--entry->refcount > 0)
+    {
+        return;
+    }
+    link = &table->buckets[entry->hash & (table->bucket_count - 1)];
+    while (*link != entry)
+    {
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+    context_free_sized(context, entry, offsetof(JSON_Intern_Entry, name) + strlen(name) + 1);
+    table->count--;
+    if (table->count == 0)
+    { /* give the buckets back once no document uses the table */
+        context_free_sized(context, table->buckets,
+                           table->bucket_count * sizeof(JSON_Intern_Entry *));
+        table->buckets = NULL;
+        table->bucket_count = 0;
+    }
+}
+
+static char *json_object_store_name(const JSON_Object *object, const char *name, size_t name_len,
+                                    uint32_t hash)
+{
+    if (object->interned_names)
+    {
+        return intern_name(object_context(object), name, name_len, hash);
+    }
+    return parson_strndup(object_context(object), name, name_len);
+}
+
+static void json_object_release_name(const JSON_Object *object, char *name)
+{
+    if (object->interned_names)
+    {
+        intern_release(object_context(object), name);
+    }
+    else
+    {
+        context_free_sized(object_context(object), name, strlen(name) + 1);
+    }
+}
+
 /* JSON Object */
 static JSON_Object *json_object_init(JSON_Value *wrapping_value)
 {
-    JSON_Object *new_obj = (JSON_Object *)parson_malloc(sizeof(JSON_Object));
+    JSON_Object *new_obj =
+        (JSON_Object *)context_malloc(wrapping_value->context, sizeof(JSON_Object));
     if (new_obj == NULL)
     {
         return NULL;
     }
     new_obj->wrapping_value = wrapping_value;
     new_obj->names = (char **)NULL;
+    new_obj->hashes = (uint32_t *)NULL;
     new_obj->values = (JSON_Value **)NULL;
     new_obj->capacity = 0;
     new_obj->count = 0;
+    new_obj->interned_names = wrapping_value->context->intern_keys;
     return new_obj;
 }
 
@@ -400,11 +1437,13 @@ static JSON_Status json_object_addn(JSON_Object *object, const char *name, size_
                                     JSON_Value *value)
 {
     size_t index = 0;
+    uint32_t hash = 0;
     if (object == NULL || name == NULL || value == NULL)
     {
         return JSONFailure;
     }
-    if (json_object_getn_value(object, name, name_len) != NULL)
+    hash = hash_name(name, name_len);
+    if (json_object_getn_value_hashed(object, name, name_len, hash) != NULL)
     {
         return JSONFailure;
     }
@@ -417,11 +1456,12 @@ static JSON_Status json_object_addn(JSON_Object *object, const char *name, size_
         }
     }
     index = object->count;
-    object->names[index] = parson_strndup(name, name_len);
+    object->names[index] = json_object_store_name(object, name, name_len, hash);
     if (object->names[index] == NULL)
     {
         return JSONFailure;
     }
+    object->hashes[index] = hash;
     value->parent = json_object_get_wrapping_value(object);
     object->values[index] = value;
     object->count++;
@@ -430,7 +1470,9 @@ static JSON_Status json_object_addn(JSON_Object *object, const char *name, size_
 
 static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity)
 {
+    JSON_Context *context = object_context(object);
     char **temp_names = NULL;
+    uint32_t *temp_hashes = NULL;
     JSON_Value **temp_values = NULL;
 
     if ((object->names == NULL && object->values != NULL) ||
@@ -438,25 +1480,35 @@ static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity)
     {
         return JSONFailure; /* Shouldn't happen */
     }
-    temp_names = (char **)parson_malloc(new_capacity * sizeof(char *));
+    temp_names = (char **)context_malloc(context, new_capacity * sizeof(char *));
     if (temp_names == NULL)
     {
         return JSONFailure;
     }
-    temp_values = (JSON_Value **)parson_malloc(new_capacity * sizeof(JSON_Value *));
+    temp_hashes = (uint32_t *)context_malloc(context, new_capacity * sizeof(uint32_t));
+    if (temp_hashes == NULL)
+    {
+        context_free_sized(context, temp_names, new_capacity * sizeof(char *));
+        return JSONFailure;
+    }
+    temp_values = (JSON_Value **)context_malloc(context, new_capacity * sizeof(JSON_Value *));
     if (temp_values == NULL)
     {
-        parson_free(temp_names);
+        context_free_sized(context, temp_names, new_capacity * sizeof(char *));
+        context_free_sized(context, temp_hashes, new_capacity * sizeof(uint32_t));
         return JSONFailure;
     }
     if (object->names != NULL && object->values != NULL && object->count > 0)
     {
         memcpy(temp_names, object->names, object->count * sizeof(char *));
+        memcpy(temp_hashes, object->hashes, object->count * sizeof(uint32_t));
         memcpy(temp_values, object->values, object->count * sizeof(JSON_Value *));
     }
-    parson_free(object->names);
-    parson_free(object->values);
+    context_free_sized(context, object->names, object->capacity * sizeof(char *));
+    context_free_sized(context, object->hashes, object->capacity * sizeof(uint32_t));
+    context_free_sized(context, object->values, object->capacity * sizeof(JSON_Value *));
     object->names = temp_names;
+    object->hashes = temp_hashes;
     object->values = temp_values;
     object->capacity = new_capacity;
     return JSONSuccess;
@@ -465,15 +1517,24 @@ static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity)
 static JSON_Value *json_object_getn_value(const JSON_Object *object, const char *name,
                                           size_t name_len)
 {
-    size_t i, name_length;
+    return json_object_getn_value_hashed(object, name, name_len, hash_name(name, name_len));
+}
+
+static JSON_Value *json_object_getn_value_hashed(const JSON_Object *object, const char *name,
+                                                 size_t name_len, uint32_t hash)
+{
+    size_t i;
     for (i = 0; i < json_object_get_count(object); i++)
     {
-        name_length = strlen(object->names[i]);
-        if (name_length != name_len)
+        if (object->names[i] == name)
+        { /* same interned name */
+            return object->values[i];
+        }
+        if (object->hashes[i] != hash)
         {
             continue;
         }
-        if (strncmp(object->names[i], name, name_len) == 0)
+        if (strncmp(object->names[i], name, name_len) == 0 && object->names[i][name_len] == '\0')
         {
             return object->values[i];
         }
@@ -494,7 +1555,7 @@ static JSON_Status json_object_remove_internal(JSON_Object *object, const char *
     {
         if (strcmp(object->names[i], name) == 0)
         {
-            parson_free(object->names[i]);
+            json_object_release_name(object, object->names[i]);
             if (free_value)
             {
                 json_value_free(object->values[i]);
@@ -502,6 +1563,7 @@ static JSON_Status json_object_remove_internal(JSON_Object *object, const char *
             if (i != last_item_index)
             { /* Replace key value pair with one from the end */
                 object->names[i] = object->names[last_item_index];
+                object->hashes[i] = object->hashes[last_item_index];
                 object->values[i] = object->values[last_item_index];
             }
             object->count -= 1;
@@ -532,21 +1594,18 @@ static JSON_Status json_object_dotremove_internal(JSON_Object *object, const cha
 
 static void json_object_free(JSON_Object *object)
 {
-    size_t i;
-    for (i = 0; i < object->count; i++)
-    {
-        parson_free(object->names[i]);
-        json_value_free(object->values[i]);
-    }
-    parson_free(object->names);
-    parson_free(object->values);
-    parson_free(object);
+    JSON_Context *context = object_context(object);
+    context_free_sized(context, object->names, object->capacity * sizeof(char *));
+    context_free_sized(context, object->hashes, object->capacity * sizeof(uint32_t));
+    context_free_sized(context, object->values, object->capacity * sizeof(JSON_Value *));
+    context_free_sized(context, object, sizeof(JSON_Object));
 }
 
 /* JSON Array */
 static JSON_Array *json_array_init(JSON_Value *wrapping_value)
 {
-    JSON_Array *new_array = (JSON_Array *)parson_malloc(sizeof(JSON_Array));
+    JSON_Array *new_array =
+        (JSON_Array *)context_malloc(wrapping_value->context, sizeof(JSON_Array));
     if (new_array == NULL)
     {
         return NULL;
@@ -581,7 +1640,8 @@ static JSON_Status json_array_resize(JSON_Array *array, size_t new_capacity)
     {
         return JSONFailure;
     }
-    new_items = (JSON_Value **)parson_malloc(new_capacity * sizeof(JSON_Value *));
+    new_items =
+        (JSON_Value **)context_malloc(array_context(array), new_capacity * sizeof(JSON_Value *));
     if (new_items == NULL)
     {
         return JSONFailure;
@@ -590,7 +1650,7 @@ static JSON_Status json_array_resize(JSON_Array *array, size_t new_capacity)
     {
         memcpy(new_items, array->items, array->count * sizeof(JSON_Value *));
     }
-    parson_free(array->items);
+    context_free_sized(array_context(array), array->items, array->capacity * sizeof(JSON_Value *));
     array->items = new_items;
     array->capacity = new_capacity;
     return JSONSuccess;
@@ -598,29 +1658,81 @@ static JSON_Status json_array_resize(JSON_Array *array, size_t new_capacity)
 
 static void json_array_free(JSON_Array *array)
 {
-    size_t i;
-    for (i = 0; i < array->count; i++)
+    context_free_sized(array_context(array), array->items, array->capacity * sizeof(JSON_Value *));
+    context_free_sized(array_context(array), array, sizeof(JSON_Array));
+}
+
+/* JSON Value */
+static JSON_Value *json_value_alloc(JSON_Context *context, JSON_Value_Type type)
+{
+    JSON_Value *new_value = NULL;
+    if (context->parsing && context->limits.max_values != 0 &&
+        context->parse_values++ >= context->limits.max_values)
+    {
+        parse_fail(context, JSONParseErrorValues);
+        return NULL;
+    }
+    new_value = (JSON_Value *)context_malloc(context, sizeof(JSON_Value));
+    if (new_value == NULL)
     {
-        json_value_free(array->items[i]);
+        return NULL;
     }
-    parson_free(array->items);
-    parson_free(array);
+    new_value->parent = NULL;
+    new_value->context = context;
+    new_value->type = type;
+    return new_value;
 }
 
-/* JSON Value */
-static JSON_Value *json_value_init_string_no_copy(char *string)
+static JSON_Value *json_value_init_string_no_copy(JSON_Context *context, char *string)
 {
-    JSON_Value *new_value = (JSON_Value *)parson_malloc(sizeof(JSON_Value));
+    JSON_Value *new_value = json_value_alloc(context, JSONString);
     if (!new_value)
     {
         return NULL;
     }
-    new_value->parent = NULL;
-    new_value->type = JSONString;
     new_value->value.string = string;
     return new_value;
 }
 
+static JSON_Value *json_value_init_string_n(JSON_Context *context, const char *string,
+                                            size_t string_len)
+{
+    JSON_Value *new_value = NULL;
+    char *copy = NULL;
+    if (string_len >= INLINE_STRING_SIZE)
+    {
+        copy = parson_strndup(context, string, string_len);
+        if (copy == NULL)
+        {
+            return NULL;
+        }
+        new_value = json_value_init_string_no_copy(context, copy);
+        if (new_value == NULL)
+        {
+            context_free_sized(context, copy, string_len + 1);
+        }
+        return new_value;
+    }
+    new_value = json_value_alloc(context, JSON_INLINE_STRING);
+    if (new_value == NULL)
+    {
+        return NULL;
+    }
+    memcpy(new_value->value.inline_string, string, string_len);
+    new_value->value.inline_string[string_len] = '\0';
+    return new_value;
+}
+
+static JSON_Context *object_context(const JSON_Object *object)
+{
+    return object != NULL ? object->wrapping_value->context : &default_context;
+}
+
+static JSON_Context *array_context(const JSON_Array *array)
+{
+    return array != NULL ? array->wrapping_value->context : &default_context;
+}
+
 /* Parser */
 static JSON_Status skip_quotes(const char **string)
 {
@@ -629,19 +1741,21 @@ static JSON_Status skip_quotes(const char **string)
         return JSONFailure;
     }
     SKIP_CHAR(string);
-    while (**string != '\"')
+    for (;;)
     {
-        if (**string == '\0')
+        *string = scan_string_body(*string);
+        if (**string == '\"')
+        {
+            break;
+        }
+        else if (**string == '\0')
         {
             return JSONFailure;
         }
-        else if (**string == '\\')
+        SKIP_CHAR(string); /* backslash */
+        if (**string == '\0')
         {
-            SKIP_CHAR(string);
-            if (**string == '\0')
-            {
-                return JSONFailure;
-            }
+            return JSONFailure;
         }
         SKIP_CHAR(string);
     }
@@ -710,93 +1824,113 @@ static int parse_utf16(const char **unprocessed, char **processed)
     return JSONSuccess;
 }
 
-/* Copies and processes passed string up to supplied length.
-Example: "\u006Corem ipsum" -> lorem ipsum */
-static char *process_string(const char *input, size_t len)
+/* Copies and processes passed string up to supplied length into output, which must have room
+for len + 1 chars (unescaping never makes a string longer).
+Example: "\u006Corem ipsum" -> lorem ipsum
+Text between escapes is copied in bulk. */
+static JSON_Status unescape_string(const char *input, size_t len, char *output,
+                                   size_t *output_len)
 {
-    const char *input_ptr = input;
-    size_t initial_size = (len + 1) * sizeof(char);
-    size_t final_size = 0;
-    char *output = NULL, *output_ptr = NULL, *resized_output = NULL;
-    output = (char *)parson_malloc(initial_size);
-    if (output == NULL)
-    {
-        goto error;
-    }
-    output_ptr = output;
-    while ((*input_ptr != '\0') && (size_t)(input_ptr - input) < len)
+    const char *input_ptr = input, *input_end = input + len, *run_end = NULL;
+    char *output_ptr = output;
+    while (input_ptr < input_end)
     {
-        if (*input_ptr == '\\')
+        run_end = (const char *)memchr(input_ptr, '\\', (size_t)(input_end - input_ptr));
+        if (run_end == NULL)
         {
-            input_ptr++;
-            switch (*input_ptr)
-            {
-            case '\"':
-                *output_ptr = '\"';
-                break;
-            case '\\':
-                *output_ptr = '\\';
-                break;
-            case '/':
-                *output_ptr = '/';
-                break;
-            case 'b':
-                *output_ptr = '\b';
-                break;
-            case 'f':
-                *output_ptr = '\f';
-                break;
-            case 'n':
-                *output_ptr = '\n';
-                break;
-            case 'r':
-                *output_ptr = '\r';
-                break;
-            case 't':
-                *output_ptr = '\t';
-                break;
-            case 'u':
-                if (parse_utf16(&input_ptr, &output_ptr) == JSONFailure)
-                {
-                    goto error;
-                }
-                break;
-            default:
-                goto error;
-            }
+            run_end = input_end;
         }
-        else if ((unsigned char)*input_ptr < 0x20)
+        if (has_control_characters(input_ptr, (size_t)(run_end - input_ptr)))
         {
-            goto error; /* 0x00-0x19 are invalid characters for json string
-                           (http://www.ietf.org/rfc/rfc4627.txt) */
+            return JSONFailure;
         }
-        else
+        memcpy(output_ptr, input_ptr, (size_t)(run_end - input_ptr));
+        output_ptr += run_end - input_ptr;
+        input_ptr = run_end;
+        if (input_ptr == input_end)
         {
-            *output_ptr = *input_ptr;
+            break;
+        }
+        input_ptr++;
+        switch (*input_ptr)
+        {
+        case '\"':
+            *output_ptr = '\"';
+            break;
+        case '\\':
+            *output_ptr = '\\';
+            break;
+        case '/':
+            *output_ptr = '/';
+            break;
+        case 'b':
+            *output_ptr = '\b';
+            break;
+        case 'f':
+            *output_ptr = '\f';
+            break;
+        case 'n':
+            *output_ptr = '\n';
+            break;
+        case 'r':
+            *output_ptr = '\r';
+            break;
+        case 't':
+            *output_ptr = '\t';
+            break;
+        case 'u':
+            if (parse_utf16(&input_ptr, &output_ptr) == JSONFailure)
+            {
+                return JSONFailure;
+            }
+            break;
+        default:
+            return JSONFailure;
         }
         output_ptr++;
         input_ptr++;
     }
     *output_ptr = '\0';
+    *output_len = (size_t)(output_ptr - output);
+    return JSONSuccess;
+}
+
+/* Like unescape_string, but returns a newly allocated string. */
+static char *process_string(JSON_Context *context, const char *input, size_t len)
+{
+    size_t initial_size = (len + 1) * sizeof(char);
+    size_t final_size = 0;
+    char *output = NULL, *resized_output = NULL;
+    output = (char *)context_malloc(context, initial_size);
+    if (output == NULL)
+    {
+        return NULL;
+    }
+    if (unescape_string(input, len, output, &final_size) == JSONFailure)
+    {
+        context_free_sized(context, output, initial_size);
+        return NULL;
+    }
+    final_size += 1;
+    if (final_size == initial_size)
+    { /* no escapes, nothing to trim */
+        return output;
+    }
     /* resize to new length */
-    final_size = (size_t)(output_ptr - output) + 1;
-    /* todo: don't resize if final_size == initial_size */
-    resized_output = (char *)parson_malloc(final_size);
+    resized_output = (char *)context_malloc(context, final_size);
     if (resized_output == NULL)
     {
-        goto error;
+        context_free_sized(context, output, initial_size);
+        return NULL;
     }
     memcpy(resized_output, output, final_size);
-    parson_free(output);
+    context_free_sized(context, output, initial_size);
     return resized_output;
-error:
-    parson_free(output);
-    return NULL;
 }
 
 /* Return processed contents of a string between quotes and
    skips passed argument to a matching quote. */
-static char *get_quoted_string(const char **string)
+static char *get_quoted_string(JSON_Context *context, const char **string)
 {
     const char *string_start = *string;
     size_t string_len = 0;
@@ -806,608 +1940,923 @@ static char *get_quoted_string(const char **string)
         return NULL;
     }
     string_len = (size_t)(*string - string_start - 2); /* length without quotes */
-    return process_string(string_start + 1, string_len);
+    if (parse_check_string_length(context, string_len) == JSONFailure)
+    {
+        return NULL;
+    }
+    return process_string(context, string_start + 1, string_len);
+}
+
+static void parse_stack_init(JSON_Parse_Stack *stack, JSON_Context *context)
+{
+    stack->context = context;
+    stack->frames = stack->inline_frames;
+    stack->count = 0;
+    stack->capacity = PARSE_STACK_INLINE;
 }
 
-static JSON_Value *parse_value(const char **string, size_t nesting)
+static JSON_Status parse_stack_push(JSON_Parse_Stack *stack, JSON_Value *value)
 {
-    if (nesting > MAX_NESTING)
+    JSON_Context *context = stack->context;
+    JSON_Parse_Frame *new_frames = NULL;
+    size_t new_capacity = 0;
+    if (stack->count >= context->max_nesting)
     {
-        return NULL;
+        parse_fail(context, JSONParseErrorNesting);
+        return JSONFailure;
     }
-    SKIP_WHITESPACES(string);
-    switch (**string)
+    if (stack->count >= stack->capacity)
     {
-    case '{':
-        return parse_object_value(string, nesting + 1);
-    case '[':
-        return parse_array_value(string, nesting + 1);
-    case '\"':
-        return parse_string_value(string);
-    case 'f':
-    case 't':
-        return parse_boolean_value(string);
-    case '-':
-    case '0':
-    case '1':
-    case '2':
-    case '3':
-    case '4':
-    case '5':
-    case '6':
-    case '7':
-    case '8':
-    case '9':
-        return parse_number_value(string);
-    case 'n':
-        return parse_null_value(string);
-    default:
-        return NULL;
+        new_capacity = stack->capacity * 2;
+        if (new_capacity > context->max_nesting)
+        {
+            new_capacity = context->max_nesting;
+        }
+        if (context->scratch_capacity >= new_capacity)
+        { /* scratch frames left by an earlier parse are big enough */
+            memcpy(context->scratch_frames, stack->frames, stack->count * sizeof(JSON_Parse_Frame));
+        }
+        else
+        {
+            new_frames = (JSON_Parse_Frame *)context_malloc(context, new_capacity *
+                                                                         sizeof(JSON_Parse_Frame));
+            if (new_frames == NULL)
+            {
+                return JSONFailure;
+            }
+            memcpy(new_frames, stack->frames, stack->count * sizeof(JSON_Parse_Frame));
+            context_free_sized(context, context->scratch_frames,
+                               context->scratch_capacity * sizeof(JSON_Parse_Frame));
+            context->scratch_frames = new_frames;
+            context->scratch_capacity = new_capacity;
+        }
+        stack->frames = context->scratch_frames;
+        stack->capacity = context->scratch_capacity;
     }
+    stack->frames[stack->count].value = value;
+    stack->frames[stack->count].key = NULL;
+    stack->count++;
+    return JSONSuccess;
 }
 
-static JSON_Value *parse_object_value(const char **string, size_t nesting)
+/* Frees containers that were never closed (and so never attached to a parent) */
+static void parse_stack_free(JSON_Parse_Stack *stack)
 {
-    JSON_Value *output_value = NULL, *new_value = NULL;
-    JSON_Object *output_object = NULL;
-    char *new_key = NULL;
-    output_value = json_value_init_object();
-    if (output_value == NULL)
+    JSON_Context *context = stack->context;
+    while (stack->count > 0)
     {
-        return NULL;
+        stack->count--;
+        if (stack->frames[stack->count].key != NULL)
+        {
+            context_free_sized(context, stack->frames[stack->count].key,
+                               strlen(stack->frames[stack->count].key) + 1);
+        }
+        json_value_free(stack->frames[stack->count].value);
     }
-    if (**string != '{')
-    {
-        json_value_free(output_value);
-        return NULL;
+    if (context->scratch_capacity > PARSE_SCRATCH_RETAIN)
+    { /* a rare deep document shouldn't pin its stack for good */
+        context_free_sized(context, context->scratch_frames,
+                           context->scratch_capacity * sizeof(JSON_Parse_Frame));
+        context->scratch_frames = NULL;
+        context->scratch_capacity = 0;
     }
-    output_object = json_value_get_object(output_value);
-    SKIP_CHAR(string);
-    SKIP_WHITESPACES(string);
-    if (**string == '}')
-    { /* empty object */
-        SKIP_CHAR(string);
-        return output_value;
+    stack->frames = stack->inline_frames;
+}
+
+static void walk_stack_init(JSON_Walk_Stack *stack, JSON_Context *context)
+{
+    stack->context = context;
+    stack->frames = stack->inline_frames;
+    stack->count = 0;
+    stack->capacity = PARSE_STACK_INLINE;
+}
+
+static JSON_Status walk_stack_push(JSON_Walk_Stack *stack, const JSON_Value *value)
+{
+    JSON_Walk_Frame *new_frames = NULL;
+    size_t new_capacity = 0;
+    if (stack->count >= stack->context->max_nesting)
+    {
+        return JSONFailure;
     }
-    while (**string != '\0')
+    if (stack->count >= stack->capacity)
     {
-        new_key = get_quoted_string(string);
-        if (new_key == NULL)
-        {
-            json_value_free(output_value);
-            return NULL;
-        }
-        SKIP_WHITESPACES(string);
-        if (**string != ':')
-        {
-            parson_free(new_key);
-            json_value_free(output_value);
-            return NULL;
-        }
-        SKIP_CHAR(string);
-        new_value = parse_value(string, nesting);
-        if (new_value == NULL)
+        new_capacity = stack->capacity * 2;
+        new_frames = (JSON_Walk_Frame *)context_malloc(stack->context,
+                                                       new_capacity * sizeof(JSON_Walk_Frame));
+        if (new_frames == NULL)
         {
-            parson_free(new_key);
-            json_value_free(output_value);
-            return NULL;
-        }
-        if (json_object_add(output_object, new_key, new_value) == JSONFailure)
-        {
-            parson_free(new_key);
-            json_value_free(new_value);
-            json_value_free(output_value);
-            return NULL;
-        }
-        parson_free(new_key);
-        SKIP_WHITESPACES(string);
-        if (**string != ',')
-        {
-            break;
+            return JSONFailure;
         }
-        SKIP_CHAR(string);
-        SKIP_WHITESPACES(string);
+        memcpy(new_frames, stack->frames, stack->count * sizeof(JSON_Walk_Frame));
+        walk_stack_free(stack);
+        stack->frames = new_frames;
+        stack->capacity = new_capacity;
+    }
+    stack->frames[stack->count].value = value;
+    stack->frames[stack->count].other = NULL;
+    stack->frames[stack->count].result = NULL;
+    stack->frames[stack->count].index = 0;
+    stack->count++;
+    return JSONSuccess;
+}
+
+/* Releases the frames, not the values they point at */
+static void walk_stack_free(JSON_Walk_Stack *stack)
+{
+    if (stack->frames != stack->inline_frames)
+    {
+        context_free_sized(stack->context, stack->frames,
+                           stack->capacity * sizeof(JSON_Walk_Frame));
+        stack->frames = stack->inline_frames;
+        stack->capacity = PARSE_STACK_INLINE;
+    }
+}
+
+static JSON_Status parse_object_key(const char **string, JSON_Parse_Frame *frame)
+{
+    frame->key = get_quoted_string(frame->value->context, string);
+    if (frame->key == NULL)
+    {
+        return JSONFailure;
     }
     SKIP_WHITESPACES(string);
-    if (**string != '}' || /* Trim object after parsing is over */
-        json_object_resize(output_object, json_object_get_count(output_object)) == JSONFailure)
+    if (**string != ':')
     {
-        json_value_free(output_value);
-        return NULL;
+        return JSONFailure;
     }
     SKIP_CHAR(string);
-    return output_value;
+    return JSONSuccess;
 }
 
-static JSON_Value *parse_array_value(const char **string, size_t nesting)
+static JSON_Status parse_frame_add(JSON_Parse_Frame *frame, JSON_Value *value)
 {
-    JSON_Value *output_value = NULL, *new_array_value = NULL;
-    JSON_Array *output_array = NULL;
-    output_value = json_value_init_array();
-    if (output_value == NULL)
+    JSON_Context *context = frame->value->context;
+    JSON_Object *object = json_value_get_object(frame->value);
+    JSON_Array *array = json_value_get_array(frame->value);
+    JSON_Status status = JSONFailure;
+    if (object != NULL)
     {
-        return NULL;
+        status = json_object_add(object, frame->key, value);
+        context_free_sized(context, frame->key, strlen(frame->key) + 1);
+        frame->key = NULL;
+        return status;
     }
-    if (**string != '[')
+    return json_array_add(array, value);
+}
+
+/* Called when another member or item starts, so the error points at it rather than at the end
+   of its value */
+static JSON_Status parse_check_container_size(JSON_Parse_Frame *frame)
+{
+    JSON_Context *context = frame->value->context;
+    JSON_Object *object = json_value_get_object(frame->value);
+    size_t count = object != NULL ? json_object_get_count(object)
+                                  : json_array_get_count(json_value_get_array(frame->value));
+    if (context->limits.max_container_size != 0 && count >= context->limits.max_container_size)
     {
-        json_value_free(output_value);
-        return NULL;
+        parse_fail(context, JSONParseErrorContainerSize);
+        return JSONFailure;
     }
-    output_array = json_value_get_array(output_value);
-    SKIP_CHAR(string);
-    SKIP_WHITESPACES(string);
-    if (**string == ']')
-    { /* empty array */
-        SKIP_CHAR(string);
-        return output_value;
+    return JSONSuccess;
+}
+
+static JSON_Value *parse_scalar_value(JSON_Context *context, const char **string)
+{
+    switch (**string)
+    {
+    case '\"':
+        return parse_string_value(context, string);
+    case 'f':
+    case 't':
+        return parse_boolean_value(context, string);
+    case '-':
+    case '0':
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+    case '8':
+    case '9':
+        return parse_number_value(context, string);
+    case 'n':
+        return parse_null_value(context, string);
+    default:
+        return NULL;
     }
-    while (**string != '\0')
+}
+
+/* Parses one value without recursing: open objects and arrays are kept on an explicit stack, so
+   C stack usage doesn't depend on how deeply the input is nested. The context's limits apply to
+   this one parse; on failure its parse_error says why and at which token. */
+static JSON_Value *parse_value(JSON_Context *context, const char **string)
+{
+    JSON_Parse_Stack stack;
+    JSON_Parse_Frame *top = NULL;
+    JSON_Value *value = NULL;
+    const char *begin = *string, *token = *string;
+    char close_char = '\0';
+    parse_stack_init(&stack, context);
+    context->parsing = 1;
+    context->parse_bytes = 0;
+    context->parse_values = 0;
+    context->parse_error.code = JSONParseErrorNone;
+    context->parse_error.offset = 0;
+    for (;;)
     {
-        new_array_value = parse_value(string, nesting);
-        if (new_array_value == NULL)
+        SKIP_WHITESPACES(string);
+        token = *string;
+        if (**string == '{' || **string == '[')
         {
-            json_value_free(output_value);
-            return NULL;
+            close_char = **string == '{' ? '}' : ']';
+            value = close_char == '}' ? json_value_init_object_ctx(context)
+                                      : json_value_init_array_ctx(context);
+            if (value == NULL)
+            {
+                goto error;
+            }
+            SKIP_CHAR(string);
+            SKIP_WHITESPACES(string);
+            if (**string == close_char)
+            { /* empty object or array */
+                SKIP_CHAR(string);
+            }
+            else
+            {
+                if (parse_stack_push(&stack, value) == JSONFailure)
+                {
+                    json_value_free(value);
+                    goto error;
+                }
+                top = &stack.frames[stack.count - 1];
+                token = *string;
+                if (close_char == '}' && parse_object_key(string, top) == JSONFailure)
+                {
+                    goto error;
+                }
+                continue;
+            }
         }
-        if (json_array_add(output_array, new_array_value) == JSONFailure)
+        else
         {
-            json_value_free(new_array_value);
-            json_value_free(output_value);
-            return NULL;
+            value = parse_scalar_value(context, string);
+            if (value == NULL)
+            {
+                goto error;
+            }
         }
-        SKIP_WHITESPACES(string);
-        if (**string != ',')
+
+        /* Attach the finished value to its parent, closing every container that ends here */
+        for (;;)
         {
-            break;
+            if (stack.count == 0)
+            {
+                parse_stack_free(&stack);
+                context->parsing = 0;
+                return value;
+            }
+            top = &stack.frames[stack.count - 1];
+            if (parse_frame_add(top, value) == JSONFailure)
+            {
+                json_value_free(value);
+                goto error;
+            }
+            SKIP_WHITESPACES(string);
+            token = *string;
+            if (**string == ',')
+            {
+                break;
+            }
+            if (json_value_get_type(top->value) == JSONObject)
+            {
+                if (**string != '}' || /* Trim object after parsing is over */
+                    json_object_resize(json_value_get_object(top->value),
+                                       json_object_get_count(json_value_get_object(top->value))) ==
+                        JSONFailure)
+                {
+                    goto error;
+                }
+            }
+            else if (**string != ']' || /* Trim array after parsing is over */
+                     json_array_resize(json_value_get_array(top->value),
+                                       json_array_get_count(json_value_get_array(top->value))) ==
+                         JSONFailure)
+            {
+                goto error;
+            }
+            SKIP_CHAR(string);
+            value = top->value;
+            stack.count--;
         }
         SKIP_CHAR(string);
         SKIP_WHITESPACES(string);
+        token = *string;
+        if (parse_check_container_size(top) == JSONFailure ||
+            (json_value_get_type(top->value) == JSONObject &&
+             parse_object_key(string, top) == JSONFailure))
+        {
+            goto error;
+        }
     }
-    SKIP_WHITESPACES(string);
-    if (**string != ']' || /* Trim array after parsing is over */
-        json_array_resize(output_array, json_array_get_count(output_array)) == JSONFailure)
-    {
-        json_value_free(output_value);
-        return NULL;
-    }
-    SKIP_CHAR(string);
-    return output_value;
+error:
+    parse_stack_free(&stack);
+    context->parsing = 0;
+    parse_fail(context, JSONParseErrorSyntax);
+    context->parse_error.offset = (size_t)(token - begin);
+    return NULL;
 }
 
-static JSON_Value *parse_string_value(const char **string)
+static JSON_Value *parse_string_value(JSON_Context *context, const char **string)
 {
     JSON_Value *value = NULL;
-    char *new_string = get_quoted_string(string);
+    const char *string_start = *string;
+    size_t string_len = 0, unescaped_len = 0;
+    char *new_string = NULL;
+    if (skip_quotes(string) != JSONSuccess)
+    {
+        return NULL;
+    }
+    string_len = (size_t)(*string - string_start - 2); /* length without quotes */
+    if (parse_check_string_length(context, string_len) == JSONFailure)
+    {
+        return NULL;
+    }
+    if (string_len < INLINE_STRING_SIZE)
+    { /* unescape straight into the value */
+        value = json_value_alloc(context, JSON_INLINE_STRING);
+        if (value == NULL)
+        {
+            return NULL;
+        }
+        if (unescape_string(string_start + 1, string_len, value->value.inline_string,
+                            &unescaped_len) == JSONFailure)
+        {
+            context_free_sized(context, value, sizeof(JSON_Value));
+            return NULL;
+        }
+        return value;
+    }
+    new_string = process_string(context, string_start + 1, string_len);
     if (new_string == NULL)
     {
         return NULL;
     }
-    value = json_value_init_string_no_copy(new_string);
+    value = json_value_init_string_no_copy(context, new_string);
     if (value == NULL)
     {
-        parson_free(new_string);
+        context_free_sized(context, new_string, strlen(new_string) + 1);
         return NULL;
     }
     return value;
 }
 
-static JSON_Value *parse_boolean_value(const char **string)
+static JSON_Value *parse_boolean_value(JSON_Context *context, const char **string)
 {
     size_t true_token_size = SIZEOF_TOKEN("true");
     size_t false_token_size = SIZEOF_TOKEN("false");
     if (strncmp("true", *string, true_token_size) == 0)
     {
         *string += true_token_size;
-        return json_value_init_boolean(1);
+        return json_value_init_boolean_ctx(context, 1);
     }
     else if (strncmp("false", *string, false_token_size) == 0)
     {
         *string += false_token_size;
-        return json_value_init_boolean(0);
+        return json_value_init_boolean_ctx(context, 0);
     }
     return NULL;
 }
 
-static JSON_Value *parse_number_value(const char **string)
+static JSON_Value *parse_number_value(JSON_Context *context, const char **string)
 {
     char *end;
+    const char *fast_end = NULL;
     double number = 0;
+    int64_t integer = 0;
+    if (parse_integer_fast(*string, &integer, &fast_end))
+    {
+        *string = fast_end;
+        return json_value_init_int64_ctx(context, integer);
+    }
+    if (parse_number_fast(*string, &number, &fast_end))
+    {
+        *string = fast_end;
+        return json_value_init_number_ctx(context, number);
+    }
     errno = 0;
     number = strtod(*string, &end);
-    if (errno || !is_decimal(*string, (size_t)(end - *string)))
+    /* strtod reports ERANGE for subnormal results too, which format_double does produce */
+    if ((errno != 0 && (errno != ERANGE || isinf(number))) ||
+        !is_decimal(*string, (size_t)(end - *string)))
     {
         return NULL;
     }
     *string = end;
-    return json_value_init_number(number);
+    return json_value_init_number_ctx(context, number);
 }
 
-static JSON_Value *parse_null_value(const char **string)
+static JSON_Value *parse_null_value(JSON_Context *context, const char **string)
 {
     size_t token_size = SIZEOF_TOKEN("null");
     if (strncmp("null", *string, token_size) == 0)
     {
         *string += token_size;
-        return json_value_init_null();
+        return json_value_init_null_ctx(context);
     }
     return NULL;
 }
 
 /* Serialization */
-#define APPEND_STRING(str)                   \
-    do                                       \
-    {                                        \
-        written = append_string(buf, (str)); \
-        if (written < 0)                     \
-        {                                    \
-            return -1;                       \
-        }                                    \
-        if (buf != NULL)                     \
-        {                                    \
-            buf += written;                  \
-        }                                    \
-        written_total += written;            \
-    } while (0)
-
-#define APPEND_INDENT(level)                   \
-    do                                         \
-    {                                          \
-        written = append_indent(buf, (level)); \
-        if (written < 0)                       \
-        {                                      \
-            return -1;                         \
-        }                                      \
-        if (buf != NULL)                       \
-        {                                      \
-            buf += written;                    \
-        }                                      \
-        written_total += written;              \
-    } while (0)
-
-static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int level, int is_pretty,
-                                      char *num_buf)
-{
-    const char *key = NULL, *string = NULL;
-    JSON_Value *temp_value = NULL;
-    JSON_Array *array = NULL;
-    JSON_Object *object = NULL;
-    size_t i = 0, count = 0;
-    double num = 0.0;
-    int written = -1, written_total = 0;
+#define WRITER_STARTING_CAPACITY 128
 
-    switch (json_value_get_type(value))
+static void writer_init(JSON_Writer *writer, char *buf, size_t buf_size, JSON_Flush_Function flush,
+                        void *context)
+{
+    writer->buf = buf;
+    writer->buf_size = buf_size;
+    writer->buf_len = 0;
+    writer->total_len = 0;
+    writer->flush = flush;
+    writer->context = context;
+    writer->allocator = NULL;
+    writer->grow = 0;
+    writer->failed = 0;
+}
+
+static JSON_Status writer_make_room(JSON_Writer *writer)
+{
+    char *new_buf = NULL;
+    if (writer->flush != NULL)
     {
-    case JSONArray:
-        array = json_value_get_array(value);
-        count = json_array_get_count(array);
-        APPEND_STRING("[");
-        if (count > 0 && is_pretty)
+        if (writer->flush(writer->context, writer->buf, writer->buf_len) != JSONSuccess)
         {
-            APPEND_STRING("\n");
+            return JSONFailure;
         }
-        for (i = 0; i < count; i++)
+        writer->buf_len = 0;
+        return JSONSuccess;
+    }
+    if (!writer->grow)
+    {
+        return JSONFailure;
+    }
+    new_buf = (char *)context_malloc(writer->allocator, writer->buf_size * 2);
+    if (new_buf == NULL)
+    {
+        return JSONFailure;
+    }
+    memcpy(new_buf, writer->buf, writer->buf_len);
+    context_free_sized(writer->allocator, writer->buf, writer->buf_size);
+    writer->buf = new_buf;
+    writer->buf_size *= 2;
+    return JSONSuccess;
+}
+
+static void writer_write(JSON_Writer *writer, const char *data, size_t len)
+{
+    size_t chunk_len = 0;
+    writer->total_len += len;
+    if (writer->buf == NULL || writer->failed)
+    {
+        return;
+    }
+    while (len > 0)
+    {
+        if (writer->buf_len == writer->buf_size && writer_make_room(writer) == JSONFailure)
         {
-            if (is_pretty)
-            {
-                APPEND_INDENT(level + 1);
-            }
-            temp_value = json_array_get_value(array, i);
-            written = json_serialize_to_buffer_r(temp_value, buf, level + 1, is_pretty, num_buf);
-            if (written < 0)
-            {
-                return -1;
-            }
-            if (buf != NULL)
-            {
-                buf += written;
-            }
-            written_total += written;
-            if (i < (count - 1))
-            {
-                APPEND_STRING(",");
-            }
-            if (is_pretty)
-            {
-                APPEND_STRING("\n");
-            }
+            writer->failed = 1;
+            return;
         }
-        if (count > 0 && is_pretty)
+        chunk_len = writer->buf_size - writer->buf_len;
+        if (chunk_len > len)
         {
-            APPEND_INDENT(level);
+            chunk_len = len;
         }
-        APPEND_STRING("]");
-        return written_total;
-    case JSONObject:
-        object = json_value_get_object(value);
-        count = json_object_get_count(object);
-        APPEND_STRING("{");
-        if (count > 0 && is_pretty)
+        memcpy(writer->buf + writer->buf_len, data, chunk_len);
+        writer->buf_len += chunk_len;
+        data += chunk_len;
+        len -= chunk_len;
+    }
+}
+
+/* Hands whatever is still buffered to the flush callback */
+static JSON_Status writer_finish(JSON_Writer *writer)
+{
+    if (writer->failed)
+    {
+        return JSONFailure;
+    }
+    if (writer->flush != NULL && writer->buf_len > 0)
+    {
+        if (writer->flush(writer->context, writer->buf, writer->buf_len) != JSONSuccess)
         {
-            APPEND_STRING("\n");
+            writer->failed = 1;
+            return JSONFailure;
         }
-        for (i = 0; i < count; i++)
+        writer->buf_len = 0;
+    }
+    return JSONSuccess;
+}
+
+/* Walks the value with an explicit stack of the containers it is inside, so nesting costs heap
+ * frames beyond the first few rather than C stack */
+static void json_serialize_to_writer(const JSON_Value *value, JSON_Writer *writer, int is_pretty)
+{
+    JSON_Walk_Stack stack;
+    JSON_Walk_Frame *frame = NULL;
+    const JSON_Value *container = NULL;
+    const char *key = NULL;
+    size_t count = 0;
+    int level = 0;
+
+    if (value == NULL)
+    {
+        writer->failed = 1;
+        return;
+    }
+    walk_stack_init(&stack, value->context);
+    while (value != NULL || stack.count > 0)
+    {
+        if (value != NULL)
         {
-            key = json_object_get_name(object, i);
-            if (key == NULL)
-            {
-                return -1;
-            }
-            if (is_pretty)
-            {
-                APPEND_INDENT(level + 1);
-            }
-            written = json_serialize_string(key, buf);
-            if (written < 0)
+            if (json_serialize_value_start(value, writer, is_pretty) &&
+                walk_stack_push(&stack, value) == JSONFailure)
             {
-                return -1;
+                writer->failed = 1;
             }
-            if (buf != NULL)
+            value = NULL;
+        }
+        if (writer->failed || stack.count == 0)
+        {
+            break;
+        }
+
+        frame = &stack.frames[stack.count - 1];
+        container = frame->value;
+        level = (int)stack.count - 1;
+        count = json_value_get_type(container) == JSONObject
+                    ? json_object_get_count(json_value_get_object(container))
+                    : json_array_get_count(json_value_get_array(container));
+        if (frame->index > 0)
+        { /* after the previous member */
+            if (frame->index < count)
             {
-                buf += written;
+                append_string(writer, ",");
             }
-            written_total += written;
-            APPEND_STRING(":");
             if (is_pretty)
             {
-                APPEND_STRING(" ");
-            }
-            temp_value = json_object_get_value(object, key);
-            written = json_serialize_to_buffer_r(temp_value, buf, level + 1, is_pretty, num_buf);
-            if (written < 0)
-            {
-                return -1;
+                append_string(writer, "\n");
             }
-            if (buf != NULL)
+        }
+        if (frame->index == count)
+        {
+            if (is_pretty)
             {
-                buf += written;
+                append_indent(writer, level);
             }
-            written_total += written;
-            if (i < (count - 1))
+            append_string(writer, json_value_get_type(container) == JSONObject ? "}" : "]");
+            stack.count--;
+            continue;
+        }
+
+        if (is_pretty)
+        {
+            append_indent(writer, level + 1);
+        }
+        if (json_value_get_type(container) == JSONObject)
+        {
+            key = json_object_get_name(json_value_get_object(container), frame->index);
+            if (key == NULL)
             {
-                APPEND_STRING(",");
+                writer->failed = 1;
+                break;
             }
+            json_serialize_string(key, writer);
+            append_string(writer, ":");
             if (is_pretty)
             {
-                APPEND_STRING("\n");
+                append_string(writer, " ");
             }
+            value = json_object_get_value_at(json_value_get_object(container), frame->index);
         }
-        if (count > 0 && is_pretty)
+        else
         {
-            APPEND_INDENT(level);
+            value = json_array_get_value(json_value_get_array(container), frame->index);
         }
-        APPEND_STRING("}");
-        return written_total;
-    case JSONString:
-        string = json_value_get_string(value);
-        if (string == NULL)
+        frame->index++;
+    }
+    walk_stack_free(&stack);
+}
+
+/* Writes a scalar, or the opening of a container. Returns 1 when the members of a container
+ * have to follow, 0 when the value is complete. */
+static int json_serialize_value_start(const JSON_Value *value, JSON_Writer *writer, int is_pretty)
+{
+    const char *string = NULL;
+    size_t count = 0;
+    int written = -1;
+
+    switch (json_value_get_type(value))
+    {
+    case JSONArray:
+        count = json_array_get_count(json_value_get_array(value));
+        append_string(writer, count > 0 ? "[" : "[]");
+        if (count > 0 && is_pretty)
         {
-            return -1;
+            append_string(writer, "\n");
         }
-        written = json_serialize_string(string, buf);
-        if (written < 0)
+        return count > 0;
+    case JSONObject:
+        count = json_object_get_count(json_value_get_object(value));
+        append_string(writer, count > 0 ? "{" : "{}");
+        if (count > 0 && is_pretty)
         {
-            return -1;
+            append_string(writer, "\n");
         }
-        if (buf != NULL)
+        return count > 0;
+    case JSONString:
+        string = json_value_get_string(value);
+        if (string == NULL)
         {
-            buf += written;
+            writer->failed = 1;
+            return 0;
         }
-        written_total += written;
-        return written_total;
+        json_serialize_string(string, writer);
+        return 0;
     case JSONBoolean:
-        if (json_value_get_boolean(value))
-        {
-            APPEND_STRING("true");
-        }
-        else
-        {
-            APPEND_STRING("false");
-        }
-        return written_total;
+        append_string(writer, json_value_get_boolean(value) ? "true" : "false");
+        return 0;
     case JSONNumber:
-        num = json_value_get_number(value);
-        if (buf != NULL)
-        {
-            num_buf = buf;
-        }
-        written = sprintf(num_buf, FLOAT_FORMAT, num);
-        if (written < 0)
-        {
-            return -1;
-        }
-        if (buf != NULL)
-        {
-            buf += written;
-        }
-        written_total += written;
-        return written_total;
+        written = format_number(writer->num_buf, json_value_get_number(value));
+        writer_write(writer, writer->num_buf, (size_t)written);
+        return 0;
+    case JSONInteger:
+        written = format_int64(writer->num_buf, json_value_get_int64(value));
+        writer_write(writer, writer->num_buf, (size_t)written);
+        return 0;
     case JSONNull:
-        APPEND_STRING("null");
-        return written_total;
+        append_string(writer, "null");
+        return 0;
     case JSONError:
-        return -1;
     default:
-        return -1;
+        writer->failed = 1;
+        return 0;
     }
 }
 
-static int json_serialize_string(const char *string, char *buf)
+/* Writes runs of plain characters in one go and escapes the rest */
+static void json_serialize_string(const char *string, JSON_Writer *writer)
 {
-    size_t i = 0, len = strlen(string);
-    char c = '\0';
-    int written = -1, written_total = 0;
-    APPEND_STRING("\"");
-    for (i = 0; i < len; i++)
-    {
-        c = string[i];
+    static const char hex_digits[] = "0123456789abcdef";
+    const char *run_start = string;
+    char escaped[7] = {'\\', 'u', '0', '0', '0', '0', '\0'};
+    unsigned char c = '\0';
+    append_string(writer, "\"");
+    for (; *string != '\0'; string++)
+    {
+        c = (unsigned char)*string;
+        if (c >= 0x20 && c != '\"' && c != '\\' && c != '/')
+        {
+            continue;
+        }
+        writer_write(writer, run_start, (size_t)(string - run_start));
+        run_start = string + 1;
         switch (c)
         {
         case '\"':
-            APPEND_STRING("\\\"");
+            append_string(writer, "\\\"");
             break;
         case '\\':
-            APPEND_STRING("\\\\");
+            append_string(writer, "\\\\");
             break;
         case '/':
-            APPEND_STRING("\\/");
+            append_string(writer, "\\/");
             break; /* to make json embeddable in xml\/html */
         case '\b':
-            APPEND_STRING("\\b");
+            append_string(writer, "\\b");
             break;
         case '\f':
-            APPEND_STRING("\\f");
+            append_string(writer, "\\f");
             break;
         case '\n':
-            APPEND_STRING("\\n");
+            append_string(writer, "\\n");
             break;
         case '\r':
-            APPEND_STRING("\\r");
+            append_string(writer, "\\r");
             break;
         case '\t':
-            APPEND_STRING("\\t");
-            break;
-        case '\x00':
-            APPEND_STRING("\\u0000");
-            break;
-        case '\x01':
-            APPEND_STRING("\\u0001");
-            break;
-        case '\x02':
-            APPEND_STRING("\\u0002");
-            break;
-        case '\x03':
-            APPEND_STRING("\\u0003");
-            break;
-        case '\x04':
-            APPEND_STRING("\\u0004");
-            break;
-        case '\x05':
-            APPEND_STRING("\\u0005");
-            break;
-        case '\x06':
-            APPEND_STRING("\\u0006");
-            break;
-        case '\x07':
-            APPEND_STRING("\\u0007");
-            break;
-        /* '\x08' duplicate: '\b' */
-        /* '\x09' duplicate: '\t' */
-        /* '\x0a' duplicate: '\n' */
-        case '\x0b':
-            APPEND_STRING("\\u000b");
-            break;
-        /* '\x0c' duplicate: '\f' */
-        /* '\x0d' duplicate: '\r' */
-        case '\x0e':
-            APPEND_STRING("\\u000e");
-            break;
-        case '\x0f':
-            APPEND_STRING("\\u000f");
-            break;
-        case '\x10':
-            APPEND_STRING("\\u0010");
-            break;
-        case '\x11':
-            APPEND_STRING("\\u0011");
-            break;
-        case '\x12':
-            APPEND_STRING("\\u0012");
-            break;
-        case '\x13':
-            APPEND_STRING("\\u0013");
-            break;
-        case '\x14':
-            APPEND_STRING("\\u0014");
+            append_string(writer, "\\t");
             break;
-        case '\x15':
-            APPEND_STRING("\\u0015");
-            break;
-        case '\x16':
-            APPEND_STRING("\\u0016");
-            break;
-        case '\x17':
-            APPEND_STRING("\\u0017");
-            break;
-        case '\x18':
-            APPEND_STRING("\\u0018");
-            break;
-        case '\x19':
-            APPEND_STRING("\\u0019");
-            break;
-        case '\x1a':
-            APPEND_STRING("\\u001a");
-            break;
-        case '\x1b':
-            APPEND_STRING("\\u001b");
-            break;
-        case '\x1c':
-            APPEND_STRING("\\u001c");
-            break;
-        case '\x1d':
-            APPEND_STRING("\\u001d");
-            break;
-        case '\x1e':
-            APPEND_STRING("\\u001e");
-            break;
-        case '\x1f':
-            APPEND_STRING("\\u001f");
-            break;
-        default:
-            if (buf != NULL)
-            {
-                buf[0] = c;
-                buf += 1;
-            }
-            written_total += 1;
+        default: /* remaining control characters are written as \u00xx */
+            escaped[4] = hex_digits[c >> 4];
+            escaped[5] = hex_digits[c & 0xF];
+            writer_write(writer, escaped, 6);
             break;
         }
     }
-    APPEND_STRING("\"");
-    return written_total;
+    writer_write(writer, run_start, (size_t)(string - run_start));
+    append_string(writer, "\"");
 }
 
-static int append_indent(char *buf, int level)
+static void append_indent(JSON_Writer *writer, int level)
 {
     int i;
-    int written = -1, written_total = 0;
     for (i = 0; i < level; i++)
     {
-        APPEND_STRING("    ");
+        append_string(writer, "    ");
     }
-    return written_total;
 }
 
-static int append_string(char *buf, const char *string)
+static void append_string(JSON_Writer *writer, const char *string)
+{
+    writer_write(writer, string, strlen(string));
+}
+
+static char *json_serialize_to_string_internal(JSON_Context *context, const JSON_Value *value,
+                                               int is_pretty)
 {
+    JSON_Writer writer;
+    char *buf = (char *)context_malloc(context, WRITER_STARTING_CAPACITY);
     if (buf == NULL)
     {
-        return (int)strlen(string);
+        return NULL;
+    }
+    writer_init(&writer, buf, WRITER_STARTING_CAPACITY, NULL, NULL);
+    writer.allocator = context;
+    writer.grow = 1;
+    json_serialize_to_writer(value, &writer, is_pretty);
+    writer_write(&writer, "", 1);
+    if (writer.failed)
+    {
+        context_free_sized(context, writer.buf, writer.buf_size);
+        return NULL;
+    }
+    return writer.buf;
+}
+
+/* Context API */
+JSON_Context *json_context_init(JSON_Malloc_Function malloc_fun, JSON_Free_Function free_fun)
+{
+    JSON_Context *context = NULL;
+    if (malloc_fun == NULL || free_fun == NULL)
+    {
+        malloc_fun = malloc;
+        free_fun = free;
+    }
+    context = (JSON_Context *)malloc_fun(sizeof(JSON_Context));
+    if (context == NULL)
+    {
+        return NULL;
+    }
+    context->malloc_fun = malloc_fun;
+    context->free_fun = free_fun;
+    context->max_nesting = MAX_NESTING;
+    context->intern_keys = 0;
+    context->intern_table.buckets = NULL;
+    context->intern_table.bucket_count = 0;
+    context->intern_table.count = 0;
+    context->scratch_frames = NULL;
+    context->scratch_capacity = 0;
+    memset(&context->limits, 0, sizeof(JSON_Parse_Limits));
+    context->parse_error.code = JSONParseErrorNone;
+    context->parse_error.offset = 0;
+    context->parsing = 0;
+    context->parse_bytes = 0;
+    context->parse_values = 0;
+    memset(context->pools, 0, sizeof(context->pools));
+    context->pool_limit = 0;
+    context->pool_bytes = 0;
+    context->allocated = 0;
+    return context;
+}
+
+void json_context_free(JSON_Context *context)
+{
+    if (context == NULL || context == &default_context)
+    {
+        return;
+    }
+    pool_drain(context, 0);
+    context->free_fun(context->intern_table.buckets);
+    context->free_fun(context->scratch_frames);
+    context->free_fun(context);
+}
+
+JSON_Context *json_context_default(void)
+{
+    return &default_context;
+}
+
+void json_context_set_key_interning(JSON_Context *context, int enabled)
+{
+    if (context != NULL)
+    {
+        context->intern_keys = enabled ? 1 : 0;
+    }
+}
+
+JSON_Status json_context_set_max_nesting(JSON_Context *context, size_t max_nesting)
+{
+    if (context == NULL || max_nesting == 0)
+    {
+        return JSONFailure;
+    }
+    context->max_nesting = max_nesting;
+    return JSONSuccess;
+}
+
+void json_context_set_parse_limits(JSON_Context *context, const JSON_Parse_Limits *limits)
+{
+    if (context == NULL)
+    {
+        return;
     }
-    return sprintf(buf, "%s", string);
+    if (limits == NULL)
+    {
+        memset(&context->limits, 0, sizeof(JSON_Parse_Limits));
+        return;
+    }
+    context->limits = *limits;
+}
+
+JSON_Parse_Error json_context_get_parse_error(const JSON_Context *context)
+{
+    JSON_Parse_Error none = {JSONParseErrorNone, 0};
+    return context != NULL ? context->parse_error : none;
+}
+
+JSON_Status json_context_set_pool_limit(JSON_Context *context, size_t max_bytes)
+{
+    if (context == NULL || (max_bytes != 0 && context->pool_limit == 0 && context->allocated))
+    {
+        return JSONFailure;
+    }
+    context->pool_limit = max_bytes;
+    pool_drain(context, max_bytes);
+    return JSONSuccess;
+}
+
+size_t json_context_get_pool_size(const JSON_Context *context)
+{
+    return context != NULL ? context->pool_bytes : 0;
+}
+
+void *json_context_malloc(JSON_Context *context, size_t size)
+{
+    return context != NULL && size != 0 ? context_malloc(context, size) : NULL;
 }
 
-#undef APPEND_STRING
-#undef APPEND_INDENT
+void json_context_free_block(JSON_Context *context, void *block, size_t size)
+{
+    if (context != NULL)
+    {
+        context_free_sized(context, block, size);
+    }
+}
 
 /* Parser API */
 JSON_Value *json_parse_string(const char *string)
 {
-    if (string == NULL)
+    return json_parse_string_ctx(&default_context, string);
+}
+
+JSON_Value *json_parse_string_with_comments(const char *string)
+{
+    return json_parse_string_with_comments_ctx(&default_context, string);
+}
+
+JSON_Value *json_parse_string_ctx(JSON_Context *context, const char *string)
+{
+    JSON_Value *result = NULL;
+    size_t bom_len = 0;
+    if (context == NULL || string == NULL)
     {
         return NULL;
     }
     if (string[0] == '\xEF' && string[1] == '\xBB' && string[2] == '\xBF')
     {
-        string = string + 3; /* Support for UTF-8 BOM */
+        bom_len = 3; /* Support for UTF-8 BOM */
+        string = string + bom_len;
     }
-    return parse_value((const char **)&string, 0);
+    result = parse_value(context, (const char **)&string);
+    if (result == NULL)
+    {
+        context->parse_error.offset += bom_len;
+    }
+    return result;
 }
 
-JSON_Value *json_parse_string_with_comments(const char *string)
+JSON_Value *json_parse_string_with_comments_ctx(JSON_Context *context, const char *string)
 {
     JSON_Value *result = NULL;
     char *string_mutable_copy = NULL, *string_mutable_copy_ptr = NULL;
-    string_mutable_copy = parson_strdup(string);
+    if (context == NULL || string == NULL)
+    {
+        return NULL;
+    }
+    string_mutable_copy = parson_strdup(context, string);
     if (string_mutable_copy == NULL)
     {
         return NULL;
@@ -1415,8 +2864,8 @@ JSON_Value *json_parse_string_with_comments(const char *string)
     remove_comments(string_mutable_copy, "/*", "*/");
     remove_comments(string_mutable_copy, "//", "\n");
     string_mutable_copy_ptr = string_mutable_copy;
-    result = parse_value((const char **)&string_mutable_copy_ptr, 0);
-    parson_free(string_mutable_copy);
+    result = parse_value(context, (const char **)&string_mutable_copy_ptr);
+    context_free_sized(context, string_mutable_copy, strlen(string) + 1);
     return result;
 }
 
@@ -1441,6 +2890,11 @@ double json_object_get_number(const JSON_Object *object, const char *name)
     return json_value_get_number(json_object_get_value(object, name));
 }
 
+int64_t json_object_get_int64(const JSON_Object *object, const char *name)
+{
+    return json_value_get_int64(json_object_get_value(object, name));
+}
+
 JSON_Object *json_object_get_object(const JSON_Object *object, const char *name)
 {
     return json_value_get_object(json_object_get_value(object, name));
@@ -1478,6 +2932,11 @@ double json_object_dotget_number(const JSON_Object *object, const char *name)
     return json_value_get_number(json_object_dotget_value(object, name));
 }
 
+int64_t json_object_dotget_int64(const JSON_Object *object, const char *name)
+{
+    return json_value_get_int64(json_object_dotget_value(object, name));
+}
+
 JSON_Object *json_object_dotget_object(const JSON_Object *object, const char *name)
 {
     return json_value_get_object(json_object_dotget_value(object, name));
@@ -1564,6 +3023,11 @@ double json_array_get_number(const JSON_Array *array, size_t index)
     return json_value_get_number(json_array_get_value(array, index));
 }
 
+int64_t json_array_get_int64(const JSON_Array *array, size_t index)
+{
+    return json_value_get_int64(json_array_get_value(array, index));
+}
+
 JSON_Object *json_array_get_object(const JSON_Array *array, size_t index)
 {
     return json_value_get_object(json_array_get_value(array, index));
@@ -1592,7 +3056,11 @@ JSON_Value *json_array_get_wrapping_value(const JSON_Array *array)
 /* JSON Value API */
 JSON_Value_Type json_value_get_type(const JSON_Value *value)
 {
-    return value ? value->type : JSONError;
+    if (value == NULL)
+    {
+        return JSONError;
+    }
+    return value->type == JSON_INLINE_STRING ? JSONString : value->type;
 }
 
 JSON_Object *json_value_get_object(const JSON_Value *value)
@@ -1607,12 +3075,42 @@ JSON_Array *json_value_get_array(const JSON_Value *value)
 
 const char *json_value_get_string(const JSON_Value *value)
 {
-    return json_value_get_type(value) == JSONString ? value->value.string : NULL;
+    if (json_value_get_type(value) != JSONString)
+    {
+        return NULL;
+    }
+    return value->type == JSON_INLINE_STRING ? value->value.inline_string : value->value.string;
 }
 
 double json_value_get_number(const JSON_Value *value)
 {
-    return json_value_get_type(value) == JSONNumber ? value->value.number : 0;
+    switch (json_value_get_type(value))
+    {
+    case JSONNumber:
+        return value->value.number;
+    case JSONInteger:
+        return (double)value->value.integer;
+    default:
+        return 0;
+    }
+}
+
+int64_t json_value_get_int64(const JSON_Value *value)
+{
+    switch (json_value_get_type(value))
+    {
+    case JSONInteger:
+        return value->value.integer;
+    case JSONNumber: /* truncated, out of range values fail */
+        if (value->value.number >= -9223372036854775808.0 &&
+            value->value.number < 9223372036854775808.0)
+        {
+            return (int64_t)value->value.number;
+        }
+        return 0;
+    default:
+        return 0;
+    }
 }
 
 int json_value_get_boolean(const JSON_Value *value)
@@ -1625,7 +3123,55 @@ JSON_Value *json_value_get_parent(const JSON_Value *value)
     return value ? value->parent : NULL;
 }
 
+/* Detaches and descends into the last member of each container until it reaches one that is
+   empty or a scalar, frees that and goes back up. The detached member's parent pointer is set
+   to the container on the way down, so the walk needs neither recursion nor memory. */
 void json_value_free(JSON_Value *value)
+{
+    JSON_Value *current = value, *child = NULL, *up = NULL;
+    JSON_Object *object = NULL;
+    JSON_Array *array = NULL;
+    while (current != NULL)
+    {
+        child = NULL;
+        switch (json_value_get_type(current))
+        {
+        case JSONObject:
+            object = current->value.object;
+            if (object->count > 0)
+            {
+                object->count--;
+                json_object_release_name(object, object->names[object->count]);
+                child = object->values[object->count];
+            }
+            break;
+        case JSONArray:
+            array = current->value.array;
+            if (array->count > 0)
+            {
+                array->count--;
+                child = array->items[array->count];
+            }
+            break;
+        case JSONError:
+            return;
+        default:
+            break;
+        }
+        if (child != NULL)
+        {
+            child->parent = current;
+            current = child;
+            continue;
+        }
+        up = current == value ? NULL : current->parent;
+        json_value_free_node(current);
+        current = up;
+    }
+}
+
+/* Frees a scalar, or a container that has no members left */
+static void json_value_free_node(JSON_Value *value)
 {
     switch (json_value_get_type(value))
     {
@@ -1633,7 +3179,11 @@ void json_value_free(JSON_Value *value)
         json_object_free(value->value.object);
         break;
     case JSONString:
-        parson_free(value->value.string);
+        if (value->type != JSON_INLINE_STRING)
+        {
+            context_free_sized(value->context, value->value.string,
+                               strlen(value->value.string) + 1);
+        }
         break;
     case JSONArray:
         json_array_free(value->value.array);
@@ -1641,51 +3191,80 @@ void json_value_free(JSON_Value *value)
     default:
         break;
     }
-    parson_free(value);
+    context_free_sized(value->context, value, sizeof(JSON_Value));
 }
 
 JSON_Value *json_value_init_object(void)
 {
-    JSON_Value *new_value = (JSON_Value *)parson_malloc(sizeof(JSON_Value));
+    return json_value_init_object_ctx(&default_context);
+}
+
+JSON_Value *json_value_init_array(void)
+{
+    return json_value_init_array_ctx(&default_context);
+}
+
+JSON_Value *json_value_init_string(const char *string)
+{
+    return json_value_init_string_ctx(&default_context, string);
+}
+
+JSON_Value *json_value_init_number(double number)
+{
+    return json_value_init_number_ctx(&default_context, number);
+}
+
+JSON_Value *json_value_init_int64(int64_t integer)
+{
+    return json_value_init_int64_ctx(&default_context, integer);
+}
+
+JSON_Value *json_value_init_boolean(int boolean)
+{
+    return json_value_init_boolean_ctx(&default_context, boolean);
+}
+
+JSON_Value *json_value_init_null(void)
+{
+    return json_value_init_null_ctx(&default_context);
+}
+
+JSON_Value *json_value_init_object_ctx(JSON_Context *context)
+{
+    JSON_Value *new_value = context != NULL ? json_value_alloc(context, JSONObject) : NULL;
     if (!new_value)
     {
         return NULL;
     }
-    new_value->parent = NULL;
-    new_value->type = JSONObject;
     new_value->value.object = json_object_init(new_value);
     if (!new_value->value.object)
     {
-        parson_free(new_value);
+        context_free_sized(context, new_value, sizeof(JSON_Value));
         return NULL;
     }
     return new_value;
 }
 
-JSON_Value *json_value_init_array(void)
+JSON_Value *json_value_init_array_ctx(JSON_Context *context)
 {
-    JSON_Value *new_value = (JSON_Value *)parson_malloc(sizeof(JSON_Value));
+    JSON_Value *new_value = context != NULL ? json_value_alloc(context, JSONArray) : NULL;
     if (!new_value)
     {
         return NULL;
     }
-    new_value->parent = NULL;
-    new_value->type = JSONArray;
     new_value->value.array = json_array_init(new_value);
     if (!new_value->value.array)
     {
-        parson_free(new_value);
+        context_free_sized(context, new_value, sizeof(JSON_Value));
         return NULL;
     }
     return new_value;
 }
 
-JSON_Value *json_value_init_string(const char *string)
+JSON_Value *json_value_init_string_ctx(JSON_Context *context, const char *string)
 {
-    char *copy = NULL;
-    JSON_Value *value;
     size_t string_len = 0;
-    if (string == NULL)
+    if (context == NULL || string == NULL)
     {
         return NULL;
     }
@@ -1694,252 +3273,285 @@ JSON_Value *json_value_init_string(const char *string)
     {
         return NULL;
     }
-    copy = parson_strndup(string, string_len);
-    if (copy == NULL)
-    {
-        return NULL;
-    }
-    value = json_value_init_string_no_copy(copy);
-    if (value == NULL)
-    {
-        parson_free(copy);
-    }
-    return value;
+    return json_value_init_string_n(context, string, string_len);
 }
 
-JSON_Value *json_value_init_number(double number)
+JSON_Value *json_value_init_number_ctx(JSON_Context *context, double number)
 {
     JSON_Value *new_value = NULL;
-    if ((number * 0.0) != 0.0)
+    if (context == NULL || (number * 0.0) != 0.0)
     { /* nan and inf test */
         return NULL;
     }
-    new_value = (JSON_Value *)parson_malloc(sizeof(JSON_Value));
+    new_value = json_value_alloc(context, JSONNumber);
     if (new_value == NULL)
     {
         return NULL;
     }
-    new_value->parent = NULL;
-    new_value->type = JSONNumber;
     new_value->value.number = number;
     return new_value;
 }
 
-JSON_Value *json_value_init_boolean(int boolean)
+JSON_Value *json_value_init_int64_ctx(JSON_Context *context, int64_t integer)
 {
-    JSON_Value *new_value = (JSON_Value *)parson_malloc(sizeof(JSON_Value));
-    if (!new_value)
+    JSON_Value *new_value = context != NULL ? json_value_alloc(context, JSONInteger) : NULL;
+    if (new_value == NULL)
     {
         return NULL;
     }
-    new_value->parent = NULL;
-    new_value->type = JSONBoolean;
-    new_value->value.boolean = boolean ? 1 : 0;
+    new_value->value.integer = integer;
     return new_value;
 }
 
-JSON_Value *json_value_init_null(void)
+JSON_Value *json_value_init_boolean_ctx(JSON_Context *context, int boolean)
 {
-    JSON_Value *new_value = (JSON_Value *)parson_malloc(sizeof(JSON_Value));
+    JSON_Value *new_value = context != NULL ? json_value_alloc(context, JSONBoolean) : NULL;
     if (!new_value)
     {
         return NULL;
     }
-    new_value->parent = NULL;
-    new_value->type = JSONNull;
+    new_value->value.boolean = boolean ? 1 : 0;
     return new_value;
 }
 
+JSON_Value *json_value_init_null_ctx(JSON_Context *context)
+{
+    return context != NULL ? json_value_alloc(context, JSONNull) : NULL;
+}
+
 JSON_Value *json_value_deep_copy(const JSON_Value *value)
 {
-    size_t i = 0;
-    JSON_Value *return_value = NULL, *temp_value_copy = NULL, *temp_value = NULL;
-    const char *temp_string = NULL, *temp_key = NULL;
-    char *temp_string_copy = NULL;
-    JSON_Array *temp_array = NULL, *temp_array_copy = NULL;
-    JSON_Object *temp_object = NULL, *temp_object_copy = NULL;
+    if (value == NULL)
+    {
+        return NULL;
+    }
+    return json_value_deep_copy_internal(value->context, value);
+}
+
+JSON_Value *json_value_deep_copy_ctx(JSON_Context *context, const JSON_Value *value)
+{
+    if (context == NULL)
+    {
+        return NULL;
+    }
+    return json_value_deep_copy_internal(context, value);
+}
 
+/* Copies the value alone: a scalar, or an empty container of the same type */
+static JSON_Value *json_value_copy_node(JSON_Context *context, const JSON_Value *value)
+{
+    const char *temp_string = NULL;
     switch (json_value_get_type(value))
     {
     case JSONArray:
-        temp_array = json_value_get_array(value);
-        return_value = json_value_init_array();
-        if (return_value == NULL)
+        return json_value_init_array_ctx(context);
+    case JSONObject:
+        return json_value_init_object_ctx(context);
+    case JSONBoolean:
+        return json_value_init_boolean_ctx(context, json_value_get_boolean(value));
+    case JSONNumber:
+        return json_value_init_number_ctx(context, json_value_get_number(value));
+    case JSONInteger:
+        return json_value_init_int64_ctx(context, json_value_get_int64(value));
+    case JSONString:
+        temp_string = json_value_get_string(value);
+        if (temp_string == NULL)
         {
             return NULL;
         }
-        temp_array_copy = json_value_get_array(return_value);
-        for (i = 0; i < json_array_get_count(temp_array); i++)
+        return json_value_init_string_n(context, temp_string, strlen(temp_string));
+    case JSONNull:
+        return json_value_init_null_ctx(context);
+    case JSONError:
+        return NULL;
+    default:
+        return NULL;
+    }
+}
+
+static size_t json_value_get_child_count(const JSON_Value *value)
+{
+    return json_value_get_type(value) == JSONObject
+               ? json_object_get_count(json_value_get_object(value))
+               : json_array_get_count(json_value_get_array(value));
+}
+
+/* Copies node by node, attaching each copy to its parent's copy straight away so a failure
+ * only has to free the root */
+static JSON_Value *json_value_deep_copy_internal(JSON_Context *context, const JSON_Value *value)
+{
+    JSON_Walk_Stack stack;
+    JSON_Walk_Frame *frame = NULL;
+    JSON_Value *root = NULL, *copy = NULL;
+    JSON_Status status = JSONSuccess;
+
+    root = json_value_copy_node(context, value);
+    if (root == NULL)
+    {
+        return NULL;
+    }
+    walk_stack_init(&stack, context);
+    copy = root;
+    while (status == JSONSuccess)
+    {
+        if (copy != NULL &&
+            (json_value_get_type(copy) == JSONObject || json_value_get_type(copy) == JSONArray))
         {
-            temp_value = json_array_get_value(temp_array, i);
-            temp_value_copy = json_value_deep_copy(temp_value);
-            if (temp_value_copy == NULL)
+            if (walk_stack_push(&stack, value) == JSONFailure)
             {
-                json_value_free(return_value);
-                return NULL;
-            }
-            if (json_array_add(temp_array_copy, temp_value_copy) == JSONFailure)
-            {
-                json_value_free(return_value);
-                json_value_free(temp_value_copy);
-                return NULL;
+                copy = NULL; /* already attached */
+                status = JSONFailure;
+                break;
             }
+            stack.frames[stack.count - 1].result = copy;
         }
-        return return_value;
-    case JSONObject:
-        temp_object = json_value_get_object(value);
-        return_value = json_value_init_object();
-        if (return_value == NULL)
-        {
-            return NULL;
-        }
-        temp_object_copy = json_value_get_object(return_value);
-        for (i = 0; i < json_object_get_count(temp_object); i++)
+        copy = NULL;
+        if (stack.count == 0)
         {
-            temp_key = json_object_get_name(temp_object, i);
-            temp_value = json_object_get_value(temp_object, temp_key);
-            temp_value_copy = json_value_deep_copy(temp_value);
-            if (temp_value_copy == NULL)
-            {
-                json_value_free(return_value);
-                return NULL;
-            }
-            if (json_object_add(temp_object_copy, temp_key, temp_value_copy) == JSONFailure)
-            {
-                json_value_free(return_value);
-                json_value_free(temp_value_copy);
-                return NULL;
-            }
+            break;
         }
-        return return_value;
-    case JSONBoolean:
-        return json_value_init_boolean(json_value_get_boolean(value));
-    case JSONNumber:
-        return json_value_init_number(json_value_get_number(value));
-    case JSONString:
-        temp_string = json_value_get_string(value);
-        if (temp_string == NULL)
+        frame = &stack.frames[stack.count - 1];
+        if (frame->index == json_value_get_child_count(frame->value))
         {
-            return NULL;
+            stack.count--;
+            continue;
         }
-        temp_string_copy = parson_strdup(temp_string);
-        if (temp_string_copy == NULL)
+        if (json_value_get_type(frame->value) == JSONObject)
         {
-            return NULL;
+            value = json_object_get_value_at(json_value_get_object(frame->value), frame->index);
+            copy = json_value_copy_node(context, value);
+            if (copy == NULL ||
+                json_object_add(json_value_get_object(frame->result),
+                                json_object_get_name(json_value_get_object(frame->value),
+                                                     frame->index),
+                                copy) == JSONFailure)
+            {
+                status = JSONFailure;
+            }
         }
-        return_value = json_value_init_string_no_copy(temp_string_copy);
-        if (return_value == NULL)
+        else
         {
-            parson_free(temp_string_copy);
+            value = json_array_get_value(json_value_get_array(frame->value), frame->index);
+            copy = json_value_copy_node(context, value);
+            if (copy == NULL ||
+                json_array_add(json_value_get_array(frame->result), copy) == JSONFailure)
+            {
+                status = JSONFailure;
+            }
         }
-        return return_value;
-    case JSONNull:
-        return json_value_init_null();
-    case JSONError:
-        return NULL;
-    default:
+        frame->index++;
+    }
+    walk_stack_free(&stack);
+    if (status == JSONFailure)
+    {
+        json_value_free(copy); /* NULL, or the copy that couldn't be attached */
+        json_value_free(root);
         return NULL;
     }
+    return root;
 }
 
 size_t json_serialization_size(const JSON_Value *value)
 {
-    char num_buf[NUM_BUF_SIZE]; /* recursively allocating buffer on stack is a bad idea, so let's do
-                                   it only once */
-    int res = json_serialize_to_buffer_r(value, NULL, 0, 0, num_buf);
-    return res < 0 ? 0 : (size_t)(res + 1);
+    JSON_Writer writer;
+    writer_init(&writer, NULL, 0, NULL, NULL);
+    json_serialize_to_writer(value, &writer, 0);
+    return writer.failed ? 0 : writer.total_len + 1;
 }
 
 JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes)
 {
-    int written = -1;
-    size_t needed_size_in_bytes = json_serialization_size(value);
-    if (needed_size_in_bytes == 0 || buf_size_in_bytes < needed_size_in_bytes)
+    JSON_Writer writer;
+    if (buf == NULL || buf_size_in_bytes == 0)
     {
         return JSONFailure;
     }
-    written = json_serialize_to_buffer_r(value, buf, 0, 0, NULL);
-    if (written < 0)
-    {
-        return JSONFailure;
-    }
-    return JSONSuccess;
+    writer_init(&writer, buf, buf_size_in_bytes, NULL, NULL);
+    json_serialize_to_writer(value, &writer, 0);
+    writer_write(&writer, "", 1);
+    return writer.failed ? JSONFailure : JSONSuccess;
 }
 
 char *json_serialize_to_string(const JSON_Value *value)
 {
-    JSON_Status serialization_result = JSONFailure;
-    size_t buf_size_bytes = json_serialization_size(value);
-    char *buf = NULL;
-    if (buf_size_bytes == 0)
-    {
-        return NULL;
-    }
-    buf = (char *)parson_malloc(buf_size_bytes);
-    if (buf == NULL)
-    {
-        return NULL;
-    }
-    serialization_result = json_serialize_to_buffer(value, buf, buf_size_bytes);
-    if (serialization_result == JSONFailure)
+    return json_serialize_to_string_internal(&default_context, value, 0);
+}
+
+char *json_serialize_to_string_ctx(JSON_Context *context, const JSON_Value *value)
+{
+    return context != NULL ? json_serialize_to_string_internal(context, value, 0) : NULL;
+}
+
+JSON_Status json_serialize_to_stream(const JSON_Value *value, char *buf, size_t buf_size_in_bytes,
+                                     JSON_Flush_Function flush, void *context)
+{
+    JSON_Writer writer;
+    if (buf == NULL || buf_size_in_bytes == 0 || flush == NULL)
     {
-        json_free_serialized_string(buf);
-        return NULL;
+        return JSONFailure;
     }
-    return buf;
+    writer_init(&writer, buf, buf_size_in_bytes, flush, context);
+    json_serialize_to_writer(value, &writer, 0);
+    return writer_finish(&writer);
 }
 
 size_t json_serialization_size_pretty(const JSON_Value *value)
 {
-    char num_buf[NUM_BUF_SIZE]; /* recursively allocating buffer on stack is a bad idea, so let's do
-                                   it only once */
-    int res = json_serialize_to_buffer_r(value, NULL, 0, 1, num_buf);
-    return res < 0 ? 0 : (size_t)(res + 1);
+    JSON_Writer writer;
+    writer_init(&writer, NULL, 0, NULL, NULL);
+    json_serialize_to_writer(value, &writer, 1);
+    return writer.failed ? 0 : writer.total_len + 1;
 }
 
 JSON_Status json_serialize_to_buffer_pretty(const JSON_Value *value, char *buf,
                                             size_t buf_size_in_bytes)
 {
-    int written = -1;
-    size_t needed_size_in_bytes = json_serialization_size_pretty(value);
-    if (needed_size_in_bytes == 0 || buf_size_in_bytes < needed_size_in_bytes)
+    JSON_Writer writer;
+    if (buf == NULL || buf_size_in_bytes == 0)
     {
         return JSONFailure;
     }
-    written = json_serialize_to_buffer_r(value, buf, 0, 1, NULL);
-    if (written < 0)
-    {
-        return JSONFailure;
-    }
-    return JSONSuccess;
+    writer_init(&writer, buf, buf_size_in_bytes, NULL, NULL);
+    json_serialize_to_writer(value, &writer, 1);
+    writer_write(&writer, "", 1);
+    return writer.failed ? JSONFailure : JSONSuccess;
 }
 
 char *json_serialize_to_string_pretty(const JSON_Value *value)
 {
-    JSON_Status serialization_result = JSONFailure;
-    size_t buf_size_bytes = json_serialization_size_pretty(value);
-    char *buf = NULL;
-    if (buf_size_bytes == 0)
-    {
-        return NULL;
-    }
-    buf = (char *)parson_malloc(buf_size_bytes);
-    if (buf == NULL)
-    {
-        return NULL;
-    }
-    serialization_result = json_serialize_to_buffer_pretty(value, buf, buf_size_bytes);
-    if (serialization_result == JSONFailure)
+    return json_serialize_to_string_internal(&default_context, value, 1);
+}
+
+char *json_serialize_to_string_pretty_ctx(JSON_Context *context, const JSON_Value *value)
+{
+    return context != NULL ? json_serialize_to_string_internal(context, value, 1) : NULL;
+}
+
+JSON_Status json_serialize_to_stream_pretty(const JSON_Value *value, char *buf,
+                                            size_t buf_size_in_bytes, JSON_Flush_Function flush,
+                                            void *context)
+{
+    JSON_Writer writer;
+    if (buf == NULL || buf_size_in_bytes == 0 || flush == NULL)
     {
-        json_free_serialized_string(buf);
-        return NULL;
+        return JSONFailure;
     }
-    return buf;
+    writer_init(&writer, buf, buf_size_in_bytes, flush, context);
+    json_serialize_to_writer(value, &writer, 1);
+    return writer_finish(&writer);
 }
 
 void json_free_serialized_string(char *string)
 {
-    parson_free(string);
+    json_free_serialized_string_ctx(&default_context, string);
+}
+
+void json_free_serialized_string_ctx(JSON_Context *context, char *string)
+{
+    if (context != NULL && string != NULL)
+    { /* the buffer may be larger than the string, which only puts it in a smaller size class */
+        context_free_sized(context, string, strlen(string) + 1);
+    }
 }
 
 JSON_Status json_array_remove(JSON_Array *array, size_t ix)
@@ -1971,7 +3583,7 @@ JSON_Status json_array_replace_value(JSON_Array *array, size_t ix, JSON_Value *v
 
 JSON_Status json_array_replace_string(JSON_Array *array, size_t i, const char *string)
 {
-    JSON_Value *value = json_value_init_string(string);
+    JSON_Value *value = json_value_init_string_ctx(array_context(array), string);
     if (value == NULL)
     {
         return JSONFailure;
@@ -1986,7 +3598,22 @@ JSON_Status json_array_replace_string(JSON_Array *array, size_t i, const char *s
 
 JSON_Status json_array_replace_number(JSON_Array *array, size_t i, double number)
 {
-    JSON_Value *value = json_value_init_number(number);
+    JSON_Value *value = json_value_init_number_ctx(array_context(array), number);
+    if (value == NULL)
+    {
+        return JSONFailure;
+    }
+    if (json_array_replace_value(array, i, value) == JSONFailure)
+    {
+        json_value_free(value);
+        return JSONFailure;
+    }
+    return JSONSuccess;
+}
+
+JSON_Status json_array_replace_int64(JSON_Array *array, size_t i, int64_t integer)
+{
+    JSON_Value *value = json_value_init_int64_ctx(array_context(array), integer);
     if (value == NULL)
     {
         return JSONFailure;
@@ -2001,7 +3628,7 @@ JSON_Status json_array_replace_number(JSON_Array *array, size_t i, double number
 
 JSON_Status json_array_replace_boolean(JSON_Array *array, size_t i, int boolean)
 {
-    JSON_Value *value = json_value_init_boolean(boolean);
+    JSON_Value *value = json_value_init_boolean_ctx(array_context(array), boolean);
     if (value == NULL)
     {
         return JSONFailure;
@@ -2016,7 +3643,7 @@ JSON_Status json_array_replace_boolean(JSON_Array *array, size_t i, int boolean)
 
 JSON_Status json_array_replace_null(JSON_Array *array, size_t i)
 {
-    JSON_Value *value = json_value_init_null();
+    JSON_Value *value = json_value_init_null_ctx(array_context(array));
     if (value == NULL)
     {
         return JSONFailure;
@@ -2055,7 +3682,7 @@ JSON_Status json_array_append_value(JSON_Array *array, JSON_Value *value)
 
 JSON_Status json_array_append_string(JSON_Array *array, const char *string)
 {
-    JSON_Value *value = json_value_init_string(string);
+    JSON_Value *value = json_value_init_string_ctx(array_context(array), string);
     if (value == NULL)
     {
         return JSONFailure;
@@ -2070,7 +3697,22 @@ JSON_Status json_array_append_string(JSON_Array *array, const char *string)
 
 JSON_Status json_array_append_number(JSON_Array *array, double number)
 {
-    JSON_Value *value = json_value_init_number(number);
+    JSON_Value *value = json_value_init_number_ctx(array_context(array), number);
+    if (value == NULL)
+    {
+        return JSONFailure;
+    }
+    if (json_array_append_value(array, value) == JSONFailure)
+    {
+        json_value_free(value);
+        return JSONFailure;
+    }
+    return JSONSuccess;
+}
+
+JSON_Status json_array_append_int64(JSON_Array *array, int64_t integer)
+{
+    JSON_Value *value = json_value_init_int64_ctx(array_context(array), integer);
     if (value == NULL)
     {
         return JSONFailure;
@@ -2085,7 +3727,7 @@ JSON_Status json_array_append_number(JSON_Array *array, double number)
 
 JSON_Status json_array_append_boolean(JSON_Array *array, int boolean)
 {
-    JSON_Value *value = json_value_init_boolean(boolean);
+    JSON_Value *value = json_value_init_boolean_ctx(array_context(array), boolean);
     if (value == NULL)
     {
         return JSONFailure;
@@ -2100,7 +3742,7 @@ JSON_Status json_array_append_boolean(JSON_Array *array, int boolean)
 
 JSON_Status json_array_append_null(JSON_Array *array)
 {
-    JSON_Value *value = json_value_init_null();
+    JSON_Value *value = json_value_init_null_ctx(array_context(array));
     if (value == NULL)
     {
         return JSONFailure;
@@ -2141,22 +3783,31 @@ JSON_Status json_object_set_value(JSON_Object *object, const char *name, JSON_Va
 
 JSON_Status json_object_set_string(JSON_Object *object, const char *name, const char *string)
 {
-    return json_object_set_value(object, name, json_value_init_string(string));
+    return json_object_set_value(object, name,
+                                 json_value_init_string_ctx(object_context(object), string));
 }
 
 JSON_Status json_object_set_number(JSON_Object *object, const char *name, double number)
 {
-    return json_object_set_value(object, name, json_value_init_number(number));
+    return json_object_set_value(object, name,
+                                 json_value_init_number_ctx(object_context(object), number));
+}
+
+JSON_Status json_object_set_int64(JSON_Object *object, const char *name, int64_t integer)
+{
+    return json_object_set_value(object, name,
+                                 json_value_init_int64_ctx(object_context(object), integer));
 }
 
 JSON_Status json_object_set_boolean(JSON_Object *object, const char *name, int boolean)
 {
-    return json_object_set_value(object, name, json_value_init_boolean(boolean));
+    return json_object_set_value(object, name,
+                                 json_value_init_boolean_ctx(object_context(object), boolean));
 }
 
 JSON_Status json_object_set_null(JSON_Object *object, const char *name)
 {
-    return json_object_set_value(object, name, json_value_init_null());
+    return json_object_set_value(object, name, json_value_init_null_ctx(object_context(object)));
 }
 
 JSON_Status json_object_dotset_value(JSON_Object *object, const char *name, JSON_Value *value)
@@ -2188,7 +3839,7 @@ JSON_Status json_object_dotset_value(JSON_Object *object, const char *name, JSON
         temp_object = json_value_get_object(temp_value);
         return json_object_dotset_value(temp_object, dot_pos + 1, value);
     }
-    new_value = json_value_init_object();
+    new_value = json_value_init_object_ctx(object_context(object));
     if (new_value == NULL)
     {
         return JSONFailure;
@@ -2197,22 +3848,37 @@ JSON_Status json_object_dotset_value(JSON_Object *object, const char *name, JSON
     status = json_object_dotset_value(new_object, dot_pos + 1, value);
     if (status != JSONSuccess)
     {
-        json_value_free(new_value);
+        json_value_free(new_value);
+        return JSONFailure;
+    }
+    status = json_object_addn(object, name, name_len, new_value);
+    if (status != JSONSuccess)
+    {
+        json_object_dotremove_internal(new_object, dot_pos + 1, 0);
+        json_value_free(new_value);
+        return JSONFailure;
+    }
+    return JSONSuccess;
+}
+
+JSON_Status json_object_dotset_string(JSON_Object *object, const char *name, const char *string)
+{
+    JSON_Value *value = json_value_init_string_ctx(object_context(object), string);
+    if (value == NULL)
+    {
         return JSONFailure;
     }
-    status = json_object_addn(object, name, name_len, new_value);
-    if (status != JSONSuccess)
+    if (json_object_dotset_value(object, name, value) == JSONFailure)
     {
-        json_object_dotremove_internal(new_object, dot_pos + 1, 0);
-        json_value_free(new_value);
+        json_value_free(value);
         return JSONFailure;
     }
     return JSONSuccess;
 }
 
-JSON_Status json_object_dotset_string(JSON_Object *object, const char *name, const char *string)
+JSON_Status json_object_dotset_number(JSON_Object *object, const char *name, double number)
 {
-    JSON_Value *value = json_value_init_string(string);
+    JSON_Value *value = json_value_init_number_ctx(object_context(object), number);
     if (value == NULL)
     {
         return JSONFailure;
@@ -2225,9 +3891,9 @@ JSON_Status json_object_dotset_string(JSON_Object *object, const char *name, con
     return JSONSuccess;
 }
 
-JSON_Status json_object_dotset_number(JSON_Object *object, const char *name, double number)
+JSON_Status json_object_dotset_int64(JSON_Object *object, const char *name, int64_t integer)
 {
-    JSON_Value *value = json_value_init_number(number);
+    JSON_Value *value = json_value_init_int64_ctx(object_context(object), integer);
     if (value == NULL)
     {
         return JSONFailure;
@@ -2242,7 +3908,7 @@ JSON_Status json_object_dotset_number(JSON_Object *object, const char *name, dou
 
 JSON_Status json_object_dotset_boolean(JSON_Object *object, const char *name, int boolean)
 {
-    JSON_Value *value = json_value_init_boolean(boolean);
+    JSON_Value *value = json_value_init_boolean_ctx(object_context(object), boolean);
     if (value == NULL)
     {
         return JSONFailure;
@@ -2257,7 +3923,7 @@ JSON_Status json_object_dotset_boolean(JSON_Object *object, const char *name, in
 
 JSON_Status json_object_dotset_null(JSON_Object *object, const char *name)
 {
-    JSON_Value *value = json_value_init_null();
+    JSON_Value *value = json_value_init_null_ctx(object_context(object));
     if (value == NULL)
     {
         return JSONFailure;
@@ -2289,13 +3955,192 @@ JSON_Status json_object_clear(JSON_Object *object)
     }
     for (i = 0; i < json_object_get_count(object); i++)
     {
-        parson_free(object->names[i]);
+        json_object_release_name(object, object->names[i]);
         json_value_free(object->values[i]);
     }
     object->count = 0;
     return JSONSuccess;
 }
 
+static size_t path_segment_index(const char *name, size_t name_len)
+{
+    size_t index = 0;
+    if (name_len == 0 || (name[0] == '0' && name_len > 1))
+    {
+        return PATH_NO_INDEX;
+    }
+    while (name_len--)
+    {
+        if (*name < '0' || *name > '9' || index > (PATH_NO_INDEX - 1 - 9) / 10)
+        {
+            return PATH_NO_INDEX;
+        }
+        index = index * 10 + (size_t)(*name++ - '0');
+    }
+    return index;
+}
+
+static JSON_Path *json_path_compile_internal(JSON_Context *context, const char *path,
+                                             int is_pointer)
+{
+    size_t count = 0, path_len = 0, size = 0, i = 0;
+    const char *ptr = NULL;
+    char *names = NULL;
+    char separator = is_pointer ? '/' : '.';
+    JSON_Path *compiled = NULL;
+    JSON_Path_Segment *segment = NULL;
+    if (context == NULL || path == NULL || (is_pointer && *path != '\0' && *path != '/'))
+    {
+        return NULL;
+    }
+    count = is_pointer ? 0 : 1;
+    for (ptr = path; *ptr != '\0'; ptr++)
+    {
+        count += (*ptr == separator);
+    }
+    path_len = (size_t)(ptr - path);
+    /* unescaping only shrinks names, and each name loses a separator to its terminator */
+    size = sizeof(JSON_Path) + count * sizeof(JSON_Path_Segment) + path_len + 1;
+    compiled = (JSON_Path *)context_malloc(context, size);
+    if (compiled == NULL)
+    {
+        return NULL;
+    }
+    compiled->segments = (JSON_Path_Segment *)(compiled + 1);
+    compiled->count = count;
+    compiled->context = context;
+    compiled->size = size;
+    names = (char *)(compiled->segments + count);
+    ptr = path;
+    for (i = 0; i < count; i++)
+    {
+        if (is_pointer || i > 0)
+        {
+            ptr++; /* separator */
+        }
+        segment = &compiled->segments[i];
+        segment->name = names;
+        while (*ptr != '\0' && *ptr != separator)
+        {
+            if (is_pointer && *ptr == '~')
+            {
+                ptr++;
+                if (*ptr == '0')
+                {
+                    *names = '~';
+                }
+                else if (*ptr == '1')
+                {
+                    *names = '/';
+                }
+                else
+                {
+                    context_free_sized(context, compiled, size);
+                    return NULL;
+                }
+            }
+            else
+            {
+                *names = *ptr;
+            }
+            names++;
+            ptr++;
+        }
+        segment->name_len = (size_t)(names - segment->name);
+        *names++ = '\0';
+        segment->hash = hash_name(segment->name, segment->name_len);
+        segment->index =
+            is_pointer ? path_segment_index(segment->name, segment->name_len) : PATH_NO_INDEX;
+    }
+    return compiled;
+}
+
+JSON_Path *json_path_compile(const char *path)
+{
+    return json_path_compile_internal(&default_context, path, 0);
+}
+
+JSON_Path *json_path_compile_pointer(const char *pointer)
+{
+    return json_path_compile_internal(&default_context, pointer, 1);
+}
+
+JSON_Path *json_path_compile_ctx(JSON_Context *context, const char *path)
+{
+    return json_path_compile_internal(context, path, 0);
+}
+
+JSON_Path *json_path_compile_pointer_ctx(JSON_Context *context, const char *pointer)
+{
+    return json_path_compile_internal(context, pointer, 1);
+}
+
+void json_path_free(JSON_Path *path)
+{
+    if (path != NULL)
+    {
+        context_free_sized(path->context, path, path->size);
+    }
+}
+
+JSON_Value *json_path_get_value(const JSON_Value *root, const JSON_Path *path)
+{
+    size_t i = 0;
+    const JSON_Path_Segment *segment = NULL;
+    JSON_Value *value = (JSON_Value *)root;
+    if (path == NULL)
+    {
+        return NULL;
+    }
+    for (i = 0; i < path->count && value != NULL; i++)
+    {
+        segment = &path->segments[i];
+        switch (json_value_get_type(value))
+        {
+        case JSONObject:
+            value = json_object_getn_value_hashed(json_value_get_object(value), segment->name,
+                                                  segment->name_len, segment->hash);
+            break;
+        case JSONArray:
+            value = json_array_get_value(json_value_get_array(value), segment->index);
+            break;
+        default:
+            return NULL;
+        }
+    }
+    return value;
+}
+
+const char *json_path_get_string(const JSON_Value *root, const JSON_Path *path)
+{
+    return json_value_get_string(json_path_get_value(root, path));
+}
+
+JSON_Object *json_path_get_object(const JSON_Value *root, const JSON_Path *path)
+{
+    return json_value_get_object(json_path_get_value(root, path));
+}
+
+JSON_Array *json_path_get_array(const JSON_Value *root, const JSON_Path *path)
+{
+    return json_value_get_array(json_path_get_value(root, path));
+}
+
+double json_path_get_number(const JSON_Value *root, const JSON_Path *path)
+{
+    return json_value_get_number(json_path_get_value(root, path));
+}
+
+int64_t json_path_get_int64(const JSON_Value *root, const JSON_Path *path)
+{
+    return json_value_get_int64(json_path_get_value(root, path));
+}
+
+int json_path_get_boolean(const JSON_Value *root, const JSON_Path *path)
+{
+    return json_value_get_boolean(json_path_get_value(root, path));
+}
+
 JSON_Status json_validate(const JSON_Value *schema, const JSON_Value *value)
 {
     JSON_Value *temp_schema_value = NULL, *temp_value = NULL;
@@ -2310,6 +4155,11 @@ JSON_Status json_validate(const JSON_Value *schema, const JSON_Value *value)
     }
     schema_type = json_value_get_type(schema);
     value_type = json_value_get_type(value);
+    if (schema_type == JSONInteger || value_type == JSONInteger)
+    { /* integers and other numbers validate each other */
+        schema_type = schema_type == JSONInteger ? JSONNumber : schema_type;
+        value_type = value_type == JSONInteger ? JSONNumber : value_type;
+    }
     if (schema_type != value_type && schema_type != JSONNull)
     { /* null represents all values */
         return JSONFailure;
@@ -2373,16 +4223,22 @@ JSON_Status json_validate(const JSON_Value *schema, const JSON_Value *value)
     }
 }
 
-int json_value_equals(const JSON_Value *a, const JSON_Value *b)
+/* Compares the values alone: scalars by value, containers by type and member count */
+static int json_value_equals_node(const JSON_Value *a, const JSON_Value *b)
 {
-    JSON_Object *a_object = NULL, *b_object = NULL;
-    JSON_Array *a_array = NULL, *b_array = NULL;
     const char *a_string = NULL, *b_string = NULL;
-    const char *key = NULL;
-    size_t a_count = 0, b_count = 0, i = 0;
     JSON_Value_Type a_type, b_type;
     a_type = json_value_get_type(a);
     b_type = json_value_get_type(b);
+    if (a_type == JSONInteger && b_type == JSONInteger)
+    {
+        return json_value_get_int64(a) == json_value_get_int64(b);
+    }
+    if (a_type == JSONInteger || b_type == JSONInteger)
+    { /* mixed integer and double compare as doubles */
+        a_type = a_type == JSONInteger ? JSONNumber : a_type;
+        b_type = b_type == JSONInteger ? JSONNumber : b_type;
+    }
     if (a_type != b_type)
     {
         return 0;
@@ -2390,42 +4246,8 @@ int json_value_equals(const JSON_Value *a, const JSON_Value *b)
     switch (a_type)
     {
     case JSONArray:
-        a_array = json_value_get_array(a);
-        b_array = json_value_get_array(b);
-        a_count = json_array_get_count(a_array);
-        b_count = json_array_get_count(b_array);
-        if (a_count != b_count)
-        {
-            return 0;
-        }
-        for (i = 0; i < a_count; i++)
-        {
-            if (!json_value_equals(json_array_get_value(a_array, i),
-                                   json_array_get_value(b_array, i)))
-            {
-                return 0;
-            }
-        }
-        return 1;
     case JSONObject:
-        a_object = json_value_get_object(a);
-        b_object = json_value_get_object(b);
-        a_count = json_object_get_count(a_object);
-        b_count = json_object_get_count(b_object);
-        if (a_count != b_count)
-        {
-            return 0;
-        }
-        for (i = 0; i < a_count; i++)
-        {
-            key = json_object_get_name(a_object, i);
-            if (!json_value_equals(json_object_get_value(a_object, key),
-                                   json_object_get_value(b_object, key)))
-            {
-                return 0;
-            }
-        }
-        return 1;
+        return json_value_get_child_count(a) == json_value_get_child_count(b);
     case JSONString:
         a_string = json_value_get_string(a);
         b_string = json_value_get_string(b);
@@ -2447,6 +4269,304 @@ int json_value_equals(const JSON_Value *a, const JSON_Value *b)
     }
 }
 
+/* Walks both documents side by side. Documents too deep to walk compare unequal. */
+int json_value_equals(const JSON_Value *a, const JSON_Value *b)
+{
+    JSON_Walk_Stack stack;
+    JSON_Walk_Frame *frame = NULL;
+    const JSON_Object *a_object = NULL;
+    int equal = 1, pending = 1;
+
+    walk_stack_init(&stack, a != NULL ? a->context : &default_context);
+    while (equal)
+    {
+        if (pending)
+        {
+            equal = json_value_equals_node(a, b);
+            if (equal && (json_value_get_type(a) == JSONObject || json_value_get_type(a) == JSONArray))
+            {
+                equal = walk_stack_push(&stack, a) == JSONSuccess;
+                if (equal)
+                {
+                    stack.frames[stack.count - 1].other = b;
+                }
+            }
+            pending = 0;
+        }
+        if (!equal || stack.count == 0)
+        {
+            break;
+        }
+        frame = &stack.frames[stack.count - 1];
+        if (frame->index == json_value_get_child_count(frame->value))
+        {
+            stack.count--;
+            continue;
+        }
+        if (json_value_get_type(frame->value) == JSONObject)
+        {
+            a_object = json_value_get_object(frame->value);
+            a = json_object_get_value_at(a_object, frame->index);
+            b = json_object_get_value(json_value_get_object(frame->other),
+                                      json_object_get_name(a_object, frame->index));
+        }
+        else
+        {
+            a = json_array_get_value(json_value_get_array(frame->value), frame->index);
+            b = json_array_get_value(json_value_get_array(frame->other), frame->index);
+        }
+        frame->index++;
+        pending = 1;
+    }
+    walk_stack_free(&stack);
+    return equal;
+}
+
+/* Walks the patch with an explicit stack, each frame holding a patch object and the target
+ * object it applies to */
+static JSON_Status merge_patch_object(JSON_Object *target, const JSON_Object *patch)
+{
+    JSON_Walk_Stack stack;
+    JSON_Walk_Frame *frame = NULL;
+    JSON_Context *context = object_context(target);
+    const char *name = NULL;
+    JSON_Value *patch_value = NULL, *target_value = NULL, *new_value = NULL;
+    JSON_Status status = JSONSuccess;
+
+    walk_stack_init(&stack, context);
+    status = walk_stack_push(&stack, json_object_get_wrapping_value(patch));
+    if (status == JSONSuccess)
+    {
+        stack.frames[0].result = json_object_get_wrapping_value(target);
+    }
+    while (status == JSONSuccess && stack.count > 0)
+    {
+        frame = &stack.frames[stack.count - 1];
+        patch = json_value_get_object(frame->value);
+        target = json_value_get_object(frame->result);
+        if (frame->index == json_object_get_count(patch))
+        {
+            stack.count--;
+            continue;
+        }
+        name = json_object_get_name(patch, frame->index);
+        patch_value = json_object_get_value_at(patch, frame->index);
+        frame->index++;
+        switch (json_value_get_type(patch_value))
+        {
+        case JSONNull:
+            json_object_remove(target, name); /* nothing to do if it isn't there */
+            break;
+        case JSONObject:
+            target_value = json_object_get_value(target, name);
+            if (json_value_get_type(target_value) != JSONObject)
+            {
+                target_value = json_value_init_object_ctx(context);
+                if (target_value == NULL)
+                {
+                    status = JSONFailure;
+                    break;
+                }
+                if (json_object_set_value(target, name, target_value) == JSONFailure)
+                {
+                    json_value_free(target_value);
+                    status = JSONFailure;
+                    break;
+                }
+            }
+            status = walk_stack_push(&stack, patch_value);
+            if (status == JSONSuccess)
+            {
+                stack.frames[stack.count - 1].result = target_value;
+            }
+            break;
+        default:
+            new_value = json_value_deep_copy_internal(context, patch_value);
+            if (new_value == NULL)
+            {
+                status = JSONFailure;
+                break;
+            }
+            if (json_object_set_value(target, name, new_value) == JSONFailure)
+            {
+                json_value_free(new_value);
+                status = JSONFailure;
+            }
+            break;
+        }
+    }
+    walk_stack_free(&stack);
+    return status;
+}
+
+JSON_Value *json_merge_patch_apply(JSON_Value *target, const JSON_Value *patch)
+{
+    JSON_Context *context = target != NULL ? target->context : &default_context;
+    if (target != NULL && target->parent != NULL)
+    {
+        return NULL; /* only whole documents can be consumed */
+    }
+    if (patch == NULL)
+    {
+        json_value_free(target);
+        return NULL;
+    }
+    if (json_value_get_type(patch) != JSONObject)
+    {
+        json_value_free(target);
+        return json_value_deep_copy_internal(context, patch);
+    }
+    if (json_value_get_type(target) != JSONObject)
+    {
+        json_value_free(target);
+        target = json_value_init_object_ctx(context);
+        if (target == NULL)
+        {
+            return NULL;
+        }
+    }
+    if (merge_patch_object(json_value_get_object(target), json_value_get_object(patch)) ==
+        JSONFailure)
+    {
+        json_value_free(target);
+        return NULL;
+    }
+    return target;
+}
+
+/* Starts diffing a pair of objects: records the members that were removed and pushes the frame
+ * that visits the members of new_object */
+static JSON_Status merge_patch_diff_push(JSON_Walk_Stack *stack, JSON_Value *diff,
+                                         const JSON_Value *old_value, const JSON_Value *new_value)
+{
+    size_t i = 0;
+    const char *name = NULL;
+    const JSON_Object *old_object = json_value_get_object(old_value);
+    JSON_Value *removal = NULL;
+    for (i = 0; i < json_object_get_count(old_object); i++)
+    {
+        name = json_object_get_name(old_object, i);
+        if (json_object_get_value(json_value_get_object(new_value), name) != NULL)
+        {
+            continue;
+        }
+        removal = json_value_init_null_ctx(diff->context);
+        if (removal == NULL)
+        {
+            return JSONFailure;
+        }
+        if (json_object_set_value(json_value_get_object(diff), name, removal) == JSONFailure)
+        {
+            json_value_free(removal);
+            return JSONFailure;
+        }
+    }
+    if (walk_stack_push(stack, new_value) == JSONFailure)
+    {
+        return JSONFailure;
+    }
+    stack->frames[stack->count - 1].other = old_value;
+    stack->frames[stack->count - 1].result = diff;
+    return JSONSuccess;
+}
+
+/* Each frame holds a new object, the old object it replaces and the diff between them, which is
+ * attached to its parent diff as soon as it is created and dropped again if it ends up empty */
+static JSON_Status merge_patch_diff_object(JSON_Object *diff, const JSON_Object *old_object,
+                                           const JSON_Object *new_object)
+{
+    JSON_Walk_Stack stack;
+    JSON_Walk_Frame *frame = NULL;
+    JSON_Context *context = object_context(diff);
+    const char *name = NULL;
+    JSON_Value *old_value = NULL, *new_value = NULL, *diff_value = NULL;
+    JSON_Status status = JSONSuccess;
+
+    walk_stack_init(&stack, context);
+    status = merge_patch_diff_push(&stack, json_object_get_wrapping_value(diff),
+                                   json_object_get_wrapping_value(old_object),
+                                   json_object_get_wrapping_value(new_object));
+    while (status == JSONSuccess && stack.count > 0)
+    {
+        frame = &stack.frames[stack.count - 1];
+        new_object = json_value_get_object(frame->value);
+        old_object = json_value_get_object(frame->other);
+        diff = json_value_get_object(frame->result);
+        if (frame->index == json_object_get_count(new_object))
+        {
+            stack.count--;
+            if (stack.count > 0 && json_object_get_count(diff) == 0)
+            { /* nothing changed below this member: it is the last one added to the parent diff */
+                frame = &stack.frames[stack.count - 1];
+                json_object_remove(json_value_get_object(frame->result),
+                                   json_object_get_name(json_value_get_object(frame->value),
+                                                        frame->index - 1));
+            }
+            continue;
+        }
+        name = json_object_get_name(new_object, frame->index);
+        new_value = json_object_get_value_at(new_object, frame->index);
+        old_value = json_object_get_value(old_object, name);
+        frame->index++;
+        if (json_value_get_type(old_value) == JSONObject &&
+            json_value_get_type(new_value) == JSONObject)
+        {
+            diff_value = json_value_init_object_ctx(context);
+            if (diff_value == NULL)
+            {
+                status = JSONFailure;
+                break;
+            }
+            if (json_object_set_value(diff, name, diff_value) == JSONFailure)
+            {
+                json_value_free(diff_value);
+                status = JSONFailure;
+                break;
+            }
+            status = merge_patch_diff_push(&stack, diff_value, old_value, new_value);
+            continue;
+        }
+        if (old_value != NULL && json_value_equals(old_value, new_value))
+        {
+            continue;
+        }
+        diff_value = json_value_deep_copy_internal(context, new_value);
+        if (diff_value == NULL)
+        {
+            status = JSONFailure;
+            break;
+        }
+        if (json_object_set_value(diff, name, diff_value) == JSONFailure)
+        {
+            json_value_free(diff_value);
+            status = JSONFailure;
+        }
+    }
+    walk_stack_free(&stack);
+    return status;
+}
+
+JSON_Value *json_merge_patch_diff(const JSON_Value *old_value, const JSON_Value *new_value)
+{
+    JSON_Value *diff = NULL;
+    if (json_value_get_type(old_value) != JSONObject || json_value_get_type(new_value) != JSONObject)
+    {
+        return json_value_deep_copy(new_value);
+    }
+    diff = json_value_init_object_ctx(new_value->context);
+    if (diff == NULL)
+    {
+        return NULL;
+    }
+    if (merge_patch_diff_object(json_value_get_object(diff), json_value_get_object(old_value),
+                                json_value_get_object(new_value)) == JSONFailure)
+    {
+        json_value_free(diff);
+        return NULL;
+    }
+    return diff;
+}
+
 JSON_Value_Type json_type(const JSON_Value *value)
 {
     return json_value_get_type(value);
@@ -2472,6 +4592,11 @@ double json_number(const JSON_Value *value)
     return json_value_get_number(value);
 }
 
+int64_t json_int64(const JSON_Value *value)
+{
+    return json_value_get_int64(value);
+}
+
 int json_boolean(const JSON_Value *value)
 {
     return json_value_get_boolean(value);
@@ -2479,6 +4604,11 @@ int json_boolean(const JSON_Value *value)
 
 void json_set_allocation_functions(JSON_Malloc_Function malloc_fun, JSON_Free_Function free_fun)
 {
-    parson_malloc = malloc_fun;
-    parson_free = free_fun;
+    default_context.malloc_fun = malloc_fun;
+    default_context.free_fun = free_fun;
+}
+
+void json_set_key_interning(int enabled)
+{
+    default_context.intern_keys = enabled ? 1 : 0;
 }
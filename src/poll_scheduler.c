@@ -0,0 +1,42 @@
+#include "poll_scheduler.h"
+
+void PollScheduler_Init(PollScheduler *scheduler, int fastMs, int idleMs)
+{
+	scheduler->fastMs = fastMs;
+	scheduler->idleMs = idleMs;
+	scheduler->delayMs = idleMs;
+	scheduler->activity = false;
+	scheduler->polls = 0;
+	scheduler->fastPolls = 0;
+}
+
+bool PollScheduler_Kick(PollScheduler *scheduler)
+{
+	scheduler->activity = true;
+	if (scheduler->delayMs <= scheduler->fastMs)
+	{
+		return false;
+	}
+	scheduler->delayMs = scheduler->fastMs;
+	return true;
+}
+
+int PollScheduler_Next(PollScheduler *scheduler, bool busy)
+{
+	scheduler->polls++;
+	if (busy || scheduler->activity)
+	{
+		scheduler->delayMs = scheduler->fastMs;
+	}
+	else
+	{
+		// Back off exponentially so a quiet connection costs no more wakeups than a fixed idle poll
+		scheduler->delayMs = scheduler->delayMs * 2 < scheduler->idleMs ? scheduler->delayMs * 2 : scheduler->idleMs;
+	}
+	scheduler->activity = false;
+	if (scheduler->delayMs == scheduler->fastMs)
+	{
+		scheduler->fastPolls++;
+	}
+	return scheduler->delayMs;
+}
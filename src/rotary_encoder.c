@@ -1,4 +1,5 @@
 #include "rotary_encoder.h"
+#include "telemetry.h"
 #include "unistd.h"
 #include <applibs/gpio.h>
 
@@ -6,6 +7,7 @@ int fdClock = -1;
 int fdData = -1;
 RotaryChangedHandler changedHandler;
 EventLoopTimer *timer = NULL;
+static int32_t encoderCount = 0;
 
 const struct timespec debounceEncoder = { .tv_sec = 0, .tv_nsec = 2 * 1000 * 1000 };
 const struct timespec pollRotaryEncoder = { .tv_sec = 0, .tv_nsec = 1 * 1000 * 1000 };
@@ -37,7 +39,10 @@ void RotaryEncoder_Poll(EventLoopTimer* timer)
 			nanosleep(&delay1ms, NULL);
 		}
 
-		changedHandler(v2 ? -1 : 1);
+		int increment = v2 ? -1 : 1;
+		encoderCount += increment;
+		Telemetry_Record(Telemetry_EncoderCount, 1, encoderCount);
+		changedHandler(increment);
 	}
 }
 
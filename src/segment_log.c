@@ -0,0 +1,392 @@
+#include "segment_log.h"
+#include <string.h>
+#include <unistd.h>
+
+#define SEGMENT_MAGIC 0x534C4F47u // "SLOG"
+#define CHUNK_SIZE 64
+
+static void Put16(uint8_t *bytes, uint16_t value)
+{
+	bytes[0] = (uint8_t)value;
+	bytes[1] = (uint8_t)(value >> 8);
+}
+
+static void Put32(uint8_t *bytes, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		bytes[i] = (uint8_t)(value >> (8 * i));
+	}
+}
+
+static uint16_t Get16(const uint8_t *bytes)
+{
+	return (uint16_t)(bytes[0] | (bytes[1] << 8));
+}
+
+static uint32_t Get32(const uint8_t *bytes)
+{
+	return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) |
+		   ((uint32_t)bytes[3] << 24);
+}
+
+// CRC-32 (IEEE), a nibble at a time to keep the table small. Records are seeded with their
+// segment's sequence number, so records left over from an earlier lap of the ring never verify.
+static uint32_t Crc32(uint32_t seed, const void *data, size_t length)
+{
+	static const uint32_t table[16] = {
+		0x00000000u, 0x1DB71064u, 0x3B6E20C8u, 0x26D930ACu, 0x76DC4190u, 0x6B6B51F4u,
+		0x4DB26158u, 0x5005713Cu, 0xEDB88320u, 0xF00F9344u, 0xD6D6A3E8u, 0xCB61B38Cu,
+		0x9B64C2B0u, 0x86D3D2D4u, 0xA00AE278u, 0xBDBDF21Cu};
+	const uint8_t *bytes = data;
+	uint32_t crc = ~seed;
+	for (size_t i = 0; i < length; i++)
+	{
+		crc ^= bytes[i];
+		crc = (crc >> 4) ^ table[crc & 0xF];
+		crc = (crc >> 4) ^ table[crc & 0xF];
+	}
+	return ~crc;
+}
+
+static off_t FileOffset(uint32_t segment, uint32_t offset)
+{
+	return (off_t)segment * SEGMENT_LOG_SEGMENT_SIZE + offset;
+}
+
+// Reads from the file, seeing the buffered block in place of what is on disk. Bytes past the end
+// of the file read as zero.
+static int ReadAt(SegmentLog *log, uint32_t segment, uint32_t offset, void *buffer, size_t length)
+{
+	uint8_t *bytes = buffer;
+	memset(bytes, 0, length);
+	if (lseek(log->fd, FileOffset(segment, offset), SEEK_SET) == -1)
+	{
+		return -1;
+	}
+	size_t done = 0;
+	while (done < length)
+	{
+		ssize_t count = read(log->fd, bytes + done, length - done);
+		if (count < 0)
+		{
+			return -1;
+		}
+		if (count == 0)
+		{
+			break;
+		}
+		done += (size_t)count;
+	}
+
+	if (segment == log->writeSegment)
+	{
+		uint32_t start = offset > log->blockOffset ? offset : log->blockOffset;
+		uint32_t end = offset + (uint32_t)length;
+		if (end > log->blockOffset + SEGMENT_LOG_BLOCK_SIZE)
+		{
+			end = log->blockOffset + SEGMENT_LOG_BLOCK_SIZE;
+		}
+		if (start < end)
+		{
+			memcpy(bytes + (start - offset), log->block + (start - log->blockOffset), end - start);
+		}
+	}
+	return 0;
+}
+
+static int WriteAt(SegmentLog *log, uint32_t segment, uint32_t offset, const void *data, size_t length)
+{
+	if (lseek(log->fd, FileOffset(segment, offset), SEEK_SET) == -1)
+	{
+		return -1;
+	}
+	const uint8_t *bytes = data;
+	while (length > 0)
+	{
+		ssize_t count = write(log->fd, bytes, length);
+		if (count <= 0)
+		{
+			return -1;
+		}
+		bytes += count;
+		length -= (size_t)count;
+	}
+	return 0;
+}
+
+static bool ReadHeader(SegmentLog *log, uint32_t segment, uint32_t *sequence)
+{
+	uint8_t header[SEGMENT_LOG_HEADER_SIZE];
+	if (ReadAt(log, segment, 0, header, sizeof(header)) != 0 || Get32(header) != SEGMENT_MAGIC ||
+		Get32(header + 8) != Crc32(0, header, 8))
+	{
+		return false;
+	}
+	*sequence = Get32(header + 4);
+	return true;
+}
+
+// Checks the record at offset and returns its payload length, or 0 at the end of the segment
+static uint16_t CheckRecord(SegmentLog *log, uint32_t segment, uint32_t sequence, uint32_t offset)
+{
+	uint8_t header[SEGMENT_LOG_RECORD_HEADER_SIZE];
+	if (offset + SEGMENT_LOG_RECORD_HEADER_SIZE > SEGMENT_LOG_SEGMENT_SIZE ||
+		ReadAt(log, segment, offset, header, sizeof(header)) != 0)
+	{
+		return 0;
+	}
+	uint16_t length = Get16(header);
+	if (length == 0 || offset + SEGMENT_LOG_RECORD_HEADER_SIZE + length > SEGMENT_LOG_SEGMENT_SIZE)
+	{
+		return 0;
+	}
+	uint32_t crc = Crc32(sequence, header, 2);
+	uint8_t chunk[CHUNK_SIZE];
+	for (uint32_t done = 0; done < length;)
+	{
+		uint32_t count = length - done < CHUNK_SIZE ? length - done : CHUNK_SIZE;
+		if (ReadAt(log, segment, offset + SEGMENT_LOG_RECORD_HEADER_SIZE + done, chunk, count) != 0)
+		{
+			return 0;
+		}
+		crc = Crc32(crc, chunk, count);
+		done += count;
+	}
+	return crc == Get32(header + 4) ? length : 0;
+}
+
+static int WriteBlock(SegmentLog *log)
+{
+	if (WriteAt(log, log->writeSegment, log->blockOffset, log->block, SEGMENT_LOG_BLOCK_SIZE) != 0)
+	{
+		return -1;
+	}
+	log->blockDirty = false;
+	return 0;
+}
+
+static void StartSegment(SegmentLog *log, uint32_t segment, uint32_t sequence)
+{
+	log->writeSegment = segment;
+	log->writeSequence = sequence;
+	log->blockOffset = 0;
+	memset(log->block, 0, sizeof(log->block));
+	Put32(log->block, SEGMENT_MAGIC);
+	Put32(log->block + 4, sequence);
+	Put32(log->block + 8, Crc32(0, log->block, 8));
+	log->writeOffset = SEGMENT_LOG_HEADER_SIZE;
+	log->blockDirty = true;
+}
+
+// Copies into the block buffer, writing each block out as it fills
+static int Put(SegmentLog *log, const void *data, size_t length)
+{
+	const uint8_t *bytes = data;
+	while (length > 0)
+	{
+		uint32_t used = log->writeOffset - log->blockOffset;
+		size_t count = SEGMENT_LOG_BLOCK_SIZE - used < length ? SEGMENT_LOG_BLOCK_SIZE - used : length;
+		memcpy(log->block + used, bytes, count);
+		log->writeOffset += (uint32_t)count;
+		log->blockDirty = true;
+		bytes += count;
+		length -= count;
+		if (log->writeOffset - log->blockOffset == SEGMENT_LOG_BLOCK_SIZE)
+		{
+			if (WriteBlock(log) != 0)
+			{
+				return -1;
+			}
+			log->blockOffset += SEGMENT_LOG_BLOCK_SIZE;
+			memset(log->block, 0, sizeof(log->block));
+		}
+	}
+	return 0;
+}
+
+static bool ReadSegmentIsWriteSegment(const SegmentLog *log)
+{
+	return log->readSegment == log->writeSegment && log->readSequence == log->writeSequence;
+}
+
+// Moves the read cursor past segments that have been read to the end, invalidating each so it is
+// not replayed after a restart.
+static int SkipExhausted(SegmentLog *log)
+{
+	while (!ReadSegmentIsWriteSegment(log) &&
+		   CheckRecord(log, log->readSegment, log->readSequence, log->readOffset) == 0)
+	{
+		uint8_t header[SEGMENT_LOG_HEADER_SIZE] = {0};
+		if (WriteAt(log, log->readSegment, 0, header, sizeof(header)) != 0)
+		{
+			return -1;
+		}
+		log->readSegment = (log->readSegment + 1) % log->segmentCount;
+		log->readSequence++;
+		log->readOffset = SEGMENT_LOG_HEADER_SIZE;
+	}
+	return 0;
+}
+
+int SegmentLog_Open(SegmentLog *log, int fd, size_t capacity)
+{
+	memset(log, 0, sizeof(*log));
+	log->fd = fd;
+	log->segmentCount = (uint32_t)(capacity / SEGMENT_LOG_SEGMENT_SIZE);
+	log->writeSegment = UINT32_MAX; // no buffered block yet
+	if (log->segmentCount < 2)
+	{
+		return -1;
+	}
+
+	bool found = false;
+	uint32_t newest = 0;
+	uint32_t newestSequence = 0;
+	for (uint32_t segment = 0; segment < log->segmentCount; segment++)
+	{
+		uint32_t sequence;
+		if (ReadHeader(log, segment, &sequence) && (!found || sequence > newestSequence))
+		{
+			found = true;
+			newest = segment;
+			newestSequence = sequence;
+		}
+	}
+	if (!found)
+	{
+		StartSegment(log, 0, 1);
+		log->readSegment = log->writeSegment;
+		log->readSequence = log->writeSequence;
+		log->readOffset = log->writeOffset;
+		return 0;
+	}
+
+	// The unread segments run back from the newest with consecutive sequence numbers
+	log->readSegment = newest;
+	log->readSequence = newestSequence;
+	for (uint32_t i = 1; i < log->segmentCount; i++)
+	{
+		uint32_t previous = (log->readSegment + log->segmentCount - 1) % log->segmentCount;
+		uint32_t sequence;
+		if (!ReadHeader(log, previous, &sequence) || sequence != log->readSequence - 1)
+		{
+			break;
+		}
+		log->readSegment = previous;
+		log->readSequence = sequence;
+	}
+	log->readOffset = SEGMENT_LOG_HEADER_SIZE;
+
+	// Appends continue after the last record that verifies
+	uint32_t offset = SEGMENT_LOG_HEADER_SIZE;
+	for (;;)
+	{
+		uint16_t length = CheckRecord(log, newest, newestSequence, offset);
+		if (length == 0)
+		{
+			break;
+		}
+		offset += SEGMENT_LOG_RECORD_HEADER_SIZE + length;
+	}
+	log->blockOffset = offset & ~(uint32_t)(SEGMENT_LOG_BLOCK_SIZE - 1);
+	if (ReadAt(log, newest, log->blockOffset, log->block, sizeof(log->block)) != 0)
+	{
+		return -1;
+	}
+	// Clear whatever follows the last record so a torn tail is not written back
+	memset(log->block + (offset - log->blockOffset), 0, SEGMENT_LOG_BLOCK_SIZE - (offset - log->blockOffset));
+	log->writeSegment = newest;
+	log->writeSequence = newestSequence;
+	log->writeOffset = offset;
+	return 0;
+}
+
+int SegmentLog_Append(SegmentLog *log, const void *data, size_t length)
+{
+	if (length == 0 || length > SEGMENT_LOG_MAX_RECORD)
+	{
+		return -1;
+	}
+	if (log->writeOffset + SEGMENT_LOG_RECORD_HEADER_SIZE + length > SEGMENT_LOG_SEGMENT_SIZE)
+	{
+		if (SegmentLog_Flush(log) != 0)
+		{
+			return -1;
+		}
+		uint32_t next = (log->writeSegment + 1) % log->segmentCount;
+		if (next == log->readSegment)
+		{
+			// Full: give up the oldest segment
+			log->readSegment = (next + 1) % log->segmentCount;
+			log->readSequence++;
+			log->readOffset = SEGMENT_LOG_HEADER_SIZE;
+			log->droppedSegments++;
+		}
+		StartSegment(log, next, log->writeSequence + 1);
+	}
+
+	uint8_t header[SEGMENT_LOG_RECORD_HEADER_SIZE] = {0};
+	Put16(header, (uint16_t)length);
+	Put32(header + 4, Crc32(Crc32(log->writeSequence, header, 2), data, length));
+	return Put(log, header, sizeof(header)) == 0 && Put(log, data, length) == 0 ? 0 : -1;
+}
+
+int SegmentLog_Flush(SegmentLog *log)
+{
+	return log->blockDirty ? WriteBlock(log) : 0;
+}
+
+bool SegmentLog_IsEmpty(SegmentLog *log)
+{
+	if (SkipExhausted(log) != 0)
+	{
+		return false;
+	}
+	return ReadSegmentIsWriteSegment(log) && log->readOffset >= log->writeOffset;
+}
+
+int SegmentLog_Peek(SegmentLog *log, void *buffer, size_t size)
+{
+	if (SegmentLog_IsEmpty(log))
+	{
+		return 0;
+	}
+	uint16_t length = CheckRecord(log, log->readSegment, log->readSequence, log->readOffset);
+	if (length == 0 || length > size ||
+		ReadAt(log, log->readSegment, log->readOffset + SEGMENT_LOG_RECORD_HEADER_SIZE, buffer, length) != 0)
+	{
+		return -1;
+	}
+	return length;
+}
+
+int SegmentLog_Advance(SegmentLog *log)
+{
+	if (SegmentLog_IsEmpty(log))
+	{
+		return -1;
+	}
+	uint16_t length = CheckRecord(log, log->readSegment, log->readSequence, log->readOffset);
+	if (length == 0)
+	{
+		return -1;
+	}
+	log->readOffset += SEGMENT_LOG_RECORD_HEADER_SIZE + length;
+	if (ReadSegmentIsWriteSegment(log) && log->readOffset >= log->writeOffset)
+	{
+		// Drained: retire the write segment too, so nothing is replayed after a restart, and
+		// continue in the next one
+		uint8_t header[SEGMENT_LOG_HEADER_SIZE] = {0};
+		if (WriteAt(log, log->writeSegment, 0, header, sizeof(header)) != 0)
+		{
+			return -1;
+		}
+		StartSegment(log, (log->writeSegment + 1) % log->segmentCount, log->writeSequence + 1);
+		log->readSegment = log->writeSegment;
+		log->readSequence = log->writeSequence;
+		log->readOffset = log->writeOffset;
+		return 0;
+	}
+	return SkipExhausted(log);
+}
@@ -1,5 +1,6 @@
 #include "stepper.h"
 #include "pwmcontroller.h"
+#include "telemetry.h"
 #include "unistd.h"
 #include <applibs/gpio.h>
 
@@ -217,5 +218,7 @@ int Stepper_Move(int hStepper, int speed)
 	const struct timespec stepPeriod = { .tv_sec = 0, .tv_nsec = (long int)(1000000000L * (secPerRev / stepsPerRev)) };
 	SetEventLoopTimerPeriod(stepper->timer, &stepPeriod);
 
+	int32_t stepRate = speed == 0 ? 0 : (int32_t)(1000000000L / stepPeriod.tv_nsec);
+	Telemetry_Record(Telemetry_StepRate, hStepper, speed < 0 ? -stepRate : stepRate);
 	return 0;
 }
@@ -0,0 +1,322 @@
+#include "telemetry.h"
+#include "cbor.h"
+#include <time.h>
+
+#define RING_MASK (TELEMETRY_RING_CAPACITY - 1)
+#define SUMMARY_MASK (TELEMETRY_SUMMARY_CAPACITY - 1)
+
+// Largest encoding of one [dt, channel, source, value] sample
+#define MAX_SAMPLE_SIZE (1 + 9 + 3 + 3 + 5)
+
+// Largest encoding of one [dt, channel, source, count, min, max, mean, last, p50, p90] summary
+#define MAX_SUMMARY_SIZE (1 + 9 + 3 + 3 + 5 * 7)
+
+// Free-running sequence numbers, the ring index is their low bits
+static Telemetry_Sample ring[TELEMETRY_RING_CAPACITY];
+static uint32_t head = 0;
+static uint32_t tail = 0;
+static uint32_t dropped = 0;
+
+// The signals being aggregated and the window they are in
+typedef struct
+{
+	uint16_t channel;
+	uint16_t source;
+	Downsample_Window window;
+} Signal;
+
+static Signal signals[TELEMETRY_MAX_SIGNALS];
+static int signalCount = 0;
+static uint32_t windowMs = TELEMETRY_DEFAULT_WINDOW_MS;
+static uint32_t windowStartMs = 0;
+static bool windowStarted = false;
+
+// Closed windows, in the same free-running style as the samples
+static Telemetry_Summary summaries[TELEMETRY_SUMMARY_CAPACITY];
+static uint32_t summaryHead = 0;
+static uint32_t summaryTail = 0;
+static uint32_t summaryDropped = 0; // samples of untracked signals, and summaries overwritten
+
+// What the last batch covered, so Telemetry_Consume releases exactly those samples or summaries
+static bool batchSummaries = false;
+static uint32_t batchStart = 0;
+static uint32_t batchDropped = 0;
+
+static uint32_t MonotonicMs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint32_t)((uint64_t)now.tv_sec * 1000u + (uint64_t)now.tv_nsec / 1000000u);
+}
+
+static int64_t WallClockMs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Moves every signal with samples into the summary ring and starts the next window. Signals
+// that were idle for the whole window give their slot up to new ones.
+static void CloseWindow(uint32_t nowMs)
+{
+	int kept = 0;
+	for (int i = 0; i < signalCount; i++)
+	{
+		Signal *signal = &signals[i];
+		if (signal->window.count == 0)
+		{
+			continue;
+		}
+		if (kept != i)
+		{
+			signals[kept] = *signal;
+			signal = &signals[kept];
+		}
+		kept++;
+
+		if (summaryHead - summaryTail == TELEMETRY_SUMMARY_CAPACITY)
+		{
+			summaryTail++;
+			summaryDropped++;
+		}
+		Telemetry_Summary *summary = &summaries[summaryHead & SUMMARY_MASK];
+		summary->windowStartMs = windowStartMs;
+		summary->windowMs = windowMs;
+		summary->channel = signal->channel;
+		summary->source = signal->source;
+		Downsample_Summarize(&signal->window, &summary->summary);
+		Downsample_Reset(&signal->window);
+		summaryHead++;
+	}
+	signalCount = kept;
+	windowStartMs = nowMs;
+}
+
+static void CloseWindowIfDue(uint32_t nowMs)
+{
+	if (windowMs == 0)
+	{
+		return;
+	}
+	if (!windowStarted)
+	{
+		windowStartMs = nowMs;
+		windowStarted = true;
+		return;
+	}
+	uint32_t elapsed = nowMs - windowStartMs;
+	if (elapsed >= windowMs)
+	{
+		// Windows stay on their grid when nothing was recorded for a while
+		CloseWindow(nowMs - elapsed % windowMs);
+	}
+}
+
+static void Aggregate(uint16_t channel, uint16_t source, int32_t value)
+{
+	for (int i = 0; i < signalCount; i++)
+	{
+		if (signals[i].channel == channel && signals[i].source == source)
+		{
+			Downsample_Add(&signals[i].window, value);
+			return;
+		}
+	}
+	if (signalCount == TELEMETRY_MAX_SIGNALS)
+	{
+		summaryDropped++;
+		return;
+	}
+	Signal *signal = &signals[signalCount++];
+	signal->channel = channel;
+	signal->source = source;
+	Downsample_Reset(&signal->window);
+	Downsample_Add(&signal->window, value);
+}
+
+void Telemetry_Record(Telemetry_Channel channel, int source, int32_t value)
+{
+	uint32_t nowMs = MonotonicMs();
+	if (windowMs != 0)
+	{
+		CloseWindowIfDue(nowMs);
+		Aggregate((uint16_t)channel, (uint16_t)source, value);
+		return;
+	}
+
+	if (head - tail == TELEMETRY_RING_CAPACITY)
+	{
+		tail++;
+		dropped++;
+	}
+	Telemetry_Sample *sample = &ring[head & RING_MASK];
+	sample->timeMs = nowMs;
+	sample->channel = (uint16_t)channel;
+	sample->source = (uint16_t)source;
+	sample->value = value;
+	head++;
+}
+
+void Telemetry_SetWindow(uint32_t milliseconds)
+{
+	if (windowMs != 0 && windowStarted)
+	{
+		CloseWindow(MonotonicMs());
+	}
+	windowMs = milliseconds > TELEMETRY_MAX_WINDOW_MS ? TELEMETRY_MAX_WINDOW_MS : milliseconds;
+	windowStarted = false;
+}
+
+uint32_t Telemetry_Window(void)
+{
+	return windowMs;
+}
+
+size_t Telemetry_Pending(void)
+{
+	return (head - tail) + (summaryHead - summaryTail);
+}
+
+bool Telemetry_FlushDue(void)
+{
+	uint32_t nowMs = MonotonicMs();
+	CloseWindowIfDue(nowMs);
+
+	if (head != tail && (head - tail >= TELEMETRY_FLUSH_COUNT ||
+						 nowMs - ring[tail & RING_MASK].timeMs >= TELEMETRY_FLUSH_AGE_MS))
+	{
+		return true;
+	}
+	return summaryHead != summaryTail &&
+		   (summaryHead - summaryTail >= TELEMETRY_FLUSH_SUMMARIES ||
+			nowMs - summaries[summaryTail & SUMMARY_MASK].windowStartMs >= TELEMETRY_FLUSH_AGE_MS);
+}
+
+static size_t EncodeSamples(uint8_t *buffer, size_t size, size_t *count)
+{
+	const Telemetry_Sample *first = &ring[tail & RING_MASK];
+	CborWriter writer;
+	CborWriter_Init(&writer, buffer, size);
+	CborWriter_BeginMap(&writer, 3);
+	CborWriter_String(&writer, "t");
+	CborWriter_Int(&writer, WallClockMs() - (int64_t)(MonotonicMs() - first->timeMs));
+	CborWriter_String(&writer, "dropped");
+	CborWriter_Int(&writer, dropped);
+	CborWriter_String(&writer, "samples");
+	CborWriter_BeginIndefiniteArray(&writer);
+
+	uint32_t sequence = tail;
+	// Keep room for the break that closes the array
+	while (sequence != head && !writer.overflow && writer.size - writer.length > MAX_SAMPLE_SIZE)
+	{
+		const Telemetry_Sample *sample = &ring[sequence & RING_MASK];
+		CborWriter_BeginArray(&writer, 4);
+		CborWriter_Int(&writer, sample->timeMs - first->timeMs);
+		CborWriter_Int(&writer, sample->channel);
+		CborWriter_Int(&writer, sample->source);
+		CborWriter_Int(&writer, sample->value);
+		sequence++;
+	}
+	CborWriter_End(&writer);
+
+	size_t length = CborWriter_Finish(&writer);
+	if (length == 0)
+	{
+		return 0;
+	}
+	batchSummaries = false;
+	batchStart = tail;
+	batchDropped = dropped;
+	*count = sequence - tail;
+	return length;
+}
+
+static size_t EncodeSummaries(uint8_t *buffer, size_t size, size_t *count)
+{
+	const Telemetry_Summary *first = &summaries[summaryTail & SUMMARY_MASK];
+	CborWriter writer;
+	CborWriter_Init(&writer, buffer, size);
+	CborWriter_BeginMap(&writer, 4);
+	CborWriter_String(&writer, "t");
+	CborWriter_Int(&writer, WallClockMs() - (int64_t)(MonotonicMs() - first->windowStartMs));
+	CborWriter_String(&writer, "window");
+	CborWriter_Int(&writer, first->windowMs);
+	CborWriter_String(&writer, "dropped");
+	CborWriter_Int(&writer, summaryDropped);
+	CborWriter_String(&writer, "summaries");
+	CborWriter_BeginIndefiniteArray(&writer);
+
+	uint32_t sequence = summaryTail;
+	while (sequence != summaryHead && !writer.overflow &&
+		   writer.size - writer.length > MAX_SUMMARY_SIZE)
+	{
+		const Telemetry_Summary *summary = &summaries[sequence & SUMMARY_MASK];
+		if (summary->windowMs != first->windowMs)
+		{
+			break;
+		}
+		CborWriter_BeginArray(&writer, 10);
+		CborWriter_Int(&writer, summary->windowStartMs - first->windowStartMs);
+		CborWriter_Int(&writer, summary->channel);
+		CborWriter_Int(&writer, summary->source);
+		CborWriter_Int(&writer, summary->summary.count);
+		CborWriter_Int(&writer, summary->summary.min);
+		CborWriter_Int(&writer, summary->summary.max);
+		CborWriter_Int(&writer, summary->summary.mean);
+		CborWriter_Int(&writer, summary->summary.last);
+		CborWriter_Int(&writer, summary->summary.p50);
+		CborWriter_Int(&writer, summary->summary.p90);
+		sequence++;
+	}
+	CborWriter_End(&writer);
+
+	size_t length = CborWriter_Finish(&writer);
+	if (length == 0)
+	{
+		return 0;
+	}
+	batchSummaries = true;
+	batchStart = summaryTail;
+	batchDropped = summaryDropped;
+	*count = sequence - summaryTail;
+	return length;
+}
+
+size_t Telemetry_EncodeBatch(uint8_t *buffer, size_t size, size_t *count)
+{
+	*count = 0;
+	// Raw samples left from before a window was set are older than any summary
+	if (head != tail)
+	{
+		return EncodeSamples(buffer, size, count);
+	}
+	if (summaryHead != summaryTail)
+	{
+		return EncodeSummaries(buffer, size, count);
+	}
+	return 0;
+}
+
+void Telemetry_Consume(size_t count)
+{
+	// Entries dropped since the batch was encoded may already have moved the tail past it
+	uint32_t end = batchStart + (uint32_t)count;
+	if (batchSummaries)
+	{
+		if ((int32_t)(end - summaryTail) > 0)
+		{
+			summaryTail = end;
+		}
+		summaryDropped -= batchDropped;
+	}
+	else
+	{
+		if ((int32_t)(end - tail) > 0)
+		{
+			tail = end;
+		}
+		dropped -= batchDropped;
+	}
+	batchDropped = 0;
+}
@@ -0,0 +1,111 @@
+#include "cbor.h"
+#include "parson.h"
+#include "telemetry.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Telemetry batches of 1, 100 and 1000 samples as CBOR, straight from the ring as the device sends
+// them, against the same batch as JSON. The JSON document is the CBOR one decoded, so both carry
+// the same values; it is timed serializing a DOM that is already built, which leaves out the cost
+// of building it, and through Cbor_EncodeJson from that DOM.
+
+#define MIN_SECONDS 0.5
+#define BATCH_BUFFER_SIZE (32 * 1024)
+
+static uint8_t batch[BATCH_BUFFER_SIZE];
+static char text[BATCH_BUFFER_SIZE];
+static JSON_Value *document;
+static volatile size_t sink;
+
+static double NowSeconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void EncodeRing(void)
+{
+	size_t count;
+	sink = Telemetry_EncodeBatch(batch, sizeof(batch), &count);
+}
+
+static void EncodeDom(void)
+{
+	sink = Cbor_EncodeJson(document, batch, sizeof(batch));
+}
+
+static void SerializeJson(void)
+{
+	sink = json_serialize_to_buffer(document, text, sizeof(text)) == JSONSuccess;
+}
+
+static double Time(void (*function)(void))
+{
+	long iterations = 0;
+	double start = NowSeconds(), elapsed = 0;
+	while (elapsed < MIN_SECONDS)
+	{
+		for (int i = 0; i < 100; i++)
+		{
+			function();
+		}
+		iterations += 100;
+		elapsed = NowSeconds() - start;
+	}
+	return elapsed * 1e6 / iterations;
+}
+
+// Motor duty, step rates and loop latencies, the mix a running device records
+static void RecordSamples(int samples)
+{
+	srand(40);
+	for (int i = 0; i < samples; i++)
+	{
+		switch (i % 4)
+		{
+		case 0:
+			Telemetry_Record(Telemetry_MotorDuty, i % 2, rand() % 201 - 100);
+			break;
+		case 1:
+			Telemetry_Record(Telemetry_StepRate, 0, rand() % 4001 - 2000);
+			break;
+		case 2:
+			Telemetry_Record(Telemetry_EncoderCount, 0, i * 3);
+			break;
+		default:
+			Telemetry_Record(Telemetry_LoopLatency, 0, 50 + rand() % 2000);
+			break;
+		}
+	}
+}
+
+int main(void)
+{
+	const int sizes[] = {1, 100, 1000};
+	Telemetry_SetWindow(0);
+	printf("samples  cbor bytes  json bytes   ring to cbor    dom to cbor    dom to json\n");
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+	{
+		RecordSamples(sizes[i]);
+		size_t count;
+		size_t cborLength = Telemetry_EncodeBatch(batch, sizeof(batch), &count);
+		document = Cbor_DecodeJson(batch, cborLength, NULL);
+		if (count != (size_t)sizes[i] || document == NULL)
+		{
+			fprintf(stderr, "batch of %d samples held %zu\n", sizes[i], count);
+			return 1;
+		}
+		size_t jsonLength = json_serialization_size(document) - 1;
+
+		double ring = Time(EncodeRing), dom = Time(EncodeDom), json = Time(SerializeJson);
+		printf("%7d  %10zu  %10zu  %10.3f us  %10.3f us  %10.3f us\n", sizes[i], cborLength, jsonLength, ring,
+			   dom, json);
+
+		json_value_free(document);
+		Telemetry_Consume(count);
+	}
+	return 0;
+}
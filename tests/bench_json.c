@@ -0,0 +1,258 @@
+#include "parson.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Parse and serialize throughput, and allocations per parse, on the shapes of document the device
+// handles. Uses only the API parson had before this tree changed it, so BENCH_PARSON_SOURCE can
+// point at the original.
+//
+// "bench_json interning" instead compares the memory held by parsed twins with key interning off
+// and on. It needs this tree's parson, CMake defines BENCH_KEY_INTERNING when it is used.
+
+#define DOCUMENT_BYTES (64 * 1024)
+#define MIN_SECONDS 0.5
+
+typedef struct
+{
+	char *text;
+	size_t length;
+} Document;
+
+static size_t allocations;
+static size_t liveBytes; // requested and not freed yet
+
+// Blocks carry their size in front, aligned like malloc's
+typedef union
+{
+	size_t size;
+	max_align_t align;
+} BlockHeader;
+
+static void *CountingMalloc(size_t size)
+{
+	BlockHeader *header = malloc(sizeof(BlockHeader) + size);
+	if (header == NULL)
+	{
+		return NULL;
+	}
+	allocations++;
+	liveBytes += size;
+	header->size = size;
+	return header + 1;
+}
+
+static void CountingFree(void *block)
+{
+	if (block != NULL)
+	{
+		BlockHeader *header = (BlockHeader *)block - 1;
+		liveBytes -= header->size;
+		free(header);
+	}
+}
+
+static double NowSeconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void Append(Document *document, const char *text)
+{
+	size_t length = strlen(text);
+	if (document->length + length >= DOCUMENT_BYTES)
+	{
+		return;
+	}
+	memcpy(document->text + document->length, text, length + 1);
+	document->length += length;
+}
+
+// Shallow twin-sized objects of small members, in an array
+static void BuildFlat(Document *document)
+{
+	char member[96];
+	Append(document, "[");
+	for (int i = 0; document->length < DOCUMENT_BYTES - 200; i++)
+	{
+		switch (i % 8)
+		{
+		case 0:
+			snprintf(member, sizeof(member), "%s{\"speed\":%d", i ? "," : "", i % 100);
+			break;
+		case 1:
+			snprintf(member, sizeof(member), ",\"mode\":\"run\"");
+			break;
+		case 2:
+			snprintf(member, sizeof(member), ",\"enabled\":%s", i % 3 ? "true" : "false");
+			break;
+		case 7:
+			snprintf(member, sizeof(member), ",\"nothing\":null}");
+			break;
+		default:
+			snprintf(member, sizeof(member), ",\"count%d\":%d", i % 8, i);
+			break;
+		}
+		Append(document, member);
+	}
+	Append(document, document->text[document->length - 1] == '}' ? "]" : "}]");
+}
+
+// Telemetry samples: [dt ms, channel, value] with integer and fractional readings
+static void BuildNumbers(Document *document)
+{
+	char sample[96];
+	Append(document, "[");
+	for (int i = 0; document->length < DOCUMENT_BYTES - 200; i++)
+	{
+		if (i % 2)
+		{
+			snprintf(sample, sizeof(sample), "%s[%d,%d,%d]", i ? "," : "", i * 20, i % 4, i % 200 - 100);
+		}
+		else
+		{
+			snprintf(sample, sizeof(sample), "%s[%d,%d,%.17g]", i ? "," : "", i * 20, i % 4,
+					 (i % 1000) * 0.001 + 21.5);
+		}
+		Append(document, sample);
+	}
+	Append(document, "]");
+}
+
+// Log lines and messages: long strings, mostly plain ASCII with the odd escape and UTF-8 character
+static void BuildStrings(Document *document)
+{
+	static const char *const words[] = {"motor", "stalled", "after", "\\u00b0C", "bubbles", "\\\"wand\\\"",
+										"caf\xC3\xA9", "retry", "\\n", "connection"};
+	char line[256];
+	Append(document, "[");
+	for (int i = 0; document->length < DOCUMENT_BYTES - 300; i++)
+	{
+		size_t length = (size_t)snprintf(line, sizeof(line), "%s\"", i ? "," : "");
+		for (int word = 0; word < 4 + i % 24; word++)
+		{
+			length += (size_t)snprintf(line + length, sizeof(line) - length, "%s%s", word ? " " : "",
+										words[(i + word * 7) % 10]);
+		}
+		snprintf(line + length, sizeof(line) - length, "\"");
+		Append(document, line);
+	}
+	Append(document, "]");
+}
+
+static void Run(const char *name, const Document *document)
+{
+	int iterations = 0;
+	double parseSeconds = 0, serializeSeconds = 0;
+	size_t before = allocations;
+	json_value_free(json_parse_string(document->text));
+	size_t parseAllocations = allocations - before;
+	while (parseSeconds < MIN_SECONDS)
+	{
+		double start = NowSeconds();
+		JSON_Value *value = json_parse_string(document->text);
+		double parsed = NowSeconds();
+		char *serialized = json_serialize_to_string(value);
+		double serializedAt = NowSeconds();
+		if (value == NULL || serialized == NULL)
+		{
+			fprintf(stderr, "%s: parse or serialize failed\n", name);
+			exit(1);
+		}
+		json_free_serialized_string(serialized);
+		json_value_free(value);
+		parseSeconds += parsed - start;
+		serializeSeconds += serializedAt - parsed;
+		iterations++;
+	}
+	double megabytes = (double)document->length * iterations / 1e6;
+	printf("%-10s %7zu bytes  parse %7.1f MB/s  serialize %7.1f MB/s  %6zu allocations per parse\n", name,
+		   document->length, megabytes / parseSeconds, megabytes / serializeSeconds, parseAllocations);
+}
+
+#ifdef BENCH_KEY_INTERNING
+#define HELD_TWINS 16
+
+// A complete twin as the hub sends it: every property comes with $metadata, so the same few names
+// repeat throughout
+static const char twin[] =
+	"{\"desired\":{\"SpeedMotorA\":50,\"SpeedMotorB\":-20,\"TelemetryWindowSeconds\":10,"
+	"\"$metadata\":{\"$lastUpdated\":\"2026-10-18T09:12:44.1234567Z\",\"$lastUpdatedVersion\":7,"
+	"\"SpeedMotorA\":{\"$lastUpdated\":\"2026-10-18T09:12:44.1234567Z\",\"$lastUpdatedVersion\":7},"
+	"\"SpeedMotorB\":{\"$lastUpdated\":\"2026-10-18T09:10:02.7654321Z\",\"$lastUpdatedVersion\":6},"
+	"\"TelemetryWindowSeconds\":{\"$lastUpdated\":\"2026-10-17T22:01:13.0000001Z\","
+	"\"$lastUpdatedVersion\":2}},\"$version\":7},"
+	"\"reported\":{\"SpeedMotorA\":50,\"SpeedMotorB\":-20,\"TelemetryWindowSeconds\":10,"
+	"\"$metadata\":{\"$lastUpdated\":\"2026-10-18T09:12:45.5550000Z\","
+	"\"SpeedMotorA\":{\"$lastUpdated\":\"2026-10-18T09:12:45.5550000Z\"},"
+	"\"SpeedMotorB\":{\"$lastUpdated\":\"2026-10-18T09:10:03.1110000Z\"},"
+	"\"TelemetryWindowSeconds\":{\"$lastUpdated\":\"2026-10-17T22:01:14.2220000Z\"}},"
+	"\"$version\":12}}";
+
+// Parses one twin, then HELD_TWINS at once, reporting allocations and bytes held
+static void RunInterning(int enabled)
+{
+	JSON_Value *held[HELD_TWINS];
+	json_set_key_interning(enabled);
+
+	size_t before = allocations, bytesBefore = liveBytes;
+	held[0] = json_parse_string(twin);
+	size_t oneAllocations = allocations - before, oneBytes = liveBytes - bytesBefore;
+	for (int i = 1; i < HELD_TWINS; i++)
+	{
+		held[i] = json_parse_string(twin);
+	}
+	size_t heldAllocations = allocations - before, heldBytes = liveBytes - bytesBefore;
+	for (int i = 0; i < HELD_TWINS; i++)
+	{
+		if (held[i] == NULL)
+		{
+			fprintf(stderr, "parse failed\n");
+			exit(1);
+		}
+		json_value_free(held[i]);
+	}
+	printf("interning %-3s  1 twin: %4zu allocations %6zu bytes   %d twins: %5zu allocations %6zu bytes"
+		   "   left after free: %zu bytes\n",
+		   enabled ? "on" : "off", oneAllocations, oneBytes, HELD_TWINS, heldAllocations, heldBytes,
+		   liveBytes - bytesBefore);
+}
+#endif
+
+int main(int argc, char **argv)
+{
+	json_set_allocation_functions(CountingMalloc, CountingFree);
+
+	if (argc > 1 && strcmp(argv[1], "interning") == 0)
+	{
+#ifdef BENCH_KEY_INTERNING
+		printf("%zu byte twin\n", strlen(twin));
+		RunInterning(0);
+		RunInterning(1);
+		return 0;
+#else
+		fprintf(stderr, "interning needs this tree's parson.c\n");
+		return 1;
+#endif
+	}
+
+	static char flatText[DOCUMENT_BYTES];
+	Document flat = {flatText, 0};
+	BuildFlat(&flat);
+	Run("flat", &flat);
+
+	static char numbersText[DOCUMENT_BYTES];
+	Document numbers = {numbersText, 0};
+	BuildNumbers(&numbers);
+	Run("numbers", &numbers);
+
+	static char stringsText[DOCUMENT_BYTES];
+	Document strings = {stringsText, 0};
+	BuildStrings(&strings);
+	Run("strings", &strings);
+	return 0;
+}
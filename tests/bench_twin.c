@@ -0,0 +1,100 @@
+#include "parson.h"
+#include "twin_model.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// The generated Device Twin codec against the generic parson path it replaced: a DOM parse with
+// name lookups for the desired properties, and a DOM built and serialized for the reported ones.
+
+#define MIN_SECONDS 0.5
+
+static const char twin[] =
+	"{\"desired\":{\"SpeedMotorA\":50,\"SpeedMotorB\":{\"value\":-20,\"ac\":200,\"av\":3},"
+	"\"TelemetryWindowSeconds\":10,\"$version\":7},"
+	"\"reported\":{\"SpeedMotorA\":50,\"SpeedMotorB\":-20,\"TelemetryWindowSeconds\":10,"
+	"\"$version\":3}}";
+
+static volatile int sink;
+
+static double NowSeconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int PropertyValue(const JSON_Object *desired, const char *name)
+{
+	JSON_Value *value = json_object_get_value(desired, name);
+	if (json_value_get_type(value) == JSONObject)
+	{
+		value = json_object_get_value(json_value_get_object(value), "value");
+	}
+	return (int)json_value_get_number(value);
+}
+
+static void ParseGenerated(void)
+{
+	TwinModel_Properties properties = {0};
+	uint32_t fields = 0;
+	int64_t version = 0;
+	TwinModel_ParseDesired(twin, sizeof(twin) - 1, &properties, &fields, &version);
+	sink = properties.SpeedMotorA + properties.SpeedMotorB + properties.TelemetryWindowSeconds;
+}
+
+static void ParseParson(void)
+{
+	JSON_Value *root = json_parse_string(twin);
+	JSON_Object *desired = json_object_get_object(json_value_get_object(root), "desired");
+	sink = PropertyValue(desired, "SpeedMotorA") + PropertyValue(desired, "SpeedMotorB") +
+		   PropertyValue(desired, "TelemetryWindowSeconds") +
+		   (int)json_object_get_number(desired, "$version");
+	json_value_free(root);
+}
+
+static void SerializeGenerated(void)
+{
+	TwinModel_Properties properties = {50, -20, 10};
+	char buffer[TWIN_MODEL_MAX_REPORTED_SIZE];
+	sink = (int)TwinModel_SerializeReported(&properties, TWIN_MODEL_ALL_FIELDS, buffer, sizeof(buffer));
+}
+
+static void SerializeParson(void)
+{
+	JSON_Value *root = json_value_init_object();
+	JSON_Object *object = json_value_get_object(root);
+	json_object_set_number(object, "SpeedMotorA", 50);
+	json_object_set_number(object, "SpeedMotorB", -20);
+	json_object_set_number(object, "TelemetryWindowSeconds", 10);
+	char *serialized = json_serialize_to_string(root);
+	sink = (int)strlen(serialized);
+	json_free_serialized_string(serialized);
+	json_value_free(root);
+}
+
+static void Run(const char *name, void (*function)(void))
+{
+	long iterations = 0;
+	double start = NowSeconds(), elapsed = 0;
+	while (elapsed < MIN_SECONDS)
+	{
+		for (int i = 0; i < 1000; i++)
+		{
+			function();
+		}
+		iterations += 1000;
+		elapsed = NowSeconds() - start;
+	}
+	printf("%-20s %8.3f us\n", name, elapsed * 1e6 / iterations);
+}
+
+int main(void)
+{
+	Run("parse generated", ParseGenerated);
+	Run("parse parson", ParseParson);
+	Run("serialize generated", SerializeGenerated);
+	Run("serialize parson", SerializeParson);
+	return 0;
+}
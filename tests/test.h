@@ -0,0 +1,23 @@
+#ifndef test_test_h
+#define test_test_h
+
+#include <stdio.h>
+
+// Minimal host test support: CHECK reports a failure and carries on, so one run lists them all.
+// main returns TEST_RESULT().
+
+static int test_failures = 0;
+
+#define CHECK(condition)                                                                          \
+	do                                                                                            \
+	{                                                                                             \
+		if (!(condition))                                                                         \
+		{                                                                                         \
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition);         \
+			test_failures++;                                                                      \
+		}                                                                                         \
+	} while (0)
+
+#define TEST_RESULT() (test_failures == 0 ? 0 : 1)
+
+#endif
@@ -0,0 +1,266 @@
+#include "cbor.h"
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Decoding checks use examples from RFC 8949 appendix A, written as hex
+
+static size_t FromHex(const char *hex, uint8_t *bytes)
+{
+	size_t length = strlen(hex) / 2;
+	for (size_t i = 0; i < length; i++)
+	{
+		char pair[3] = {hex[2 * i], hex[2 * i + 1], '\0'};
+		bytes[i] = (uint8_t)strtoul(pair, NULL, 16);
+	}
+	return length;
+}
+
+// Decodes hex and serializes the result, NULL when decoding fails
+static char *Decode(const char *hex)
+{
+	uint8_t bytes[256];
+	size_t length = FromHex(hex, bytes);
+	JSON_Value *value = Cbor_DecodeJson(bytes, length, NULL);
+	char *serialized = value != NULL ? json_serialize_to_string(value) : NULL;
+	json_value_free(value);
+	return serialized;
+}
+
+static void Decoding(void)
+{
+	const char *cases[][2] = {
+		{"00", "0"},
+		{"1818", "24"},
+		{"1903e8", "1000"},
+		{"3903e7", "-1000"},
+		{"f93e00", "1.5"},
+		{"f90001", "5.960464477539063e-8"},
+		{"fa47c35000", "100000"},
+		{"fb3ff199999999999a", "1.1"},
+		{"f4", "false"},
+		{"f5", "true"},
+		{"f6", "null"},
+		{"f7", "null"},
+		{"60", "\"\""},
+		{"62c3bc", "\"\xC3\xBC\""},
+		{"7f657374726561646d696e67ff", "\"streaming\""},
+		{"7fff", "\"\""},
+		{"5fff", "\"\""},
+		{"4401020304", "\"AQIDBA\""},
+		{"5f42010243030405ff", "\"AQIDBAU\""},
+		{"83010203", "[1,2,3]"},
+		{"9f018202039f0405ffff", "[1,[2,3],[4,5]]"},
+		{"a201020304", "{\"1\":2,\"3\":4}"},
+		{"a26161016162820203", "{\"a\":1,\"b\":[2,3]}"},
+		{"bf6346756ef563416d7421ff", "{\"Fun\":true,\"Amt\":-2}"},
+		{"a17fff00", "{\"\":0}"},
+		{"bf7fff00ff", "{\"\":0}"},
+		{"c074323031332d30332d32315432303a30343a30305a", "\"2013-03-21T20:04:00Z\""},
+	};
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+	{
+		char *decoded = Decode(cases[i][0]);
+		if (decoded == NULL || strcmp(decoded, cases[i][1]) != 0)
+		{
+			fprintf(stderr, "%s decoded as %s\n", cases[i][0], decoded ? decoded : "NULL");
+			CHECK(0);
+		}
+		json_free_serialized_string(decoded);
+	}
+
+	const char *malformed[] = {
+		"",			  // nothing
+		"18",		  // argument cut short
+		"62c3",		  // string cut short
+		"7f61",		  // chunk cut short
+		"7f6161",	  // no break
+		"7f7fffff",	  // nested indefinite chunk
+		"7f4161ff",	  // byte chunk in a text string
+		"ff",		  // stray break
+		"8301",		  // missing items
+		"a1",		  // missing key and value
+		"a161",		  // missing value
+		"0000",		  // trailing data
+		"6100",		  // null character in text
+		"f97c00",	  // infinity
+		"1c",		  // reserved additional information
+	};
+	for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); i++)
+	{
+		char *decoded = Decode(malformed[i]);
+		if (decoded != NULL)
+		{
+			fprintf(stderr, "%s decoded as %s\n", malformed[i], decoded);
+			CHECK(0);
+		}
+		json_free_serialized_string(decoded);
+	}
+
+	// Nesting up to CBOR_MAX_DEPTH
+	char hex[2 * CBOR_MAX_DEPTH + 8];
+	for (int depth = CBOR_MAX_DEPTH; depth <= CBOR_MAX_DEPTH + 1; depth++)
+	{
+		for (int i = 0; i < depth; i++)
+		{
+			memcpy(hex + 2 * i, "81", 2);
+		}
+		strcpy(hex + 2 * depth, "00");
+		char *decoded = Decode(hex);
+		CHECK((decoded != NULL) == (depth == CBOR_MAX_DEPTH));
+		json_free_serialized_string(decoded);
+	}
+}
+
+// JSON through CBOR and back, then every truncation of the encoding is rejected
+static void RoundTrips(void)
+{
+	const char *documents[] = {
+		"{\"t\":1700000000,\"window\":10000,\"summaries\":[[0,1,2,10,-1.5,3.25,0.5,1,0.5,2.75]]}",
+		"[0,-1,255,256,65535,65536,-4294967297,9007199254740993,0.1,-0.0,1e300,5e-324]",
+		"{\"\":\"\",\"nested\":{\"a\":[[],{},[null,true,false]],\"\xC3\xA9\":\"\xF0\x9F\x98\x80\"}}",
+		"\"a string long enough to need a one byte length header and then some\"",
+	};
+	for (size_t i = 0; i < sizeof(documents) / sizeof(documents[0]); i++)
+	{
+		JSON_Value *value = json_parse_string(documents[i]);
+		uint8_t encoded[512];
+		size_t length = Cbor_EncodeJson(value, encoded, sizeof(encoded));
+		CHECK(length > 0);
+		CHECK(Cbor_EncodeJson(value, encoded, length - 1) == 0);
+		CHECK(Cbor_EncodeJson(value, encoded, sizeof(encoded)) == length);
+
+		JSON_Value *decoded = Cbor_DecodeJson(encoded, length, NULL);
+		CHECK(json_value_equals(value, decoded));
+		json_value_free(decoded);
+		for (size_t cut = 0; cut < length; cut++)
+		{
+			decoded = Cbor_DecodeJson(encoded, cut, NULL);
+			CHECK(decoded == NULL);
+			json_value_free(decoded);
+		}
+		json_value_free(value);
+	}
+}
+
+static long liveBlocks = 0;
+static long allocations = 0;
+static long defaultAllocations = 0;
+static size_t largestRequest = 0;
+static long failAfter = -1; // allocations to allow before failing, -1 for no limit
+
+static void *CountingMalloc(size_t size)
+{
+	if (failAfter >= 0 && allocations >= failAfter)
+	{
+		return NULL;
+	}
+	allocations++;
+	liveBlocks++;
+	largestRequest = size > largestRequest ? size : largestRequest;
+	return malloc(size);
+}
+
+static void CountingFree(void *block)
+{
+	if (block != NULL)
+	{
+		liveBlocks--;
+	}
+	free(block);
+}
+
+static void *DefaultMalloc(size_t size)
+{
+	defaultAllocations++;
+	return malloc(size);
+}
+
+// Decoding into a context takes everything from its allocator, the scratch included, and gives it
+// all back, on success and on failure. Keys held on the scratch survive it growing under them.
+static void Contexts(void)
+{
+	char text[300];
+	memset(text, 'x', sizeof(text) - 1);
+	text[sizeof(text) - 1] = '\0';
+	JSON_Value *value = json_value_init_object();
+	json_object_dotset_string(json_object(value), "outer key.inner key.long", text);
+	json_object_dotset_number(json_object(value), "outer key.inner key.after", 1.5);
+	json_object_dotset_string(json_object(value), "outer key.next", text + 200);
+	uint8_t encoded[1024];
+	size_t length = Cbor_EncodeJson(value, encoded, sizeof(encoded));
+	CHECK(length > 0);
+
+	json_set_allocation_functions(DefaultMalloc, free);
+	for (int pooled = 0; pooled <= 1; pooled++)
+	{
+		JSON_Context *context = json_context_init(CountingMalloc, CountingFree);
+		if (pooled)
+		{
+			CHECK(json_context_set_pool_limit(context, 16 * 1024) == JSONSuccess);
+		}
+		long contextBlocks = liveBlocks;
+		for (int round = 0; round < 3; round++)
+		{
+			long before = allocations;
+			largestRequest = 0;
+			JSON_Value *decoded = Cbor_DecodeJson(encoded, length, context);
+			CHECK(json_value_equals(value, decoded));
+			json_value_free(decoded);
+			// A pooled context serves later rounds from what the first one freed
+			CHECK(pooled && round > 0 ? allocations == before : allocations > before);
+			// The scratch grew to hold both keys and the 300 byte string above them, no value is that big
+			CHECK(pooled && round > 0 ? largestRequest == 0 : largestRequest >= 512);
+			for (size_t cut = 0; cut < length; cut += 7)
+			{
+				CHECK(Cbor_DecodeJson(encoded, cut, context) == NULL);
+			}
+		}
+		CHECK(defaultAllocations == 0);
+		CHECK(pooled || liveBlocks == contextBlocks);
+
+		// Running out of memory at any point fails the decode without leaking
+		bool decodedOnce = false;
+		for (long limit = 0; !pooled && !decodedOnce; limit++)
+		{
+			failAfter = allocations + limit;
+			JSON_Value *decoded = Cbor_DecodeJson(encoded, length, context);
+			failAfter = -1;
+			decodedOnce = decoded != NULL;
+			CHECK(decoded == NULL || json_value_equals(value, decoded));
+			json_value_free(decoded);
+			CHECK(liveBlocks == contextBlocks);
+		}
+		json_context_free(context);
+		CHECK(liveBlocks == 0);
+	}
+	json_set_allocation_functions(malloc, free);
+	json_value_free(value);
+}
+
+// Random bytes must never crash the decoder
+static void Garbage(void)
+{
+	srand(40);
+	for (int i = 0; i < 100000; i++)
+	{
+		uint8_t bytes[24];
+		size_t length = (size_t)(rand() % (int)sizeof(bytes));
+		for (size_t j = 0; j < length; j++)
+		{
+			// favour heads of short strings and containers and the break byte
+			int r = rand();
+			bytes[j] = r % 4 == 0 ? 0xFF : r % 4 == 1 ? (uint8_t)(0x60 | (r >> 8) % 0x20) : (uint8_t)(r >> 8);
+		}
+		json_value_free(Cbor_DecodeJson(bytes, length, NULL));
+	}
+}
+
+int main(void)
+{
+	Decoding();
+	RoundTrips();
+	Contexts();
+	Garbage();
+	return TEST_RESULT();
+}
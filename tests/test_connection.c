@@ -0,0 +1,100 @@
+#include "connection.h"
+#include "test.h"
+#include <string.h>
+
+// Drives the connection policy through a direct connection, a provisioned one and both kinds of
+// backoff, checking the cached hub and that delays stay within their bounds.
+
+#define HUB "bubbles.azure-devices.net"
+#define OTHER_HUB "other.azure-devices.net"
+
+static void TestDirect(void)
+{
+	Connection connection;
+	Connection_Init(&connection, 1, HUB, 0);
+	CHECK(!Connection_ShouldConnect(&connection, -1));
+	CHECK(Connection_ShouldConnect(&connection, CONNECTION_START_SPREAD_MS));
+
+	// The transport reports the hostname it was handed, the cached buffer itself
+	const char *target = Connection_Target(&connection);
+	CHECK(target == connection.hubHostname);
+	Connection_Attempted(&connection, IotTransport_Ok, target, 1000);
+	CHECK(strcmp(connection.hubHostname, HUB) == 0);
+	CHECK(connection.state == Connection_Connecting);
+
+	CHECK(!Connection_StatusChanged(&connection, true, IotTransport_Ok, 2000));
+	CHECK(connection.state == Connection_Connected);
+
+	// A transient drop waits for the client, a timeout tears it down and keeps the hub
+	CHECK(!Connection_StatusChanged(&connection, false, IotTransport_Transient, 3000));
+	CHECK(!Connection_TimedOut(&connection, 3000 + CONNECTION_CONNECTING_TIMEOUT_MS - 1));
+	CHECK(Connection_TimedOut(&connection, 3000 + CONNECTION_CONNECTING_TIMEOUT_MS));
+	CHECK(strcmp(connection.hubHostname, HUB) == 0);
+
+	// Failing straight to the hub for another reason than the network provisions next time
+	int64_t now = connection.retryAtMs;
+	CHECK(Connection_ShouldConnect(&connection, now));
+	CHECK(Connection_Target(&connection) != NULL);
+	Connection_Attempted(&connection, IotTransport_Retry, NULL, now);
+	CHECK(connection.hubHostname[0] == '\0');
+	CHECK(Connection_Target(&connection) == NULL);
+}
+
+static void TestProvisioned(void)
+{
+	Connection connection;
+	Connection_Init(&connection, 2, NULL, 0);
+	CHECK(Connection_Target(&connection) == NULL);
+	Connection_Attempted(&connection, IotTransport_Ok, OTHER_HUB, 0);
+	CHECK(strcmp(connection.hubHostname, OTHER_HUB) == 0);
+
+	// Rejected credentials drop the hub even when it came from provisioning
+	CHECK(Connection_StatusChanged(&connection, false, IotTransport_Credentials, 0));
+	CHECK(connection.hubHostname[0] == '\0');
+	CHECK(connection.state == Connection_Disconnected);
+
+	// A late callback from the client being torn down changes nothing
+	CHECK(!Connection_StatusChanged(&connection, true, IotTransport_Ok, 0));
+	CHECK(connection.state == Connection_Disconnected);
+}
+
+static void TestBackOff(void)
+{
+	Connection connection;
+	Connection_Init(&connection, 3, NULL, 0);
+	int64_t now = 0;
+	for (int i = 0; i < 50; i++)
+	{
+		now = connection.retryAtMs;
+		Connection_Target(&connection);
+		Connection_Attempted(&connection, IotTransport_Transient, NULL, now);
+		CHECK(connection.delayMs >= CONNECTION_TRANSIENT_BASE_MS);
+		CHECK(connection.delayMs <= CONNECTION_TRANSIENT_CAP_MS);
+		CHECK(Connection_WaitMs(&connection, now) == connection.delayMs);
+	}
+	for (int i = 0; i < 50; i++)
+	{
+		now = connection.retryAtMs;
+		Connection_Target(&connection);
+		Connection_Attempted(&connection, IotTransport_Retry, NULL, now);
+		CHECK(connection.delayMs >= CONNECTION_RETRY_BASE_MS);
+		CHECK(connection.delayMs <= CONNECTION_RETRY_CAP_MS);
+	}
+	CHECK(connection.failures == 100);
+
+	// Connecting resets the backoff
+	now = connection.retryAtMs;
+	Connection_Attempted(&connection, IotTransport_Ok, NULL, now);
+	Connection_StatusChanged(&connection, true, IotTransport_Ok, now);
+	CHECK(connection.failures == 0);
+	CHECK(connection.delayMs == 0);
+	CHECK(Connection_WaitMs(&connection, now) == 0);
+}
+
+int main(void)
+{
+	TestDirect();
+	TestProvisioned();
+	TestBackOff();
+	return TEST_RESULT();
+}
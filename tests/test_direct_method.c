@@ -0,0 +1,123 @@
+#include "direct_method.h"
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Registers a full table in scrambled order and dispatches every name, which only finds the
+// right handler when the table stayed sorted, then checks the responses the IoT client gets.
+
+// Each handler answers with its own number
+#define HANDLER(n)                                                                                \
+	static DirectMethod_Result Handler##n(const char *payload, size_t size)                       \
+	{                                                                                             \
+		return (DirectMethod_Result)DIRECT_METHOD_RESULT(200 + n, #n);                            \
+	}
+HANDLER(0)
+HANDLER(1)
+HANDLER(2)
+HANDLER(3)
+HANDLER(4)
+HANDLER(5)
+HANDLER(6)
+HANDLER(7)
+HANDLER(8)
+HANDLER(9)
+HANDLER(10)
+HANDLER(11)
+HANDLER(12)
+HANDLER(13)
+HANDLER(14)
+
+static const char *echoedPayload = NULL;
+static size_t echoedSize = 0;
+
+// Answers with the payload it was given, or an empty body for an empty payload
+static DirectMethod_Result Echo(const char *payload, size_t size)
+{
+	echoedPayload = payload;
+	echoedSize = size;
+	return (DirectMethod_Result){200, payload, size};
+}
+
+static const DirectMethod_Handler handlers[] = {
+	Handler0, Handler1, Handler2,  Handler3,  Handler4,	 Handler5,	Handler6, Handler7,
+	Handler8, Handler9, Handler10, Handler11, Handler12, Handler13, Handler14, Echo,
+};
+
+// Names in registration order, with prefixes of one another and mixed case
+static const char *names[] = {
+	"Stop", "RampTo", "A", "StopAll", "SetSpeed", "Z", "RunProgram", "a", "TriggerAlarm", "Ramp",
+	"St",	"B",	  "z", "Reset",	  "Run",	  "Echo",
+};
+
+static int Dispatch(const char *name, const char *payload, char *body, size_t *bodySize)
+{
+	unsigned char *response = NULL;
+	int status = DirectMethod_Dispatch(name, (const unsigned char *)payload, strlen(payload), &response,
+									   bodySize);
+	CHECK(response != NULL);
+	memcpy(body, response, *bodySize);
+	body[*bodySize] = '\0';
+	free(response);
+	return status;
+}
+
+int main(void)
+{
+	char body[64];
+	size_t bodySize;
+
+	// Nothing registered yet
+	CHECK(Dispatch("Stop", "{}", body, &bodySize) == 404);
+	CHECK(strcmp(body, "{\"error\":\"unknown method\"}") == 0);
+	CHECK(bodySize == strlen(body));
+
+	CHECK(sizeof(names) / sizeof(names[0]) == DIRECT_METHOD_MAX_METHODS);
+	for (int i = 0; i < DIRECT_METHOD_MAX_METHODS; i++)
+	{
+		CHECK(DirectMethod_Register(names[i], handlers[i]) == 0);
+		// Each registration keeps every earlier one reachable
+		for (int j = 0; j <= i && handlers[j] != Echo; j++)
+		{
+			char expected[4];
+			sprintf(expected, "%d", j);
+			CHECK(Dispatch(names[j], "", body, &bodySize) == 200 + j);
+			CHECK(strcmp(body, expected) == 0);
+			CHECK(bodySize == strlen(expected));
+		}
+	}
+
+	// Duplicates and a full table are refused
+	CHECK(DirectMethod_Register("Stop", Handler1) == -1);
+	CHECK(DirectMethod_Register("Stopp", Handler1) == -1);
+	CHECK(Dispatch("Stop", "", body, &bodySize) == 200);
+	CHECK(strcmp(body, "0") == 0);
+
+	// The handler gets the payload, and the response is a copy of its body of exactly its length
+	const char payload[] = "{\"motor\":\"B\",\"speed\":-40}";
+	unsigned char *response = NULL;
+	CHECK(DirectMethod_Dispatch("Echo", (const unsigned char *)payload, sizeof(payload) - 1, &response,
+								&bodySize) == 200);
+	CHECK(echoedPayload == payload && echoedSize == sizeof(payload) - 1);
+	CHECK(response != NULL && response != (const unsigned char *)payload);
+	CHECK(bodySize == sizeof(payload) - 1 && memcmp(response, payload, bodySize) == 0);
+	free(response);
+
+	// An empty body still gets a response to free
+	response = NULL;
+	bodySize = 1;
+	CHECK(DirectMethod_Dispatch("Echo", (const unsigned char *)"", 0, &response, &bodySize) == 200);
+	CHECK(response != NULL && bodySize == 0);
+	free(response);
+
+	// Unknown names, including prefixes and case variants of registered ones
+	const char *unknown[] = {"", "Sto", "stop", "StopAl", "Stopp", "ZZ"};
+	for (size_t i = 0; i < sizeof(unknown) / sizeof(unknown[0]); i++)
+	{
+		CHECK(Dispatch(unknown[i], "{\"motor\":\"A\"}", body, &bodySize) == 404);
+		CHECK(strcmp(body, "{\"error\":\"unknown method\"}") == 0);
+		CHECK(bodySize == sizeof("{\"error\":\"unknown method\"}") - 1);
+	}
+
+	return TEST_RESULT();
+}
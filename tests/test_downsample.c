@@ -0,0 +1,199 @@
+#include "downsample.h"
+#include "test.h"
+#include <stdlib.h>
+
+// Checks the exact statistics of a window against the values added, and the P-square estimates
+// against the nearest-rank percentiles of the same values, on streams drawn from a few shapes.
+// Estimates are judged by rank, how far the fraction of values at or below them is from the
+// percentile, so the bound doesn't depend on the shape. P-square tightens as the window grows,
+// from a few values off in a window of twenty to a few hundredths of a percent in one of ten
+// thousand. A run whose first values land far out can leave the upper markers bunched together
+// for the rest of the window, so single runs get a looser bound than the average.
+
+#define MAX_VALUES 10000
+#define RANGE 10000
+
+static uint32_t state = 0x2545F491u;
+
+static uint32_t NextRandom(void)
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+static int32_t Uniform(void)
+{
+	return (int32_t)(NextRandom() % (RANGE + 1));
+}
+
+// Roughly normal around the middle of the range
+static int32_t Bell(void)
+{
+	int32_t sum = 0;
+	for (int i = 0; i < 12; i++)
+	{
+		sum += Uniform();
+	}
+	return sum / 12;
+}
+
+// Most values low with a long tail, like loop latency
+static int32_t Skewed(void)
+{
+	int32_t value = Uniform();
+	return (int32_t)((int64_t)value * value / RANGE);
+}
+
+static int CompareInt32(const void *a, const void *b)
+{
+	int32_t x = *(const int32_t *)a;
+	int32_t y = *(const int32_t *)b;
+	return (x > y) - (x < y);
+}
+
+// Nearest rank, as the summary defines its percentiles
+static int32_t Percentile(const int32_t *sorted, size_t count, double p)
+{
+	size_t rank = (size_t)(p * count + 0.999999);
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static int32_t values[MAX_VALUES];
+static int32_t sorted[MAX_VALUES];
+
+static Downsample_Summary Summarize(size_t count)
+{
+	Downsample_Window window;
+	Downsample_Reset(&window);
+	for (size_t i = 0; i < count; i++)
+	{
+		Downsample_Add(&window, values[i]);
+	}
+	Downsample_Summary summary;
+	Downsample_Summarize(&window, &summary);
+	return summary;
+}
+
+static void CheckExact(const Downsample_Summary *summary, size_t count)
+{
+	int64_t sum = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		sum += values[i];
+	}
+	CHECK(summary->count == count);
+	CHECK(summary->min == sorted[0]);
+	CHECK(summary->max == sorted[count - 1]);
+	CHECK(summary->last == values[count - 1]);
+	CHECK(llabs(summary->mean * (int64_t)count - sum) * 2 <= (int64_t)count);
+}
+
+static void SmallWindows(void)
+{
+	// Up to five values the percentiles are exact
+	for (size_t count = 1; count <= 5; count++)
+	{
+		for (int run = 0; run < 20; run++)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				values[i] = sorted[i] = Uniform() - RANGE / 2;
+			}
+			qsort(sorted, count, sizeof(sorted[0]), CompareInt32);
+			Downsample_Summary summary = Summarize(count);
+			CheckExact(&summary, count);
+			CHECK(summary.p50 == Percentile(sorted, count, 0.5));
+			CHECK(summary.p90 == Percentile(sorted, count, 0.9));
+		}
+	}
+
+	// The mean rounds to nearest, halves away from zero
+	values[0] = 1;
+	values[1] = 2;
+	CHECK(Summarize(2).mean == 2);
+	values[0] = -1;
+	values[1] = -2;
+	CHECK(Summarize(2).mean == -2);
+
+	// Sums past 32 bits
+	for (size_t i = 0; i < 1000; i++)
+	{
+		values[i] = INT32_MAX;
+	}
+	Downsample_Summary summary = Summarize(1000);
+	CHECK(summary.mean == INT32_MAX);
+	CHECK(summary.p50 == INT32_MAX);
+	CHECK(summary.p90 == INT32_MAX);
+}
+
+// How far the estimate is from percentile p, as a fraction of the values
+static double RankError(const int32_t *sorted, size_t count, double p, int32_t estimate)
+{
+	size_t below = 0;
+	while (below < count && sorted[below] < estimate)
+	{
+		below++;
+	}
+	size_t atOrBelow = below;
+	while (atOrBelow < count && sorted[atOrBelow] == estimate)
+	{
+		atOrBelow++;
+	}
+	double target = p * count;
+	// Ties put every rank between them at the same value
+	double distance = target < below ? below - target : target > atOrBelow ? target - atOrBelow : 0;
+	return distance / count;
+}
+
+static void Streams(int32_t (*draw)(void), const char *name)
+{
+	const struct
+	{
+		size_t count;
+		double typical; // bounds the mean rank error over the runs
+		double worst;   // and that of every run
+	} windows[] = {
+		{6, 0.03, 0.2}, {20, 0.08, 0.3}, {100, 0.03, 0.15}, {1000, 0.006, 0.1}, {MAX_VALUES, 0.001, 0.1},
+	};
+	const int runs = 100;
+	for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); w++)
+	{
+		size_t count = windows[w].count;
+		double total = 0;
+		for (int run = 0; run < runs; run++)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				values[i] = sorted[i] = draw();
+			}
+			qsort(sorted, count, sizeof(sorted[0]), CompareInt32);
+			Downsample_Summary summary = Summarize(count);
+			CheckExact(&summary, count);
+			CHECK(summary.p50 >= summary.min && summary.p50 <= summary.max);
+			CHECK(summary.p90 >= summary.min && summary.p90 <= summary.max);
+
+			double p50Error = RankError(sorted, count, 0.5, summary.p50);
+			double p90Error = RankError(sorted, count, 0.9, summary.p90);
+			CHECK(p50Error <= windows[w].worst);
+			CHECK(p90Error <= windows[w].worst);
+			total += p50Error + p90Error;
+		}
+		double mean = total / (2 * runs);
+		if (mean > windows[w].typical)
+		{
+			fprintf(stderr, "%s, %zu values: mean rank error %.4f\n", name, count, mean);
+		}
+		CHECK(mean <= windows[w].typical);
+	}
+}
+
+int main(void)
+{
+	SmallWindows();
+	Streams(Uniform, "uniform");
+	Streams(Bell, "bell");
+	Streams(Skewed, "skewed");
+	return TEST_RESULT();
+}
@@ -0,0 +1,97 @@
+#include "json_writer.h"
+#include "parson.h"
+#include "test.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The streaming writer has to write numbers exactly as parson serializes them
+
+#define RANDOM_DOUBLES 100000
+
+static uint64_t state = 88172645463325252ull;
+
+static uint64_t NextRandom(void)
+{
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+static size_t WriteDouble(double value, char *buffer, size_t size)
+{
+	JsonWriter writer;
+	JsonWriter_Init(&writer, buffer, size);
+	JsonWriter_Double(&writer, value);
+	return JsonWriter_Finish(&writer);
+}
+
+static void Doubles(void)
+{
+	const double special[] = {0.0, -0.0, 1.0, -1.5, 0.1, 1e21, 1e-7, 123456789012345680.0, 5e-324, 1.7976931348623157e308};
+	int failures = 0;
+	for (int i = 0; i < RANDOM_DOUBLES + (int)(sizeof(special) / sizeof(special[0])) && failures < 10; i++)
+	{
+		double value;
+		if (i < (int)(sizeof(special) / sizeof(special[0])))
+		{
+			value = special[i];
+		}
+		else
+		{
+			uint64_t bits = NextRandom();
+			memcpy(&value, &bits, sizeof(value));
+			if (!isfinite(value))
+			{
+				continue;
+			}
+		}
+		char written[JSON_NUMBER_BUFFER_SIZE + 1];
+		size_t length = WriteDouble(value, written, sizeof(written));
+
+		JSON_Value *number = json_value_init_number(value);
+		char *serialized = json_serialize_to_string(number);
+		if (length == 0 || strcmp(written, serialized) != 0 || strtod(written, NULL) != value)
+		{
+			fprintf(stderr, "%.17g written as %s, parson gives %s\n", value, written, serialized);
+			failures++;
+		}
+		json_free_serialized_string(serialized);
+		json_value_free(number);
+	}
+	CHECK(failures == 0);
+
+	char buffer[16];
+	CHECK(WriteDouble(NAN, buffer, sizeof(buffer)) == 4 && strcmp(buffer, "null") == 0);
+	CHECK(WriteDouble(-INFINITY, buffer, sizeof(buffer)) == 4 && strcmp(buffer, "null") == 0);
+	CHECK(WriteDouble(0.125, buffer, 5) == 0); // doesn't fit with the terminator
+	CHECK(json_format_number(buffer, NAN) == 0);
+}
+
+static void Document(void)
+{
+	char buffer[128];
+	JsonWriter writer;
+	JsonWriter_Init(&writer, buffer, sizeof(buffer));
+	JsonWriter_BeginObject(&writer);
+	JsonWriter_Key(&writer, "t");
+	JsonWriter_Int(&writer, -42);
+	JsonWriter_Key(&writer, "v");
+	JsonWriter_BeginArray(&writer);
+	JsonWriter_Double(&writer, 21.5);
+	JsonWriter_Double(&writer, 0.1 + 0.2);
+	JsonWriter_String(&writer, "a\"b");
+	JsonWriter_End(&writer);
+	JsonWriter_End(&writer);
+	CHECK(JsonWriter_Finish(&writer) > 0);
+	CHECK(strcmp(buffer, "{\"t\":-42,\"v\":[21.5,0.30000000000000004,\"a\\\"b\"]}") == 0);
+}
+
+int main(void)
+{
+	Doubles();
+	Document();
+	return TEST_RESULT();
+}
@@ -0,0 +1,156 @@
+#include "latency_histogram.h"
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Checks the bucket edges against the layout in latency_histogram.h: values below 16 exactly, then
+// 16 buckets per power of two. A value's bucket is read back as the percentile of the lowest of two
+// values, the other being the maximum so the cap doesn't hide the bucket's top. Percentiles of
+// random streams spread over the whole range have to land within 6.25% above the exact
+// nearest-rank value.
+
+#define VALUES 5000
+#define RUNS 20
+
+static uint32_t state = 0x9E3779B9u;
+
+static uint32_t NextRandom(void)
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+// The highest value of the bucket value lands in
+static uint32_t BucketTop(uint32_t value)
+{
+	LatencyHistogram histogram;
+	LatencyHistogram_Reset(&histogram);
+	LatencyHistogram_Record(&histogram, value);
+	LatencyHistogram_Record(&histogram, LATENCY_HISTOGRAM_MAX_US);
+	return LatencyHistogram_Percentile(&histogram, 50.0);
+}
+
+static void Buckets(void)
+{
+	for (uint32_t value = 0; value < 16; value++)
+	{
+		CHECK(BucketTop(value) == value);
+	}
+
+	// From 16 to 31 buckets are still one wide, then they double with each power of two
+	const struct
+	{
+		uint32_t value;
+		uint32_t top;
+	} edges[] = {
+		{16, 16},
+		{17, 17},
+		{31, 31},
+		{32, 33},
+		{33, 33},
+		{34, 35},
+		{63, 63},
+		{64, 67},
+		{1000, 1023},
+		{(1u << 27) - 1, (1u << 27) - 1},
+		{1u << 27, (1u << 27) + (1u << 23) - 1},
+		{(1u << 27) + (1u << 23), (1u << 27) + (2u << 23) - 1},
+		{LATENCY_HISTOGRAM_MAX_US, LATENCY_HISTOGRAM_MAX_US},
+	};
+	for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); i++)
+	{
+		if (BucketTop(edges[i].value) != edges[i].top)
+		{
+			fprintf(stderr, "%u: top %u\n", edges[i].value, BucketTop(edges[i].value));
+		}
+		CHECK(BucketTop(edges[i].value) == edges[i].top);
+	}
+}
+
+static void ClampingAndNegatives(void)
+{
+	LatencyHistogram histogram;
+	LatencyHistogram_Reset(&histogram);
+	CHECK(LatencyHistogram_Percentile(&histogram, 50.0) == 0);
+
+	LatencyHistogram_Record(&histogram, -1);
+	LatencyHistogram_Record(&histogram, INT64_MIN);
+	CHECK(histogram.total == 0);
+	CHECK(LatencyHistogram_Percentile(&histogram, 99.0) == 0);
+
+	LatencyHistogram_Record(&histogram, (int64_t)LATENCY_HISTOGRAM_MAX_US + 1);
+	LatencyHistogram_Record(&histogram, INT64_MAX);
+	LatencyHistogram_Record(&histogram, 10);
+	CHECK(histogram.total == 3);
+	CHECK(histogram.max == LATENCY_HISTOGRAM_MAX_US);
+	CHECK(histogram.counts[LATENCY_HISTOGRAM_BUCKETS - 1] == 2);
+	CHECK(LatencyHistogram_Percentile(&histogram, 100.0) == LATENCY_HISTOGRAM_MAX_US);
+	CHECK(LatencyHistogram_Percentile(&histogram, 10.0) == 10);
+
+	// [count, p50, p90, p99, p99.9, max]
+	uint8_t buffer[32];
+	CborWriter writer;
+	LatencyHistogram_Reset(&histogram);
+	LatencyHistogram_Record(&histogram, 5);
+	CborWriter_Init(&writer, buffer, sizeof(buffer));
+	LatencyHistogram_Encode(&histogram, &writer);
+	const uint8_t expected[] = {0x86, 0x01, 0x05, 0x05, 0x05, 0x05, 0x05};
+	CHECK(CborWriter_Finish(&writer) == sizeof(expected));
+	CHECK(memcmp(buffer, expected, sizeof(expected)) == 0);
+}
+
+static int CompareValues(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void Percentiles(void)
+{
+	static uint32_t values[VALUES];
+	const double percentiles[] = {0.1, 1.0, 25.0, 50.0, 90.0, 99.0, 99.9, 100.0};
+
+	for (int run = 0; run < RUNS; run++)
+	{
+		LatencyHistogram histogram;
+		LatencyHistogram_Reset(&histogram);
+		// Magnitudes spread evenly, reaching higher in later runs until the last one covers them all
+		int magnitudes = 4 + run * (LATENCY_HISTOGRAM_MAX_MAGNITUDE - 4) / (RUNS - 1);
+		for (int i = 0; i < VALUES; i++)
+		{
+			int magnitude = (int)(NextRandom() % (uint32_t)magnitudes);
+			values[i] = (1u << magnitude) + NextRandom() % (1u << magnitude);
+			if (values[i] > LATENCY_HISTOGRAM_MAX_US)
+			{
+				values[i] = LATENCY_HISTOGRAM_MAX_US;
+			}
+			LatencyHistogram_Record(&histogram, values[i]);
+		}
+		qsort(values, VALUES, sizeof(values[0]), CompareValues);
+		CHECK(histogram.max == values[VALUES - 1]);
+
+		for (size_t p = 0; p < sizeof(percentiles) / sizeof(percentiles[0]); p++)
+		{
+			// Nearest rank: the smallest value with at least the percentile at or below it
+			size_t rank = (size_t)(percentiles[p] / 100.0 * VALUES + 0.999999);
+			uint32_t exact = values[rank == 0 ? 0 : rank - 1];
+			uint32_t estimate = LatencyHistogram_Percentile(&histogram, percentiles[p]);
+			if (estimate < exact || estimate > exact + exact / 16)
+			{
+				fprintf(stderr, "run %d p%g: %u for %u\n", run, percentiles[p], estimate, exact);
+			}
+			CHECK(estimate >= exact);
+			CHECK(estimate <= exact + exact / 16);
+		}
+	}
+}
+
+int main(void)
+{
+	Buckets();
+	ClampingAndNegatives();
+	Percentiles();
+	return TEST_RESULT();
+}
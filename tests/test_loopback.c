@@ -0,0 +1,175 @@
+#include "iot_transport.h"
+#include "poll_scheduler.h"
+#include "test.h"
+#include "twin_model.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Plays the application against the loopback transport off the device: twin updates go through
+// the generated codec into a reported patch, methods answer and send an event, and the transport
+// is polled the way main.c polls it. Without arguments it runs a built-in script and checks what
+// the transport recorded; "test_loopback <script> [seconds]" runs any script as a driver.
+
+#define FAST_POLL_MS 20
+#define IDLE_POLL_MS 200
+#define DEFAULT_WINDOW_SECONDS 10
+
+static const IotTransport *transport = &IotTransport_Loopback;
+static PollScheduler scheduler;
+static TwinModel_Properties desired = {0, 0, DEFAULT_WINDOW_SECONDS};
+static TwinModel_Properties reported = {0, 0, DEFAULT_WINDOW_SECONDS};
+static bool authenticated = false;
+static bool reconnect = false; // the client gave up, create a new one
+static int confirmations = 0;
+
+static long NowMs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long)(now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+static void ConnectionStatus(bool isAuthenticated, IotTransport_Status status, const char *reason)
+{
+	authenticated = isAuthenticated;
+	reconnect = !isAuthenticated && status != IotTransport_Transient;
+}
+
+static void TwinUpdate(bool complete, const unsigned char *payload, size_t size)
+{
+	static const TwinModel_Properties defaults = {0, 0, DEFAULT_WINDOW_SECONDS};
+	TwinModel_Properties update = complete ? defaults : desired;
+	uint32_t fields = 0;
+	int64_t version = -1;
+	if (!TwinModel_ParseDesired((const char *)payload, size, &update, &fields, &version))
+	{
+		return;
+	}
+	desired = update;
+	uint32_t changed = complete ? TWIN_MODEL_ALL_FIELDS : TwinModel_Diff(&reported, &desired);
+	char patch[TWIN_MODEL_MAX_REPORTED_SIZE];
+	if (changed != 0 && TwinModel_SerializeReported(&desired, changed, patch, sizeof(patch)) > 0 &&
+		transport->SendReportedState(patch, strlen(patch)))
+	{
+		reported = desired;
+		PollScheduler_Kick(&scheduler);
+	}
+}
+
+static int Method(const char *name, const unsigned char *payload, size_t size, unsigned char **response,
+				  size_t *responseSize)
+{
+	static const char event[] = "{\"method\":1}";
+	transport->SendEvent((const uint8_t *)event, sizeof(event) - 1, "application/json");
+	*response = (unsigned char *)strdup("{\"ok\":true}");
+	*responseSize = strlen((const char *)*response);
+	PollScheduler_Kick(&scheduler);
+	return 200;
+}
+
+static void Confirmed(bool delivered)
+{
+	confirmations++;
+}
+
+static void ReportConfirmed(int status)
+{
+	confirmations++;
+}
+
+static const IotTransport_Handlers handlers = {
+	.ConnectionStatus = ConnectionStatus,
+	.TwinUpdate = TwinUpdate,
+	.Method = Method,
+	.EventConfirmed = Confirmed,
+	.ReportedStateConfirmed = ReportConfirmed,
+};
+
+static void Run(const char *script, long milliseconds)
+{
+	PollScheduler_Init(&scheduler, FAST_POLL_MS, IDLE_POLL_MS);
+	reconnect = transport->Connect(script, NULL, &handlers) != IotTransport_Ok;
+	long end = NowMs() + milliseconds;
+	while (NowMs() < end)
+	{
+		if (reconnect && transport->IsNetworkReady())
+		{
+			reconnect = transport->Connect(script, transport->AssignedHub(), &handlers) != IotTransport_Ok;
+		}
+		transport->DoWork();
+		long delay = PollScheduler_Next(&scheduler, transport->IsBusy());
+		long left = end - NowMs();
+		usleep((useconds_t)((delay < left ? delay : left > 0 ? left : 0) * 1000));
+	}
+}
+
+static bool Recorded(const char *text, const char *line)
+{
+	const char *at = strstr(text, line);
+	return at != NULL && at[-1] == ' ' && (at[strlen(line)] == '\n' || at[strlen(line)] == '\0');
+}
+
+static void BuiltInScript(void)
+{
+	char script[] = "/tmp/loopbackXXXXXX";
+	int fd = mkstemp(script);
+	static const char commands[] = "reconnect-after 30\n"
+								   "twin {\"SpeedMotorA\":40,\"$version\":2}\n"
+								   "@40 method Stop {\"motor\":1}\n"
+								   "@60 disconnect\n"
+								   "@70 twin {\"SpeedMotorB\":5}\n"
+								   "@150 twin-complete {\"desired\":{\"SpeedMotorB\":7,\"$version\":4},\"reported\":{}}\n"
+								   "@600000 twin {\"SpeedMotorA\":1}\n";
+	CHECK(write(fd, commands, sizeof(commands) - 1) == (ssize_t)(sizeof(commands) - 1));
+	close(fd);
+
+	Run(script, 400);
+	// Only a line far in the future is left, so there is nothing to poll for
+	CHECK(authenticated && !transport->IsBusy());
+
+	char recordPath[64];
+	snprintf(recordPath, sizeof(recordPath), "%s.out", script);
+	FILE *file = fopen(recordPath, "r");
+	static char text[8192];
+	size_t length = file != NULL ? fread(text, 1, sizeof(text) - 1, file) : 0;
+	text[length] = '\0';
+	if (file != NULL)
+	{
+		fclose(file);
+	}
+
+	CHECK(Recorded(text, "connect dps ok"));
+	CHECK(Recorded(text, "reported {\"SpeedMotorA\":40}"));
+	CHECK(Recorded(text, "method-response Stop 200 {\"ok\":true}"));
+	CHECK(Recorded(text, "event application/json 12"));
+	CHECK(Recorded(text, "connection unauthenticated IOTHUB_CLIENT_CONNECTION_COMMUNICATION_ERROR"));
+	// held until the client came back by itself
+	const char *reconnected = strstr(text, "connection authenticated IOTHUB_CLIENT_CONNECTION_OK\n");
+	CHECK(reconnected != NULL);
+	reconnected = reconnected != NULL ? strstr(reconnected + 1, "connection authenticated") : NULL;
+	const char *held = strstr(text, "twin {\"SpeedMotorB\":5}");
+	CHECK(reconnected != NULL && held != NULL && held > reconnected);
+	CHECK(Recorded(text, "reported {\"SpeedMotorB\":5}"));
+	// a full twin starts from the defaults and reports everything
+	CHECK(Recorded(text, "reported {\"SpeedMotorA\":0,\"SpeedMotorB\":7,\"TelemetryWindowSeconds\":10}"));
+	CHECK(strstr(text, "SpeedMotorA\":1") == NULL);
+	CHECK(confirmations == 4);
+
+	transport->Disconnect();
+	unlink(script);
+	unlink(recordPath);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+	{
+		Run(argv[1], argc > 2 ? atol(argv[2]) * 1000 : 10000);
+		transport->Disconnect();
+		return 0;
+	}
+	BuiltInScript();
+	return TEST_RESULT();
+}
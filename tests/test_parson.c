@@ -0,0 +1,573 @@
+#include "parson.h"
+#include "test.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Small enough that anything recursing once per nesting level overflows it
+#define SMALL_STACK_BYTES (64 * 1024)
+#define DEEP 2048 // MAX_NESTING
+
+// Blocks handed out and not yet freed by the counting allocator
+static long liveBlocks = 0;
+
+static void *CountingMalloc(size_t size)
+{
+	void *block = malloc(size);
+	if (block != NULL)
+	{
+		liveBlocks++;
+	}
+	return block;
+}
+
+static void CountingFree(void *block)
+{
+	if (block != NULL)
+	{
+		liveBlocks--;
+	}
+	free(block);
+}
+
+// depth containers around a 0
+static char *Nested(const char *open, const char *close, int depth)
+{
+	size_t openLength = strlen(open), closeLength = strlen(close);
+	char *text = malloc(depth * (openLength + closeLength) + 2);
+	char *out = text;
+	for (int i = 0; i < depth; i++, out += openLength)
+	{
+		memcpy(out, open, openLength);
+	}
+	*out++ = '0';
+	for (int i = 0; i < depth; i++, out += closeLength)
+	{
+		memcpy(out, close, closeLength);
+	}
+	*out = '\0';
+	return text;
+}
+
+static void DeepDocuments(void)
+{
+	// Each repeat of the last shape nests two containers
+	const char *shapes[][2] = {{"[", "]"}, {"{\"a\":", "}"}, {"[1,{\"b\":", "}]"}};
+	const int repeats[] = {DEEP, DEEP, DEEP / 2};
+	for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++)
+	{
+		char *text = Nested(shapes[i][0], shapes[i][1], repeats[i]);
+		JSON_Value *value = json_parse_string(text);
+		CHECK(value != NULL);
+		char *serialized = json_serialize_to_string(value);
+		CHECK(serialized != NULL && strcmp(serialized, text) == 0);
+		json_free_serialized_string(serialized);
+		CHECK(json_serialization_size_pretty(value) > strlen(text));
+		json_value_free(value);
+		free(text);
+	}
+
+	// One level too deep is rejected, and what was built so far is freed
+	char *text = Nested("[", "]", DEEP + 1);
+	CHECK(json_parse_string(text) == NULL);
+	CHECK(json_context_get_parse_error(json_context_default()).code == JSONParseErrorNesting);
+	free(text);
+
+	// A deep document cut short
+	text = Nested("{\"a\":[", "]}", DEEP / 2);
+	text[strlen(text) - 3] = '\0';
+	CHECK(json_parse_string(text) == NULL);
+	free(text);
+}
+
+static void DeepBuiltValue(void)
+{
+	// Built by hand, past what the parser accepts: freeing still works, serializing refuses
+	JSON_Value *root = json_value_init_array();
+	JSON_Value *current = root;
+	for (int i = 0; i < 4 * DEEP; i++)
+	{
+		JSON_Value *child = json_value_init_array();
+		json_array_append_value(json_value_get_array(current), child);
+		current = child;
+	}
+	CHECK(json_serialization_size(root) == 0);
+	json_value_free(root);
+}
+
+static void DeepCopiesAndPatches(void)
+{
+	char *text = Nested("{\"a\":", "}", DEEP);
+	JSON_Value *value = json_parse_string(text);
+	text[DEEP * 5] = '1'; // the innermost 0
+	JSON_Value *changed = json_parse_string(text);
+	free(text);
+
+	JSON_Value *copy = json_value_deep_copy(value);
+	CHECK(copy != NULL && json_value_equals(value, copy));
+	CHECK(!json_value_equals(value, changed));
+
+	// The diff of two nested objects is itself the whole chain down to the change
+	JSON_Value *diff = json_merge_patch_diff(value, changed);
+	CHECK(json_value_equals(diff, changed));
+	copy = json_merge_patch_apply(copy, diff);
+	CHECK(json_value_equals(copy, changed));
+	json_value_free(diff);
+
+	diff = json_merge_patch_diff(value, value);
+	CHECK(diff != NULL && json_value_get_type(diff) == JSONObject &&
+		  json_object_get_count(json_value_get_object(diff)) == 0);
+	json_value_free(diff);
+	json_value_free(copy);
+	json_value_free(changed);
+	json_value_free(value);
+
+	// Deeper than max nesting, built by hand: copies fail and nothing compares equal
+	JSON_Value *root = json_value_init_object();
+	JSON_Value *current = root;
+	for (int i = 0; i < 2 * DEEP; i++)
+	{
+		JSON_Value *child = json_value_init_object();
+		json_object_set_value(json_value_get_object(current), "a", child);
+		current = child;
+	}
+	CHECK(json_value_deep_copy(root) == NULL);
+	CHECK(!json_value_equals(root, root));
+	CHECK(json_merge_patch_diff(root, root) == NULL);
+	json_value_free(root);
+}
+
+static void *SmallStackTests(void *unused)
+{
+	DeepDocuments();
+	DeepBuiltValue();
+	DeepCopiesAndPatches();
+	return NULL;
+}
+
+// The examples of RFC 7386, appendix A
+static void MergePatches(void)
+{
+	const char *cases[][3] = {
+		{"{\"a\":\"b\"}", "{\"a\":\"c\"}", "{\"a\":\"c\"}"},
+		{"{\"a\":\"b\"}", "{\"b\":\"c\"}", "{\"a\":\"b\",\"b\":\"c\"}"},
+		{"{\"a\":\"b\"}", "{\"a\":null}", "{}"},
+		{"{\"a\":\"b\",\"b\":\"c\"}", "{\"a\":null}", "{\"b\":\"c\"}"},
+		{"{\"a\":[\"b\"]}", "{\"a\":\"c\"}", "{\"a\":\"c\"}"},
+		{"{\"a\":\"c\"}", "{\"a\":[\"b\"]}", "{\"a\":[\"b\"]}"},
+		{"{\"a\":{\"b\":\"c\"}}", "{\"a\":{\"b\":\"d\",\"c\":null}}", "{\"a\":{\"b\":\"d\"}}"},
+		{"{\"a\":[{\"b\":\"c\"}]}", "{\"a\":[1]}", "{\"a\":[1]}"},
+		{"[\"a\",\"b\"]", "[\"c\",\"d\"]", "[\"c\",\"d\"]"},
+		{"{\"a\":\"b\"}", "[\"c\"]", "[\"c\"]"},
+		{"{\"a\":\"foo\"}", "null", "null"},
+		{"{\"a\":\"foo\"}", "\"bar\"", "\"bar\""},
+		{"{\"e\":null}", "{\"a\":1}", "{\"e\":null,\"a\":1}"},
+		{"[1,2]", "{\"a\":\"b\",\"c\":null}", "{\"a\":\"b\"}"},
+		{"{}", "{\"a\":{\"bb\":{\"ccc\":null}}}", "{\"a\":{\"bb\":{}}}"},
+	};
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+	{
+		JSON_Value *original = json_parse_string(cases[i][0]);
+		JSON_Value *patch = json_parse_string(cases[i][1]);
+		JSON_Value *expected = json_parse_string(cases[i][2]);
+		JSON_Value *patched = json_merge_patch_apply(json_value_deep_copy(original), patch);
+		CHECK(json_value_equals(patched, expected));
+
+		// A diff between the two turns one into the other, unless the result holds a null
+		if (json_value_get_type(patched) == JSONObject && strstr(cases[i][2], "null") == NULL)
+		{
+			JSON_Value *diff = json_merge_patch_diff(original, patched);
+			JSON_Value *again = json_merge_patch_apply(json_value_deep_copy(original), diff);
+			CHECK(json_value_equals(again, expected));
+			json_value_free(again);
+			json_value_free(diff);
+		}
+		json_value_free(patched);
+		json_value_free(expected);
+		json_value_free(patch);
+		json_value_free(original);
+	}
+
+	JSON_Value *a = json_parse_string("{\"x\":1,\"y\":[1,2.5,\"s\"]}");
+	JSON_Value *b = json_parse_string("{\"y\":[1.0,2.5,\"s\"],\"x\":1}");
+	JSON_Value *c = json_parse_string("{\"x\":1,\"z\":[1,2.5,\"s\"]}");
+	CHECK(json_value_equals(a, b));
+	CHECK(!json_value_equals(a, c));
+	CHECK(!json_value_equals(a, NULL) && json_value_equals(NULL, NULL));
+	json_value_free(a);
+	json_value_free(b);
+	json_value_free(c);
+}
+
+static void RoundTrips(void)
+{
+	const char *documents[] = {
+		"{}",
+		"[]",
+		"{\"a\":1,\"b\":[true,false,null],\"c\":{\"d\":\"e\"}}",
+		"[[],{},[{}],{\"x\":[]}]",
+		"\"\\u00e9\\n\\\"\"",
+		"-12.5",
+	};
+	for (size_t i = 0; i < sizeof(documents) / sizeof(documents[0]); i++)
+	{
+		JSON_Value *value = json_parse_string(documents[i]);
+		CHECK(value != NULL);
+		char *serialized = json_serialize_to_string(value);
+		JSON_Value *again = json_parse_string(serialized);
+		CHECK(json_value_equals(value, again));
+		json_free_serialized_string(serialized);
+		json_value_free(again);
+		json_value_free(value);
+	}
+
+	JSON_Value *value = json_parse_string("{\"a\":[1,{}],\"b\":{}}");
+	char *pretty = json_serialize_to_string_pretty(value);
+	CHECK(strcmp(pretty, "{\n    \"a\": [\n        1,\n        {}\n    ],\n    \"b\": {}\n}") == 0);
+	json_free_serialized_string(pretty);
+	json_value_free(value);
+
+	CHECK(json_serialization_size(NULL) == 0);
+}
+
+// Collects what json_serialize_to_stream flushes, failing the failAt-th call when it's set
+typedef struct
+{
+	char out[1024];
+	size_t length;
+	const char *buffer;
+	size_t bufferSize;
+	int calls;
+	int failAt;
+	int badChunks; // empty, too long, or not from the buffer
+} StreamSink;
+
+static JSON_Status Collect(void *context, const char *data, size_t size)
+{
+	StreamSink *sink = context;
+	sink->calls++;
+	if (size == 0 || size > sink->bufferSize || data != sink->buffer || sink->length + size > sizeof(sink->out))
+	{
+		sink->badChunks++;
+		return JSONFailure;
+	}
+	if (sink->calls == sink->failAt)
+	{
+		return JSONFailure;
+	}
+	memcpy(sink->out + sink->length, data, size);
+	sink->length += size;
+	return JSONSuccess;
+}
+
+// Streams value through buffers from one byte up to past its whole length; every split has to add up
+// to what json_serialize_to_string writes, and a failing flush has to stop the stream
+static void StreamWith(const JSON_Value *value, int pretty)
+{
+	char *expected = pretty ? json_serialize_to_string_pretty(value) : json_serialize_to_string(value);
+	size_t length = strlen(expected);
+	char buffer[512];
+	CHECK(length + 2 <= sizeof(buffer));
+
+	for (size_t size = 1; size <= length + 1; size++)
+	{
+		StreamSink sink = {.buffer = buffer, .bufferSize = size};
+		JSON_Status status = pretty ? json_serialize_to_stream_pretty(value, buffer, size, Collect, &sink)
+									: json_serialize_to_stream(value, buffer, size, Collect, &sink);
+		CHECK(status == JSONSuccess);
+		CHECK(sink.badChunks == 0);
+		CHECK(sink.length == length && memcmp(sink.out, expected, length) == 0);
+		// Full buffers go out as they fill, the rest once at the end, and never an empty chunk
+		CHECK(sink.calls == (int)((length + size - 1) / size));
+
+		for (int failAt = 1; failAt <= sink.calls; failAt++)
+		{
+			StreamSink failing = {.buffer = buffer, .bufferSize = size, .failAt = failAt};
+			status = pretty ? json_serialize_to_stream_pretty(value, buffer, size, Collect, &failing)
+							: json_serialize_to_stream(value, buffer, size, Collect, &failing);
+			CHECK(status == JSONFailure);
+			CHECK(failing.calls == failAt);
+		}
+	}
+	json_free_serialized_string(expected);
+}
+
+static void Streaming(void)
+{
+	// Strings and numbers longer than the smaller buffers, escapes, and empty containers
+	JSON_Value *value = json_parse_string("{\"name\":\"a string much longer than the smaller buffers\","
+										  "\"escaped\":\"\\\"\\u00e9\\n/\",\"n\":[-12.5,1e+300,0,true,null],"
+										  "\"empty\":{},\"nested\":{\"list\":[[],{\"x\":1}]}}");
+	CHECK(value != NULL);
+	StreamWith(value, 0);
+	StreamWith(value, 1);
+
+	char buffer[8];
+	StreamSink sink = {.buffer = buffer, .bufferSize = sizeof(buffer)};
+	CHECK(json_serialize_to_stream(value, NULL, sizeof(buffer), Collect, &sink) == JSONFailure);
+	CHECK(json_serialize_to_stream(value, buffer, 0, Collect, &sink) == JSONFailure);
+	CHECK(json_serialize_to_stream(value, buffer, sizeof(buffer), NULL, &sink) == JSONFailure);
+	CHECK(json_serialize_to_stream_pretty(value, buffer, 0, Collect, &sink) == JSONFailure);
+	CHECK(sink.calls == 0);
+	json_value_free(value);
+}
+
+// Each budget stops the parse with its own error, at the token that broke it, and frees everything
+static void ParseLimits(void)
+{
+	char big[4096 + 16];
+	memset(big, 'x', sizeof(big));
+	memcpy(big, "[1,2,\"", 6);
+	strcpy(big + sizeof(big) - 3, "\"]");
+
+	const struct
+	{
+		JSON_Parse_Limits limits;
+		const char *text;
+		JSON_Parse_Error_Code code;
+		size_t offset;
+	} cases[] = {
+		{{2048, 0, 0, 0}, big, JSONParseErrorBytes, 5},
+		{{0, 4, 0, 0}, "[1,2,3,4]", JSONParseErrorValues, 7},
+		{{0, 3, 0, 0}, "{\"a\":1,\"b\":{\"c\":2}}", JSONParseErrorValues, 16},
+		{{0, 0, 5, 0}, "{\"ok\":\"abc\",\"long\":\"abcdefgh\"}", JSONParseErrorStringLength, 19},
+		{{0, 0, 5, 0}, "{\"ok\":\"abc\",\"toolong\":1}", JSONParseErrorStringLength, 12},
+		{{0, 0, 5, 0}, "[\"\\u00e9\\n\"]", JSONParseErrorStringLength, 1}, // escapes count as written
+		{{0, 0, 0, 2}, "[1, 2, 3]", JSONParseErrorContainerSize, 7},
+		{{0, 0, 0, 2}, "{\"a\":1,\"b\":2,\"c\":3}", JSONParseErrorContainerSize, 13},
+		{{0, 0, 0, 2}, "[[1],[2],[3,4]]", JSONParseErrorContainerSize, 9},
+		{{0, 0, 0, 2}, "[1,[2,3,4]]", JSONParseErrorContainerSize, 8},
+		{{0, 0, 0, 0}, "[1,]", JSONParseErrorSyntax, 3},
+	};
+
+	JSON_Context *context = json_context_init(CountingMalloc, CountingFree);
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+	{
+		json_context_set_parse_limits(context, &cases[i].limits);
+		long before = liveBlocks;
+		CHECK(json_parse_string_ctx(context, cases[i].text) == NULL);
+		JSON_Parse_Error error = json_context_get_parse_error(context);
+		if (error.code != cases[i].code || error.offset != cases[i].offset)
+		{
+			fprintf(stderr, "%.40s: error %d at %zu\n", cases[i].text, error.code, error.offset);
+		}
+		CHECK(error.code == cases[i].code);
+		CHECK(error.offset == cases[i].offset);
+		CHECK(liveBlocks == before);
+
+		// The same document parses without limits, and a success clears the error
+		json_context_set_parse_limits(context, NULL);
+		JSON_Value *value = json_parse_string_ctx(context, cases[i].text);
+		CHECK((value != NULL) == (cases[i].code != JSONParseErrorSyntax));
+		if (value != NULL)
+		{
+			CHECK(json_context_get_parse_error(context).code == JSONParseErrorNone);
+		}
+		json_value_free(value);
+		CHECK(liveBlocks == before);
+	}
+
+	// Exactly at each limit is fine
+	JSON_Parse_Limits limits = {0, 5, 3, 4};
+	json_context_set_parse_limits(context, &limits);
+	JSON_Value *value = json_parse_string_ctx(context, "[1,\"abc\",3,4]");
+	CHECK(value != NULL);
+	json_value_free(value);
+
+	json_context_free(context);
+	CHECK(liveBlocks == 0);
+}
+
+// Dotted paths and the JSON Pointer examples of RFC 6901, section 5
+static void Paths(void)
+{
+	JSON_Context *context = json_context_init(CountingMalloc, CountingFree);
+	JSON_Value *root = json_parse_string_ctx(
+		context, "{\"foo\":[\"bar\",\"baz\"],\"\":0,\"a/b\":1,\"c%d\":2,\"e^f\":3,\"g|h\":4,\"i\\\\j\":5,"
+				 "\"k\\\"l\":6,\" \":7,\"m~n\":8,\"~1\":9,\"arr\":[10,11,12,13,14,15,16,17,18,19,20],"
+				 "\"x\":{\"y\":{\"z\":true},\"01\":\"key\"}}");
+	CHECK(root != NULL);
+
+	const struct
+	{
+		const char *pointer;
+		const char *expected; // serialized, NULL when nothing is there
+	} pointers[] = {
+		{"", NULL}, // the whole document, checked below
+		{"/foo", "[\"bar\",\"baz\"]"},
+		{"/foo/0", "\"bar\""},
+		{"/", "0"},
+		{"/a~1b", "1"},
+		{"/c%d", "2"},
+		{"/e^f", "3"},
+		{"/g|h", "4"},
+		{"/i\\j", "5"},
+		{"/k\"l", "6"},
+		{"/ ", "7"},
+		{"/m~0n", "8"},
+		{"/~01", "9"}, // ~0 is unescaped after ~1, so this is "~1" rather than "/"
+		{"/arr/10", "20"},
+		{"/x/y/z", "true"},
+		{"/x/01", "\"key\""}, // leading zeros are fine in a member name
+		{"/arr/01", NULL},	  // but not in an index
+		{"/arr/-", NULL},	  // the element past the end exists only to add to
+		{"/arr/11", NULL},
+		{"/arr/1a", NULL},
+		{"/foo/0/bar", NULL}, // through a string
+		{"/missing", NULL},
+		{"/x/missing/z", NULL},
+	};
+	for (size_t i = 0; i < sizeof(pointers) / sizeof(pointers[0]); i++)
+	{
+		JSON_Path *path = json_path_compile_pointer_ctx(context, pointers[i].pointer);
+		CHECK(path != NULL);
+		JSON_Value *value = json_path_get_value(root, path);
+		if (i == 0)
+		{
+			CHECK(value == root);
+		}
+		else if (pointers[i].expected == NULL)
+		{
+			CHECK(value == NULL);
+		}
+		else
+		{
+			char *serialized = json_serialize_to_string_ctx(context, value);
+			CHECK(serialized != NULL && strcmp(serialized, pointers[i].expected) == 0);
+			json_free_serialized_string_ctx(context, serialized);
+		}
+		json_path_free(path);
+	}
+
+	// Not pointers: no leading slash, or a ~ not followed by 0 or 1
+	const char *invalid[] = {"foo", "/a~2b", "/a~", "/~/0"};
+	for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+	{
+		CHECK(json_path_compile_pointer_ctx(context, invalid[i]) == NULL);
+	}
+
+	// Dotted paths follow dotget: no escapes, and arrays can't be indexed
+	const char *dotted[][2] = {
+		{"x.y.z", "true"}, {"x.01", "\"key\""}, {"a/b", "1"}, {"m~n", "8"}, {"foo", "[\"bar\",\"baz\"]"},
+		{"x.y.missing", NULL}, {"x..y", NULL}, {"foo.0", NULL}, {"missing.y", NULL},
+	};
+	for (size_t i = 0; i < sizeof(dotted) / sizeof(dotted[0]); i++)
+	{
+		JSON_Path *path = json_path_compile_ctx(context, dotted[i][0]);
+		CHECK(path != NULL);
+		JSON_Value *value = json_path_get_value(root, path);
+		CHECK(json_value_equals(value, json_object_dotget_value(json_value_get_object(root), dotted[i][0])));
+		if (dotted[i][1] == NULL)
+		{
+			CHECK(value == NULL);
+		}
+		else
+		{
+			char *serialized = json_serialize_to_string_ctx(context, value);
+			CHECK(serialized != NULL && strcmp(serialized, dotted[i][1]) == 0);
+			json_free_serialized_string_ctx(context, serialized);
+		}
+		json_path_free(path);
+	}
+
+	// Typed getters, on a path allocated from the context
+	long before = liveBlocks;
+	JSON_Path *path = json_path_compile_pointer_ctx(context, "/arr/3");
+	CHECK(liveBlocks == before + 1);
+	CHECK(json_path_get_number(root, path) == 13 && json_path_get_int64(root, path) == 13);
+	CHECK(json_path_get_string(root, path) == NULL && json_path_get_boolean(root, path) == -1);
+	json_path_free(path);
+	CHECK(json_path_get_value(root, NULL) == NULL);
+	json_path_free(NULL);
+
+	// Paths come from and go back to their context
+	json_value_free(root);
+	json_context_free(context);
+	CHECK(liveBlocks == 0);
+}
+
+// The name as stored by object, NULL when it has no such member
+static const char *NameOf(const JSON_Object *object, const char *name)
+{
+	for (size_t i = 0; i < json_object_get_count(object); i++)
+	{
+		if (strcmp(json_object_get_name(object, i), name) == 0)
+		{
+			return json_object_get_name(object, i);
+		}
+	}
+	return NULL;
+}
+
+// Interned names are stored once per context and released with the last object using them
+static void Interning(void)
+{
+	const char *text = "{\"desired\":{\"SpeedMotorA\":1,\"$version\":2},"
+					   "\"reported\":{\"SpeedMotorA\":3,\"$version\":4}}";
+	JSON_Context *context = json_context_init(CountingMalloc, CountingFree);
+	JSON_Context *plain = json_context_init(CountingMalloc, CountingFree);
+	json_context_set_key_interning(context, 1);
+
+	JSON_Value *first = json_parse_string_ctx(context, text);
+	JSON_Value *second = json_parse_string_ctx(context, text);
+	JSON_Object *desired = json_object_get_object(json_value_get_object(first), "desired");
+	JSON_Object *reported = json_object_get_object(json_value_get_object(first), "reported");
+	JSON_Object *again = json_object_get_object(json_value_get_object(second), "desired");
+	const char *speed = NameOf(desired, "SpeedMotorA");
+	CHECK(speed != NULL);
+	CHECK(NameOf(reported, "SpeedMotorA") == speed); // within a document
+	CHECK(NameOf(again, "SpeedMotorA") == speed);	 // and across documents
+	CHECK(NameOf(again, "$version") == NameOf(desired, "$version"));
+
+	// Names added later, and copies in the same context, share too
+	json_object_set_number(reported, "$version", 5);
+	json_object_dotset_number(json_value_get_object(second), "reported.extra.SpeedMotorA", 6);
+	CHECK(NameOf(json_object_dotget_object(json_value_get_object(second), "reported.extra"), "SpeedMotorA") ==
+		  speed);
+	JSON_Value *copy = json_value_deep_copy(first);
+	CHECK(NameOf(json_object_get_object(json_value_get_object(copy), "desired"), "SpeedMotorA") == speed);
+
+	// A context without interning keeps its own copies
+	JSON_Value *elsewhere = json_value_deep_copy_ctx(plain, first);
+	JSON_Object *elsewhereDesired = json_object_get_object(json_value_get_object(elsewhere), "desired");
+	CHECK(json_value_equals(elsewhere, first));
+	CHECK(NameOf(elsewhereDesired, "SpeedMotorA") != speed);
+	CHECK(NameOf(json_object_get_object(json_value_get_object(elsewhere), "reported"), "SpeedMotorA") !=
+		  NameOf(elsewhereDesired, "SpeedMotorA"));
+
+	// Names outlive the documents they came from while others still use them
+	json_value_free(first);
+	CHECK(strcmp(NameOf(again, "SpeedMotorA"), "SpeedMotorA") == 0);
+	CHECK(json_object_remove(again, "SpeedMotorA") == JSONSuccess);
+	CHECK(json_object_clear(json_object_get_object(json_value_get_object(copy), "reported")) == JSONSuccess);
+	CHECK(NameOf(json_object_get_object(json_value_get_object(copy), "desired"), "SpeedMotorA") != NULL);
+
+	// Every reference gone: the names and the table itself are freed, leaving only the contexts
+	json_value_free(second);
+	json_value_free(copy);
+	json_value_free(elsewhere);
+	json_context_free(plain);
+	long contextOnly = liveBlocks;
+	json_context_free(context);
+	CHECK(liveBlocks == 0 && contextOnly == 1);
+}
+
+int main(void)
+{
+	RoundTrips();
+	Streaming();
+	MergePatches();
+	ParseLimits();
+	Paths();
+	Interning();
+
+	pthread_attr_t attributes;
+	pthread_t thread;
+	pthread_attr_init(&attributes);
+	pthread_attr_setstacksize(&attributes, SMALL_STACK_BYTES);
+	CHECK(pthread_create(&thread, &attributes, SmallStackTests, NULL) == 0);
+	pthread_join(thread, NULL);
+	pthread_attr_destroy(&attributes);
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,179 @@
+#include "parson.h"
+#include "test.h"
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The number codec has to read and write exactly what strtod and "%.17g" would round trip to
+
+#define RANDOM_DOUBLES 200000
+#define RANDOM_LITERALS 200000
+
+static uint64_t state = 0x9E3779B97F4A7C15ull;
+
+static uint64_t NextRandom(void)
+{
+	// xorshift64*
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return state * 0x2545F4914F6CDD1Dull;
+}
+
+static uint64_t Bits(double number)
+{
+	uint64_t bits;
+	memcpy(&bits, &number, sizeof(bits));
+	return bits;
+}
+
+static double Parse(const char *text)
+{
+	JSON_Value *value = json_parse_string(text);
+	double number = json_value_get_number(value);
+	CHECK(json_value_get_type(value) == JSONNumber || json_value_get_type(value) == JSONInteger);
+	json_value_free(value);
+	return number;
+}
+
+// Formats number and checks that both strtod and parson read it back bit for bit
+static int RoundTrips(double number)
+{
+	char text[64];
+	JSON_Value *value = json_value_init_number(number);
+	int ok = json_serialize_to_buffer(value, text, sizeof(text)) == JSONSuccess &&
+			 Bits(strtod(text, NULL)) == Bits(number) && Bits(Parse(text)) == Bits(number);
+	if (!ok)
+	{
+		fprintf(stderr, "%.17g formatted as %s\n", number, text);
+	}
+	json_value_free(value);
+	return ok;
+}
+
+static void Formatting(void)
+{
+	const double special[] = {0.0,		-0.0,	 1.0,	  -1.0,	   0.1,		   0.3,		 1e21,
+							  1e22,		1e23,	 5e-324,  DBL_MIN, DBL_MAX,	   -DBL_MAX, 9007199254740992.0,
+							  123.456,	1e-7,	 1.5e-6,  2.5e300, 4.35e-310,  100.0,	 1234567.0};
+	for (size_t i = 0; i < sizeof(special) / sizeof(special[0]); i++)
+	{
+		CHECK(RoundTrips(special[i]));
+	}
+
+	int failures = 0;
+	for (int i = 0; i < RANDOM_DOUBLES; i++)
+	{
+		uint64_t bits = NextRandom();
+		double number;
+		memcpy(&number, &bits, sizeof(number));
+		if (isfinite(number) && !RoundTrips(number) && ++failures > 10)
+		{
+			break;
+		}
+	}
+	CHECK(failures == 0);
+
+	// Twin speeds and other small integers take the integer path and print without a fraction
+	char text[64];
+	JSON_Value *value = json_value_init_number(-42);
+	CHECK(json_serialize_to_buffer(value, text, sizeof(text)) == JSONSuccess && strcmp(text, "-42") == 0);
+	json_value_free(value);
+	value = json_value_init_number(-0.0);
+	CHECK(json_serialize_to_buffer(value, text, sizeof(text)) == JSONSuccess && strcmp(text, "-0") == 0);
+	json_value_free(value);
+	value = json_value_init_int64(INT64_MIN);
+	CHECK(json_serialize_to_buffer(value, text, sizeof(text)) == JSONSuccess &&
+		  strcmp(text, "-9223372036854775808") == 0);
+	json_value_free(value);
+}
+
+static void Parsing(void)
+{
+	const char *literals[] = {"0",	   "-0",	"1e0",		"0.1",		"1E-2",	   "123456789012345678901234",
+							  "2.2250738585072011e-308",	"4.9e-324", "1.7976931348623157e308",
+							  "9007199254740993",			"0.000001", "17.5e+3", "-1.25",
+							  // Odd significands just past 2^53 round when converted, so they can't take the fast path
+							  "9007199254740993e-16", "9007199254740993e-22", "9007199254740993e-14",
+							  "0.9007199254740993", "-9007199254740995e-3", "9007199254740997e5"};
+	for (size_t i = 0; i < sizeof(literals) / sizeof(literals[0]); i++)
+	{
+		CHECK(Bits(Parse(literals[i])) == Bits(strtod(literals[i], NULL)));
+	}
+
+	// Random literals across the fast path's edges: up to 19 digits, exponents around +-22
+	int failures = 0;
+	for (int i = 0; i < RANDOM_LITERALS && failures <= 10; i++)
+	{
+		char literal[64];
+		uint64_t random = NextRandom();
+		int digits = 1 + (int)(random % 20);
+		int point = (int)((random >> 8) % (uint64_t)(digits + 1));
+		int exponent = (int)((random >> 16) % 61) - 30;
+		char *out = literal;
+		if (random >> 63)
+		{
+			*out++ = '-';
+		}
+		for (int d = 0; d < digits; d++)
+		{
+			if (d == point && d > 0)
+			{
+				*out++ = '.';
+			}
+			*out++ = (char)('0' + (d == 0 ? 1 + NextRandom() % 9 : NextRandom() % 10));
+		}
+		sprintf(out, "e%d", exponent);
+		if (Bits(Parse(literal)) != Bits(strtod(literal, NULL)))
+		{
+			fprintf(stderr, "%s parsed as %.17g\n", literal, Parse(literal));
+			failures++;
+		}
+	}
+	CHECK(failures == 0);
+
+	// Every power of ten the fast path handles, on significands either side of 2^53
+	failures = 0;
+	for (uint64_t mantissa = (1ULL << 53) - 64; mantissa <= (1ULL << 53) + 64; mantissa++)
+	{
+		for (int exponent = -22; exponent <= 22; exponent++)
+		{
+			char literal[64];
+			sprintf(literal, "%llue%d", (unsigned long long)mantissa, exponent);
+			if (Bits(Parse(literal)) != Bits(strtod(literal, NULL)))
+			{
+				fprintf(stderr, "%s parsed as %.17g\n", literal, Parse(literal));
+				failures++;
+			}
+		}
+	}
+	CHECK(failures == 0);
+
+	// Integers that fit int64_t keep every digit
+	JSON_Value *value = json_parse_string("[9223372036854775807,-9223372036854775808,9223372036854775808]");
+	JSON_Array *array = json_value_get_array(value);
+	CHECK(json_value_get_type(json_array_get_value(array, 0)) == JSONInteger);
+	CHECK(json_array_get_int64(array, 0) == INT64_MAX);
+	CHECK(json_array_get_int64(array, 1) == INT64_MIN);
+	CHECK(json_value_get_type(json_array_get_value(array, 2)) == JSONNumber);
+	json_value_free(value);
+
+	// Overflow is an error, underflow isn't
+	CHECK(json_parse_string("1e400") == NULL);
+	CHECK(Parse("1e-400") == 0.0);
+
+	const char *invalid[] = {"01", ".5", "0x10", "+1", "[1e]", "[01]", "[-]", "[1e+]"};
+	for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+	{
+		CHECK(json_parse_string(invalid[i]) == NULL);
+	}
+}
+
+int main(void)
+{
+	Formatting();
+	Parsing();
+	return TEST_RESULT();
+}
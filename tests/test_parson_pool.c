@@ -0,0 +1,138 @@
+#include "parson.h"
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Node pools: once a context has handled a document, handling the same shape again shouldn't
+// reach the allocator at all
+
+#define WARM_UP 3
+#define STEADY_ROUNDS 1000
+#define POOL_LIMIT (16 * 1024)
+
+static const char twin[] =
+	"{\"desired\":{\"SpeedMotorA\":50,\"SpeedMotorB\":{\"value\":-20,\"ac\":200,\"av\":3},"
+	"\"TelemetryWindowSeconds\":10,\"mode\":\"a mode name longer than inline\",\"$version\":7},"
+	"\"reported\":{\"SpeedMotorA\":50,\"SpeedMotorB\":-20,\"samples\":[1,2.5,[3,4],{\"x\":null}],"
+	"\"$version\":3}}";
+
+static size_t allocations, frees;
+
+static void *CountingMalloc(size_t size)
+{
+	allocations++;
+	return malloc(size);
+}
+
+static void CountingFree(void *block)
+{
+	if (block != NULL)
+	{
+		frees++;
+	}
+	free(block);
+}
+
+// Each fails after allocating: a member name whose value is bad, a long string, a container
+static const char *const broken[] = {
+	"{\"desired\":{\"SpeedMotorA\": tru}}",
+	"[\"a string long enough to be allocated\", 1,",
+	"{\"desired\":{\"mode\":\"a mode name longer than inline\",\"x\":[1,2,{\"y\":}]}}",
+};
+
+// One twin update: parse the document, build a report and serialize it, plus the paths that
+// give memory back on failure or growth
+static void Update(JSON_Context *context, int round)
+{
+	JSON_Value *document = json_parse_string_ctx(context, twin);
+	CHECK(document != NULL);
+	JSON_Value *report = json_value_init_object_ctx(context);
+	JSON_Object *object = json_value_get_object(report);
+	json_object_set_number(object, "SpeedMotorA", round % 100);
+	json_object_set_string(object, "mode", round % 2 ? "run" : "a mode name longer than inline");
+	json_object_set_value(object, "copy", json_value_deep_copy(json_object_get_value(json_value_get_object(document), "desired")));
+	char buffer[512];
+	CHECK(json_serialize_to_buffer(report, buffer, sizeof(buffer)) == JSONSuccess);
+
+	// Longer than the serializer's first buffer, so it grows
+	char *serialized = json_serialize_to_string_ctx(context, report);
+	CHECK(serialized != NULL && strcmp(serialized, buffer) == 0 && strlen(serialized) > 128);
+	json_free_serialized_string_ctx(context, serialized);
+
+	JSON_Value *commented = json_parse_string_with_comments_ctx(context, "/* twin */ {\"a\":[1,2]} // end");
+	CHECK(commented != NULL);
+	json_value_free(commented);
+	CHECK(json_parse_string_ctx(context, broken[round % 3]) == NULL);
+
+	json_value_free(report);
+	json_value_free(document);
+}
+
+// With interning the name table is emptied, and its buckets given back, after every update
+static void SteadyState(int interning)
+{
+	allocations = frees = 0;
+	JSON_Context *context = json_context_init(CountingMalloc, CountingFree);
+	json_context_set_key_interning(context, interning);
+	CHECK(json_context_set_pool_limit(context, POOL_LIMIT) == JSONSuccess);
+	for (int i = 0; i < WARM_UP; i++)
+	{
+		Update(context, i);
+	}
+	size_t pooled = json_context_get_pool_size(context);
+	CHECK(pooled > 0 && pooled <= POOL_LIMIT);
+
+	size_t allocationsBefore = allocations, freesBefore = frees;
+	for (int i = 0; i < STEADY_ROUNDS; i++)
+	{
+		Update(context, i);
+	}
+	CHECK(allocations == allocationsBefore && frees == freesBefore);
+	CHECK(json_context_get_pool_size(context) == pooled);
+
+	// Lowering the limit gives the excess back, 0 empties the pools
+	CHECK(json_context_set_pool_limit(context, pooled / 2) == JSONSuccess);
+	CHECK(json_context_get_pool_size(context) <= pooled / 2);
+	CHECK(json_context_set_pool_limit(context, 0) == JSONSuccess);
+	CHECK(json_context_get_pool_size(context) == 0);
+	// and pooling can't come back once the context has allocated
+	CHECK(json_context_set_pool_limit(context, POOL_LIMIT) == JSONFailure);
+
+	json_context_free(context);
+	CHECK(allocations == frees);
+}
+
+// A limit smaller than a document caps what is held, and everything still comes back on free
+static void SmallLimit(void)
+{
+	allocations = frees = 0;
+	JSON_Context *context = json_context_init(CountingMalloc, CountingFree);
+	CHECK(json_context_set_pool_limit(context, 256) == JSONSuccess);
+	for (int i = 0; i < 10; i++)
+	{
+		Update(context, i);
+		CHECK(json_context_get_pool_size(context) <= 256);
+	}
+	json_context_free(context);
+	CHECK(allocations == frees);
+}
+
+// Without pools every update allocates, which is what the pools save
+static void Unpooled(void)
+{
+	JSON_Context *context = json_context_init(CountingMalloc, CountingFree);
+	Update(context, 0);
+	size_t before = allocations;
+	Update(context, 1);
+	CHECK(allocations - before > 20);
+	json_context_free(context);
+}
+
+int main(void)
+{
+	SteadyState(0);
+	SteadyState(1);
+	SmallLimit();
+	Unpooled();
+	return TEST_RESULT();
+}
@@ -0,0 +1,301 @@
+#include "parson.h"
+#include "test.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The string scanner reads a block at a time, so every check runs at every alignment and with
+// quotes, escapes and multi-byte characters at every position around the block edges.
+
+#define MAX_ALIGNMENT 16
+#define RANDOM_STRINGS 20000
+#define RANDOM_BYTE_STRINGS 200000
+
+static uint32_t state = 2463534242u;
+
+static uint32_t NextRandom(void)
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+// Parses text copied to the given offset of a buffer, so the scanner meets it at that alignment
+static JSON_Value *ParseAt(const char *text, size_t offset)
+{
+	size_t length = strlen(text);
+	char *buffer = malloc(length + MAX_ALIGNMENT + 1);
+	memcpy(buffer + offset, text, length + 1);
+	JSON_Value *value = json_parse_string(buffer + offset);
+	free(buffer);
+	return value;
+}
+
+// Builds a string value from text copied to the given offset; this is where UTF-8 is validated
+static JSON_Value *InitAt(const char *text, size_t offset)
+{
+	size_t length = strlen(text);
+	char *buffer = malloc(length + MAX_ALIGNMENT + 1);
+	memcpy(buffer + offset, text, length + 1);
+	JSON_Value *value = json_value_init_string(buffer + offset);
+	free(buffer);
+	return value;
+}
+
+// Random string bodies as JSON and as what they decode to
+static void RandomString(char *json, char *expected, int pieces)
+{
+	static const char *const escapes[][2] = {{"\\\"", "\""}, {"\\\\", "\\"},			{"\\/", "/"},
+											 {"\\n", "\n"},	 {"\\t", "\t"},				{"\\u00e9", "\xC3\xA9"},
+											 {"\\u20AC", "\xE2\x82\xAC"},				{"\\ud83d\\ude00", "\xF0\x9F\x98\x80"}};
+	static const char *const raw[] = {"\xC3\xA9", "\xE2\x82\xAC", "\xF0\x9F\x98\x80", "'", "a b"};
+	*json++ = '"';
+	for (int i = 0; i < pieces; i++)
+	{
+		uint32_t random = NextRandom();
+		const char *in, *out;
+		switch (random % 4)
+		{
+		case 0:
+			in = escapes[(random >> 8) % 8][0];
+			out = escapes[(random >> 8) % 8][1];
+			break;
+		case 1:
+			in = out = raw[(random >> 8) % 5];
+			break;
+		default:
+		{
+			// a run of plain ASCII, often longer than a block
+			static char run[40];
+			size_t length = (random >> 8) % sizeof(run);
+			for (size_t j = 0; j < length; j++)
+			{
+				run[j] = (char)('a' + (random >> (j % 24)) % 26);
+			}
+			run[length] = '\0';
+			in = out = run;
+			break;
+		}
+		}
+		json = stpcpy(json, in);
+		expected = stpcpy(expected, out);
+	}
+	*json++ = '"';
+	*json = '\0';
+	*expected = '\0';
+}
+
+static void Decoding(void)
+{
+	char json[4096], expected[4096];
+	int failures = 0;
+	for (int i = 0; i < RANDOM_STRINGS && failures < 10; i++)
+	{
+		RandomString(json, expected, 1 + (int)(NextRandom() % 24));
+		size_t offset = (size_t)i % MAX_ALIGNMENT;
+		JSON_Value *value = ParseAt(json, offset);
+		const char *decoded = json_value_get_string(value);
+		if (decoded == NULL || strcmp(decoded, expected) != 0)
+		{
+			fprintf(stderr, "%s at offset %zu decoded as %s\n", json, offset, decoded ? decoded : "NULL");
+			failures++;
+		}
+		else
+		{
+			// and back again
+			char *serialized = json_serialize_to_string(value);
+			JSON_Value *again = json_parse_string(serialized);
+			CHECK(strcmp(json_value_get_string(again), expected) == 0);
+			json_value_free(again);
+			json_free_serialized_string(serialized);
+		}
+		json_value_free(value);
+	}
+	CHECK(failures == 0);
+
+	// A quote or backslash at each position of the first few blocks, at each alignment
+	for (size_t length = 0; length < 3 * MAX_ALIGNMENT; length++)
+	{
+		for (size_t offset = 0; offset < MAX_ALIGNMENT; offset++)
+		{
+			char text[4 * MAX_ALIGNMENT + 8], want[4 * MAX_ALIGNMENT];
+			memset(want, 'x', length);
+			want[length] = '\0';
+			snprintf(text, sizeof(text), "\"%s\"", want);
+			JSON_Value *value = ParseAt(text, offset);
+			CHECK(value != NULL && strcmp(json_value_get_string(value), want) == 0);
+			json_value_free(value);
+
+			snprintf(text, sizeof(text), "\"%s\\\"\"", want);
+			value = ParseAt(text, offset);
+			const char *got = json_value_get_string(value);
+			CHECK(got != NULL && strlen(got) == length + 1 && got[length] == '"');
+			json_value_free(value);
+
+			// unterminated
+			snprintf(text, sizeof(text), "\"%s", want);
+			CHECK(ParseAt(text, offset) == NULL);
+		}
+	}
+
+	// Control characters have to be escaped, and the escape has to be complete
+	const char *invalid[] = {"\"a\tb\"", "\"\x01\"", "\"\\x\"", "\"\\u12\"", "\"\\ud83d\"", "\"\\ude00\""};
+	for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+	{
+		CHECK(json_parse_string(invalid[i]) == NULL);
+	}
+}
+
+// RFC 3629: no overlong forms, no surrogates, nothing past U+10FFFF
+static int ValidUtf8(const unsigned char *s, size_t length)
+{
+	size_t i = 0;
+	while (i < length)
+	{
+		unsigned char c = s[i];
+		int extra;
+		uint32_t codePoint;
+		if (c < 0x80)
+		{
+			i++;
+			continue;
+		}
+		else if (c >= 0xC2 && c <= 0xDF)
+		{
+			extra = 1, codePoint = c & 0x1F;
+		}
+		else if (c >= 0xE0 && c <= 0xEF)
+		{
+			extra = 2, codePoint = c & 0x0F;
+		}
+		else if (c >= 0xF0 && c <= 0xF4)
+		{
+			extra = 3, codePoint = c & 0x07;
+		}
+		else
+		{
+			return 0;
+		}
+		if (i + extra >= length)
+		{
+			return 0;
+		}
+		for (int j = 1; j <= extra; j++)
+		{
+			if ((s[i + j] & 0xC0) != 0x80)
+			{
+				return 0;
+			}
+			codePoint = codePoint << 6 | (s[i + j] & 0x3F);
+		}
+		if ((extra == 2 && codePoint < 0x800) || (extra == 3 && codePoint < 0x10000) ||
+			codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF))
+		{
+			return 0;
+		}
+		i += (size_t)extra + 1;
+	}
+	return 1;
+}
+
+static void Validation(void)
+{
+	int failures = 0;
+	for (int i = 0; i < RANDOM_BYTE_STRINGS && failures < 10; i++)
+	{
+		// Mostly ASCII, so the word-at-a-time path runs, with a few high bytes mixed in
+		unsigned char body[48];
+		size_t length = NextRandom() % sizeof(body);
+		for (size_t j = 0; j < length; j++)
+		{
+			uint32_t random = NextRandom();
+			body[j] = random % 8 ? (unsigned char)(' ' + random % 90) : (unsigned char)(0x80 | random >> 8);
+		}
+		char text[64];
+		memcpy(text, body, length);
+		text[length] = '\0';
+		JSON_Value *value = InitAt(text, (size_t)i % MAX_ALIGNMENT);
+		if ((value != NULL) != ValidUtf8(body, length))
+		{
+			failures++;
+		}
+		json_value_free(value);
+	}
+	CHECK(failures == 0);
+
+	const char *invalid[] = {"\xC0\xAF", "\xE0\x80\xAF", "\xED\xA0\x80", "\xF4\x90\x80\x80", "\xC3", "abcdefghijklmnop\xFF"};
+	for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+	{
+		CHECK(json_value_init_string(invalid[i]) == NULL);
+	}
+}
+
+static size_t allocations;
+
+static void *CountingMalloc(size_t size)
+{
+	allocations++;
+	return malloc(size);
+}
+
+static size_t ParseAllocations(JSON_Context *context, const char *text)
+{
+	size_t before = allocations;
+	JSON_Value *value = json_parse_string_ctx(context, text);
+	size_t count = allocations - before;
+	CHECK(value != NULL);
+	json_value_free(value);
+	return count;
+}
+
+// Strings of up to 7 bytes live inside the value and need no allocation of their own. The parser
+// decides by the length as written, escapes included.
+static void InlineStrings(void)
+{
+	char text[32];
+	for (size_t length = 0; length < 20; length++)
+	{
+		memset(text, 'a' + (int)length, length);
+		text[length] = '\0';
+		JSON_Value *built = json_value_init_string(text);
+		CHECK(json_value_get_type(built) == JSONString && strcmp(json_value_get_string(built), text) == 0);
+
+		JSON_Value *copy = json_value_deep_copy(built);
+		CHECK(json_value_equals(built, copy));
+		char quoted[40];
+		snprintf(quoted, sizeof(quoted), "\"%s\"", text);
+		JSON_Value *parsed = json_parse_string(quoted);
+		CHECK(json_value_equals(built, parsed));
+		json_value_free(parsed);
+		json_value_free(copy);
+		json_value_free(built);
+	}
+
+	// Replacing a short string with a long one and back
+	JSON_Value *root = json_value_init_object();
+	JSON_Object *object = json_value_get_object(root);
+	json_object_set_string(object, "mode", "idle");
+	json_object_set_string(object, "mode", "a much longer mode name");
+	CHECK(strcmp(json_object_get_string(object, "mode"), "a much longer mode name") == 0);
+	json_object_set_string(object, "mode", "run");
+	CHECK(strcmp(json_object_get_string(object, "mode"), "run") == 0);
+	char *serialized = json_serialize_to_string(root);
+	CHECK(strcmp(serialized, "{\"mode\":\"run\"}") == 0);
+	json_free_serialized_string(serialized);
+	json_value_free(root);
+
+	JSON_Context *context = json_context_init(CountingMalloc, free);
+	CHECK(ParseAllocations(context, "[\"ok\",\"idle\",\"off\",\"\\u00e9t\"]") ==
+		  ParseAllocations(context, "[1,2,3,4]"));
+	CHECK(ParseAllocations(context, "[\"not short enough\"]") == ParseAllocations(context, "[1]") + 1);
+	json_context_free(context);
+}
+
+int main(void)
+{
+	Decoding();
+	Validation();
+	InlineStrings();
+	return TEST_RESULT();
+}
@@ -0,0 +1,161 @@
+#include "parson.h"
+#include "test.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Threads parse, build, look up, copy, patch and serialize at the same time, each through its own context.
+// Every context gets an allocator of its own that records which thread called it, so any block
+// crossing between contexts, or any use of the default context, shows up in the counts.
+
+#define THREADS 4
+#define ROUNDS 500
+
+static const char document[] =
+	"{\"desired\":{\"SpeedMotorA\":50,\"SpeedMotorB\":-20,\"TelemetryWindowSeconds\":10,"
+	"\"mode\":\"a mode name longer than inline\",\"$version\":7},"
+	"\"reported\":{\"SpeedMotorA\":50,\"samples\":[1,2.5,[3,4],{\"x\":null}],\"$version\":3}}";
+
+typedef struct
+{
+	pthread_t thread; // the only one that may call it
+	long allocations;
+	long frees;
+	long foreignCalls; // made from any other thread
+	long failures;
+} Allocator;
+
+static Allocator allocators[THREADS];
+static long defaultCalls = 0; // only main touches the default context, before and after
+
+static void *AllocatorMalloc(Allocator *allocator, size_t size)
+{
+	if (!pthread_equal(pthread_self(), allocator->thread))
+	{
+		allocator->foreignCalls++;
+	}
+	allocator->allocations++;
+	return malloc(size);
+}
+
+static void AllocatorFree(Allocator *allocator, void *block)
+{
+	if (block == NULL)
+	{
+		return;
+	}
+	if (!pthread_equal(pthread_self(), allocator->thread))
+	{
+		allocator->foreignCalls++;
+	}
+	allocator->frees++;
+	free(block);
+}
+
+// The allocator functions take no user data, so each context gets its own pair
+#define ALLOCATOR(n)                                                                              \
+	static void *Malloc##n(size_t size)                                                           \
+	{                                                                                             \
+		return AllocatorMalloc(&allocators[n], size);                                             \
+	}                                                                                             \
+	static void Free##n(void *block)                                                              \
+	{                                                                                             \
+		AllocatorFree(&allocators[n], block);                                                     \
+	}
+ALLOCATOR(0)
+ALLOCATOR(1)
+ALLOCATOR(2)
+ALLOCATOR(3)
+
+static const JSON_Malloc_Function mallocs[THREADS] = {Malloc0, Malloc1, Malloc2, Malloc3};
+static const JSON_Free_Function frees[THREADS] = {Free0, Free1, Free2, Free3};
+
+static void *DefaultMalloc(size_t size)
+{
+	__atomic_fetch_add(&defaultCalls, 1, __ATOMIC_RELAXED);
+	return malloc(size);
+}
+
+static void DefaultFree(void *block)
+{
+	__atomic_fetch_add(&defaultCalls, 1, __ATOMIC_RELAXED);
+	free(block);
+}
+
+static void *Worker(void *argument)
+{
+	int index = (int)(intptr_t)argument;
+	Allocator *allocator = &allocators[index];
+	allocator->thread = pthread_self(); // before the context makes its first allocation
+	JSON_Context *context = json_context_init(mallocs[index], frees[index]);
+	// Odd threads also share names through their intern table and recycle through pools
+	if (index % 2 == 1)
+	{
+		json_context_set_key_interning(context, 1);
+		json_context_set_pool_limit(context, 16 * 1024);
+	}
+
+	JSON_Path *speedPath = json_path_compile_pointer_ctx(context, "/desired/SpeedMotorA");
+	for (int round = 0; round < ROUNDS; round++)
+	{
+		JSON_Value *value = json_parse_string_ctx(context, document);
+		JSON_Object *desired = json_object_get_object(json_value_get_object(value), "desired");
+		json_object_set_number(desired, "SpeedMotorA", round % 100);
+		json_object_set_string(desired, "owner", round % 2 ? "thread" : "a thread name longer than inline");
+		json_object_dotset_number(json_value_get_object(value), "reported.extra.round", round);
+		if (json_path_get_number(value, speedPath) != round % 100)
+		{
+			allocator->failures++;
+		}
+
+		char *serialized = json_serialize_to_string_ctx(context, value);
+		JSON_Value *again = json_parse_string_ctx(context, serialized);
+		JSON_Value *copy = json_value_deep_copy_ctx(context, again);
+		JSON_Value *diff = json_merge_patch_diff(value, copy);
+		if (serialized == NULL || !json_value_equals(value, again) || !json_value_equals(again, copy) ||
+			diff == NULL || json_object_get_count(json_value_get_object(diff)) != 0)
+		{
+			allocator->failures++;
+		}
+		copy = json_merge_patch_apply(copy, value);
+		if (!json_value_equals(copy, value))
+		{
+			allocator->failures++;
+		}
+		json_value_free(diff);
+		json_value_free(copy);
+		json_value_free(again);
+		json_free_serialized_string_ctx(context, serialized);
+		json_value_free(value);
+	}
+	json_path_free(speedPath);
+	json_context_free(context);
+	return NULL;
+}
+
+int main(void)
+{
+	json_set_allocation_functions(DefaultMalloc, DefaultFree);
+
+	pthread_t threads[THREADS];
+	for (int i = 0; i < THREADS; i++)
+	{
+		CHECK(pthread_create(&threads[i], NULL, Worker, (void *)(intptr_t)i) == 0);
+	}
+	for (int i = 0; i < THREADS; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+
+	CHECK(defaultCalls == 0);
+	for (int i = 0; i < THREADS; i++)
+	{
+		// Pooled contexts stop allocating once warmed up, the others allocate every round
+		CHECK(allocators[i].allocations > (i % 2 == 1 ? 0 : ROUNDS));
+		CHECK(allocators[i].allocations == allocators[i].frees);
+		CHECK(allocators[i].foreignCalls == 0);
+		CHECK(allocators[i].failures == 0);
+	}
+	return TEST_RESULT();
+}
@@ -0,0 +1,212 @@
+#include "segment_log.h"
+#include "test.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The store-and-forward log against a regular file. Records carry their index, so whatever the
+// log hands back can be checked against what was appended.
+
+#define SEGMENTS 4
+#define CAPACITY (SEGMENTS * SEGMENT_LOG_SEGMENT_SIZE)
+
+static size_t RecordLength(uint32_t index)
+{
+	return sizeof(index) + (index * 37) % 300;
+}
+
+static void MakeRecord(uint32_t index, uint8_t *record)
+{
+	memcpy(record, &index, sizeof(index));
+	for (size_t i = sizeof(index); i < RecordLength(index); i++)
+	{
+		record[i] = (uint8_t)(index * 7 + i);
+	}
+}
+
+static int Append(SegmentLog *log, uint32_t index)
+{
+	uint8_t record[SEGMENT_LOG_MAX_RECORD];
+	MakeRecord(index, record);
+	return SegmentLog_Append(log, record, RecordLength(index));
+}
+
+// Reads the next record and returns its index, or -1 when the log is empty or the record is wrong
+static long ReadRecord(SegmentLog *log)
+{
+	uint8_t record[SEGMENT_LOG_MAX_RECORD], expected[SEGMENT_LOG_MAX_RECORD];
+	int length = SegmentLog_Peek(log, record, sizeof(record));
+	if (length <= 0)
+	{
+		return -1;
+	}
+	uint32_t index;
+	memcpy(&index, record, sizeof(index));
+	MakeRecord(index, expected);
+	if ((size_t)length != RecordLength(index) || memcmp(record, expected, (size_t)length) != 0 ||
+		SegmentLog_Advance(log) != 0)
+	{
+		return -1;
+	}
+	return index;
+}
+
+static int NewFile(void)
+{
+	FILE *file = tmpfile();
+	int fd = dup(fileno(file));
+	fclose(file);
+	CHECK(ftruncate(fd, CAPACITY) == 0);
+	return fd;
+}
+
+static void AppendAndRead(void)
+{
+	int fd = NewFile();
+	SegmentLog log;
+	CHECK(SegmentLog_Open(&log, fd, CAPACITY) == 0);
+	CHECK(SegmentLog_IsEmpty(&log));
+	uint8_t buffer[16];
+	CHECK(SegmentLog_Peek(&log, buffer, sizeof(buffer)) == 0);
+
+	for (uint32_t i = 0; i < 20; i++)
+	{
+		CHECK(Append(&log, i) == 0);
+	}
+	CHECK(!SegmentLog_IsEmpty(&log));
+	CHECK(SegmentLog_Peek(&log, buffer, 1) == -1); // too small, and the record stays
+	for (long i = 0; i < 20; i++)
+	{
+		CHECK(ReadRecord(&log) == i);
+	}
+	CHECK(SegmentLog_IsEmpty(&log));
+
+	// Longest record there is room for
+	uint8_t record[SEGMENT_LOG_MAX_RECORD + 1];
+	memset(record, 0xA5, sizeof(record));
+	CHECK(SegmentLog_Append(&log, record, SEGMENT_LOG_MAX_RECORD + 1) == -1);
+	CHECK(SegmentLog_Append(&log, record, SEGMENT_LOG_MAX_RECORD) == 0);
+	CHECK(SegmentLog_Peek(&log, record, sizeof(record)) == SEGMENT_LOG_MAX_RECORD);
+	CHECK(SegmentLog_Advance(&log) == 0 && SegmentLog_IsEmpty(&log));
+	close(fd);
+
+	// A file too small for two segments
+	fd = NewFile();
+	CHECK(SegmentLog_Open(&log, fd, SEGMENT_LOG_SEGMENT_SIZE) == -1);
+	close(fd);
+}
+
+// Flushed records survive a restart, and nothing read to the end of a segment comes back
+static void Recovery(void)
+{
+	int fd = NewFile();
+	SegmentLog log;
+	CHECK(SegmentLog_Open(&log, fd, CAPACITY) == 0);
+	uint32_t appended = 0;
+	while (log.writeSegment < 2)
+	{
+		CHECK(Append(&log, appended++) == 0);
+	}
+	long firstUnread = 0;
+	while (log.readSegment < 1)
+	{
+		CHECK(ReadRecord(&log) == firstUnread++);
+	}
+	CHECK(ReadRecord(&log) == firstUnread++);
+	CHECK(SegmentLog_Flush(&log) == 0);
+
+	// Restart: the partly read segment is replayed from its start, at least once delivery
+	SegmentLog reopened;
+	CHECK(SegmentLog_Open(&reopened, fd, CAPACITY) == 0);
+	long first = ReadRecord(&reopened), next = first;
+	CHECK(first >= 0 && first < firstUnread);
+	while (next >= 0 && next + 1 < (long)appended)
+	{
+		long index = ReadRecord(&reopened);
+		CHECK(index == next + 1);
+		next = index;
+	}
+	CHECK(next == (long)appended - 1 && SegmentLog_IsEmpty(&reopened));
+
+	// Appends after the restart carry on behind the recovered records
+	CHECK(Append(&reopened, appended) == 0);
+	CHECK(ReadRecord(&reopened) == (long)appended);
+	close(fd);
+}
+
+// When the ring fills up the oldest segment goes, and what is left is still in order
+static void Overflow(void)
+{
+	int fd = NewFile();
+	SegmentLog log;
+	CHECK(SegmentLog_Open(&log, fd, CAPACITY) == 0);
+	uint32_t appended = 0;
+	while (log.droppedSegments < 3)
+	{
+		CHECK(Append(&log, appended++) == 0);
+	}
+	long index = ReadRecord(&log), count = 1;
+	CHECK(index > 0);
+	while (!SegmentLog_IsEmpty(&log))
+	{
+		long next = ReadRecord(&log);
+		CHECK(next == index + 1);
+		index = next;
+		count++;
+	}
+	CHECK(index == (long)appended - 1);
+	CHECK(count * (long)sizeof(uint32_t) < CAPACITY);
+	close(fd);
+}
+
+// A corrupted byte is caught by the CRC: only intact records come back, in order
+static void Corruption(void)
+{
+	for (off_t offset = SEGMENT_LOG_HEADER_SIZE; offset < 2 * SEGMENT_LOG_SEGMENT_SIZE; offset += 97)
+	{
+		int fd = NewFile();
+		SegmentLog log;
+		CHECK(SegmentLog_Open(&log, fd, CAPACITY) == 0);
+		uint32_t appended = 0;
+		while (log.writeSegment < 2)
+		{
+			CHECK(Append(&log, appended++) == 0);
+		}
+		CHECK(SegmentLog_Flush(&log) == 0);
+
+		uint8_t byte;
+		CHECK(pread(fd, &byte, 1, offset) == 1);
+		byte ^= 0x40;
+		CHECK(pwrite(fd, &byte, 1, offset) == 1);
+
+		CHECK(SegmentLog_Open(&log, fd, CAPACITY) == 0);
+		long previous = -1;
+		for (;;)
+		{
+			uint8_t record[SEGMENT_LOG_MAX_RECORD];
+			int length = SegmentLog_Peek(&log, record, sizeof(record));
+			if (length <= 0)
+			{
+				break;
+			}
+			long index = ReadRecord(&log);
+			CHECK(index > previous && index < (long)appended);
+			if (index < 0)
+			{
+				break;
+			}
+			previous = index;
+		}
+		close(fd);
+	}
+}
+
+int main(void)
+{
+	AppendAndRead();
+	Recovery();
+	Overflow();
+	Corruption();
+	return TEST_RESULT();
+}
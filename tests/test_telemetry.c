@@ -0,0 +1,207 @@
+#include "cbor.h"
+#include "telemetry.h"
+#include "test.h"
+#include <unistd.h>
+
+// Records through the public calls and decodes each batch back to JSON to check what it holds:
+// raw samples, dropping the oldest when the ring fills, splitting into batches that fit, and
+// windows closing into summaries that match aggregating the same values directly.
+
+#define WINDOW_MS 50
+#define BUFFER_SIZE 16384
+
+static uint8_t buffer[BUFFER_SIZE];
+
+// Encodes the next batch into size bytes and decodes it, NULL when nothing is pending
+static JSON_Value *NextBatch(size_t size, size_t *count)
+{
+	size_t length = Telemetry_EncodeBatch(buffer, size, count);
+	if (length == 0)
+	{
+		return NULL;
+	}
+	JSON_Value *batch = Cbor_DecodeJson(buffer, length, NULL);
+	CHECK(batch != NULL);
+	return batch;
+}
+
+static int Item(JSON_Array *entry, size_t index)
+{
+	return (int)json_array_get_number(entry, index);
+}
+
+static void Samples(void)
+{
+	Telemetry_SetWindow(0);
+	CHECK(Telemetry_Window() == 0);
+	size_t count = 1;
+	CHECK(Telemetry_EncodeBatch(buffer, sizeof(buffer), &count) == 0);
+	CHECK(count == 0);
+	CHECK(!Telemetry_FlushDue());
+
+	Telemetry_Record(Telemetry_MotorDuty, 1, -50);
+	Telemetry_Record(Telemetry_StepRate, 2, 400);
+	Telemetry_Record(Telemetry_LoopLatency, 0, 1234567);
+	CHECK(Telemetry_Pending() == 3);
+
+	JSON_Value *batch = NextBatch(sizeof(buffer), &count);
+	CHECK(count == 3);
+	JSON_Object *object = json_value_get_object(batch);
+	CHECK(json_object_get_number(object, "t") > 0);
+	CHECK(json_object_get_number(object, "dropped") == 0);
+	JSON_Array *samples = json_object_get_array(object, "samples");
+	CHECK(json_array_get_count(samples) == 3);
+	const int expected[3][3] = {{1, 1, -50}, {2, 2, 400}, {4, 0, 1234567}};
+	int previous = 0;
+	for (size_t i = 0; i < 3; i++)
+	{
+		JSON_Array *sample = json_array_get_array(samples, i);
+		CHECK(json_array_get_count(sample) == 4);
+		CHECK(Item(sample, 0) >= previous);
+		previous = Item(sample, 0);
+		CHECK(Item(sample, 1) == expected[i][0]);
+		CHECK(Item(sample, 2) == expected[i][1]);
+		CHECK(Item(sample, 3) == expected[i][2]);
+	}
+	json_value_free(batch);
+
+	// Encoding alone releases nothing
+	CHECK(Telemetry_Pending() == 3);
+	Telemetry_Consume(count);
+	CHECK(Telemetry_Pending() == 0);
+}
+
+static void Overflow(void)
+{
+	for (int i = 0; i < TELEMETRY_RING_CAPACITY + 10; i++)
+	{
+		Telemetry_Record(Telemetry_EncoderCount, 0, i);
+	}
+	CHECK(Telemetry_Pending() == TELEMETRY_RING_CAPACITY);
+	CHECK(Telemetry_FlushDue());
+
+	// Small buffers split the ring into batches, the count of dropped samples goes with the first
+	int next = 10;
+	int batches = 0;
+	size_t count;
+	JSON_Value *batch;
+	while ((batch = NextBatch(256, &count)) != NULL)
+	{
+		JSON_Object *object = json_value_get_object(batch);
+		CHECK(json_object_get_number(object, "dropped") == (batches == 0 ? 10 : 0));
+		JSON_Array *samples = json_object_get_array(object, "samples");
+		CHECK(count > 0 && json_array_get_count(samples) == count);
+		for (size_t i = 0; i < json_array_get_count(samples); i++)
+		{
+			CHECK(Item(json_array_get_array(samples, i), 3) == next);
+			next++;
+		}
+		json_value_free(batch);
+		Telemetry_Consume(count);
+		batches++;
+	}
+	CHECK(next == TELEMETRY_RING_CAPACITY + 10);
+	CHECK(batches > 1);
+	CHECK(Telemetry_Pending() == 0);
+
+	// Too small for even one sample
+	CHECK(Telemetry_EncodeBatch(buffer, 8, &count) == 0);
+}
+
+static void Windows(void)
+{
+	Telemetry_SetWindow(WINDOW_MS);
+	CHECK(Telemetry_Window() == WINDOW_MS);
+
+	const int32_t values[] = {12, -3, 40, 7, 7, 19, 25, -11, 3, 30, 8};
+	const size_t valueCount = sizeof(values) / sizeof(values[0]);
+	Downsample_Window direct;
+	Downsample_Reset(&direct);
+	for (size_t i = 0; i < valueCount; i++)
+	{
+		Telemetry_Record(Telemetry_StepRate, 3, values[i]);
+		Downsample_Add(&direct, values[i]);
+	}
+	Telemetry_Record(Telemetry_LoopLatency, 0, 900);
+	CHECK(Telemetry_Pending() == 0);
+
+	// The window closes on the first call after it ends
+	usleep((WINDOW_MS + 20) * 1000);
+	Telemetry_FlushDue();
+	CHECK(Telemetry_Pending() == 2);
+
+	size_t count;
+	JSON_Value *batch = NextBatch(sizeof(buffer), &count);
+	CHECK(count == 2);
+	JSON_Object *object = json_value_get_object(batch);
+	CHECK(json_object_get_number(object, "window") == WINDOW_MS);
+	CHECK(json_object_get_number(object, "dropped") == 0);
+	JSON_Array *summaries = json_object_get_array(object, "summaries");
+	CHECK(json_array_get_count(summaries) == 2);
+
+	Downsample_Summary expected;
+	Downsample_Summarize(&direct, &expected);
+	JSON_Array *summary = json_array_get_array(summaries, 0);
+	CHECK(json_array_get_count(summary) == 10);
+	CHECK(Item(summary, 0) == 0);
+	CHECK(Item(summary, 1) == Telemetry_StepRate);
+	CHECK(Item(summary, 2) == 3);
+	CHECK(Item(summary, 3) == (int)valueCount);
+	CHECK(Item(summary, 4) == -11);
+	CHECK(Item(summary, 5) == 40);
+	CHECK(Item(summary, 6) == 12); // 137 / 11 rounded
+	CHECK(Item(summary, 7) == 8);
+	CHECK(Item(summary, 8) == expected.p50);
+	CHECK(Item(summary, 9) == expected.p90);
+
+	const int latency[10] = {0, Telemetry_LoopLatency, 0, 1, 900, 900, 900, 900, 900, 900};
+	summary = json_array_get_array(summaries, 1);
+	for (size_t i = 0; i < 10; i++)
+	{
+		CHECK(Item(summary, i) == latency[i]);
+	}
+	json_value_free(batch);
+	Telemetry_Consume(count);
+	CHECK(Telemetry_Pending() == 0);
+}
+
+static void Signals(void)
+{
+	// Samples of signals past the limit are counted as dropped, and changing the window closes
+	// the one in progress
+	Telemetry_SetWindow(WINDOW_MS);
+	for (int source = 0; source <= TELEMETRY_MAX_SIGNALS; source++)
+	{
+		Telemetry_Record(Telemetry_MotorDuty, source, source);
+	}
+	Telemetry_SetWindow(0);
+	CHECK(Telemetry_Pending() == TELEMETRY_MAX_SIGNALS);
+
+	size_t count;
+	JSON_Value *batch = NextBatch(sizeof(buffer), &count);
+	CHECK(count == TELEMETRY_MAX_SIGNALS);
+	JSON_Object *object = json_value_get_object(batch);
+	CHECK(json_object_get_number(object, "dropped") == 1);
+	JSON_Array *summaries = json_object_get_array(object, "summaries");
+	for (size_t i = 0; i < json_array_get_count(summaries); i++)
+	{
+		JSON_Array *summary = json_array_get_array(summaries, i);
+		CHECK(Item(summary, 2) == (int)i);
+		CHECK(Item(summary, 3) == 1);
+	}
+	json_value_free(batch);
+	Telemetry_Consume(count);
+	CHECK(Telemetry_Pending() == 0);
+
+	Telemetry_SetWindow(TELEMETRY_MAX_WINDOW_MS + 1);
+	CHECK(Telemetry_Window() == TELEMETRY_MAX_WINDOW_MS);
+}
+
+int main(void)
+{
+	Samples();
+	Overflow();
+	Windows();
+	Signals();
+	return TEST_RESULT();
+}
@@ -0,0 +1,119 @@
+#include "parson.h"
+#include "test.h"
+#include "twin_model.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The codec generated from interface.json, checked against parson reading the same documents
+
+#define RANDOM_ROUND_TRIPS 10000
+
+static const char fullTwin[] =
+	"{\"desired\":{\"SpeedMotorA\":50,\"SpeedMotorB\":{\"value\":-20,\"ac\":200,\"av\":3},"
+	"\"Unknown\":[1,{\"SpeedMotorA\":7}],\"$version\":7},"
+	"\"reported\":{\"SpeedMotorA\":1,\"TelemetryWindowSeconds\":3,\"$version\":3}}";
+
+static bool Parse(const char *json, TwinModel_Properties *properties, uint32_t *fields, int64_t *version)
+{
+	return TwinModel_ParseDesired(json, strlen(json), properties, fields, version);
+}
+
+static void Desired(void)
+{
+	TwinModel_Properties properties = {1, 2, 3};
+	uint32_t fields = 0;
+	int64_t version = 0;
+
+	// Only the desired section of a full twin counts, and unknown members are skipped whole
+	CHECK(Parse(fullTwin, &properties, &fields, &version));
+	CHECK(properties.SpeedMotorA == 50 && properties.SpeedMotorB == -20 && properties.TelemetryWindowSeconds == 3);
+	CHECK(fields == (TwinModel_Field_SpeedMotorA | TwinModel_Field_SpeedMotorB) && version == 7);
+
+	// A patch carries the properties at the top level, keys may be escaped
+	CHECK(Parse("{\"TelemetryWindowSeconds\":30,\"Speed\\u004dotorA\":5,\"$version\":8}", &properties, &fields,
+				&version));
+	CHECK(properties.SpeedMotorA == 5 && properties.TelemetryWindowSeconds == 30 && version == 8);
+	CHECK(fields == (TwinModel_Field_SpeedMotorA | TwinModel_Field_TelemetryWindowSeconds));
+
+	// Values of the wrong type or out of range are ignored, not an error
+	TwinModel_Properties before = properties;
+	CHECK(Parse("{\"SpeedMotorA\":\"fast\",\"SpeedMotorB\":1.5,\"TelemetryWindowSeconds\":99999999999}",
+				&properties, &fields, &version));
+	CHECK(fields == 0 && version == -1 && memcmp(&properties, &before, sizeof(before)) == 0);
+
+	// Malformed documents, including every truncation of a valid one, leave everything untouched
+	size_t length = strlen(fullTwin);
+	for (size_t cut = 0; cut < length; cut++)
+	{
+		fields = 0x55;
+		version = 42;
+		CHECK(!TwinModel_ParseDesired(fullTwin, cut, &properties, &fields, &version));
+		CHECK(fields == 0x55 && version == 42 && memcmp(&properties, &before, sizeof(before)) == 0);
+	}
+	const char *malformed[] = {"", "[]", "{\"SpeedMotorA\":}", "{\"SpeedMotorA\":1,}", "{\"SpeedMotorA\":1} x"};
+	for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); i++)
+	{
+		CHECK(!Parse(malformed[i], &properties, &fields, &version));
+	}
+}
+
+static void Reported(void)
+{
+	TwinModel_Properties properties = {50, -20, 10};
+	char buffer[TWIN_MODEL_MAX_REPORTED_SIZE];
+	size_t length = TwinModel_SerializeReported(&properties, TWIN_MODEL_ALL_FIELDS, buffer, sizeof(buffer));
+	CHECK(length == strlen(buffer));
+	CHECK(strcmp(buffer, "{\"SpeedMotorA\":50,\"SpeedMotorB\":-20,\"TelemetryWindowSeconds\":10}") == 0);
+	CHECK(TwinModel_SerializeReported(&properties, TWIN_MODEL_ALL_FIELDS, buffer, length) == 0);
+	CHECK(TwinModel_SerializeReported(&properties, 0, buffer, sizeof(buffer)) == 2 && strcmp(buffer, "{}") == 0);
+
+	TwinModel_Properties extremes = {INT_MIN, INT_MIN, INT_MIN};
+	CHECK(TwinModel_SerializeReported(&extremes, TWIN_MODEL_ALL_FIELDS, buffer, sizeof(buffer)) > 0);
+
+	TwinModel_Properties other = properties;
+	other.TelemetryWindowSeconds = 11;
+	CHECK(TwinModel_Diff(&properties, &other) == TwinModel_Field_TelemetryWindowSeconds);
+	CHECK(TwinModel_Diff(&properties, &properties) == 0);
+}
+
+// What parson reads from a reported patch has to match what went in, and parsing it back as a
+// desired patch has to give the same properties
+static void RoundTrips(void)
+{
+	srand(7);
+	for (int i = 0; i < RANDOM_ROUND_TRIPS; i++)
+	{
+		TwinModel_Properties properties = {rand() - RAND_MAX / 2, rand() % 201 - 100, rand() % 3601};
+		uint32_t fields = (uint32_t)rand() & TWIN_MODEL_ALL_FIELDS;
+		char buffer[TWIN_MODEL_MAX_REPORTED_SIZE];
+		CHECK(TwinModel_SerializeReported(&properties, fields, buffer, sizeof(buffer)) > 0);
+
+		JSON_Value *value = json_parse_string(buffer);
+		JSON_Object *object = json_value_get_object(value);
+		CHECK(json_object_get_count(object) == (size_t)__builtin_popcount(fields));
+		if ((fields & TwinModel_Field_SpeedMotorA) != 0)
+		{
+			CHECK(json_object_get_number(object, "SpeedMotorA") == properties.SpeedMotorA);
+		}
+		if ((fields & TwinModel_Field_TelemetryWindowSeconds) != 0)
+		{
+			CHECK(json_object_get_number(object, "TelemetryWindowSeconds") == properties.TelemetryWindowSeconds);
+		}
+		json_value_free(value);
+
+		TwinModel_Properties parsed = {0};
+		uint32_t parsedFields = 0;
+		int64_t version = 0;
+		CHECK(Parse(buffer, &parsed, &parsedFields, &version) && parsedFields == fields);
+		CHECK((TwinModel_Diff(&parsed, &properties) & fields) == 0);
+	}
+}
+
+int main(void)
+{
+	Desired();
+	Reported();
+	RoundTrips();
+	return TEST_RESULT();
+}
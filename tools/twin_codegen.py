@@ -0,0 +1,447 @@
+#!/usr/bin/env python3
+#  Copyright (c) Alan Ludwig. All rights reserved.
+#  Licensed under the MIT License.
+
+"""Generates the typed Device Twin codec (twin_model.h / twin_model.c) from the DTDL model.
+
+Every Property in the model becomes a field of TwinModel_Properties. Writable properties are read
+from desired-property documents by a parser that walks the JSON with json_reader and finds known
+names with a perfect hash. All properties can be written as a reported-properties patch.
+
+usage: twin_codegen.py interface.json output_dir
+"""
+
+import json
+import os
+import re
+import sys
+
+STRING_SIZE = 64  # bytes per string property, including the terminator
+MAX_FIELDS = 32  # fields are tracked in a uint32_t mask
+FNV_PRIME = 16777619
+FNV_OFFSET = 2166136261
+
+# DTDL schema -> (C type, longest JSON text for a value)
+SCHEMAS = {
+    "integer": ("int", len("-2147483648")),
+    "long": ("int64_t", len("-9223372036854775808")),
+    "double": ("double", len("-1.2345678901234567e-308")),
+    "float": ("double", len("-1.2345678901234567e-308")),
+    "boolean": ("bool", len("false")),
+    "string": ("char", 2 + (STRING_SIZE - 1) * len("\\u0000")),
+}
+
+
+class Property:
+    def __init__(self, name, schema, writable):
+        self.name = name
+        self.schema = schema
+        self.writable = writable
+        self.c_type, self.max_json_length = SCHEMAS[schema]
+
+
+def types_of(node):
+    value = node.get("@type", [])
+    return value if isinstance(value, list) else [value]
+
+
+def find_properties(node, found):
+    """Collects Property definitions from DTDL v1 capability models and v2 interfaces."""
+    if isinstance(node, dict):
+        if "Property" in types_of(node):
+            name = node.get("name", "")
+            schema = node.get("schema")
+            if not re.match(r"^[A-Za-z][A-Za-z0-9_]*$", name):
+                raise ValueError("property name '%s' is not a C identifier" % name)
+            if schema not in SCHEMAS:
+                raise ValueError("property '%s' has unsupported schema %r" % (name, schema))
+            found.append(Property(name, schema, bool(node.get("writable", False))))
+            return
+        for value in node.values():
+            find_properties(value, found)
+    elif isinstance(node, list):
+        for value in node:
+            find_properties(value, found)
+
+
+def fnv1a(text, seed):
+    value = seed
+    for byte in text.encode("utf-8"):
+        value ^= byte
+        value = (value * FNV_PRIME) & 0xFFFFFFFF
+    return value
+
+
+def perfect_hash(names):
+    """Finds a seed and a power of two table size with no collisions between names."""
+    slot_count = 1
+    while slot_count < 2 * len(names):
+        slot_count *= 2
+    while True:
+        for attempt in range(100000):
+            seed = (FNV_OFFSET + attempt) & 0xFFFFFFFF
+            slots = {}
+            for name in names:
+                slot = fnv1a(name, seed) & (slot_count - 1)
+                if slot in slots:
+                    break
+                slots[slot] = name
+            else:
+                return seed, slot_count, slots
+        slot_count *= 2
+
+
+def generate_header(properties):
+    all_fields = (1 << len(properties)) - 1
+    writable_fields = sum(1 << i for i, p in enumerate(properties) if p.writable)
+    reported_size = 2 + sum(len(p.name) + 4 + p.max_json_length for p in properties) + 1
+
+    out = []
+    out.append("// Generated by tools/twin_codegen.py from interface.json. Do not edit.")
+    out.append("#ifndef twin_model_twin_model_h")
+    out.append("#define twin_model_twin_model_h")
+    out.append("")
+    out.append("#include <stdbool.h>")
+    out.append("#include <stddef.h>")
+    out.append("#include <stdint.h>")
+    out.append("")
+    out.append("#ifdef __cplusplus")
+    out.append('extern "C"')
+    out.append("{")
+    out.append("#endif")
+    out.append("")
+    if any(p.schema == "string" for p in properties):
+        out.append("#define TWIN_MODEL_STRING_SIZE %d" % STRING_SIZE)
+    out.append("#define TWIN_MODEL_ALL_FIELDS 0x%Xu" % all_fields)
+    out.append("#define TWIN_MODEL_WRITABLE_FIELDS 0x%Xu" % writable_fields)
+    out.append("#define TWIN_MODEL_MAX_REPORTED_SIZE %d // fits every property" % reported_size)
+    out.append("")
+    out.append("\ttypedef enum")
+    out.append("\t{")
+    for i, p in enumerate(properties):
+        out.append("\t\tTwinModel_Field_%s = 1u << %d," % (p.name, i))
+    out.append("\t} TwinModel_Field;")
+    out.append("")
+    out.append("\ttypedef struct")
+    out.append("\t{")
+    for p in properties:
+        if p.schema == "string":
+            out.append("\t\tchar %s[TWIN_MODEL_STRING_SIZE];" % p.name)
+        else:
+            out.append("\t\t%s %s;" % (p.c_type, p.name))
+    out.append("\t} TwinModel_Properties;")
+    out.append("")
+    out.append("\t// Reads writable properties from a full twin document (the \"desired\" section) or a")
+    out.append("\t// desired-properties patch. A property may be a bare value or an object with a \"value\"")
+    out.append("\t// member. Only properties that were found are updated and flagged in fields, values of the")
+    out.append("\t// wrong type are ignored. version is set to the desired \"$version\", or -1 if there is none.")
+    out.append("\t// Returns false, leaving properties untouched, on malformed JSON.")
+    out.append("\tbool TwinModel_ParseDesired(const char *json, size_t length, TwinModel_Properties *properties,")
+    out.append("\t\t\t\t\t\t\t\tuint32_t *fields, int64_t *version);")
+    out.append("")
+    out.append("\t// Returns the fields whose values differ")
+    out.append("\tuint32_t TwinModel_Diff(const TwinModel_Properties *a, const TwinModel_Properties *b);")
+    out.append("")
+    out.append("\t// Writes the given fields as a reported-properties patch, e.g. {\"%s\":0}." % properties[0].name)
+    out.append("\t// Returns its length, or 0 if it doesn't fit in buffer with the terminator.")
+    out.append("\tsize_t TwinModel_SerializeReported(const TwinModel_Properties *properties, uint32_t fields,")
+    out.append("\t\t\t\t\t\t\t\t\t   char *buffer, size_t size);")
+    out.append("")
+    out.append("#ifdef __cplusplus")
+    out.append("}")
+    out.append("#endif")
+    out.append("")
+    out.append("#endif")
+    return "\n".join(out) + "\n"
+
+
+def generate_read_field(p):
+    member = "properties->%s" % p.name
+    if p.schema == "integer":
+        return [
+            "\t\tif (!JsonReader_GetInt64(reader, &integer) || integer < INT_MIN || integer > INT_MAX)",
+            "\t\t{",
+            "\t\t\treturn false;",
+            "\t\t}",
+            "\t\t%s = (int)integer;" % member,
+        ]
+    if p.schema == "long":
+        return ["\t\tif (!JsonReader_GetInt64(reader, &%s))" % member, "\t\t{", "\t\t\treturn false;", "\t\t}"]
+    if p.schema in ("double", "float"):
+        return ["\t\tif (!JsonReader_GetDouble(reader, &%s))" % member, "\t\t{", "\t\t\treturn false;", "\t\t}"]
+    if p.schema == "boolean":
+        return ["\t\tif (!JsonReader_GetBool(reader, &%s))" % member, "\t\t{", "\t\t\treturn false;", "\t\t}"]
+    return [
+        "\t\tif (JsonReader_GetString(reader, text, sizeof(text)) < 0)",
+        "\t\t{",
+        "\t\t\treturn false;",
+        "\t\t}",
+        "\t\tmemcpy(%s, text, sizeof(text));" % member,
+    ]
+
+
+def generate_source(properties):
+    writable = [p for p in properties if p.writable]
+    index_of = {p.name: i for i, p in enumerate(properties)}
+    writable_schemas = set(p.schema for p in writable)
+    max_name = max(len(p.name) for p in properties)
+    seed, slot_count, slots = perfect_hash([p.name for p in writable]) if writable else (FNV_OFFSET, 1, {})
+
+    out = []
+    out.append("// Generated by tools/twin_codegen.py from interface.json. Do not edit.")
+    out.append('#include "twin_model.h"')
+    out.append('#include "json_reader.h"')
+    out.append('#include "json_writer.h"')
+    out.append("#include <limits.h>")
+    out.append("#include <string.h>")
+    out.append("")
+    out.append("#define FIELD_COUNT %d" % len(properties))
+    out.append("#define MAX_NAME_LENGTH %d" % max_name)
+    out.append("#define SLOT_COUNT %d" % slot_count)
+    out.append("#define HASH_SEED 0x%08Xu" % seed)
+    out.append("")
+    out.append("static const char *const fieldNames[FIELD_COUNT] = {%s};" %
+               ", ".join('"%s"' % p.name for p in properties))
+    out.append("static const uint8_t fieldNameLengths[FIELD_COUNT] = {%s};" %
+               ", ".join(str(len(p.name)) for p in properties))
+    out.append("")
+    out.append("// Writable field for each hash slot, -1 when empty")
+    out.append("static const int8_t fieldSlots[SLOT_COUNT] = {%s};" %
+               ", ".join(str(index_of[slots[s]]) if s in slots else "-1" for s in range(slot_count)))
+    out.append("")
+    out.append("static uint32_t Hash(const char *name, size_t length)")
+    out.append("{")
+    out.append("\tuint32_t hash = HASH_SEED;")
+    out.append("\tfor (size_t i = 0; i < length; i++)")
+    out.append("\t{")
+    out.append("\t\thash ^= (unsigned char)name[i];")
+    out.append("\t\thash *= %du;" % FNV_PRIME)
+    out.append("\t}")
+    out.append("\treturn hash;")
+    out.append("}")
+    out.append("")
+    out.append("// Returns the writable field named by the current key, or -1")
+    out.append("static int FindField(const JsonReader *reader)")
+    out.append("{")
+    out.append("\tchar buffer[MAX_NAME_LENGTH + 1];")
+    out.append("\tconst char *name = reader->text;")
+    out.append("\tsize_t length = reader->textLength;")
+    out.append("\tif (reader->textEscaped)")
+    out.append("\t{")
+    out.append("\t\tint unescapedLength = JsonReader_GetString(reader, buffer, sizeof(buffer));")
+    out.append("\t\tif (unescapedLength < 0)")
+    out.append("\t\t{")
+    out.append("\t\t\treturn -1;")
+    out.append("\t\t}")
+    out.append("\t\tname = buffer;")
+    out.append("\t\tlength = (size_t)unescapedLength;")
+    out.append("\t}")
+    out.append("\tint index = fieldSlots[Hash(name, length) & (SLOT_COUNT - 1)];")
+    out.append("\tif (index < 0 || fieldNameLengths[index] != length || memcmp(fieldNames[index], name, length) != 0)")
+    out.append("\t{")
+    out.append("\t\treturn -1;")
+    out.append("\t}")
+    out.append("\treturn index;")
+    out.append("}")
+    out.append("")
+    out.append("// Converts the current token into a field, false if it has the wrong type")
+    out.append("static bool ReadField(const JsonReader *reader, int index, TwinModel_Properties *properties)")
+    out.append("{")
+    if "integer" in writable_schemas:
+        out.append("\tint64_t integer = 0;")
+    if "string" in writable_schemas:
+        out.append("\tchar text[TWIN_MODEL_STRING_SIZE] = {0};")
+    out.append("\tswitch (index)")
+    out.append("\t{")
+    for p in writable:
+        out.append("\tcase %d: // %s" % (index_of[p.name], p.name))
+        out.extend(generate_read_field(p))
+        out.append("\t\treturn true;")
+    out.append("\tdefault:")
+    out.append("\t\treturn false;")
+    out.append("\t}")
+    out.append("}")
+    out.append("")
+    out.append("static bool ParseProperty(JsonReader *reader, int index, TwinModel_Properties *properties,")
+    out.append("\t\t\t\t\t\t  uint32_t *fields, bool allowWrapper)")
+    out.append("{")
+    out.append("\tJsonToken token = JsonReader_Next(reader);")
+    out.append("\tif (token == JsonToken_ObjectStart && allowWrapper)")
+    out.append("\t{")
+    out.append("\t\t// {\"value\": ..., \"ac\": ..., \"av\": ...}")
+    out.append("\t\twhile ((token = JsonReader_Next(reader)) == JsonToken_Key)")
+    out.append("\t\t{")
+    out.append("\t\t\tbool ok = JsonReader_TextEquals(reader, \"value\", 5)")
+    out.append("\t\t\t\t\t\t  ? ParseProperty(reader, index, properties, fields, false)")
+    out.append("\t\t\t\t\t\t  : JsonReader_Skip(reader);")
+    out.append("\t\t\tif (!ok)")
+    out.append("\t\t\t{")
+    out.append("\t\t\t\treturn false;")
+    out.append("\t\t\t}")
+    out.append("\t\t}")
+    out.append("\t\treturn token == JsonToken_ObjectEnd;")
+    out.append("\t}")
+    out.append("\tif (token == JsonToken_ObjectStart || token == JsonToken_ArrayStart)")
+    out.append("\t{")
+    out.append("\t\treturn JsonReader_Skip(reader);")
+    out.append("\t}")
+    out.append("\tif (token == JsonToken_Error)")
+    out.append("\t{")
+    out.append("\t\treturn false;")
+    out.append("\t}")
+    out.append("\tif (ReadField(reader, index, properties))")
+    out.append("\t{")
+    out.append("\t\t*fields |= 1u << index;")
+    out.append("\t}")
+    out.append("\treturn true;")
+    out.append("}")
+    out.append("")
+    out.append("// Reads $version, ignoring values that are not integers")
+    out.append("static bool ParseVersion(JsonReader *reader, int64_t *version)")
+    out.append("{")
+    out.append("\tJsonToken token = JsonReader_Next(reader);")
+    out.append("\tif (token == JsonToken_ObjectStart || token == JsonToken_ArrayStart)")
+    out.append("\t{")
+    out.append("\t\treturn JsonReader_Skip(reader);")
+    out.append("\t}")
+    out.append("\tif (token == JsonToken_Number)")
+    out.append("\t{")
+    out.append("\t\tJsonReader_GetInt64(reader, version);")
+    out.append("\t}")
+    out.append("\treturn token != JsonToken_Error;")
+    out.append("}")
+    out.append("")
+    out.append("static bool ParseMembers(JsonReader *reader, TwinModel_Properties *properties, uint32_t *fields,")
+    out.append("\t\t\t\t\t\t int64_t *version, bool topLevel)")
+    out.append("{")
+    out.append("\tJsonToken token;")
+    out.append("\twhile ((token = JsonReader_Next(reader)) == JsonToken_Key)")
+    out.append("\t{")
+    out.append("\t\tbool ok = false;")
+    out.append("\t\tint index = FindField(reader);")
+    out.append("\t\tif (index >= 0)")
+    out.append("\t\t{")
+    out.append("\t\t\tok = ParseProperty(reader, index, properties, fields, true);")
+    out.append("\t\t}")
+    out.append("\t\telse if (JsonReader_TextEquals(reader, \"$version\", 8))")
+    out.append("\t\t{")
+    out.append("\t\t\tok = ParseVersion(reader, version);")
+    out.append("\t\t}")
+    out.append("\t\telse if (topLevel && JsonReader_TextEquals(reader, \"desired\", 7))")
+    out.append("\t\t{")
+    out.append("\t\t\ttoken = JsonReader_Next(reader);")
+    out.append("\t\t\tok = token == JsonToken_ObjectStart ? ParseMembers(reader, properties, fields, version, false)")
+    out.append("\t\t\t\t : token == JsonToken_ArrayStart ? JsonReader_Skip(reader)")
+    out.append("\t\t\t\t : token != JsonToken_Error;")
+    out.append("\t\t}")
+    out.append("\t\telse")
+    out.append("\t\t{")
+    out.append("\t\t\tok = JsonReader_Skip(reader);")
+    out.append("\t\t}")
+    out.append("\t\tif (!ok)")
+    out.append("\t\t{")
+    out.append("\t\t\treturn false;")
+    out.append("\t\t}")
+    out.append("\t}")
+    out.append("\treturn token == JsonToken_ObjectEnd;")
+    out.append("}")
+    out.append("")
+    out.append("bool TwinModel_ParseDesired(const char *json, size_t length, TwinModel_Properties *properties,")
+    out.append("\t\t\t\t\t\t\tuint32_t *fields, int64_t *version)")
+    out.append("{")
+    out.append("\tJsonReader reader;")
+    out.append("\tTwinModel_Properties parsed = *properties;")
+    out.append("\tuint32_t found = 0;")
+    out.append("\tint64_t foundVersion = -1;")
+    out.append("\tJsonReader_Init(&reader, json, length);")
+    out.append("\tif (JsonReader_Next(&reader) != JsonToken_ObjectStart || !ParseMembers(&reader, &parsed, &found, &foundVersion, true) ||")
+    out.append("\t\tJsonReader_Next(&reader) != JsonToken_End)")
+    out.append("\t{")
+    out.append("\t\treturn false;")
+    out.append("\t}")
+    out.append("\t*properties = parsed;")
+    out.append("\t*fields = found;")
+    out.append("\t*version = foundVersion;")
+    out.append("\treturn true;")
+    out.append("}")
+    out.append("")
+    out.append("uint32_t TwinModel_Diff(const TwinModel_Properties *a, const TwinModel_Properties *b)")
+    out.append("{")
+    out.append("\tuint32_t fields = 0;")
+    for p in properties:
+        if p.schema == "string":
+            test = "strcmp(a->%s, b->%s) != 0" % (p.name, p.name)
+        else:
+            test = "a->%s != b->%s" % (p.name, p.name)
+        out.append("\tif (%s)" % test)
+        out.append("\t{")
+        out.append("\t\tfields |= TwinModel_Field_%s;" % p.name)
+        out.append("\t}")
+    out.append("\treturn fields;")
+    out.append("}")
+    out.append("")
+    out.extend(generate_writer(properties))
+    return "\n".join(out) + "\n"
+
+
+def generate_writer(properties):
+    out = []
+    out.append("size_t TwinModel_SerializeReported(const TwinModel_Properties *properties, uint32_t fields,")
+    out.append("\t\t\t\t\t\t\t\t   char *buffer, size_t size)")
+    out.append("{")
+    out.append("\tJsonWriter writer;")
+    out.append("\tJsonWriter_Init(&writer, buffer, size);")
+    out.append("\tJsonWriter_BeginObject(&writer);")
+    for p in properties:
+        if p.schema in ("integer", "long"):
+            call = "JsonWriter_Int"
+        elif p.schema in ("double", "float"):
+            call = "JsonWriter_Double"
+        elif p.schema == "boolean":
+            call = "JsonWriter_Bool"
+        else:
+            call = "JsonWriter_String"
+        out.append("\tif ((fields & TwinModel_Field_%s) != 0)" % p.name)
+        out.append("\t{")
+        out.append("\t\tJsonWriter_Key(&writer, \"%s\");" % p.name)
+        out.append("\t\t%s(&writer, properties->%s);" % (call, p.name))
+        out.append("\t}")
+    out.append("\tJsonWriter_End(&writer);")
+    out.append("\treturn JsonWriter_Finish(&writer);")
+    out.append("}")
+    return out
+
+
+def write_if_changed(path, text):
+    """Leaves the file (and its timestamp) alone when the content is unchanged."""
+    if os.path.exists(path):
+        with open(path, "r") as existing:
+            if existing.read() == text:
+                return
+    with open(path, "w") as output:
+        output.write(text)
+
+
+def main(argv):
+    if len(argv) != 3:
+        sys.stderr.write(__doc__)
+        return 2
+    with open(argv[1], "r") as model_file:
+        model = json.load(model_file)
+    properties = []
+    find_properties(model, properties)
+    if not properties:
+        sys.stderr.write("%s: no properties found\n" % argv[1])
+        return 1
+    if len(properties) > MAX_FIELDS:
+        sys.stderr.write("%s: more than %d properties\n" % (argv[1], MAX_FIELDS))
+        return 1
+    if not os.path.isdir(argv[2]):
+        os.makedirs(argv[2])
+    write_if_changed(os.path.join(argv[2], "twin_model.h"), generate_header(properties))
+    write_if_changed(os.path.join(argv[2], "twin_model.c"), generate_source(properties))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))